@@ -35,6 +35,14 @@
 /* Print load time of input file to stderr */
 #define DBUG_PROFILE_LOAD_TIME 0
 
+/*
+ * Count each pair and triple of instructions executed back to back,
+ * and print the counts to stderr at exit, for 'tools/gen pick'.
+ * Superinstructions are not fused while this is set, so the counts
+ * are in terms of the plain instructions.  See tools/superinstructions.
+ */
+#define DBUG_PROFILE_OPCODES 0
+
 /*
  * DBUG, DBUG1, and DBUG_FN print verbose debug info to stderr.
  * Invocations of these macros should not be left in the code at
@@ -70,6 +78,8 @@
 # define DBUG_PROFILE_MALLOC_USAGE 0
 # undef DBUG_PROFILE_LOAD_TIME
 # define DBUG_PROFILE_LOAD_TIME 0
+# undef DBUG_PROFILE_OPCODES
+# define DBUG_PROFILE_OPCODES 0
 
 #endif
 
@@ -130,6 +130,10 @@ enum evc_strconst_t {
         STRCONST_IDX_tell,
         STRCONST_IDX_seek,
         STRCONST_IDX_call_trace,
+        STRCONST_IDX___slots__,
+        STRCONST_IDX_key,
+        STRCONST_IDX_reverse,
+        STRCONST_IDX_maxlen,
 
         /* enum after STRCONST_IDX_ is not same as string */
         STRCONST_IDX_spc,
@@ -3,7 +3,20 @@
 
 #include <stdbool.h>
 
+/* Bits in evc_ascii_ctype[] */
+enum {
+        EVC_CT_UPPER    = 0x01,
+        EVC_CT_LOWER    = 0x02,
+        EVC_CT_DIGIT    = 0x04,
+        EVC_CT_SPACE    = 0x08,
+        EVC_CT_PRINT    = 0x10,
+        EVC_CT_GRAPH    = 0x20,
+        EVC_CT_ALPHA    = EVC_CT_UPPER | EVC_CT_LOWER,
+        EVC_CT_ALNUM    = EVC_CT_ALPHA | EVC_CT_DIGIT,
+};
+
 /* ctype.c */
+extern const unsigned char evc_ascii_ctype[128];
 extern bool evc_isalnum(unsigned long c);
 extern bool evc_isalpha(unsigned long c);
 extern bool evc_isdigit(unsigned long c);
@@ -16,4 +29,11 @@ extern unsigned long evc_toupper(unsigned long c);
 extern unsigned long evc_tolower(unsigned long c);
 static inline bool evc_isascii(unsigned long c) { return c < 128; }
 
+/* true if @c is ASCII and has any of the EVC_CT_* bits in @mask */
+static inline bool
+evc_isctype(unsigned long c, unsigned int mask)
+{
+        return c < 128 && !!(evc_ascii_ctype[c] & mask);
+}
+
 #endif /* EVC_INC_EVC_CTYPE_H */
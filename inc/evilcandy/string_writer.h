@@ -20,6 +20,8 @@ struct utf8_state_t {
         } state;
         char buf[5];
         unsigned long point;
+        /* length in bytes of the sequence that @point is from */
+        int seqlen;
         size_t idx;
         size_t cookiepos;
 };
@@ -50,6 +52,9 @@ extern void string_writer_appends(struct string_writer_t *wr,
                                   const char *cstr);
 extern void string_writer_appendb(struct string_writer_t *wr,
                               const void *buf, size_t width, size_t len);
+extern void string_writer_append_utf8(struct string_writer_t *wr,
+                                      const void *buf, size_t nbytes,
+                                      size_t npoints, unsigned long maxchr);
 extern size_t string_writer_get_ascii(struct string_writer_t *wr,
                                       const void *buf, size_t max);
 extern enum result_t string_writer_swapchars(struct string_writer_t *wr,
@@ -0,0 +1,14 @@
+#ifndef EVILCANDY_TYPES_BYTEARRAY_H
+#define EVILCANDY_TYPES_BYTEARRAY_H
+
+#include <evilcandy/typedefs.h>
+#include <stddef.h>
+
+/* types/bytearray.c */
+extern Object *bytearrayvar_new(const unsigned char *buf, size_t len);
+extern unsigned char *bytearray_get_data(Object *b);
+extern enum result_t bytearray_append(Object *b,
+                                      const unsigned char *buf,
+                                      size_t len);
+
+#endif /* EVILCANDY_TYPES_BYTEARRAY_H */
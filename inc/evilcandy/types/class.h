@@ -4,6 +4,7 @@
 #include <evilcandy/typedefs.h>
 #include <evilcandy/enums.h>
 #include <stdbool.h>
+#include <stddef.h>
 
 struct type_t;
 
@@ -20,6 +21,8 @@ extern void type_init_builtin(Object *type, bool isheap,
                               bool add_to_globals);
 extern Object *type_get_builtin_attr(struct type_t *tp,
                                      Object *obj, Object *key);
+extern Object *type_get_builtin_method(struct type_t *tp, Object *obj,
+                                       Object *key, Object **self);
 extern Object *instance_super_getattr(Object *instance,
                                       Object *attribute_name);
 extern Object *instancevar_new(Object *class, Object *args,
@@ -27,8 +30,18 @@ extern Object *instancevar_new(Object *class, Object *args,
 extern Object *instance_call(Object *instance, Object *method_name,
                              Object *args, Object *kwargs);
 extern Object *instance_getattr(Frame *fr, Object *instance, Object *key);
+extern Object *instance_getmethod(Frame *fr, Object *instance,
+                                  Object *key, Object **self);
 extern enum result_t instance_setattr(Frame *fr, Object *instance,
                                       Object *key, Object *value);
+extern Object *instance_getslot(Frame *fr, Object *instance,
+                                size_t idx, Object *key);
+extern Object *instance_getslot_method(Frame *fr, Object *instance,
+                                       size_t idx, Object *key,
+                                       Object **self);
+extern enum result_t instance_setslot(Frame *fr, Object *instance,
+                                      size_t idx, Object *key,
+                                      Object *value);
 extern Object *instance_dir(Object *instance);
 
 /* TODO: make a header inc/internal/types/class.h and put this in that one. */
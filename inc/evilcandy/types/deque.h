@@ -0,0 +1,13 @@
+#ifndef EVILCANDY_TYPES_DEQUE_H
+#define EVILCANDY_TYPES_DEQUE_H
+
+#include <evilcandy/typedefs.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+/* types/deque.c */
+extern Object *dequevar_new(ssize_t maxlen);
+extern void deque_append(Object *d, Object *item, bool left);
+extern Object *deque_pop(Object *d, bool left);
+
+#endif /* EVILCANDY_TYPES_DEQUE_H */
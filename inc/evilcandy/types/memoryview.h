@@ -0,0 +1,14 @@
+#ifndef EVILCANDY_TYPES_MEMORYVIEW_H
+#define EVILCANDY_TYPES_MEMORYVIEW_H
+
+#include <evilcandy/typedefs.h>
+#include <stddef.h>
+
+/* types/memoryview.c */
+extern Object *memoryviewvar_new(Object *obj);
+extern const unsigned char *bytes_like_acquire(Object *o, size_t *len,
+                                               Object **tmp);
+extern unsigned char *bytes_like_acquire_rw(Object *o, size_t *len);
+extern void bytes_like_release(Object *o, Object *tmp);
+
+#endif /* EVILCANDY_TYPES_MEMORYVIEW_H */
@@ -0,0 +1,11 @@
+#ifndef EVILCANDY_TYPES_NUMARRAY_H
+#define EVILCANDY_TYPES_NUMARRAY_H
+
+#include <evilcandy/typedefs.h>
+#include <stddef.h>
+
+/* types/numarray.c */
+extern Object *numarrayvar_from_doubles(const double *data, size_t n);
+extern Object *numarrayvar_from_ints(const long long *data, size_t n);
+
+#endif /* EVILCANDY_TYPES_NUMARRAY_H */
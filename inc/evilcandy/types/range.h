@@ -0,0 +1,11 @@
+#ifndef EVILCANDY_TYPES_RANGE_H
+#define EVILCANDY_TYPES_RANGE_H
+
+#include <evilcandy/typedefs.h>
+#include <stdbool.h>
+
+/* types/range.c */
+extern Object *range_counter_new(Object *const *argv, int argc);
+extern bool range_counter_next(Object *it, long long *val);
+
+#endif /* EVILCANDY_TYPES_RANGE_H */
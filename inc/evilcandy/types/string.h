@@ -16,8 +16,12 @@ extern Object *stringvar_from_format(const char *fmt, ...);
 extern Object *stringvar_from_vformat(const char *fmt, va_list ap);
 extern Object *stringvar_from_ascii(const char *cstr);
 extern Object *stringvar_from_substr(Object *old, size_t start, size_t stop);
+extern Object *stringvar_from_stack(Object **items, int n_items, bool consume);
 extern long string_ord(Object *str, size_t idx);
 extern Object *string_format(Object *str, Object *tup);
+extern Object *string_format_value(Object *v, Object *spec);
+extern void string_precompile_format(Object *spec);
+extern Object *string_fstring_parts(Object *tmpl);
 extern Object *string_cat(Object *romeo, Object *juliet);
 extern size_t string_slide(Object *str, Object *sep, size_t startpos);
 extern bool string_chr(Object *str, long pt);
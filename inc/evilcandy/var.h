@@ -93,6 +93,13 @@ VAR_NEW_REF(Object *v)
         return v;
 }
 
+/* True if the caller's reference to @v is the only one */
+static inline bool
+VAR_IS_UNIQUE(Object *v)
+{
+        return v->v_refcnt == 1;
+}
+
 /*
  * VAR_SANITY - keep this a macro so I can tell where the bug was
  * trapped I'd like to also sanity-check v_->v_type, but that's
@@ -120,6 +127,8 @@ extern enum result_t var_setattr(Frame *frame, Object *obj,
                                  Object *key, Object *value);
 extern Object *var_getattr(Frame *frame, Object *obj, Object *key);
 extern Object *var_getattr_or_null(Frame *frame, Object *obj, Object *key);
+extern Object *var_getmethod(Frame *frame, Object *obj,
+                             Object *key, Object **self);
 extern bool var_hasattr(Frame *frame, Object *obj, Object *key);
 static inline enum result_t var_delattr(Frame *frame, Object *obj, Object *key)
         { return var_setattr(frame, obj, key, NULL); }
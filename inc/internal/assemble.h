@@ -25,12 +25,21 @@
  *               order in which they would appear on the stack.
  * @af_funcname: Name of function if not anonymous.  Always NULL if
  *               anonymous.
+ * @af_slots:    If this is a method of a class with __slots__, a list
+ *               of the slot names.  NULL otherwise.
  * @af_labels:   Jump labels, array of short ints
+ * @af_locations: Source line of each label in @af_labels, array of
+ *               ints, -1 if the label has none.  This may be shorter
+ *               than @af_labels.
+ * @af_inlined:  Calls pasted into this frame by inlining, array of
+ *               struct xptr_inline_t whose @start and @end are labels
+ *               until assemble_post resolves them.
  * @af_instr;    Instructions, array of instruction_t
  * @scope:       Current {...} scope within the function
  * @nest:        Pointer to current top of @scope
  * @line:        Line number of first line of code for this frame
  * @af_nlocals:  Number of local variables in this function.
+ * @af_nargs:    How many of those hold the arguments when it's called.
  * @list:        Link to sibling frames
  *
  * @af_locations_packed and @af_locations_packed_size are managed
@@ -53,14 +62,17 @@ struct as_frame_t {
         Object *af_rodata;
         Object *af_names;
         Object *af_funcname;
+        Object *af_slots;
         struct buffer_t af_localmap;
         struct buffer_t af_labels;
         struct buffer_t af_instr;
         struct buffer_t af_locations;
+        struct buffer_t af_inlined;
         int scope[FRAME_NEST_MAX];
         int nest;
         int line;
         int af_nlocals;
+        int af_nargs;
         struct list_t list;
         unsigned char *af_locations_packed;
         size_t af_locations_packed_size;
@@ -83,7 +95,19 @@ struct as_frame_t {
  *              @active frames
  * @localdict:  If in script mode, NULL.  If in interactive mode, this
  *              is the dictionary of top-level local variables.
+ * @slots:      While parsing the value of a class attribute, the slot
+ *              names of the class, if it has __slots__.  The next
+ *              function to be defined takes these as its @af_slots.
  * @inp_type:    What kind of input are we receiving? TTY? Script?...
+ * @lazy:       If true, assemble_post() leaves nested functions to be
+ *              finished when they're first needed.  See DOC "Lazy
+ *              assembly" in assemble_post.c
+ * @fr_index:   While assemble_post() runs, @finished_frames indexed by
+ *              funcno minus @fr_index_base; otherwise NULL
+ * @fr_index_base:
+ *              Lowest funcno in @fr_index
+ * @fr_index_size:
+ *              Number of entries in @fr_index
  */
 struct assemble_t {
         char *file_name;
@@ -95,17 +119,22 @@ struct assemble_t {
         struct list_t finished_frames;
         struct as_frame_t *fr;
         Object *localdict;
+        Object *slots;
         enum {
                 AS_SCRIPT,      /* script file */
                 AS_TTY,         /* interactive mode */
                 AS_STRING,      /* evaluation-only string */
         } inp_type;
+        bool lazy;
+        struct as_frame_t **fr_index;
+        long long fr_index_base;
+        size_t fr_index_size;
 };
 
 #define list2frame(li) container_of(li, struct as_frame_t, list)
 
-static inline int as_buffer_ptr_size(struct buffer_t *b)
-        { return buffer_size(b) / sizeof(void *); }
+static inline int as_frame_nlocation(struct as_frame_t *fr)
+        { return buffer_size(&fr->af_locations) / sizeof(int); }
 
 static inline Object **as_frame_rodata(struct as_frame_t *fr)
         { return array_get_data(fr->af_rodata); }
@@ -125,6 +154,7 @@ extern void assemble_label_here(struct assemble_t *a);
 extern void assemble_frame_push(struct assemble_t *a,
                                 long long funcno, Object *name);
 extern void assemble_frame_pop(struct assemble_t *a);
+extern void assemble_frame_free(struct as_frame_t *fr);
 extern void assemble_add_instr(struct assemble_t *a, int opcode,
                                int arg1, int arg2);
 extern int assemble_frame_next_label(struct as_frame_t *fr);
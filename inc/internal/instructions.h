@@ -6,10 +6,11 @@
 #include <stdint.h>
 #include <stdbool.h>
 
-/* PUSH_PTR/PUSH_COPY arg1 enumerations */
+/* LOAD/ASSIGN_xxx and ADD_CLOSURE arg1 enumerations */
 enum {
         IARG_PTR_FP = 0,
         IARG_PTR_CP,
+        IARG_PTR_COPY,  /* ADD_CLOSURE only */
 };
 
 /* CMP arg1 enumerations */
@@ -119,6 +120,7 @@ instr_uses_jump(instruction_t ii)
         case INSTR_B:
         case INSTR_B_IF:
         case INSTR_FOREACH_ITER:
+        case INSTR_RANGE_ITER:
                 return true;
         case INSTR_PUSH_BLOCK:
                 return ii.arg1 != IARG_BLOCK;
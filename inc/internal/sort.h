@@ -0,0 +1,11 @@
+#ifndef EVC_INC_INTERNAL_SORT_H
+#define EVC_INC_INTERNAL_SORT_H
+
+#include <evilcandy/enums.h>
+#include <evilcandy/typedefs.h>
+#include <stddef.h>
+
+/* sort.c */
+extern enum result_t sort_objects(Object **items, Object **keys, size_t n);
+
+#endif /* EVC_INC_INTERNAL_SORT_H */
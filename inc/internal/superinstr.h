@@ -0,0 +1,11 @@
+#ifndef EVC_INTERNAL_SUPERINSTR_H
+#define EVC_INTERNAL_SUPERINSTR_H
+
+#include <internal/instructions.h>
+#include <stddef.h>
+
+/* superinstr.c */
+extern void superinstr_fuse(instruction_t *instr, size_t n_instr);
+extern instruction_t superinstr_unfuse(instruction_t ii);
+
+#endif /* EVC_INTERNAL_SUPERINSTR_H */
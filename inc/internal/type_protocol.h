@@ -8,6 +8,7 @@
 #include <evilcandy/var.h>
 
 struct var_mem_t;
+struct shape_t;
 
 typedef Object *(*binary_operator_t)(Object *, Object *);
 typedef Object *(*unary_operator_t)(Object *);
@@ -60,6 +61,46 @@ struct seq_methods_t {
         enum result_t (*sort)(Object *);
 };
 
+/* .kind field in struct buffer_export_t */
+enum {
+        EXPORT_BYTE,    /* unsigned char */
+        EXPORT_INT,     /* long long */
+        EXPORT_FLOAT,   /* double */
+};
+
+/**
+ * struct buffer_export_t - A type's raw memory, as lent to a memoryview
+ * @buf:        Address of the first item
+ * @n:          Number of items
+ * @itemsize:   Size of each item, in bytes
+ * @stride:     Distance from one item to the next, in bytes.  This is
+ *              @itemsize if the memory is contiguous.  It may be negative.
+ * @kind:       EXPORT_BYTE, EXPORT_INT, or EXPORT_FLOAT
+ * @readonly:   True if the memory may not be written to
+ */
+struct buffer_export_t {
+        unsigned char *buf;
+        size_t n;
+        size_t itemsize;
+        ssize_t stride;
+        int kind;
+        bool readonly;
+};
+
+/*
+ * Methods for types whose memory can be viewed without copying it.
+ * .getbuffer fills in its export struct, or it raises an exception and
+ * returns RES_ERROR.  While the export is held, @buf must stay valid,
+ * so a resizable type must refuse to resize until every export has
+ * been given back with .releasebuffer.  .releasebuffer may be NULL if
+ * the type can't resize anyway.
+ */
+struct buffer_methods_t {
+        enum result_t (*getbuffer)(Object *self,
+                                   struct buffer_export_t *exp);
+        void (*releasebuffer)(Object *self);
+};
+
 /**
  * struct type_method_t - Used for initializing a function meant to be
  *                        visible to the UAPI, usu. as an attribute to
@@ -95,6 +136,8 @@ enum {
         OBF_HEAP                = 0x10, /*< allocated on heap */
         OBF_INTERNAL            = 0x20, /*< internal use */
         OBF_GP_INSTANCE         = 0x40, /*< see class.c */
+        OBF_SLOTS               = 0x80, /*< instance has __slots__ */
+        OBF_BROADCAST           = 0x100, /*< .opm takes a number on either side */
 };
 
 /**
@@ -164,6 +207,8 @@ enum {
  *              are initialized in whatever way prepares it for the first
  *              call to .next().  IF THIS FIELD IS NON-NULL, OBJECT HEAD
  *              MUST BE struct seqvar_t!!
+ * @bfm:        Methods for lending the type's memory to a memoryview,
+ *              or NULL if it has no such memory
  *
  * For statically allocated struct type_t's:
  *    - name must be non-NULL and size must be nonzero.
@@ -183,6 +228,7 @@ struct type_t {
         Object *all_priv;
         Object *mro;
         Object *delegate_name;
+        struct shape_t *shape;
         unsigned int flags;
         const char *name;
         struct var_mem_t *freelist;
@@ -203,6 +249,7 @@ struct type_t {
         hash_t (*hash)(Object *);
         Object *(*iter_next)(Object *);
         Object *(*get_iter)(Object *);
+        const struct buffer_methods_t *bfm;
 };
 
 /*
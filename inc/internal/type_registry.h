@@ -23,12 +23,16 @@ extern struct type_t XptrType;
 extern struct type_t DictType;
 extern struct type_t StringType;
 extern struct type_t BytesType;
+extern struct type_t BytearrayType;
 extern struct type_t PropertyType;
 extern struct type_t RangeType;
 extern struct type_t UuidptrType;
 extern struct type_t IdType;
 extern struct type_t SetType;
 extern struct type_t CellType;
+extern struct type_t NumArrayType;
+extern struct type_t DequeType;
+extern struct type_t MemoryviewType;
 
 /* in builtins/ */
 extern struct type_t BinFileType;
@@ -39,11 +43,15 @@ extern struct type_t SocketType;
 /* iterators */
 extern struct type_t ArrayIterType;
 extern struct type_t BytesIterType;
+extern struct type_t BytearrayIterType;
 extern struct type_t DictIterType;
 extern struct type_t TupleIterType;
 extern struct type_t SetIterType;
 extern struct type_t RangeIterType;
 extern struct type_t StringIterType;
+extern struct type_t NumArrayIterType;
+extern struct type_t DequeIterType;
+extern struct type_t MemoryviewIterType;
 extern struct type_t GeneratorType;
 
 /* special-purpose iterators */
@@ -74,6 +82,8 @@ static inline bool isvar_string(Object *v)
         { return v->v_type == &StringType; }
 static inline bool isvar_bytes(Object *v)
         { return v->v_type == &BytesType; }
+static inline bool isvar_bytearray(Object *v)
+        { return v->v_type == &BytearrayType; }
 static inline bool isvar_range(Object *v)
         { return v->v_type == &RangeType; }
 static inline bool isvar_uuidptr(Object *v)
@@ -91,6 +101,12 @@ static inline bool isvar_cell(Object *obj)
         { return obj->v_type == &CellType; }
 static inline bool isvar_type(Object *obj)
         { return obj->v_type == &TypeType; }
+static inline bool isvar_numarray(Object *obj)
+        { return obj->v_type == &NumArrayType; }
+static inline bool isvar_deque(Object *obj)
+        { return obj->v_type == &DequeType; }
+static inline bool isvar_memoryview(Object *obj)
+        { return obj->v_type == &MemoryviewType; }
 
 static inline bool isvar_number(Object *v)
         { return !!(v->v_type->flags & OBF_NUMBER); }
@@ -104,6 +120,8 @@ static inline bool isvar_map(Object *v)
         { return v->v_type->mpm != NULL; }
 static inline bool hasvar_len(Object *v)
         { return v->v_type->get_iter != NULL; }
+static inline bool hasvar_buffer(Object *v)
+        { return v->v_type->bfm != NULL; }
 
 
 #endif /* EVC_INC_INTERNAL_TYPE_REGISTRY_H */
@@ -0,0 +1,85 @@
+#ifndef EVC_INC_INTERNAL_TYPES_HASHTABLE_H
+#define EVC_INC_INTERNAL_TYPES_HASHTABLE_H
+
+#include <evilcandy/typedefs.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * struct htentry_t - One entry of a hash table
+ * @hash:       Cached hash of @key
+ * @key:        Key, or NULL if this entry was removed
+ * @val:        Value.  Always NULL for sets.
+ */
+struct htentry_t {
+        hash_t hash;
+        Object *key;
+        Object *val;
+};
+
+/**
+ * struct htable_t - Hash table shared by dictionaries and sets
+ * @size:       Number of slots, a power of 2 and a multiple of the
+ *              group size.
+ * @used:       Number of live entries
+ * @n_entries:  Number of entries in @entries, live or removed
+ * @max_entries: Allocated size of @entries.  When @n_entries reaches
+ *              this, the table is rebuilt.
+ * @ctrl:       Control byte for each slot.  See hashtable.c
+ * @slots:      For each full slot, the index of its entry in @entries
+ * @entries:    Entries in insertion order
+ *
+ * @ctrl, @slots, and @entries are allocated together, and the
+ * allocation pointer is at @ctrl.
+ *
+ * The table does not produce or consume any references.  Owners take
+ * care of that for the keys and values they store in the entries.
+ */
+struct htable_t {
+        size_t size;
+        size_t used;
+        size_t n_entries;
+        size_t max_entries;
+        uint8_t *ctrl;
+        uint32_t *slots;
+        struct htentry_t *entries;
+};
+
+/* types/hashtable.c */
+extern void htable_init(struct htable_t *ht);
+extern void htable_free(struct htable_t *ht);
+extern void htable_reset(struct htable_t *ht);
+extern void htable_reserve(struct htable_t *ht, size_t n);
+extern struct htentry_t *htable_lookup(struct htable_t *ht,
+                                       Object *key, hash_t hash);
+extern struct htentry_t *htable_insert(struct htable_t *ht,
+                                       Object *key, hash_t hash,
+                                       bool *found);
+extern struct htentry_t *htable_append(struct htable_t *ht,
+                                       Object *key, hash_t hash);
+extern bool htable_remove(struct htable_t *ht, Object *key,
+                          hash_t hash, struct htentry_t *removed);
+
+/**
+ * htable_next - Get the next live entry in insertion order
+ * @ht:         Hash table
+ * @idx:        Iterator state, start at zero.
+ *
+ * Return: The entry, or NULL if there are no more.
+ *
+ * Inserting or removing entries during iteration may rebuild the
+ * table, and then iteration may skip or repeat entries.
+ */
+static inline struct htentry_t *
+htable_next(struct htable_t *ht, size_t *idx)
+{
+        while (*idx < ht->n_entries) {
+                struct htentry_t *e = &ht->entries[(*idx)++];
+                if (e->key)
+                        return e;
+        }
+        return NULL;
+}
+
+#endif /* EVC_INC_INTERNAL_TYPES_HASHTABLE_H */
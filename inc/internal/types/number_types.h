@@ -30,4 +30,11 @@ static inline long long realvar_toint(Object *v)
 static inline double realvar_tod(Object *v)
         { return isvar_float(v) ? floatvar_tod(v) : (double)intvar_toll(v); }
 
+/*
+ * Integers are immutable, but if VAR_IS_UNIQUE(@v) then nobody else can
+ * tell if we change one, so it can be reused instead of replaced.
+ */
+static inline void intvar_reuse(Object *v, long long i)
+        { ((struct intvar_t *)v)->i = i; }
+
 #endif /* EVC_INC_INTERNAL_TYPES_NUMBER_TYPES_H */
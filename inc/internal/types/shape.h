@@ -0,0 +1,104 @@
+#ifndef EVC_INC_INTERNAL_TYPES_SHAPE_H
+#define EVC_INC_INTERNAL_TYPES_SHAPE_H
+
+#include <evilcandy/typedefs.h>
+#include <internal/types/hashtable.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+/**
+ * struct shape_t - Key layout shared by instances of a class
+ * @keys:       Attribute names, in the order they were added.  The
+ *              index of a key's entry is the index of its value in an
+ *              instance's value array.  Entries are never removed.
+ *              Entries' .val fields are NULL, except in the shape of a
+ *              class with __slots__, where they hold each slot's
+ *              initial value.
+ * @parent:     Shape this one was reached from, NULL for the root
+ * @root:       Root shape of the class, which owns the whole tree
+ * @children:   First of the shapes reached by adding one key to this
+ *              one (the "transitions")
+ * @sibling:    Next child of @parent
+ * @n_children: Number of shapes in @children
+ * @n_shapes:   Root only: number of shapes in the tree
+ * @hint:       Root only: most keys any instance has needed, used to
+ *              size new instances' value arrays.
+ *
+ * Shapes are immutable once created, and they live for as long as
+ * their class, so a (shape, index) pair stays valid for anything that
+ * wants to cache where an attribute lives.
+ */
+struct shape_t {
+        struct htable_t keys;
+        struct shape_t *parent;
+        struct shape_t *root;
+        struct shape_t *children;
+        struct shape_t *sibling;
+        size_t n_children;
+        size_t n_shapes;
+        size_t hint;
+};
+
+/* Shapes up to this size are searched linearly first */
+#define SHAPE_SCAN_KEYS 8
+
+/* Number of attributes an instance of shape @sh has */
+static inline size_t
+shape_size(struct shape_t *sh)
+{
+        return sh->keys.n_entries;
+}
+
+/* Name of the @i'th attribute of shape @sh, borrowed */
+static inline Object *
+shape_key(struct shape_t *sh, size_t i)
+{
+        return sh->keys.entries[i].key;
+}
+
+/**
+ * shape_lookup - Get the index of an attribute
+ * @sh:         Shape
+ * @key:        Attribute name
+ * @hash:       Result of var_hash(@key)
+ *
+ * Return: Index into the instance's values, or -1 if @sh has no @key.
+ */
+static inline ssize_t
+shape_lookup(struct shape_t *sh, Object *key, hash_t hash)
+{
+        struct htentry_t *e;
+        size_t i, n = shape_size(sh);
+
+        /*
+         * Attribute names usually come from the same interned string
+         * constants that first set them, so for small shapes, try a
+         * pointer match before probing the table.
+         */
+        if (n <= SHAPE_SCAN_KEYS) {
+                for (i = 0; i < n; i++) {
+                        if (sh->keys.entries[i].key == key)
+                                return i;
+                }
+        }
+        e = htable_lookup(&sh->keys, key, hash);
+        return e ? (ssize_t)(e - sh->keys.entries) : -1;
+}
+
+/* Initial value of the @i'th slot of a __slots__ shape, borrowed */
+static inline Object *
+shape_slot_init(struct shape_t *sh, size_t i)
+{
+        return sh->keys.entries[i].val;
+}
+
+/* types/shape.c */
+extern struct shape_t *shape_new_root(void);
+extern void shape_free(struct shape_t *root);
+extern struct shape_t *shape_add(struct shape_t *sh,
+                                 Object *key, hash_t hash);
+extern bool shape_add_slot(struct shape_t *root, Object *key,
+                           hash_t hash, Object *init);
+
+#endif /* EVC_INC_INTERNAL_TYPES_SHAPE_H */
@@ -7,6 +7,8 @@
 #include <internal/type_registry.h>
 #include <string.h>
 
+struct fmt_spec_t;
+
 struct stringvar_t {
         struct seqvar_t base;
         char *s;                /* the UTF8-encoded C string */
@@ -15,6 +17,7 @@ struct stringvar_t {
         size_t s_width;         /* width of .s_unicode */
         int s_ascii;            /* true if ASCII */
         hash_t s_hash;          /* 0 until string_hash() call */
+        struct fmt_spec_t *s_fmt; /* compiled template, see string.c */
 };
 
 /*
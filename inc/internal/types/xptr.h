@@ -5,11 +5,37 @@
 #include <evilcandy/typedefs.h>
 #include <evilcandy/var.h>
 
+struct as_lazy_t;
+
+/**
+ * struct xptr_inline_t - A call the assembler replaced with a copy of
+ *                        the function being called
+ * @start:      Index of the first instruction of the copy
+ * @end:        Index of the first instruction after the copy
+ * @line:       Source line of the call
+ * @funcname:   Name of the function that was copied, or NULL if it's
+ *              anonymous
+ *
+ * This is only for tracebacks, so that an error in the copy looks like
+ * it happened in a call to the function.  See DOC "Inline expansion"
+ * in assemble_post.c
+ */
+struct xptr_inline_t {
+        int start;
+        int end;
+        int line;
+        Object *funcname;
+};
+
 /**
  * struct xptrvar_t - executable code of a function or a script body
  * @instr:      Opcode array
  * @rodata:     Constants used by the function (a tuple)
  * @n_instr:    Number of opcodes
+ * @n_locals:   Number of local variables, which sit at the bottom of
+ *              the frame's stack
+ * @max_stack:  Most items the code will push onto the stack above its
+ *              locals, as computed by assemble_post.c
  * @file_name:  Name of source file where this was defined
  * @file_line:  Starting line in source file where this was defined
  * @nref:       Reference count, for garbage collection
@@ -22,6 +48,13 @@
  * @locations:  Packed locations buffer, for tracing where an exception
  *              occurred.
  * @locations_size: Size of @locations, in bytes, not #locations.
+ * @inlined:    Calls that were pasted into this code, sorted by @start,
+ *              with a call before the calls pasted inside it.  NULL if
+ *              there are none.
+ * @n_inlined:  Number of entries in @inlined
+ * @lazy:      If not NULL, the function's code has not been assembled
+ *              yet, and every field above but @file_name, @file_line
+ *              and @funcname is still empty.  See xptr_ready().
  *
  * A XptrType var is created for every script and every function
  * definition or lambda within the script.  During assembly, if the
@@ -75,6 +108,7 @@ struct xptrvar_t {
         /* warm items */
         int n_instr;
         int n_locals;
+        int max_stack;
         /* cold items used by disassembly and serializer */
         char *file_name;
         int file_line;
@@ -82,6 +116,9 @@ struct xptrvar_t {
         Object *funcname;
         unsigned char *locations;
         size_t locations_size;
+        struct xptr_inline_t *inlined;
+        int n_inlined;
+        struct as_lazy_t *lazy;
 };
 
 /* only serializer.c and assembler.c code should need to use these */
@@ -89,6 +126,7 @@ struct xptr_cfg_t {
         instruction_t *instr;
         int n_instr;
         int n_locals;
+        int max_stack;
         Object *rodata;
         Object *names;
         Object *funcname;
@@ -96,8 +134,28 @@ struct xptr_cfg_t {
         const char *file_name;
         unsigned char *locations;
         size_t locations_size;
+        struct xptr_inline_t *inlined;
+        int n_inlined;
+        struct as_lazy_t *lazy;
 };
 
 extern Object *xptrvar_new(const struct xptr_cfg_t *cfg);
+extern void xptr_set_code(struct xptrvar_t *x,
+                          const struct xptr_cfg_t *cfg);
+
+/* assemble_post.c */
+extern void assemble_lazy(struct xptrvar_t *x);
+extern void assemble_lazy_free(struct as_lazy_t *lazy);
+
+/*
+ * Make sure @x's code has been assembled.  Anything that looks at more
+ * of an XptrType object than its name and location must call this first.
+ */
+static inline void
+xptr_ready(struct xptrvar_t *x)
+{
+        if (x->lazy)
+                assemble_lazy(x);
+}
 
 #endif /* EVILCANDY_XPTR_H */
@@ -32,6 +32,12 @@ extern void *memrmem(const void *haystack, size_t hlen,
 #define ASCII_WS_CHARS " \t\r\n\v\f"
 #define ASCII_NWS_CHARS 6
 
+/* flags arg to mem_ascii_case() */
+enum {
+        ASCII_TOLOWER = 0x01,
+        ASCII_TOUPPER = 0x02,
+};
+
 /* helpers.c */
 extern ssize_t evc_sprintf(char *buf, size_t bufsize, const char *fmt, ...);
 extern char *strchr_nonnull(const char *charset, int c);
@@ -44,6 +50,8 @@ extern int bit_count64(uint64_t v);
 extern char *slide(const char *s, const char *sep);
 extern bool mem_is_ascii(const void *p, size_t size);
 extern size_t mem_find_nonascii(const void *p, size_t size);
+extern void mem_ascii_case(void *dst, const void *src,
+                           size_t size, unsigned int flags);
 
 /* Why isn't this in stdlib.h? */
 #define container_of(x, type, member) \
@@ -2,9 +2,13 @@
 #define EVILCANDY_LIB_UTF8_H
 
 #include <stdbool.h>
+#include <stddef.h>
 
 extern long utf8_decode_one(const unsigned char *src,
                             unsigned char **endptr);
+extern size_t utf8_scan(const void *src, size_t n,
+                        size_t *npoints, unsigned long *maxchr);
+
 static inline bool
 utf8_valid_unicode(unsigned long point)
 {
@@ -13,4 +17,32 @@ utf8_valid_unicode(unsigned long point)
                !(point >= 0xd800ul && point <= 0xdffful);
 }
 
+/*
+ * utf8_decode_valid - Decode one point from a sequence that has already
+ *                     been validated, eg. by utf8_scan().
+ * @src: Pointer to the start of the sequence.  This will be advanced
+ *       to the start of the next sequence.
+ */
+static inline unsigned long
+utf8_decode_valid(const unsigned char **src)
+{
+        const unsigned char *s = *src;
+        unsigned long c = *s++;
+
+        if (c >= 0xf0u) {
+                c = ((c & 0x07u) << 18) | ((s[0] & 0x3fu) << 12)
+                    | ((s[1] & 0x3fu) << 6) | (s[2] & 0x3fu);
+                s += 3;
+        } else if (c >= 0xe0u) {
+                c = ((c & 0x0fu) << 12) | ((s[0] & 0x3fu) << 6)
+                    | (s[1] & 0x3fu);
+                s += 2;
+        } else if (c >= 0xc0u) {
+                c = ((c & 0x1fu) << 6) | (s[0] & 0x3fu);
+                s++;
+        }
+        *src = s;
+        return c;
+}
+
 #endif /* EVILCANDY_LIB_UTF8_H */
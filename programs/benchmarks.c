@@ -0,0 +1,1233 @@
+/*
+ * benchmarks.c - Micro-benchmarks for EvilCandy internals
+ *
+ * Build with `make tests', then run
+ *
+ *      programs/benchmarks [NAME...]
+ *
+ * from the top of the build tree.  With no arguments, every benchmark
+ * is run.  Each benchmark repeats its inner loop until it has run for at
+ * least BENCH_MIN_SECONDS, so the numbers are stable enough to compare
+ * between builds on the same machine.  They are NOT meant to compare
+ * across machines.
+ */
+#include <evilcandy/assemble.h>
+#include <evilcandy/debug.h>
+#include <evilcandy/enums.h>
+#include <evilcandy/err.h>
+#include <evilcandy/ewrappers.h>
+#include <evilcandy/global.h>
+#include <evilcandy/var.h>
+#include <evilcandy/vm.h>
+#include <evilcandy/types/array.h>
+#include <evilcandy/types/bytearray.h>
+#include <evilcandy/types/bytes.h>
+#include <evilcandy/types/class.h>
+#include <evilcandy/types/deque.h>
+#include <evilcandy/types/dict.h>
+#include <evilcandy/types/memoryview.h>
+#include <evilcandy/types/number_types.h>
+#include <evilcandy/types/numarray.h>
+#include <evilcandy/types/set.h>
+#include <evilcandy/types/string.h>
+#include <evilcandy/types/tuple.h>
+#include <internal/init.h>
+#include <internal/op.h>
+#include <internal/token.h>
+#include <lib/buffer.h>
+#include <tests/prog_gen.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define BENCH_MIN_SECONDS 0.25
+
+struct benchmark_t {
+        const char *name;
+        void (*run)(void);
+};
+
+static double
+bench_now(void)
+{
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static void
+bench_report_ops(const char *name, unsigned long iters, double secs)
+{
+        printf("%-32s %10.1f ns/op  (%lu iterations)\n",
+               name, secs * 1e9 / iters, iters);
+}
+
+static void
+bench_report_bytes(const char *name, size_t nbytes,
+                   unsigned long iters, double secs)
+{
+        double mb = (double)nbytes * iters / (1024.0 * 1024.0);
+        printf("%-32s %10.1f MB/s  (%lu iterations)\n",
+               name, mb / secs, iters);
+}
+
+/* **********************************************************************
+ *                      UTF-8 decoding
+ ***********************************************************************/
+
+/*
+ * Build a ~1 MiB corpus out of @filler, which is mostly ASCII, with
+ * @special (some UTF-8 sequence, or NULL for pure ASCII) dropped in
+ * every @every bytes.
+ */
+static char *
+utf8_corpus(const char *filler, const char *special,
+            size_t every, size_t *size)
+{
+        enum { CORPUS_SIZE = 1024 * 1024 };
+        struct buffer_t b;
+        size_t flen = strlen(filler);
+        size_t i = 0;
+
+        buffer_init(&b);
+        while (buffer_size(&b) < CORPUS_SIZE) {
+                buffer_putc(&b, filler[i++ % flen]);
+                if (special && (i % every) == 0)
+                        buffer_puts(&b, special);
+        }
+        *size = buffer_size(&b);
+        return buffer_trim(&b);
+}
+
+static void
+bench_utf8_one(const char *name, const char *special, size_t every)
+{
+        static const char *FILLER =
+                "The quick brown fox jumps over the lazy dog.  ";
+        char *corpus;
+        size_t size;
+        unsigned long iters = 0;
+        double start, secs;
+
+        corpus = utf8_corpus(FILLER, special, every, &size);
+        start = bench_now();
+        do {
+                Object *s = stringvar_from_binary(corpus, size,
+                                                  CODEC_UTF8);
+                bug_on(s == ErrorVar);
+                VAR_DECR_REF(s);
+                iters++;
+                secs = bench_now() - start;
+        } while (secs < BENCH_MIN_SECONDS);
+        bench_report_bytes(name, size, iters, secs);
+        efree(corpus);
+}
+
+static void
+bench_utf8_decode(void)
+{
+        bench_utf8_one("utf8 decode, ascii", NULL, 0);
+        bench_utf8_one("utf8 decode, latin1 (1/64)", "\xc3\xa9", 64);
+        bench_utf8_one("utf8 decode, bmp (1/64)", "\xe2\x82\xac", 64);
+        bench_utf8_one("utf8 decode, astral (1/64)",
+                       "\xf0\x9f\x98\x80", 64);
+        bench_utf8_one("utf8 decode, bmp (1/2)", "\xe2\x82\xac", 2);
+}
+
+/* **********************************************************************
+ *                      String formatting
+ ***********************************************************************/
+
+static void
+bench_format_one(const char *name, const char *template,
+                 Object *(*fmt)(Object *, Object *))
+{
+        Object *tmpl, *args, *items[3];
+        unsigned long iters = 0;
+        double start, secs;
+
+        tmpl = stringvar_new(template);
+        items[0] = intvar_new(42);
+        items[1] = stringvar_new("evil");
+        items[2] = floatvar_new(3.14159);
+        args = tuplevar_from_stack(items, 3, true);
+
+        start = bench_now();
+        do {
+                Object *s = fmt(tmpl, args);
+                bug_on(s == ErrorVar);
+                VAR_DECR_REF(s);
+                iters++;
+                secs = bench_now() - start;
+        } while (secs < BENCH_MIN_SECONDS);
+        bench_report_ops(name, iters, secs);
+        VAR_DECR_REF(args);
+        VAR_DECR_REF(tmpl);
+}
+
+static void
+bench_format(void)
+{
+        bench_format_one("format, {}",
+                         "id={:5} name={} value={:.3} done", string_format);
+        bench_format_one("format, %",
+                         "id=%5d name=%s value=%.3f done", qop_mod);
+}
+
+/* **********************************************************************
+ *                      String methods
+ ***********************************************************************/
+
+/* Call @str.@method() repeatedly */
+static void
+bench_strmethod_one(const char *name, Object *str, const char *method)
+{
+        Object *key, *func, *args;
+        unsigned long iters = 0;
+        double start, secs;
+
+        args = arrayvar_new(0);
+        key = stringvar_new(method);
+        func = var_getattr(NULL, str, key);
+        bug_on(!func || func == ErrorVar);
+
+        start = bench_now();
+        do {
+                Object *res = vm_exec_func(NULL, func, args, NULL);
+                bug_on(res == ErrorVar);
+                VAR_DECR_REF(res);
+                iters++;
+                secs = bench_now() - start;
+        } while (secs < BENCH_MIN_SECONDS);
+        bench_report_bytes(name, seqvar_size(str), iters, secs);
+        VAR_DECR_REF(func);
+        VAR_DECR_REF(key);
+        VAR_DECR_REF(args);
+}
+
+static void
+bench_strmethods(void)
+{
+        Object *text, *digits, *padded;
+        struct buffer_t b;
+        char *corpus;
+        size_t size;
+
+        corpus = utf8_corpus("The quick brown fox jumps over the lazy dog. ",
+                             NULL, 0, &size);
+        text = stringvar_newn(corpus, size);
+
+        buffer_init(&b);
+        buffer_puts(&b, "   \t\n");
+        buffer_nputs(&b, corpus, size);
+        buffer_puts(&b, "\n\t   ");
+        size = buffer_size(&b);
+        efree(corpus);
+        corpus = buffer_trim(&b);
+        padded = stringvar_newn(corpus, size);
+        efree(corpus);
+
+        corpus = utf8_corpus("0123456789", NULL, 0, &size);
+        digits = stringvar_newn(corpus, size);
+        efree(corpus);
+
+        bench_strmethod_one("str.lower, ascii 1MB", text, "lower");
+        bench_strmethod_one("str.upper, ascii 1MB", text, "upper");
+        bench_strmethod_one("str.swapcase, ascii 1MB", text, "swapcase");
+        bench_strmethod_one("str.title, ascii 1MB", text, "title");
+        bench_strmethod_one("str.split, ascii 1MB", text, "split");
+        bench_strmethod_one("str.strip, ascii 1MB", padded, "strip");
+        bench_strmethod_one("str.isdigit, ascii 1MB", digits, "isdigit");
+
+        VAR_DECR_REF(text);
+        VAR_DECR_REF(digits);
+        VAR_DECR_REF(padded);
+}
+
+/* **********************************************************************
+ *                      Join and split
+ ***********************************************************************/
+
+/* Call ', '.join(@seq) repeatedly */
+static void
+bench_join_one(const char *name, Object *seq)
+{
+        Object *sep, *key, *func, *args;
+        unsigned long iters = 0;
+        double start, secs;
+
+        sep = stringvar_new(", ");
+        key = stringvar_new("join");
+        func = var_getattr(NULL, sep, key);
+        bug_on(!func || func == ErrorVar);
+        args = arrayvar_new(0);
+        array_append(args, seq);
+
+        start = bench_now();
+        do {
+                Object *res = vm_exec_func(NULL, func, args, NULL);
+                bug_on(res == ErrorVar);
+                VAR_DECR_REF(res);
+                iters++;
+                secs = bench_now() - start;
+        } while (secs < BENCH_MIN_SECONDS);
+        bench_report_ops(name, iters, secs);
+        VAR_DECR_REF(args);
+        VAR_DECR_REF(func);
+        VAR_DECR_REF(key);
+        VAR_DECR_REF(sep);
+}
+
+static void
+bench_join(void)
+{
+        enum { NWORDS = 10000 };
+        static const char *WORDS[] = {
+                "evil", "candy", "quick", "brown", "fox", "hÃ©llo",
+        };
+        Object *ascii, *mixed, *tup, *lines, **words;
+        struct buffer_t b;
+        char *corpus;
+        size_t i, size;
+
+        words = emalloc(NWORDS * sizeof(Object *));
+        for (i = 0; i < NWORDS; i++)
+                words[i] = stringvar_new(WORDS[i % 5]);
+        ascii = arrayvar_from_stack(words, NWORDS, false);
+        tup = tuplevar_from_stack(words, NWORDS, true);
+
+        for (i = 0; i < NWORDS; i++)
+                words[i] = stringvar_new(WORDS[i % 6]);
+        mixed = arrayvar_from_stack(words, NWORDS, true);
+        efree(words);
+
+        bench_join_one("str.join, list of 10k", ascii);
+        bench_join_one("str.join, tuple of 10k", tup);
+        bench_join_one("str.join, latin1 list of 10k", mixed);
+
+        buffer_init(&b);
+        for (i = 0; i < NWORDS; i++) {
+                buffer_puts(&b, WORDS[i % 5]);
+                buffer_putc(&b, '\n');
+        }
+        size = buffer_size(&b);
+        corpus = buffer_trim(&b);
+        lines = stringvar_newn(corpus, size);
+        efree(corpus);
+        bench_strmethod_one("str.splitlines, 10k lines", lines, "splitlines");
+
+        VAR_DECR_REF(lines);
+        VAR_DECR_REF(tup);
+        VAR_DECR_REF(mixed);
+        VAR_DECR_REF(ascii);
+}
+
+/* **********************************************************************
+ *                      Dictionaries and sets
+ ***********************************************************************/
+
+/* @n integer keys, scattered so that the hash order isn't sequential */
+static Object **
+hash_keys(size_t n, unsigned long long seed)
+{
+        Object **keys = emalloc(n * sizeof(Object *));
+        size_t i;
+
+        for (i = 0; i < n; i++) {
+                seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+                keys[i] = intvar_new((long long)(seed >> 17));
+        }
+        return keys;
+}
+
+/* Integer keys @start...@start+@n-1, the kind an id map or a sparse
+ * array has */
+static Object **
+dense_keys(size_t n, size_t start)
+{
+        Object **keys = emalloc(n * sizeof(Object *));
+        size_t i;
+
+        for (i = 0; i < n; i++)
+                keys[i] = intvar_new(start + i);
+        return keys;
+}
+
+static void
+hash_keys_free(Object **keys, size_t n)
+{
+        size_t i;
+        for (i = 0; i < n; i++)
+                VAR_DECR_REF(keys[i]);
+        efree(keys);
+}
+
+/*
+ * Fill a dict with @n keys, look all of them up, look up @n keys which
+ * aren't there, then delete them all, timing each phase separately.
+ * If @dense is true, the keys are 0...@n-1, otherwise they are
+ * scattered.
+ */
+static void
+bench_dict_one(const char *label, size_t n, bool dense)
+{
+        Object **keys, **misses;
+        double t[4] = { 0.0, 0.0, 0.0, 0.0 };
+        unsigned long iters = 0;
+        char name[64];
+
+        if (dense) {
+                keys = dense_keys(n, 0);
+                misses = dense_keys(n, n);
+        } else {
+                keys = hash_keys(n, 1);
+                misses = hash_keys(n, 2);
+        }
+        do {
+                Object *d = dictvar_new();
+                double start;
+                size_t i;
+
+                start = bench_now();
+                for (i = 0; i < n; i++)
+                        dict_setitem(d, keys[i], keys[i]);
+                t[0] += bench_now() - start;
+
+                start = bench_now();
+                for (i = 0; i < n; i++) {
+                        Object *v = dict_getitem(d, keys[i]);
+                        bug_on(!v);
+                        VAR_DECR_REF(v);
+                }
+                t[1] += bench_now() - start;
+
+                start = bench_now();
+                for (i = 0; i < n; i++)
+                        bug_on(dict_getitem(d, misses[i]) != NULL);
+                t[2] += bench_now() - start;
+
+                start = bench_now();
+                for (i = 0; i < n; i++)
+                        dict_setitem(d, keys[i], NULL);
+                t[3] += bench_now() - start;
+
+                VAR_DECR_REF(d);
+                iters++;
+        } while (t[0] + t[1] + t[2] + t[3] < BENCH_MIN_SECONDS);
+
+        snprintf(name, sizeof(name), "dict insert, %s", label);
+        bench_report_ops(name, iters * n, t[0]);
+        snprintf(name, sizeof(name), "dict lookup hit, %s", label);
+        bench_report_ops(name, iters * n, t[1]);
+        snprintf(name, sizeof(name), "dict lookup miss, %s", label);
+        bench_report_ops(name, iters * n, t[2]);
+        snprintf(name, sizeof(name), "dict delete, %s", label);
+        bench_report_ops(name, iters * n, t[3]);
+
+        hash_keys_free(misses, n);
+        hash_keys_free(keys, n);
+}
+
+static void
+bench_set_one(const char *label, size_t n)
+{
+        Object **keys, **misses;
+        double t[2] = { 0.0, 0.0 };
+        unsigned long iters = 0;
+        char name[64];
+
+        keys = hash_keys(n, 1);
+        misses = hash_keys(n, 2);
+        do {
+                Object *s = setvar_new(NULL);
+                double start;
+                size_t i;
+
+                start = bench_now();
+                for (i = 0; i < n; i++)
+                        set_additem(s, keys[i], NULL);
+                t[0] += bench_now() - start;
+
+                start = bench_now();
+                for (i = 0; i < n; i++) {
+                        bug_on(!set_hasitem(s, keys[i]));
+                        bug_on(set_hasitem(s, misses[i]));
+                }
+                t[1] += bench_now() - start;
+
+                VAR_DECR_REF(s);
+                iters++;
+        } while (t[0] + t[1] < BENCH_MIN_SECONDS);
+
+        snprintf(name, sizeof(name), "set add, %s", label);
+        bench_report_ops(name, iters * n, t[0]);
+        snprintf(name, sizeof(name), "set contains, %s", label);
+        bench_report_ops(name, iters * n * 2, t[1]);
+
+        hash_keys_free(misses, n);
+        hash_keys_free(keys, n);
+}
+
+static void
+bench_dict(void)
+{
+        bench_dict_one("1k ints", 1000, false);
+        bench_dict_one("100k ints", 100000, false);
+        bench_dict_one("1M ints", 1000000, false);
+        bench_dict_one("1k dense ints", 1000, true);
+        bench_dict_one("1M dense ints", 1000000, true);
+        bench_set_one("1k ints", 1000);
+        bench_set_one("1M ints", 1000000);
+}
+
+/* **********************************************************************
+ *                      Instance attributes
+ ***********************************************************************/
+
+/*
+ * Time building instances which all get the same @nattr attributes, the
+ * way an __init__ method would, then reading them back, @n instances at
+ * a time.  "getslot" reads them the way the VM does when the assembler
+ * has given it a hint about where each attribute is.  If @slots is
+ * true, the class declares the attributes in __slots__.
+ */
+static void
+bench_attr_one(const char *label, size_t nattr, size_t n, bool slots)
+{
+        Object *class, *cname, *dict, **names, **insts;
+        double t[3] = { 0.0, 0.0, 0.0 };
+        unsigned long iters = 0;
+        char name[64];
+        size_t i, j;
+
+        names = emalloc(nattr * sizeof(Object *));
+        for (j = 0; j < nattr; j++) {
+                snprintf(name, sizeof(name), "attr%d", (int)j);
+                names[j] = stringvar_new(name);
+        }
+        dict = dictvar_new();
+        if (slots) {
+                Object *k = stringvar_new("__slots__");
+                Object *v = tuplevar_from_stack(names, nattr, false);
+                dict_setitem(dict, k, v);
+                VAR_DECR_REF(v);
+                VAR_DECR_REF(k);
+        }
+        cname = stringvar_new("Bench");
+        class = typevar_new_user(NULL, dict, cname, NULL, NULL);
+        bug_on(class == ErrorVar);
+        insts = emalloc(n * sizeof(Object *));
+
+        do {
+                double start;
+
+                start = bench_now();
+                for (i = 0; i < n; i++) {
+                        insts[i] = instancevar_new(class, NULL,
+                                                   NULL, false);
+                        for (j = 0; j < nattr; j++) {
+                                instance_setattr(NULL, insts[i],
+                                                 names[j], names[j]);
+                        }
+                }
+                t[0] += bench_now() - start;
+
+                start = bench_now();
+                for (i = 0; i < n; i++) {
+                        for (j = 0; j < nattr; j++) {
+                                Object *v = instance_getattr(NULL,
+                                                        insts[i], names[j]);
+                                bug_on(v != names[j]);
+                                VAR_DECR_REF(v);
+                        }
+                }
+                t[1] += bench_now() - start;
+
+                start = bench_now();
+                for (i = 0; i < n; i++) {
+                        for (j = 0; j < nattr; j++) {
+                                Object *v = instance_getslot(NULL,
+                                                insts[i], j, names[j]);
+                                bug_on(v != names[j]);
+                                VAR_DECR_REF(v);
+                        }
+                }
+                t[2] += bench_now() - start;
+
+                for (i = 0; i < n; i++)
+                        VAR_DECR_REF(insts[i]);
+                iters++;
+        } while (t[0] + t[1] + t[2] < BENCH_MIN_SECONDS);
+
+        snprintf(name, sizeof(name), "instance build, %s", label);
+        bench_report_ops(name, iters * n, t[0]);
+        snprintf(name, sizeof(name), "instance getattr, %s", label);
+        bench_report_ops(name, iters * n * nattr, t[1]);
+        snprintf(name, sizeof(name), "instance getslot, %s", label);
+        bench_report_ops(name, iters * n * nattr, t[2]);
+
+        efree(insts);
+        VAR_DECR_REF(class);
+        VAR_DECR_REF(cname);
+        VAR_DECR_REF(dict);
+        for (j = 0; j < nattr; j++)
+                VAR_DECR_REF(names[j]);
+        efree(names);
+}
+
+static void
+bench_attr(void)
+{
+        bench_attr_one("2 attrs", 2, 10000, false);
+        bench_attr_one("8 attrs", 8, 10000, false);
+        bench_attr_one("8 attrs x 1M", 8, 1000000, false);
+        bench_attr_one("8 slots", 8, 10000, true);
+        bench_attr_one("8 slots x 1M", 8, 1000000, true);
+}
+
+/*
+ * Sum, add, and dot product of @n floats, once as lists of float
+ * objects the way a script would have to do it without numarray, and
+ * once as numarrays.
+ */
+static void
+bench_numarray_one(const char *label, size_t n)
+{
+        Object *la, *lb, *na, *nb, *sum, *dot, *noargs, *args, *r;
+        double *da, *db;
+        double t[6] = { 0.0, 0.0, 0.0, 0.0, 0.0, 0.0 };
+        unsigned long iters = 0;
+        char name[64];
+        size_t i;
+
+        da = emalloc(n * sizeof(double));
+        db = emalloc(n * sizeof(double));
+        la = arrayvar_new(0);
+        lb = arrayvar_new(0);
+        for (i = 0; i < n; i++) {
+                Object *v;
+
+                da[i] = (double)(i % 1000) * 0.5;
+                db[i] = (double)(i % 7) + 0.25;
+                v = floatvar_new(da[i]);
+                array_append(la, v);
+                VAR_DECR_REF(v);
+                v = floatvar_new(db[i]);
+                array_append(lb, v);
+                VAR_DECR_REF(v);
+        }
+        na = numarrayvar_from_doubles(da, n);
+        nb = numarrayvar_from_doubles(db, n);
+        r = stringvar_new("sum");
+        sum = var_getattr(NULL, na, r);
+        VAR_DECR_REF(r);
+        r = stringvar_new("dot");
+        dot = var_getattr(NULL, na, r);
+        VAR_DECR_REF(r);
+        bug_on(sum == ErrorVar || dot == ErrorVar);
+        noargs = arrayvar_new(0);
+        args = arrayvar_from_stack(&nb, 1, false);
+
+        do {
+                double start;
+
+                start = bench_now();
+                r = floatvar_new(0.0);
+                for (i = 0; i < n; i++) {
+                        Object *x = qop_add(r, array_borrowitem(la, i));
+                        VAR_DECR_REF(r);
+                        r = x;
+                }
+                VAR_DECR_REF(r);
+                t[0] += bench_now() - start;
+
+                start = bench_now();
+                r = vm_exec_func(NULL, sum, noargs, NULL);
+                VAR_DECR_REF(r);
+                t[1] += bench_now() - start;
+
+                start = bench_now();
+                r = arrayvar_new(0);
+                for (i = 0; i < n; i++) {
+                        Object *x = qop_add(array_borrowitem(la, i),
+                                            array_borrowitem(lb, i));
+                        array_append(r, x);
+                        VAR_DECR_REF(x);
+                }
+                VAR_DECR_REF(r);
+                t[2] += bench_now() - start;
+
+                start = bench_now();
+                r = qop_add(na, nb);
+                VAR_DECR_REF(r);
+                t[3] += bench_now() - start;
+
+                start = bench_now();
+                r = floatvar_new(0.0);
+                for (i = 0; i < n; i++) {
+                        Object *p, *x;
+                        p = qop_mul(array_borrowitem(la, i),
+                                    array_borrowitem(lb, i));
+                        x = qop_add(r, p);
+                        VAR_DECR_REF(p);
+                        VAR_DECR_REF(r);
+                        r = x;
+                }
+                VAR_DECR_REF(r);
+                t[4] += bench_now() - start;
+
+                start = bench_now();
+                r = vm_exec_func(NULL, dot, args, NULL);
+                VAR_DECR_REF(r);
+                t[5] += bench_now() - start;
+
+                iters++;
+        } while (t[0] + t[1] + t[2] + t[3] + t[4] + t[5]
+                 < BENCH_MIN_SECONDS);
+
+        snprintf(name, sizeof(name), "list sum, %s", label);
+        bench_report_ops(name, iters * n, t[0]);
+        snprintf(name, sizeof(name), "numarray sum, %s", label);
+        bench_report_ops(name, iters * n, t[1]);
+        snprintf(name, sizeof(name), "list add, %s", label);
+        bench_report_ops(name, iters * n, t[2]);
+        snprintf(name, sizeof(name), "numarray add, %s", label);
+        bench_report_ops(name, iters * n, t[3]);
+        snprintf(name, sizeof(name), "list dot, %s", label);
+        bench_report_ops(name, iters * n, t[4]);
+        snprintf(name, sizeof(name), "numarray dot, %s", label);
+        bench_report_ops(name, iters * n, t[5]);
+
+        VAR_DECR_REF(args);
+        VAR_DECR_REF(noargs);
+        VAR_DECR_REF(dot);
+        VAR_DECR_REF(sum);
+        VAR_DECR_REF(nb);
+        VAR_DECR_REF(na);
+        VAR_DECR_REF(lb);
+        VAR_DECR_REF(la);
+        efree(db);
+        efree(da);
+}
+
+static void
+bench_numarray(void)
+{
+        bench_numarray_one("1k floats", 1000);
+        bench_numarray_one("1M floats", 1000000);
+}
+
+/* Sort a fresh copy of @items, which is left unchanged */
+static void
+bench_sort_one(const char *label, Object **items, size_t n)
+{
+        unsigned long iters = 0;
+        double secs = 0.0;
+        char name[64];
+
+        do {
+                Object *arr = arrayvar_from_stack(items, n, false);
+                double start = bench_now();
+                var_sort(arr);
+                secs += bench_now() - start;
+                bug_on(err_occurred());
+                VAR_DECR_REF(arr);
+                iters++;
+        } while (secs < BENCH_MIN_SECONDS);
+
+        snprintf(name, sizeof(name), "sort, %s", label);
+        bench_report_ops(name, iters * n, secs);
+}
+
+static void
+bench_sort(void)
+{
+        enum { N = 100000 };
+        Object **ints, **items;
+        unsigned long long seed = 42;
+        char buf[16];
+        size_t i;
+
+        ints = hash_keys(N, 1);
+        bench_sort_one("100k random ints", ints, N);
+        hash_keys_free(ints, N);
+
+        ints = dense_keys(N, 0);
+        bench_sort_one("100k sorted ints", ints, N);
+        for (i = 0; i < N / 2; i++) {
+                Object *t = ints[i];
+                ints[i] = ints[N - 1 - i];
+                ints[N - 1 - i] = t;
+        }
+        bench_sort_one("100k reversed ints", ints, N);
+        /* sorted, but with every 100th element out of place */
+        for (i = 0; i < N; i += 100) {
+                Object *t = ints[i];
+                ints[i] = ints[N - 1 - i];
+                ints[N - 1 - i] = t;
+        }
+        bench_sort_one("100k nearly reversed ints", ints, N);
+        hash_keys_free(ints, N);
+
+        items = emalloc(N * sizeof(Object *));
+        for (i = 0; i < N; i++) {
+                seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+                items[i] = floatvar_new((double)(seed >> 11) / 1e6);
+        }
+        bench_sort_one("100k random floats", items, N);
+        for (i = 0; i < N; i += 2) {
+                VAR_DECR_REF(items[i]);
+                items[i] = intvar_new((long long)i * 7919 % N);
+        }
+        bench_sort_one("100k random ints and floats", items, N);
+        for (i = 0; i < N; i++) {
+                seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+                snprintf(buf, sizeof(buf), "k%llx", seed >> 32);
+                VAR_DECR_REF(items[i]);
+                items[i] = stringvar_new(buf);
+        }
+        bench_sort_one("100k random strings", items, N);
+        hash_keys_free(items, N);
+}
+
+/*
+ * A FIFO queue holding @depth items: take one from the front, put one
+ * on the back, as a list (array_delete_chunk(..., 0, 1) is what
+ * list.pop(0) does) and as a deque.
+ */
+static void
+bench_deque_one(const char *label, size_t depth)
+{
+        enum { N_OPS = 100000 };
+        Object *arr, *dq, **items;
+        double t[2] = { 0.0, 0.0 };
+        unsigned long iters = 0;
+        char name[64];
+        size_t i;
+
+        items = dense_keys(depth, 0);
+        arr = arrayvar_from_stack(items, depth, false);
+        dq = dequevar_new(-1);
+        for (i = 0; i < depth; i++)
+                deque_append(dq, items[i], false);
+
+        do {
+                double start;
+
+                start = bench_now();
+                for (i = 0; i < N_OPS; i++) {
+                        Object *v = array_getitem(arr, 0);
+                        array_delete_chunk(arr, 0, 1);
+                        array_append(arr, v);
+                        VAR_DECR_REF(v);
+                }
+                t[0] += bench_now() - start;
+
+                start = bench_now();
+                for (i = 0; i < N_OPS; i++) {
+                        Object *v = deque_pop(dq, true);
+                        deque_append(dq, v, false);
+                        VAR_DECR_REF(v);
+                }
+                t[1] += bench_now() - start;
+                iters++;
+        } while (t[0] + t[1] < BENCH_MIN_SECONDS);
+
+        snprintf(name, sizeof(name), "list FIFO, %s", label);
+        bench_report_ops(name, iters * N_OPS, t[0]);
+        snprintf(name, sizeof(name), "deque FIFO, %s", label);
+        bench_report_ops(name, iters * N_OPS, t[1]);
+
+        VAR_DECR_REF(dq);
+        VAR_DECR_REF(arr);
+        hash_keys_free(items, depth);
+}
+
+static void
+bench_deque(void)
+{
+        bench_deque_one("10 deep", 10);
+        bench_deque_one("1k deep", 1000);
+        bench_deque_one("100k deep", 100000);
+}
+
+/*
+ * Build a @total-byte message out of 64-byte pieces, once by adding
+ * bytes objects together (a new object each time) and once by
+ * appending to a bytearray.
+ */
+static void
+bench_bytearray_one(const char *label, size_t total)
+{
+        enum { PIECE = 64 };
+        unsigned char piece[PIECE];
+        Object *po;
+        double t[2] = { 0.0, 0.0 };
+        unsigned long iters = 0;
+        char name[64];
+        size_t i;
+
+        memset(piece, 'x', PIECE);
+        po = bytesvar_new(piece, PIECE);
+        do {
+                double start;
+                Object *msg;
+
+                start = bench_now();
+                msg = bytesvar_new(piece, 0);
+                for (i = 0; i < total; i += PIECE) {
+                        Object *tmp = qop_add(msg, po);
+                        VAR_DECR_REF(msg);
+                        msg = tmp;
+                }
+                VAR_DECR_REF(msg);
+                t[0] += bench_now() - start;
+
+                start = bench_now();
+                msg = bytearrayvar_new(NULL, 0);
+                for (i = 0; i < total; i += PIECE)
+                        bytearray_append(msg, piece, PIECE);
+                VAR_DECR_REF(msg);
+                t[1] += bench_now() - start;
+                iters++;
+        } while (t[0] + t[1] < BENCH_MIN_SECONDS);
+
+        snprintf(name, sizeof(name), "bytes +=, %s", label);
+        bench_report_bytes(name, total, iters, t[0]);
+        snprintf(name, sizeof(name), "bytearray append, %s", label);
+        bench_report_bytes(name, total, iters, t[1]);
+        VAR_DECR_REF(po);
+}
+
+static void
+bench_bytearray(void)
+{
+        bench_bytearray_one("4 KiB", 4 * 1024);
+        bench_bytearray_one("256 KiB", 256 * 1024);
+}
+
+/*
+ * Split a 1 MiB buffer into records, then slice a small header field
+ * out of each record, the way a parser would.  Slicing bytes copies
+ * every record; slicing a memoryview of the same bytes copies nothing.
+ */
+static void
+bench_memoryview_one(const char *label, size_t reclen)
+{
+        enum { TOTAL = 1024 * 1024 };
+        unsigned char *buf;
+        Object *src[2];
+        double t[2] = { 0.0, 0.0 };
+        unsigned long iters = 0;
+        char name[64];
+        size_t i;
+        int j;
+
+        buf = emalloc(TOTAL);
+        for (i = 0; i < TOTAL; i++)
+                buf[i] = i & 0xff;
+        src[0] = bytesvar_new(buf, TOTAL);
+        src[1] = memoryviewvar_new(src[0]);
+        efree(buf);
+
+        do {
+                for (j = 0; j < 2; j++) {
+                        double start = bench_now();
+                        for (i = 0; i + reclen <= TOTAL; i += reclen) {
+                                Object *rec, *field;
+
+                                rec = var_getslice(src[j], i, i + reclen, 1);
+                                field = var_getslice(rec, 4, 8, 1);
+                                VAR_DECR_REF(field);
+                                VAR_DECR_REF(rec);
+                        }
+                        t[j] += bench_now() - start;
+                }
+                iters++;
+        } while (t[0] + t[1] < BENCH_MIN_SECONDS);
+
+        snprintf(name, sizeof(name), "bytes slices, %s records", label);
+        bench_report_bytes(name, TOTAL, iters, t[0]);
+        snprintf(name, sizeof(name), "memoryview slices, %s records", label);
+        bench_report_bytes(name, TOTAL, iters, t[1]);
+        VAR_DECR_REF(src[1]);
+        VAR_DECR_REF(src[0]);
+}
+
+static void
+bench_memoryview(void)
+{
+        bench_memoryview_one("64 B", 64);
+        bench_memoryview_one("4 KiB", 4 * 1024);
+}
+
+/* **********************************************************************
+ *                      Counted loops
+ ***********************************************************************/
+
+static Object *
+bench_compile_func(const char *src)
+{
+        Object *ex, *func;
+
+        ex = assemble_string(src, true);
+        bug_on(!ex || ex == ErrorVar);
+        func = vm_exec_script(ex, NULL);
+        bug_on(!func || func == ErrorVar);
+        VAR_DECR_REF(ex);
+        return func;
+}
+
+/*
+ * Sum the integers below @n in a script loop.  "range literal" is the
+ * counted loop the assembler emits for `for i in range(...)'; "range
+ * object" iterates over a range held in a variable, which goes through
+ * the generic FOREACH_ITER path.  "while" is the same sum written out
+ * by hand, with a braced body like most real loops have.
+ */
+static void
+bench_forloop_one(const char *label, long long n)
+{
+        static const char *srcs[3] = {
+                "function(n) { let t = 0; "
+                "for i in range(n) t += i; return t; }",
+                "function(n) { let r = range(n); let t = 0; "
+                "for i in r t += i; return t; }",
+                "function(n) { let t = 0; let i = 0; "
+                "while (i < n) { t += i; i += 1; } return t; }",
+        };
+        static const char *names[3] = {
+                "range literal", "range object", "while"
+        };
+        Object *funcs[3], *args, *nv;
+        double t[3] = { 0.0, 0.0, 0.0 };
+        unsigned long iters = 0;
+        char name[64];
+        int j;
+
+        for (j = 0; j < 3; j++)
+                funcs[j] = bench_compile_func(srcs[j]);
+        nv = intvar_new(n);
+        args = arrayvar_from_stack(&nv, 1, false);
+        VAR_DECR_REF(nv);
+
+        do {
+                for (j = 0; j < 3; j++) {
+                        double start = bench_now();
+                        Object *res = vm_exec_func(NULL, funcs[j],
+                                                   args, NULL);
+                        t[j] += bench_now() - start;
+                        bug_on(!res || res == ErrorVar);
+                        VAR_DECR_REF(res);
+                }
+                iters++;
+        } while (t[0] + t[1] + t[2] < BENCH_MIN_SECONDS);
+
+        for (j = 0; j < 3; j++) {
+                snprintf(name, sizeof(name), "%s, %s", names[j], label);
+                bench_report_ops(name, iters * n, t[j]);
+                VAR_DECR_REF(funcs[j]);
+        }
+        VAR_DECR_REF(args);
+}
+
+static void
+bench_forloop(void)
+{
+        bench_forloop_one("100 steps", 100);
+        bench_forloop_one("100k steps", 100000);
+}
+
+/* **********************************************************************
+ *                      Method calls
+ ***********************************************************************/
+
+/*
+ * Call a method @n times in a script loop, once a method of a user
+ * class and once a built-in string method.
+ */
+static void
+bench_methods_one(const char *label, long long n)
+{
+        static const char *srcs[2] = {
+                "function(n) { class C() { "
+                ".__init__ = function(self) { self.x = 1; }, "
+                ".get = function(self) { return self.x; }, } "
+                "let c = C(); let t = 0; "
+                "for i in range(n) t += c.get(); return t; }",
+                "function(n) { let s = '12345'; let t = 0; "
+                "for i in range(n) { if (s.isdigit()) t += 1; } "
+                "return t; }",
+        };
+        static const char *names[2] = {
+                "user method", "builtin method"
+        };
+        Object *funcs[2], *args, *nv;
+        double t[2] = { 0.0, 0.0 };
+        unsigned long iters = 0;
+        char name[64];
+        int j;
+
+        for (j = 0; j < 2; j++)
+                funcs[j] = bench_compile_func(srcs[j]);
+        nv = intvar_new(n);
+        args = arrayvar_from_stack(&nv, 1, false);
+        VAR_DECR_REF(nv);
+
+        do {
+                for (j = 0; j < 2; j++) {
+                        double start = bench_now();
+                        Object *res = vm_exec_func(NULL, funcs[j],
+                                                   args, NULL);
+                        t[j] += bench_now() - start;
+                        bug_on(!res || res == ErrorVar);
+                        VAR_DECR_REF(res);
+                }
+                iters++;
+        } while (t[0] + t[1] < BENCH_MIN_SECONDS);
+
+        for (j = 0; j < 2; j++) {
+                snprintf(name, sizeof(name), "%s, %s", names[j], label);
+                bench_report_ops(name, iters * n, t[j]);
+                VAR_DECR_REF(funcs[j]);
+        }
+        VAR_DECR_REF(args);
+}
+
+static void
+bench_methods(void)
+{
+        bench_methods_one("100k calls", 100000);
+}
+
+/* **********************************************************************
+ *                      Tokenizer
+ ***********************************************************************/
+
+/*
+ * Build ~1 MiB of source out of programs from prog_gen(), the same
+ * generator the fuzzers use.  They're semantically wrong, but every
+ * one of them tokenizes.
+ */
+static char *
+lex_corpus(size_t *size)
+{
+        enum { CORPUS_SIZE = 1024 * 1024 };
+        static char prog[8192];
+        struct buffer_t b;
+
+        srand(1);
+        buffer_init(&b);
+        while (buffer_size(&b) < CORPUS_SIZE) {
+                if (prog_gen(prog, sizeof(prog), 10) < 0)
+                        continue;
+                buffer_puts(&b, prog);
+                buffer_putc(&b, '\n');
+        }
+        *size = buffer_size(&b);
+        return buffer_trim(&b);
+}
+
+/* Tokenize all of @fp, which holds @size bytes, over and over */
+static void
+bench_lex_one(const char *name, FILE *fp, size_t size)
+{
+        unsigned long iters = 0;
+        double start, secs;
+
+        start = bench_now();
+        do {
+                struct token_state_t *state;
+                struct token_t *tok;
+                int t;
+
+                rewind(fp);
+                state = token_state_new(fp);
+                bug_on(!state);
+                while ((t = get_tok(state, &tok)) != OC_EOF)
+                        bug_on(t == RES_ERROR);
+                token_state_free(state);
+                iters++;
+                secs = bench_now() - start;
+        } while (secs < BENCH_MIN_SECONDS);
+        bench_report_bytes(name, size, iters, secs);
+}
+
+/*
+ * "regular file" is how scripts and imports are read.  "stream" has no
+ * file descriptor behind it, so it gets read a line at a time, the way
+ * a pipe would be.
+ */
+static void
+bench_lex(void)
+{
+        char *corpus;
+        size_t size;
+        FILE *fp;
+
+        corpus = lex_corpus(&size);
+
+        fp = tmpfile();
+        bug_on(!fp);
+        bug_on(fwrite(corpus, 1, size, fp) != size);
+        fflush(fp);
+        bench_lex_one("lex, regular file", fp, size);
+        fclose(fp);
+
+        fp = fmemopen(corpus, size, "r");
+        bug_on(!fp);
+        bench_lex_one("lex, stream", fp, size);
+        fclose(fp);
+
+        efree(corpus);
+}
+
+static const struct benchmark_t BENCHMARKS[] = {
+        { "utf8",       bench_utf8_decode },
+        { "format",     bench_format },
+        { "strmethods", bench_strmethods },
+        { "join",       bench_join },
+        { "dict",       bench_dict },
+        { "attr",       bench_attr },
+        { "numarray",   bench_numarray },
+        { "sort",       bench_sort },
+        { "deque",      bench_deque },
+        { "bytearray",  bench_bytearray },
+        { "memoryview", bench_memoryview },
+        { "forloop",    bench_forloop },
+        { "methods",    bench_methods },
+        { "lex",        bench_lex },
+        { NULL, NULL },
+};
+
+int
+main(int argc, char **argv)
+{
+        const struct benchmark_t *b;
+        int i, nrun = 0;
+
+        initialize_program();
+        for (b = BENCHMARKS; b->name != NULL; b++) {
+                if (argc > 1) {
+                        for (i = 1; i < argc; i++) {
+                                if (!strcmp(argv[i], b->name))
+                                        break;
+                        }
+                        if (i == argc)
+                                continue;
+                }
+                b->run();
+                nrun++;
+        }
+        end_program();
+
+        if (!nrun) {
+                fprintf(stderr, "No benchmarks match.  Choose from:\n");
+                for (b = BENCHMARKS; b->name != NULL; b++)
+                        fprintf(stderr, "    %s\n", b->name);
+                return EXIT_FAILURE;
+        }
+        return EXIT_SUCCESS;
+}
@@ -7,6 +7,7 @@
 #include <internal/init.h>
 #include <internal/path.h>
 #include <internal/locations.h>
+#include <lib/utf8.h>
 #include <tests/tap.h>
 
 #include <assert.h>
@@ -403,6 +404,41 @@ test_unpack(struct tap_t *tap)
         RETURN_IF_ERROR(tap, result == -1);
 }
 
+static void
+test_utf8_scan(struct tap_t *tap)
+{
+        /* "héllo €😀", then garbage */
+        static const char GOOD[] =
+                "h\xc3\xa9llo \xe2\x82\xac\xf0\x9f\x98\x80";
+        static const char OVERLONG[] = "ab\xc0\x80";
+        static const char SURROGATE[] = "ab\xed\xa0\x80";
+        size_t npoints, nvalid;
+        unsigned long maxchr;
+
+        nvalid = utf8_scan("plain", 5, &npoints, &maxchr);
+        RETURN_IF_ERROR(tap, nvalid == 5);
+        RETURN_IF_ERROR(tap, npoints == 5);
+        RETURN_IF_ERROR(tap, maxchr == 0);
+
+        nvalid = utf8_scan(GOOD, sizeof(GOOD) - 1, &npoints, &maxchr);
+        RETURN_IF_ERROR(tap, nvalid == sizeof(GOOD) - 1);
+        RETURN_IF_ERROR(tap, npoints == 8);
+        RETURN_IF_ERROR(tap, maxchr == 0x1f600);
+
+        /* truncated sequence at end */
+        nvalid = utf8_scan(GOOD, sizeof(GOOD) - 2, &npoints, &maxchr);
+        RETURN_IF_ERROR(tap, nvalid == sizeof(GOOD) - 5);
+        RETURN_IF_ERROR(tap, npoints == 7);
+        RETURN_IF_ERROR(tap, maxchr == 0x20ac);
+
+        nvalid = utf8_scan(OVERLONG, sizeof(OVERLONG) - 1,
+                           &npoints, &maxchr);
+        RETURN_IF_ERROR(tap, nvalid == 2);
+        nvalid = utf8_scan(SURROGATE, sizeof(SURROGATE) - 1,
+                           &npoints, &maxchr);
+        RETURN_IF_ERROR(tap, nvalid == 2);
+}
+
 int
 main(int argc, char **argv)
 {
@@ -427,6 +463,7 @@ main(int argc, char **argv)
         initialize_program();
         test_locations(&tap);
         test_unpack(&tap);
+        test_utf8_scan(&tap);
         end_program();
 
         tap_end_tests(&tap);
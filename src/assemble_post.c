@@ -8,10 +8,10 @@
  *    - The same principle with simplify_tuples() below can be used
  *      for DEFDICT.
  *
- * XXX REVISIT: There's a lot of PUSH_BLOCK instructions that can be
- * reduced in this file as well.  In particular, check for a lack of
- * 'break' or 'continue' in block.  For exceptions, maybe use a parallel
- * exception table like Python uses, to forgo PUSH_BLOCK for exceptions.
+ * XXX REVISIT: Loop blocks are removed below when no 'break' or
+ * 'continue' needs them, but every 'try' still pushes a block.  For
+ * exceptions, maybe use a parallel exception table like Python uses,
+ * to forgo PUSH_BLOCK for exceptions.
  */
 #include <evilcandy/global.h>
 #include <evilcandy/debug.h>
@@ -22,9 +22,11 @@
 #include <evilcandy/types/number_types.h>
 #include <internal/type_registry.h>
 #include <internal/types/xptr.h>
+#include <internal/types/number_types.h>
 #include <internal/assemble.h>
 #include <internal/locations.h>
 #include <internal/op.h>
+#include <internal/superinstr.h>
 #include <internal/types/internal_types.h>
 #include <string.h>
 #include <stdlib.h>
@@ -44,6 +46,35 @@
  */
 #define TRY_SIMPLIFY_LABELS 1
 
+/*
+ * The dataflow optimizations in flow_optimize() can be turned off one
+ * at a time, for when one of them is suspected of breaking something.
+ *
+ * XXX: these ought to go in configure.ac too
+ */
+#define TRY_FORWARD_STORES              1
+#define TRY_REDUNDANT_LOADS             1
+#define TRY_LOCAL_CSE                   1
+#define TRY_ELIMINATE_DEAD_STORES       1
+
+/*
+ * Paste small local functions into the code that calls them.  This
+ * makes the disassembly harder to follow, so it can be turned off
+ * here.  Tracebacks look the same either way, see DOC "Inline
+ * expansion".
+ *
+ * XXX: ought to go in configure.ac too
+ */
+#define TRY_INLINE_FUNCTIONS            1
+
+/*
+ * Turn loop blocks into plain jumps and pops when nothing needs the VM
+ * to unwind them, see remove_loop_blocks().
+ *
+ * XXX: ought to go in configure.ac too
+ */
+#define TRY_REMOVE_LOOP_BLOCKS          1
+
 enum {
         STACK_NLABEL = 32,
         STACK_NINSTR = 128
@@ -209,12 +240,32 @@ try_unaryop(Object *v, instruction_t *ii)
         return func(v);
 }
 
+/*
+ * Return true if an instruction at @i has a label with a source
+ * location of its own.
+ */
+static bool
+instr_has_location(struct as_frame_t *fr, int i)
+{
+        const short *labels = (short *)fr->af_labels.s;
+        const int *loc = (int *)fr->af_locations.s;
+        int j, n = as_frame_nlocation(fr);
+
+        for (j = 0; j < n; j++) {
+                if (labels[j] == i && loc[j] >= 0)
+                        return true;
+        }
+        return false;
+}
+
 static void
 remove_nop_instructions(struct assemble_t *a, struct as_frame_t *fr)
 {
         int i, n_instr;
         int n_labels = as_frame_nlabel(fr);
+        int n_loc = as_frame_nlocation(fr);
         short *labels = (short *)fr->af_labels.s;
+        int *loc = (int *)fr->af_locations.s;
         struct buffer_t *b = &fr->af_instr;
         instruction_t *idata = (instruction_t *)b->s;
 
@@ -229,6 +280,7 @@ remove_nop_instructions(struct assemble_t *a, struct as_frame_t *fr)
                         continue;
                 }
                 int j, amount, after, movsize;
+                bool has_loc;
 
                 after = i;
                 do {
@@ -236,12 +288,21 @@ remove_nop_instructions(struct assemble_t *a, struct as_frame_t *fr)
                 } while (i < n_instr && idata[i].code == INSTR_NOP);
                 amount = i - after;
 
-                /* shift down labels */
+                /*
+                 * Labels on the removed instructions now mark the one
+                 * after them.  If that one has a location of its own,
+                 * it's the one describing it, so drop theirs.
+                 * Otherwise theirs carries forward.
+                 */
+                has_loc = instr_has_location(fr, i);
                 for (j = 0; j < n_labels; j++) {
-                        if (labels[j] > i)
+                        if (labels[j] > i) {
                                 labels[j] -= amount;
-                        else if (labels[j] > after)
+                        } else if (labels[j] >= after) {
+                                if (labels[j] < i && has_loc && j < n_loc)
+                                        loc[j] = -1;
                                 labels[j] = after;
+                        }
                 }
 
                 movsize = (n_instr - i) * sizeof(instruction_t);
@@ -267,6 +328,18 @@ seek_rodata(struct assemble_t *a, struct as_frame_t *fr, Object *obj)
         return ret;
 }
 
+/* Append an instruction to @b, for passes that rebuild af_instr */
+static void
+emit_instr(struct buffer_t *b, int code, int arg1, int arg2)
+{
+        instruction_t ii;
+
+        ii.code = code;
+        ii.arg1 = arg1;
+        ii.arg2 = arg2;
+        buffer_putd(b, &ii, sizeof(ii));
+}
+
 static void
 replace_fake_instructions(struct assemble_t *a, struct as_frame_t *fr)
 {
@@ -849,260 +922,2538 @@ resolve_jump_labels(struct assemble_t *a, struct as_frame_t *fr)
         a->fr = frsav;
 }
 
-static struct as_frame_t *
-func_label_to_frame(struct assemble_t *a, long long funcno)
-{
-        struct list_t *li;
-        list_foreach(li, &a->finished_frames) {
-                struct as_frame_t *sib = list2frame(li);
-                if (sib->funcno == funcno)
-                        return sib;
-        }
-        bug();
-        return NULL;
-}
+/*
+ * DOC: Stack-depth analysis
+ *
+ * A frame needs room for its locals plus however deep its evaluation
+ * stack gets.  We find the latter by walking every path through the
+ * final instructions, keeping track of the depth at each one.  In
+ * well-formed code, every path into an instruction reaches it at the
+ * same depth, so each instruction normally gets visited only once.
+ *
+ * Blocks complicate this.  BREAK, CONTINUE, and exceptions unwind the
+ * stack to where it was at the matching PUSH_BLOCK, and so does
+ * POP_BLOCK on the way out of a block.  So we also track which block
+ * each instruction is in.  A PUSH_BLOCK is treated like a branch to
+ * its break, continue, or catch target, at the depth the unwind will
+ * leave behind (plus one for a catch, whose exception gets pushed).
+ * That's why BREAK, CONTINUE, and THROW can simply end a path.
+ */
 
-/**
- * assemble_frame_to_xptr - Resolve XptrType pointers in .rodata, create
- *                          final XptrType objects, and return entry-point
- *                          XptrType object.
- * @fr: Entry-level assembly frame.  This function will recursively call
- *      itself to create all the descendant XptrType objects.
+/*
+ * Return the number of items @ii leaves on the stack, minus the number
+ * it takes off, when it falls through to the next instruction.
  */
-Object *
-assemble_frame_to_xptr(struct assemble_t *a, struct as_frame_t *fr)
+static int
+instr_stack_effect(instruction_t ii)
 {
-        static long recursion;
+        switch (ii.code) {
+        case INSTR_NOP:
+        case INSTR_NEW_GLOBAL:
+        case INSTR_NEW_NAME:
+        case INSTR_ADD_CLOSURE:
+        case INSTR_CAST_TUPLE:
+        case INSTR_DEFSET:
+        case INSTR_GETATTR_SUPER:
+        case INSTR_LOAD_METHOD:
+        case INSTR_FOREACH_SETUP:
+        case INSTR_RANGE_ITER:
+        case INSTR_IMPORT:
+        case INSTR_B:
+        case INSTR_BITWISE_NOT:
+        case INSTR_NEGATE:
+        case INSTR_LOGICAL_NOT:
+        case INSTR_PUSH_BLOCK:
+        case INSTR_POP_BLOCK:
+        case INSTR_BREAK:
+        case INSTR_CONTINUE:
+        case INSTR_END:
+        /* the generator picks up where this left off, minus its push */
+        case INSTR_RETURN_GENERATOR:
+                return 0;
+
+        case INSTR_PUSH_LOCAL:
+        case INSTR_LOAD_CONST:
+        case INSTR_LOAD_LOCAL:
+        case INSTR_LOAD_GLOBAL:
+        case INSTR_LOAD_NAME:
+        case INSTR_LOAD_ARG:
+        case INSTR_LOAD_FAST:
+        case INSTR_LOAD_CELL:
+        case INSTR_COPY:
+        case INSTR_FOREACH_ITER:
+                return 1;
+
+        case INSTR_POP:
+                return ii.arg2 ? -ii.arg2 : -1;
+
+        case INSTR_ASSIGN_LOCAL:
+        case INSTR_ASSIGN_GLOBAL:
+        case INSTR_ASSIGN_NAME:
+        case INSTR_STORE_FAST:
+        case INSTR_STORE_CELL:
+        case INSTR_RETURN_VALUE:
+        case INSTR_YIELD_VALUE:
+        case INSTR_IA_CLOSURE:
+        case INSTR_LIST_APPEND:
+        case INSTR_LIST_EXTEND:
+        case INSTR_DEFNS:
+        case INSTR_DEFFUNC:
+        case INSTR_GETATTR:
+        case INSTR_GETITEM:
+        case INSTR_THROW:
+        case INSTR_B_IF:
+        case INSTR_MUL:
+        case INSTR_POW:
+        case INSTR_DIV:
+        case INSTR_MOD:
+        case INSTR_ADD:
+        case INSTR_SUB:
+        case INSTR_LSHIFT:
+        case INSTR_RSHIFT:
+        case INSTR_CMP:
+        case INSTR_BINARY_AND:
+        case INSTR_BINARY_OR:
+        case INSTR_BINARY_XOR:
+        case INSTR_LOGICAL_OR:
+        case INSTR_LOGICAL_AND:
+                return -1;
 
-        Object *x;
-        Object **rodata;
-        int i, n_rodata;
+        case INSTR_CALL_FUNC:
+        case INSTR_DELATTR:
+        case INSTR_DELITEM:
+                return -2;
 
-        /*
-         * Resolve any nested function defintions from a magic number to
-         * a pointer to another XptrType object.  This means that we have
-         * to process the most deeply nested functions first, hence the
-         * recursion.  assembler.c already checked against runaway
-         * recursion for us, and in the case of reassemble(), that
-         * disassembly was generated from code that also was checked by
-         * assemble() some time in the past.
-         *
-         * ...but we'd be reckless to assume it, so add this inexpensive
-         * recursion guard anyway.
-         */
-        if (recursion >= RECURSION_MAX) {
-                err_setstr(RecursionError, "Recursion limit reached");
-                return ErrorVar;
-        }
-        recursion++;
+        case INSTR_CALL_METHOD:
+        case INSTR_SETATTR:
+        case INSTR_SETITEM:
+                return -3;
 
-        n_rodata = as_frame_nconst(fr);
-        rodata = as_frame_rodata(fr);
-        for (i = 0; i < n_rodata; i++) {
-                long long idval;
-                struct as_frame_t *child;
-                Object *obj;
+        case INSTR_DEFCLASS:
+                return ii.arg1 == IARG_HAVE_PRIVTUPLE ? -4 : -3;
 
-                obj = rodata[i];
-                if (obj->v_type != &IdType)
-                        continue;
-                idval = idvar_toll(obj);
-                child = func_label_to_frame(a, idval);
-                bug_on(!child || child == fr);
-                VAR_DECR_REF(rodata[i]);
-                rodata[i] = assemble_frame_to_xptr(a, child);
-                if (rodata[i] == ErrorVar) {
-                        /*
-                         * Setting to NullVar so we have something non-NULL
-                         * to decrement reference on when parent object is
-                         * cleaned up.
-                         */
-                        rodata[i] = VAR_NEW_REF(NullVar);
-                        x = ErrorVar;
-                        goto out;
-                }
-        }
+        case INSTR_FORMAT_VALUE:
+                return ii.arg1 ? -1 : 0;
 
-        do {
-                struct xptr_cfg_t cfg;
-                cfg.file_name   = a->file_name;
-                cfg.file_line   = fr->line;
-                cfg.n_instr     = as_frame_ninstr(fr);
-                cfg.rodata      = fr->af_rodata;
-                cfg.instr       = buffer_trim(&fr->af_instr);
-                cfg.n_locals    = fr->af_nlocals;
-                cfg.names       = fr->af_names;
-                cfg.funcname    = fr->af_funcname;
-                cfg.locations   = fr->af_locations_packed;
-                cfg.locations_size = fr->af_locations_packed_size;
-                x = xptrvar_new(&cfg);
-        } while (0);
+        case INSTR_DEFLIST:
+        case INSTR_DEFTUPLE:
+        case INSTR_BUILD_STRING:
+                return 1 - ii.arg2;
 
-out:
-        recursion--;
-        return x;
+        case INSTR_DEFDICT:
+                return 1 - 2 * ii.arg2;
+
+        case INSTR_DEFDICT_K:
+        case INSTR_RANGE_SETUP:
+                return -ii.arg2;
+
+        case INSTR_UNPACK:
+                return (ii.arg2 & 0x7fff) - 1;
+
+        case INSTR_UNPACK_SPECIAL:
+                return (ii.arg2 & 0xff) - 1;
+        }
+
+        DBUG("Unhandled instruction %d", ii.code);
+        bug();
+        return 0;
 }
 
-static size_t
-count_unique_locations(struct token_t *const *loc_tokens,
-                       size_t nr_loc_tokens)
+struct stack_walk_t {
+        int *depth;     /* depth at each instruction, or -1 if unvisited */
+        int *blk;       /* its innermost PUSH_BLOCK, or -1 if none */
+        int *todo;
+        int ntodo;
+        int max;
+};
+
+static void
+stack_walk_visit(struct stack_walk_t *w, int i, int depth, int blk)
 {
-        size_t i, count = 0;
-        for (i = 0; i < nr_loc_tokens; i++) {
-                if (loc_tokens[i] == NULL)
-                        continue;
-                count++;
+        /*
+         * A second path reaching @i at a different depth would mean
+         * the stack leaks or underflows at runtime.  That's a bug in
+         * the assembler, not in the user's code.
+         */
+        if (w->depth[i] >= 0) {
+                bug_on(w->depth[i] != depth);
+                return;
         }
-        return count;
+        if (depth > w->max)
+                w->max = depth;
+        w->todo[w->ntodo++] = i;
+        w->depth[i] = depth;
+        w->blk[i] = blk;
 }
 
+/*
+ * Return the instruction that jump instruction @i branches to.  Before
+ * resolve_jump_labels(), arg2 is a label number; afterward, @labels is
+ * NULL and arg2 is an offset from the next instruction.
+ */
 static int
-loc_compar(const void *a, const void *b)
+stack_walk_target(const instruction_t *instr, const short *labels, int i)
 {
-        struct location_t *alice = (struct location_t *)a;
-        struct location_t *bob = (struct location_t *)b;
-
-        return (int)alice->loc_instruction - (int)bob->loc_instruction;
+        if (labels)
+                return labels[instr[i].arg2];
+        return i + 1 + instr[i].arg2;
 }
 
-static struct location_t *
-fill_locations_unpacked(struct token_t *const *loc_tokens,
-                        size_t nr_loc_tokens, const short *labels,
-                        size_t count)
+/*
+ * Fill in @w's depth and blk for every instruction reachable from the
+ * start of @instr.  Caller must free w->depth when done.  See DOC above.
+ */
+static void
+stack_walk(struct stack_walk_t *w, const instruction_t *instr,
+           int n_instr, const short *labels)
 {
-        size_t i, j = 0;
-        struct location_t *loc_buf = emalloc(sizeof(*loc_buf) * count);
-        for (i = 0; i < nr_loc_tokens; i++) {
-                struct location_t *loc;
-                int line;
-
-                if (loc_tokens[i] == NULL)
+        int i;
+
+        w->depth = emalloc(3 * n_instr * sizeof(int));
+        w->blk   = w->depth + n_instr;
+        w->todo  = w->blk + n_instr;
+        w->ntodo = 0;
+        w->max   = 0;
+        for (i = 0; i < n_instr; i++)
+                w->depth[i] = -1;
+
+        stack_walk_visit(w, 0, 0, -1);
+        while (w->ntodo > 0) {
+                instruction_t ii;
+                int depth, blk, next;
+
+                i = w->todo[--w->ntodo];
+                ii = instr[i];
+                depth = w->depth[i];
+                blk = w->blk[i];
+                next = depth + instr_stack_effect(ii);
+                bug_on(next < 0);
+
+                switch (ii.code) {
+                case INSTR_RETURN_VALUE:
+                case INSTR_THROW:
+                case INSTR_BREAK:
+                case INSTR_CONTINUE:
+                case INSTR_END:
                         continue;
-                line = loc_tokens[i]->start_line;
-
-                bug_on(j >= count);
-                loc = &loc_buf[j];
-
-                loc->loc_startline = line;
-                loc->loc_instruction = labels[i];
-                j++;
+                case INSTR_RETURN_GENERATOR:
+                        if (depth + 1 > w->max)
+                                w->max = depth + 1;
+                        break;
+                case INSTR_PUSH_BLOCK:
+                        if (ii.arg1 == IARG_TRY) {
+                                stack_walk_visit(w,
+                                        stack_walk_target(instr, labels, i),
+                                        depth + 1, blk);
+                        } else if (ii.arg1 != IARG_BLOCK) {
+                                stack_walk_visit(w,
+                                        stack_walk_target(instr, labels, i),
+                                        depth, blk);
+                        }
+                        blk = i;
+                        break;
+                case INSTR_POP_BLOCK:
+                        bug_on(blk < 0);
+                        next = w->depth[blk];
+                        blk = w->blk[blk];
+                        break;
+                case INSTR_B:
+                        stack_walk_visit(w,
+                                stack_walk_target(instr, labels, i),
+                                next, blk);
+                        continue;
+                case INSTR_B_IF:
+                        stack_walk_visit(w,
+                                stack_walk_target(instr, labels, i),
+                                !!(ii.arg1 & IARG_COND_SAVEF)
+                                ? depth : next, blk);
+                        break;
+                case INSTR_FOREACH_ITER:
+                        stack_walk_visit(w,
+                                stack_walk_target(instr, labels, i),
+                                depth, blk);
+                        break;
+                case INSTR_RANGE_ITER:
+                        stack_walk_visit(w,
+                                stack_walk_target(instr, labels, i),
+                                next, blk);
+                        break;
+                default:
+                        bug_on(instr_uses_jump(ii));
+                        break;
+                }
+                if (i + 1 < n_instr)
+                        stack_walk_visit(w, i + 1, next, blk);
         }
-        bug_on(j != count);
-
-        qsort(loc_buf, count, sizeof(*loc_buf), loc_compar);
-        return loc_buf;
 }
 
-static unsigned char *
-fill_locations_packed(const struct location_t *loc_buf,
-                      size_t count, size_t *bufidx_out)
+/*
+ * Return the maximum number of items that @instr will push onto the
+ * stack above its frame's locals.  See DOC above.
+ */
+static int
+max_stack_depth(const instruction_t *instr, int n_instr)
 {
-        size_t i;
-        unsigned char *buf;
-        size_t bufsize, bufidx;
-
-        bufsize = 16;
-        bufidx = 0;
-        buf = erealloc(NULL, bufsize);
-
-        for (i = 0; i < count; i++) {
-                ssize_t packed;
-
-                if ((i > 0) &&
-                    (loc_buf[i].loc_startline
-                     == loc_buf[i-1].loc_startline)) {
-                        continue;
-                }
+        struct stack_walk_t w;
 
-                while ((packed = location_pack(&buf[bufidx],
-                                               bufsize - bufidx,
-                                               &loc_buf[i])) < 0) {
-                        bufsize += 16;
-                        buf = erealloc(buf, bufsize);
-                }
-                bufidx += packed;
-        }
-        *bufidx_out = bufidx;
-        return buf;
+        stack_walk(&w, instr, n_instr, NULL);
+        efree(w.depth);
+        return w.max;
 }
 
 /*
- * Instruction set is now frozen, so labels won't shift around anymore.
- * This means we can now set our labels in place properly.
+ * Several passes look up every nested function by its number, and a
+ * script can have thousands of them, so give func_label_to_frame() an
+ * index of @a's finished frames while assemble_post() runs.
  */
 static void
-resolve_locations(struct assemble_t *a, struct as_frame_t *fr)
+index_frames(struct assemble_t *a)
 {
-        struct token_t **loc_tokens;
-        size_t nr_loc_tokens;
-        short *labels;
-        struct location_t *loc_buf;
-        unsigned char *buf;
-        size_t bufidx, count;
-
-        labels = (short *)fr->af_labels.s;
-        loc_tokens = (struct token_t **)(fr->af_locations.s);
-        nr_loc_tokens = buffer_size(&fr->af_locations) / sizeof(void *);
-
-        /*
-         * #labels could only be greater than nr_loc_tokens (due to a
-         * label being produced in remove_save_flags()) or equal to it,
-         * but never less than it.
-         */
-        bug_on(as_frame_nlabel(fr) < nr_loc_tokens);
+        struct list_t *li;
+        long long lo, hi;
 
-        count = count_unique_locations(loc_tokens, nr_loc_tokens);
-        if (count) {
-                loc_buf = fill_locations_unpacked(loc_tokens, nr_loc_tokens,
-                                                  labels, count);
-                buf = fill_locations_packed(loc_buf, count, &bufidx);
-                efree(loc_buf);
-        } else {
-                buf = NULL;
-                bufidx = 0;
+        lo = hi = list2frame(a->finished_frames.next)->funcno;
+        list_foreach(li, &a->finished_frames) {
+                struct as_frame_t *fr = list2frame(li);
+                if (fr->funcno < lo)
+                        lo = fr->funcno;
+                if (fr->funcno > hi)
+                        hi = fr->funcno;
+        }
+        a->fr_index_base = lo;
+        a->fr_index_size = hi - lo + 1;
+        a->fr_index = ecalloc(a->fr_index_size * sizeof(*a->fr_index));
+        list_foreach(li, &a->finished_frames) {
+                struct as_frame_t *fr = list2frame(li);
+                a->fr_index[fr->funcno - lo] = fr;
         }
+}
 
-        fr->af_locations_packed = buf;
-        fr->af_locations_packed_size = bufidx;
+static void
+unindex_frames(struct assemble_t *a)
+{
+        efree(a->fr_index);
+        a->fr_index = NULL;
+        a->fr_index_size = 0;
 }
 
-/**
- * assemble_post - Helper function for assemble()
- *
- * All the opcodes have been compiled.  Still to do...
- * 1. If any binary operators perform on two consts, perform them here
- *    and reduce three instructions to a single LOAD_CONST.
- * 2. Garbage-collect any .rodata that the above procedure rendered
- *    no longer necessary.
- * 3. Resolve local jump addresses
- * 4. Convert it all into a tree of XptrType objects, with the entry
- *    point at the top.
+/*
+ * Frames that lazy_claim() moved out of @a's list stay in the index,
+ * but each function's ID is only in its parent's .rodata, so nothing
+ * looks for them again.
  */
-Object *
-assemble_post(struct assemble_t *a)
+static struct as_frame_t *
+func_label_to_frame(struct assemble_t *a, long long funcno)
 {
         struct list_t *li;
 
-        optimize_instructions(a);
+        if (a->fr_index) {
+                unsigned long long i = funcno - a->fr_index_base;
 
-        list_foreach(li, &a->finished_frames) {
-                struct as_frame_t *fr = list2frame(li);
-                /*
-                 * Do this before resolving jump labels,
-                 * because some "fake" instructions exist
-                 * within.
-                 */
-                replace_fake_instructions(a, fr);
-                resolve_locations(a, fr);
-                resolve_jump_labels(a, fr);
+                bug_on(i >= a->fr_index_size || !a->fr_index[i]);
+                return a->fr_index[i];
+        }
+        list_foreach(li, &a->finished_frames) {
+                struct as_frame_t *sib = list2frame(li);
+                if (sib->funcno == funcno)
+                        return sib;
+        }
+        bug();
+        return NULL;
+}
+
+/*
+ * DOC: Local-variable access
+ *
+ * A local variable gets boxed into a cell the first time a nested
+ * function captures it, so LOAD_LOCAL and ASSIGN_LOCAL have to check
+ * for a cell every time.  Most locals are never captured, though, and
+ * closures are always cells, so once a function is fully assembled we
+ * swap in opcodes that skip the check: LOAD_FAST/STORE_FAST for locals
+ * nothing captures, and LOAD_CELL/STORE_CELL for closures.
+ *
+ * A captured local can be treated as uncaptured, too, if nothing could
+ * change it after the capture: neither its own function nor the one
+ * that captured it.  Then ADD_CLOSURE gives the nested function a cell
+ * with a copy of the value instead, and the local stays unboxed.  This
+ * is the usual case for factory functions' arguments.
+ */
+
+/* Return true if @ii could change local variable FP+@idx */
+static bool
+instr_writes_local(instruction_t ii, int idx)
+{
+        switch (ii.code) {
+        case INSTR_ASSIGN_LOCAL:
+        case INSTR_STORE_FAST:
+                return ii.arg1 == IARG_PTR_FP && ii.arg2 == idx;
+        case INSTR_RANGE_ITER:
+                return ii.arg1 == idx;
+        default:
+                return false;
+        }
+}
+
+/*
+ * Return true if @fr could change its closure @idx.  Handing the
+ * closure down to a function of its own counts, since we don't chase
+ * it any further.
+ */
+static bool
+closure_is_written(struct as_frame_t *fr, int idx)
+{
+        instruction_t *idata = (instruction_t *)fr->af_instr.s;
+        size_t i, n = as_frame_ninstr(fr);
+
+        for (i = 0; i < n; i++) {
+                switch (idata[i].code) {
+                case INSTR_ASSIGN_LOCAL:
+                case INSTR_STORE_CELL:
+                case INSTR_ADD_CLOSURE:
+                        if (idata[i].arg1 == IARG_PTR_CP &&
+                            idata[i].arg2 == idx) {
+                                return true;
+                        }
+                        break;
+                default:
+                        break;
+                }
+        }
+        return false;
+}
+
+/*
+ * Return true if any instruction that writes FP+@idx can be reached
+ * after instruction @start.  We don't track which blocks we're in, so
+ * every break, continue, and catch target is assumed reachable.
+ */
+static bool
+local_written_after(struct as_frame_t *fr, int start, int idx, char *seen)
+{
+        instruction_t *idata = (instruction_t *)fr->af_instr.s;
+        const short *labels = (short *)fr->af_labels.s;
+        int i, n = as_frame_ninstr(fr);
+        int *todo, ntodo = 0;
+        bool ret = false;
+
+        todo = emalloc(n * sizeof(int));
+        memset(seen, 0, n);
+
+#define REACH(i_) do {                          \
+        int i__ = (i_);                         \
+        if (i__ < n && !seen[i__]) {            \
+                seen[i__] = 1;                  \
+                todo[ntodo++] = i__;            \
+        }                                       \
+} while (0)
+
+        REACH(start + 1);
+        for (i = 0; i < n; i++) {
+                if (idata[i].code == INSTR_PUSH_BLOCK &&
+                    idata[i].arg1 != IARG_BLOCK) {
+                        REACH(labels[idata[i].arg2]);
+                }
+        }
+
+        while (ntodo > 0) {
+                instruction_t ii;
+
+                i = todo[--ntodo];
+                ii = idata[i];
+                if (instr_writes_local(ii, idx)) {
+                        ret = true;
+                        break;
+                }
+                if (instr_uses_jump(ii))
+                        REACH(labels[ii.arg2]);
+                switch (ii.code) {
+                case INSTR_B:
+                case INSTR_RETURN_VALUE:
+                case INSTR_THROW:
+                case INSTR_BREAK:
+                case INSTR_CONTINUE:
+                case INSTR_END:
+                        break;
+                default:
+                        REACH(i + 1);
+                        break;
+                }
+        }
+#undef REACH
+
+        efree(todo);
+        return ret;
+}
+
+/*
+ * Return the frame of the function that ADD_CLOSURE instruction @i adds
+ * its closure to, and put the closure's index in @clo_idx.  The
+ * assembler emits these right after the function's DEFFUNC, in the
+ * order of the function's closures, and DEFFUNC comes right after
+ * loading the function's ID and its argument spec.
+ */
+static struct as_frame_t *
+closure_owner(struct assemble_t *a, struct as_frame_t *fr,
+              int i, int *clo_idx)
+{
+        instruction_t *idata = (instruction_t *)fr->af_instr.s;
+        Object *id;
+        int j;
+
+        for (j = i; j >= 0 && idata[j].code == INSTR_ADD_CLOSURE; j--)
+                ;
+        if (j < 2 || idata[j].code != INSTR_DEFFUNC ||
+            idata[j - 2].code != INSTR_LOAD_CONST) {
+                return NULL;
+        }
+        id = as_frame_rodata(fr)[idata[j - 2].arg2];
+        if (id->v_type != &IdType)
+                return NULL;
+        *clo_idx = i - j - 1;
+        return func_label_to_frame(a, idvar_toll(id));
+}
+
+/*
+ * Return true if every capture of FP+@idx can get a copy of the
+ * variable instead of a cell.
+ */
+static bool
+capture_by_copy(struct assemble_t *a, struct as_frame_t *fr,
+                int idx, char *seen)
+{
+        instruction_t *idata = (instruction_t *)fr->af_instr.s;
+        int i, n = as_frame_ninstr(fr);
+
+        for (i = 0; i < n; i++) {
+                struct as_frame_t *child;
+                int clo_idx;
+
+                if (idata[i].code != INSTR_ADD_CLOSURE ||
+                    idata[i].arg1 != IARG_PTR_FP || idata[i].arg2 != idx) {
+                        continue;
+                }
+                child = closure_owner(a, fr, i, &clo_idx);
+                if (!child || closure_is_written(child, clo_idx))
+                        return false;
+                if (local_written_after(fr, i, idx, seen))
+                        return false;
+        }
+        return true;
+}
+
+static void
+resolve_local_access(struct assemble_t *a, struct as_frame_t *fr)
+{
+        instruction_t *idata = (instruction_t *)fr->af_instr.s;
+        int i, n = as_frame_ninstr(fr);
+        char *boxed, *seen;
+
+        boxed = ecalloc(fr->af_nlocals + 1);
+        seen = emalloc(n);
+
+        for (i = 0; i < n; i++) {
+                if (idata[i].code == INSTR_ADD_CLOSURE &&
+                    idata[i].arg1 == IARG_PTR_FP) {
+                        bug_on(idata[i].arg2 >= fr->af_nlocals);
+                        boxed[idata[i].arg2] = 1;
+                }
+        }
+        for (i = 0; i < fr->af_nlocals; i++) {
+                if (boxed[i] && capture_by_copy(a, fr, i, seen))
+                        boxed[i] = 0;
+        }
+
+        for (i = 0; i < n; i++) {
+                instruction_t *ii = &idata[i];
+                bool fp = ii->arg1 == IARG_PTR_FP;
+
+                switch (ii->code) {
+                case INSTR_LOAD_LOCAL:
+                        if (!fp)
+                                ii->code = INSTR_LOAD_CELL;
+                        else if (!boxed[ii->arg2])
+                                ii->code = INSTR_LOAD_FAST;
+                        break;
+                case INSTR_ASSIGN_LOCAL:
+                        if (!fp)
+                                ii->code = INSTR_STORE_CELL;
+                        else if (!boxed[ii->arg2])
+                                ii->code = INSTR_STORE_FAST;
+                        break;
+                case INSTR_ADD_CLOSURE:
+                        if (fp && !boxed[ii->arg2])
+                                ii->arg1 = IARG_PTR_COPY;
+                        break;
+                default:
+                        break;
+                }
+        }
+
+        efree(seen);
+        efree(boxed);
+}
+
+/*
+ * DOC: Dataflow optimizations
+ *
+ * Once locals have their final opcodes, STORE_FAST and LOAD_FAST tell
+ * us exactly which slot is written or read where, so we can do a few
+ * of the classic cleanups.  The frame is split into basic blocks, ie.
+ * runs of instructions that are only entered at the top and only left
+ * from the bottom.  Besides the usual branches, a basic block's
+ * successors include the target of a BREAK or CONTINUE, and the catch
+ * handler if it's inside a 'try' block.  stack_walk() tells us which
+ * block each instruction is in, and how deep the stack is at the start
+ * of each basic block.
+ *
+ * Within a basic block, we number the values on the stack, such that
+ * stack slots with the same number hold the same object.  Then...
+ *
+ *   - STORE_FAST x; LOAD_FAST x becomes COPY 1; STORE_FAST x, leaving
+ *     the store for dead-store elimination to clean up.
+ *   - A LOAD_CONST, LOAD_FAST, or LOAD_CELL of something already on
+ *     the stack becomes a COPY of it.
+ *   - So does a CMP or LOGICAL_NOT whose result is already on the
+ *     stack, and the loads of its operands are removed.
+ *
+ * Any other instruction could call user code or change a container,
+ * so it makes us forget about comparisons and cells, but not about
+ * consts or uncaptured locals, which nothing else can change.  Other
+ * operators are not candidates, because adding two lists makes a new
+ * list, and two references to one list is not the same as two lists.
+ *
+ * Across basic blocks, we find which locals are live, ie. could be
+ * read before they're written again, and which could be holding
+ * something other than a const (a cheap form of reaching definitions).
+ * A store is only removed if it's dead, AND it stores a const, AND the
+ * local still holds a const or its initial null.  That's because when
+ * an object gets destroyed is visible to scripts, eg. 'view = null;'
+ * is how they let go of a memoryview, even if 'view' is never read
+ * again.  Consts live in .rodata anyway.  A dead store becomes a POP,
+ * and then a load that's immediately popped is removed altogether.
+ * Slot zero is left alone, since super() looks for it from other
+ * frames.
+ */
+
+struct flow_t {
+        instruction_t *idata;
+        const short *labels;
+        int n_instr;
+        int n_locals;
+        struct stack_walk_t w;
+        int nbb;
+        int *bbstart;   /* first instruction of each basic block, + end */
+        int *bbof;      /* basic block of each instruction */
+};
+
+/* A value on the stack, as made by instruction @code */
+struct flow_val_t {
+        int code;       /* -1 if it can no longer be matched */
+        int arg;
+        int a, b;       /* operands' value numbers */
+};
+
+/* Return true if @ii is always the last instruction of a basic block */
+static bool
+flow_ends_block(instruction_t ii)
+{
+        switch (ii.code) {
+        case INSTR_PUSH_BLOCK:
+        case INSTR_POP_BLOCK:
+        case INSTR_RETURN_VALUE:
+        case INSTR_THROW:
+        case INSTR_BREAK:
+        case INSTR_CONTINUE:
+        case INSTR_END:
+                return true;
+        default:
+                return instr_uses_jump(ii);
+        }
+}
+
+static void
+flow_init(struct flow_t *f, struct as_frame_t *fr)
+{
+        char *leader;
+        int i, n;
+
+        f->idata    = (instruction_t *)fr->af_instr.s;
+        f->labels   = (short *)fr->af_labels.s;
+        f->n_instr  = n = as_frame_ninstr(fr);
+        f->n_locals = fr->af_nlocals;
+        stack_walk(&f->w, f->idata, n, f->labels);
+
+        leader = ecalloc(n + 1);
+        leader[0] = 1;
+        for (i = 0; i < n; i++) {
+                if (instr_uses_jump(f->idata[i]))
+                        leader[f->labels[f->idata[i].arg2]] = 1;
+                if (flow_ends_block(f->idata[i]))
+                        leader[i + 1] = 1;
+        }
+
+        f->bbstart = emalloc((n + 1) * sizeof(int));
+        f->bbof = emalloc(n * sizeof(int));
+        f->nbb = 0;
+        for (i = 0; i < n; i++) {
+                if (leader[i])
+                        f->bbstart[f->nbb++] = i;
+                f->bbof[i] = f->nbb - 1;
+        }
+        f->bbstart[f->nbb] = n;
+        efree(leader);
+}
+
+static void
+flow_free(struct flow_t *f)
+{
+        efree(f->bbof);
+        efree(f->bbstart);
+        efree(f->w.depth);
+}
+
+/*
+ * Return where control goes when leaving the innermost block of type
+ * @type around instruction @i, or -1 if there's no such block.
+ */
+static int
+flow_block_target(struct flow_t *f, int i, int type)
+{
+        int k;
+
+        for (k = f->w.blk[i]; k >= 0; k = f->w.blk[k]) {
+                if (f->idata[k].arg1 == type)
+                        return f->labels[f->idata[k].arg2];
+        }
+        return -1;
+}
+
+/*
+ * Fill @succ with the basic blocks that basic block @b could continue
+ * into, not counting exceptions, and return how many there are.  @succ
+ * must fit two.
+ */
+static int
+flow_successors(struct flow_t *f, int b, int *succ)
+{
+        int first = f->bbstart[b];
+        int last = f->bbstart[b + 1] - 1;
+        instruction_t ii = f->idata[last];
+        int i, t, n = 0;
+
+        if (f->w.depth[first] < 0)
+                return 0;
+
+        switch (ii.code) {
+        case INSTR_RETURN_VALUE:
+        case INSTR_THROW:
+        case INSTR_END:
+                break;
+        case INSTR_BREAK:
+        case INSTR_CONTINUE:
+                t = flow_block_target(f, last, ii.code == INSTR_BREAK
+                                               ? IARG_LOOP : IARG_CONTINUE);
+                if (t >= 0)
+                        succ[n++] = t;
+                break;
+        case INSTR_B:
+                succ[n++] = f->labels[ii.arg2];
+                break;
+        default:
+                if (instr_uses_jump(ii))
+                        succ[n++] = f->labels[ii.arg2];
+                if (last + 1 < f->n_instr)
+                        succ[n++] = last + 1;
+                break;
+        }
+        for (i = 0; i < n; i++) {
+                bug_on(succ[i] >= f->n_instr);
+                succ[i] = f->bbof[succ[i]];
+        }
+        return n;
+}
+
+/*
+ * Return the basic block that catches exceptions thrown from basic
+ * block @b, or -1 if they'd leave the function.
+ */
+static int
+flow_handler(struct flow_t *f, int b)
+{
+        int first = f->bbstart[b];
+        int t;
+
+        if (f->w.depth[first] < 0)
+                return -1;
+        if ((t = flow_block_target(f, first, IARG_TRY)) < 0)
+                return -1;
+        return f->bbof[t];
+}
+
+/* Return the local that @ii reads, or -1 if it reads none */
+static int
+flow_local_read(instruction_t ii)
+{
+        switch (ii.code) {
+        case INSTR_LOAD_FAST:
+        case INSTR_LOAD_ARG:
+                return ii.arg2;
+        case INSTR_LOAD_LOCAL:
+        case INSTR_ASSIGN_LOCAL:
+        case INSTR_ADD_CLOSURE:
+                return ii.arg1 != IARG_PTR_CP ? ii.arg2 : -1;
+        case INSTR_RANGE_ITER:
+                return ii.arg1;
+        default:
+                return -1;
+        }
+}
+
+/* Return true if @ii pushes one object without any side effects */
+static bool
+flow_is_pure_load(instruction_t ii)
+{
+        switch (ii.code) {
+        case INSTR_LOAD_CONST:
+        case INSTR_LOAD_FAST:
+        case INSTR_LOAD_CELL:
+        case INSTR_COPY:
+                return true;
+        default:
+                return false;
+        }
+}
+
+/*
+ * Return the value number for the result of @code, adding it to @vals
+ * if it isn't there already.
+ */
+static int
+flow_value(struct flow_val_t *vals, int *nval,
+           int code, int arg, int a, int b)
+{
+        int v;
+
+        for (v = 0; v < *nval; v++) {
+                if (vals[v].code == code && vals[v].arg == arg &&
+                    vals[v].a == a && vals[v].b == b) {
+                        return v;
+                }
+        }
+        vals[v].code = code;
+        vals[v].arg  = arg;
+        vals[v].a    = a;
+        vals[v].b    = b;
+        (*nval)++;
+        return v;
+}
+
+/* Return the topmost of the lowest @depth stack slots holding @v */
+static int
+flow_find(const int *stk, int depth, int v)
+{
+        int p;
+
+        if (v < 0)
+                return -1;
+        for (p = depth - 1; p >= 0; p--) {
+                if (stk[p] == v)
+                        return p;
+        }
+        return -1;
+}
+
+static void
+make_copy(instruction_t *ii, int distance)
+{
+        ii->code = INSTR_COPY;
+        ii->arg1 = 0;
+        ii->arg2 = distance;
+}
+
+/*
+ * Instruction @i computes value @v from the @nargs items on top of the
+ * stack, which the @nargs instructions before it pushed.  If @v is
+ * already further down the stack, replace all of them with a COPY.
+ * @depth is the stack depth after the operands are popped.
+ */
+static void
+flow_try_cse(struct flow_t *f, int first, int i, int nargs,
+             const int *stk, int depth, int v)
+{
+        int j, p;
+
+        if (i - nargs < first || (p = flow_find(stk, depth, v)) < 0)
+                return;
+        for (j = i - nargs; j < i; j++) {
+                if (!flow_is_pure_load(f->idata[j]))
+                        return;
+        }
+        for (j = i - nargs; j < i; j++)
+                f->idata[j].code = INSTR_NOP;
+        make_copy(&f->idata[i], depth - p);
+}
+
+/*
+ * Do the forwarding, redundant-load, and common-subexpression parts of
+ * the DOC above, for basic block @b.  @vals, @stk, and @lvn are scratch
+ * arrays big enough for the frame's instructions, stack, and locals.
+ */
+static void
+flow_number_values(struct flow_t *f, int b, struct flow_val_t *vals,
+                   int *stk, int *lvn)
+{
+        int first = f->bbstart[b];
+        int end = f->bbstart[b + 1];
+        int i, d, nval = 0;
+
+        if ((d = f->w.depth[first]) < 0)
+                return;
+        for (i = 0; i < d; i++)
+                stk[i] = -1;
+        for (i = 0; i < f->n_locals; i++)
+                lvn[i] = -1;
+
+        for (i = first; i < end; i++) {
+                instruction_t *ii = &f->idata[i];
+                int v;
+
+                if (TRY_FORWARD_STORES && ii->code == INSTR_STORE_FAST &&
+                    i + 1 < end && ii[1].code == INSTR_LOAD_FAST &&
+                    ii[1].arg2 == ii->arg2) {
+                        ii[1] = *ii;
+                        make_copy(ii, 1);
+                }
+
+                switch (ii->code) {
+                case INSTR_NOP:
+                        continue;
+                case INSTR_STORE_FAST:
+                        bug_on(ii->arg2 >= f->n_locals);
+                        lvn[ii->arg2] = stk[--d];
+                        continue;
+                case INSTR_POP:
+                        if (ii->arg1 != IARG_POP_NORMAL)
+                                break;
+                        d -= ii->arg2 ? ii->arg2 : 1;
+                        continue;
+                case INSTR_CMP:
+                        d -= 2;
+                        v = -1;
+                        if (stk[d] >= 0 && stk[d + 1] >= 0) {
+                                v = flow_value(vals, &nval, ii->code,
+                                               ii->arg1, stk[d], stk[d + 1]);
+                                if (TRY_LOCAL_CSE)
+                                        flow_try_cse(f, first, i, 2,
+                                                     stk, d, v);
+                        }
+                        stk[d++] = v;
+                        continue;
+                case INSTR_LOGICAL_NOT:
+                        d -= 1;
+                        v = -1;
+                        if (stk[d] >= 0) {
+                                v = flow_value(vals, &nval, ii->code,
+                                               0, stk[d], -1);
+                                if (TRY_LOCAL_CSE)
+                                        flow_try_cse(f, first, i, 1,
+                                                     stk, d, v);
+                        }
+                        stk[d++] = v;
+                        continue;
+                case INSTR_LOAD_CONST:
+                case INSTR_LOAD_CELL:
+                case INSTR_LOAD_FAST:
+                case INSTR_COPY:
+                        if (ii->code == INSTR_COPY) {
+                                v = stk[d - ii->arg2];
+                        } else if (ii->code != INSTR_LOAD_FAST) {
+                                v = flow_value(vals, &nval, ii->code,
+                                               ii->arg2, -1, -1);
+                        } else {
+                                bug_on(ii->arg2 >= f->n_locals);
+                                /*
+                                 * Not flow_value(), which could match
+                                 * this local from before a store.
+                                 */
+                                if (lvn[ii->arg2] < 0) {
+                                        lvn[ii->arg2] = nval;
+                                        vals[nval].code = -1;
+                                        nval++;
+                                }
+                                v = lvn[ii->arg2];
+                        }
+                        if (TRY_REDUNDANT_LOADS && ii->code != INSTR_COPY) {
+                                int p = flow_find(stk, d, v);
+                                if (p >= 0)
+                                        make_copy(ii, d - p);
+                        }
+                        stk[d++] = v;
+                        continue;
+                default:
+                        break;
+                }
+
+                /*
+                 * Anything else: we don't know which slots it changed,
+                 * or what it did to the objects anyone points at.
+                 */
+                d += instr_stack_effect(*ii);
+                bug_on(d < 0 || d > f->w.max);
+                for (v = 0; v < d; v++)
+                        stk[v] = -1;
+                for (v = 0; v < nval; v++) {
+                        if (vals[v].code != INSTR_LOAD_CONST)
+                                vals[v].code = -1;
+                }
+        }
+}
+
+enum { FLOW_WBITS = 8 * sizeof(unsigned long) };
+
+#define FLOW_ISSET(set_, i_) \
+        (!!((set_)[(i_) / FLOW_WBITS] & (1UL << ((i_) % FLOW_WBITS))))
+#define FLOW_SET(set_, i_) \
+        ((set_)[(i_) / FLOW_WBITS] |= (1UL << ((i_) % FLOW_WBITS)))
+#define FLOW_CLR(set_, i_) \
+        ((set_)[(i_) / FLOW_WBITS] &= ~(1UL << ((i_) % FLOW_WBITS)))
+
+/*
+ * Turn @dirty from the set of locals that could hold a non-const at
+ * the start of basic block @b into the set at its end, and OR into
+ * @any every local that could at any point in between.  If @removable
+ * is not NULL, mark the stores in @b that could be removed if dead.
+ */
+static void
+flow_dirty_transfer(struct flow_t *f, int b, int nwords,
+                    unsigned long *dirty, unsigned long *any,
+                    char *removable)
+{
+        int first = f->bbstart[b];
+        int i, j, idx;
+
+        if (f->w.depth[first] < 0)
+                return;
+
+        for (i = first; i < f->bbstart[b + 1]; i++) {
+                instruction_t ii = f->idata[i];
+                bool isconst = i > first &&
+                               f->idata[i - 1].code == INSTR_LOAD_CONST;
+
+                if (ii.code == INSTR_STORE_FAST) {
+                        idx = ii.arg2;
+                        if (removable) {
+                                removable[i] = isconst && idx != 0 &&
+                                               !FLOW_ISSET(dirty, idx);
+                        }
+                        if (isconst)
+                                FLOW_CLR(dirty, idx);
+                        else
+                                FLOW_SET(dirty, idx);
+                } else if (ii.code == INSTR_RANGE_ITER) {
+                        FLOW_SET(dirty, ii.arg1);
+                }
+                for (j = 0; j < nwords; j++)
+                        any[j] |= dirty[j];
+        }
+}
+
+/*
+ * Turn @live from the set of locals live at the end of basic block @b
+ * into the set live at its start.  If @removable is not NULL, also turn
+ * removable dead stores into POPs on the way.  @live_in holds each
+ * basic block's live set at its start, @nwords long.
+ */
+static void
+flow_live_transfer(struct flow_t *f, int b, const unsigned long *live_in,
+                   int nwords, unsigned long *live, const char *removable)
+{
+        int first = f->bbstart[b];
+        int i, j, idx, handler;
+
+        if (f->w.depth[first] < 0)
+                return;
+        handler = flow_handler(f, b);
+
+        for (i = f->bbstart[b + 1] - 1; i >= first; i--) {
+                instruction_t *ii = &f->idata[i];
+
+                if (ii->code == INSTR_STORE_FAST) {
+                        idx = ii->arg2;
+                        if (removable && removable[i] &&
+                            !FLOW_ISSET(live, idx)) {
+                                ii->code = INSTR_POP;
+                                ii->arg1 = IARG_POP_NORMAL;
+                                ii->arg2 = 1;
+                        }
+                        FLOW_CLR(live, idx);
+                } else if ((idx = flow_local_read(*ii)) >= 0) {
+                        bug_on(idx >= f->n_locals);
+                        FLOW_SET(live, idx);
+                }
+
+                /* anything in here might throw */
+                if (handler >= 0) {
+                        for (j = 0; j < nwords; j++)
+                                live[j] |= live_in[handler * nwords + j];
+                }
+        }
+}
+
+/* Set @live to the union of @b's successors' live sets */
+static void
+flow_live_out(struct flow_t *f, int b, const unsigned long *live_in,
+              int nwords, unsigned long *live)
+{
+        int succ[2];
+        int i, j, n;
+
+        memset(live, 0, nwords * sizeof(*live));
+        n = flow_successors(f, b, succ);
+        for (i = 0; i < n; i++) {
+                for (j = 0; j < nwords; j++)
+                        live[j] |= live_in[succ[i] * nwords + j];
+        }
+}
+
+/* OR @src into @dst, and return true if that changed @dst */
+static bool
+flow_merge(unsigned long *dst, const unsigned long *src, int nwords)
+{
+        bool changed = false;
+        int j;
+
+        for (j = 0; j < nwords; j++) {
+                if ((dst[j] | src[j]) != dst[j]) {
+                        dst[j] |= src[j];
+                        changed = true;
+                }
+        }
+        return changed;
+}
+
+static void
+flow_eliminate_dead_stores(struct flow_t *f, int nargs)
+{
+        unsigned long *live_in, *dirty_in, *live, *any;
+        char *removable;
+        int b, i, nwords, succ[2];
+        bool changed;
+
+        nwords = (f->n_locals + FLOW_WBITS - 1) / FLOW_WBITS;
+        if (!nwords)
+                return;
+        live_in = ecalloc((2 * f->nbb + 2) * nwords * sizeof(*live_in));
+        dirty_in = live_in + f->nbb * nwords;
+        live = dirty_in + f->nbb * nwords;
+        any = live + nwords;
+        removable = ecalloc(f->n_instr);
+
+        /* Arguments are the only locals not null at the start */
+        for (i = 0; i < nargs && i < f->n_locals; i++)
+                FLOW_SET(dirty_in, i);
+        do {
+                changed = false;
+                for (b = 0; b < f->nbb; b++) {
+                        int h, n;
+
+                        memcpy(live, &dirty_in[b * nwords],
+                               nwords * sizeof(*live));
+                        memcpy(any, live, nwords * sizeof(*any));
+                        flow_dirty_transfer(f, b, nwords, live, any, NULL);
+                        n = flow_successors(f, b, succ);
+                        for (i = 0; i < n; i++) {
+                                if (flow_merge(&dirty_in[succ[i] * nwords],
+                                               live, nwords)) {
+                                        changed = true;
+                                }
+                        }
+                        if ((h = flow_handler(f, b)) >= 0 &&
+                            flow_merge(&dirty_in[h * nwords], any, nwords)) {
+                                changed = true;
+                        }
+                }
+        } while (changed);
+
+        for (b = 0; b < f->nbb; b++) {
+                memcpy(live, &dirty_in[b * nwords], nwords * sizeof(*live));
+                flow_dirty_transfer(f, b, nwords, live, any, removable);
+        }
+
+        do {
+                changed = false;
+                for (b = f->nbb - 1; b >= 0; b--) {
+                        unsigned long *in = &live_in[b * nwords];
+
+                        flow_live_out(f, b, live_in, nwords, live);
+                        flow_live_transfer(f, b, live_in, nwords,
+                                           live, NULL);
+                        if (memcmp(in, live, nwords * sizeof(*live))) {
+                                memcpy(in, live, nwords * sizeof(*live));
+                                changed = true;
+                        }
+                }
+        } while (changed);
+
+        for (b = 0; b < f->nbb; b++) {
+                flow_live_out(f, b, live_in, nwords, live);
+                flow_live_transfer(f, b, live_in, nwords, live, removable);
+        }
+
+        /* Remove loads that are popped right away */
+        for (b = 0; b < f->nbb; b++) {
+                for (i = f->bbstart[b]; i < f->bbstart[b + 1] - 1; i++) {
+                        instruction_t *ii = &f->idata[i];
+                        if (flow_is_pure_load(ii[0]) &&
+                            ii[1].code == INSTR_POP &&
+                            ii[1].arg1 == IARG_POP_NORMAL &&
+                            ii[1].arg2 <= 1) {
+                                ii[0].code = INSTR_NOP;
+                                ii[1].code = INSTR_NOP;
+                        }
+                }
+        }
+
+        efree(removable);
+        efree(live_in);
+}
+
+/*
+ * Do the dataflow optimizations described in the DOC above.
+ * Jump labels must not be resolved yet.
+ */
+static void
+flow_optimize(struct assemble_t *a, struct as_frame_t *fr)
+{
+        struct flow_t f;
+
+        if (!TRY_FORWARD_STORES && !TRY_REDUNDANT_LOADS &&
+            !TRY_LOCAL_CSE && !TRY_ELIMINATE_DEAD_STORES) {
+                return;
+        }
+
+        flow_init(&f, fr);
+        if (TRY_FORWARD_STORES || TRY_REDUNDANT_LOADS || TRY_LOCAL_CSE) {
+                struct flow_val_t *vals;
+                int b, *stk, *lvn;
+
+                vals = emalloc(f.n_instr * sizeof(*vals));
+                stk = emalloc((f.w.max + 1 + f.n_locals) * sizeof(int));
+                lvn = stk + f.w.max + 1;
+                for (b = 0; b < f.nbb; b++)
+                        flow_number_values(&f, b, vals, stk, lvn);
+                efree(stk);
+                efree(vals);
+        }
+        if (TRY_ELIMINATE_DEAD_STORES)
+                flow_eliminate_dead_stores(&f, fr->af_nargs);
+        flow_free(&f);
+
+        remove_nop_instructions(a, fr);
+        remove_unused_rodata(fr);
+}
+
+/*
+ * DOC: Inline expansion
+ *
+ * Calling a tiny function costs far more than running it: DEFFUNC to
+ * make it, and at every call, a list of arguments, a new frame, and
+ * unpacking the list into the frame.  So before optimizing anything
+ * else, we paste small functions' code directly where they're called,
+ * if being called is the only thing ever done with them.  That's one
+ * of these:
+ *
+ *   - A function literal that's called right away, eg. an IIFE, or
+ *     '((x) => x + 1)(y)'.
+ *   - A function that's stored in a local that's never written again
+ *     and only ever called, eg. 'let dbl = (x) => x * 2;'
+ *
+ * The function's locals get slots of their own in the caller's frame,
+ * and its closures become the caller's variables they were made from.
+ * Its arguments get stored into its slots, and all of its slots get
+ * set back to null when it's done, so that nothing it used outlives
+ * the call.  Its returns become jumps past the end of its code.
+ *
+ * Only straight-line and if/else code gets inlined: no loops or 'try'
+ * blocks, no 'throw' statements, nothing that yields, nothing that
+ * makes functions of its own.
+ *
+ * Plenty of what's left can still fail, eg. arithmetic or looking up
+ * an attribute, and the traceback must look the same as if the call
+ * had happened.  So the function's location data comes along with its
+ * code, and each copy is marked with a struct xptr_inline_t, which
+ * debug_print_trace() turns back into a line for the call.
+ */
+enum {
+        /* Most reachable instructions a function can have to inline */
+        INLINE_MAX_INSTR  = 24,
+        /* Don't let a frame grow past this by inlining into it */
+        INLINE_MAX_FRAME  = 8192,
+};
+
+/* A function to be inlined */
+struct inline_fn_t {
+        struct as_frame_t *child;
+        int base;               /* child's local 0 in the caller */
+        instruction_t *clo;     /* ADD_CLOSUREs that made its closures */
+};
+
+/* A call to be replaced by a copy of @fn's code */
+struct inline_site_t {
+        struct inline_fn_t *fn;
+        int call;               /* index of CALL_FUNC */
+};
+
+/*
+ * Return true if @child, which takes @nargs arguments, can be pasted
+ * into its caller.  See DOC above.
+ */
+static bool
+inline_body_ok(struct as_frame_t *child, int nargs)
+{
+        instruction_t *idata = (instruction_t *)child->af_instr.s;
+        int i, count, n = as_frame_ninstr(child);
+        struct stack_walk_t w;
+        bool ret = true;
+
+        if (child->af_nargs != nargs || n > 4 * INLINE_MAX_INSTR)
+                return false;
+
+        stack_walk(&w, idata, n, (short *)child->af_labels.s);
+        count = 0;
+        for (i = 0; i < n && ret; i++) {
+                if (w.depth[i] < 0)
+                        continue;
+                if (++count > INLINE_MAX_INSTR) {
+                        ret = false;
+                        break;
+                }
+                switch (idata[i].code) {
+                case INSTR_RETURN_VALUE:
+                        /* anything else on the stack would leak */
+                        if (w.depth[i] != 1)
+                                ret = false;
+                        break;
+                case INSTR_END:
+                case INSTR_THROW:
+                case INSTR_PUSH_BLOCK:
+                case INSTR_POP_BLOCK:
+                case INSTR_BREAK:
+                case INSTR_CONTINUE:
+                case INSTR_RETURN_GENERATOR:
+                case INSTR_YIELD_VALUE:
+                case INSTR_DEFFUNC:
+                case INSTR_ADD_CLOSURE:
+                case INSTR_IA_CLOSURE:
+                case INSTR_GETATTR_SUPER:
+                case INSTR_LOAD_ARG:
+                case INSTR_PUSH_LOCAL:
+                case INSTR_IMPORT:
+                case INSTR_FOREACH_SETUP:
+                case INSTR_FOREACH_ITER:
+                case INSTR_RANGE_SETUP:
+                case INSTR_RANGE_ITER:
+                        ret = false;
+                        break;
+                default:
+                        break;
+                }
+        }
+        efree(w.depth);
+        return ret;
+}
+
+/*
+ * If the DEFFUNC at @i makes a function that can be inlined, fill in
+ * @fn and return the index of the first instruction after its
+ * ADD_CLOSUREs.  Otherwise return -1.
+ */
+static int
+inline_candidate(struct assemble_t *a, struct as_frame_t *fr,
+                 int i, struct inline_fn_t *fn)
+{
+        instruction_t *idata = (instruction_t *)fr->af_instr.s;
+        Object **rodata = as_frame_rodata(fr);
+        Object *id, *spec;
+        struct as_frame_t *child;
+        int k, nargs, nclo;
+
+        if (i < 2 || idata[i - 2].code != INSTR_LOAD_CONST ||
+            idata[i - 1].code != INSTR_LOAD_CONST) {
+                return -1;
+        }
+        id = rodata[idata[i - 2].arg2];
+        spec = rodata[idata[i - 1].arg2];
+        if (id->v_type != &IdType || !isvar_tuple(spec) ||
+            seqvar_size(spec) != 3) {
+                return -1;
+        }
+        for (k = 0; k < 3; k++) {
+                if (!isvar_int(tuple_borrowitem(spec, k)))
+                        return -1;
+        }
+        /* no variadic or keyword arguments */
+        if (intvar_toll(tuple_borrowitem(spec, 1)) >= 0 ||
+            intvar_toll(tuple_borrowitem(spec, 2)) >= 0) {
+                return -1;
+        }
+        nargs = intvar_toll(tuple_borrowitem(spec, 0));
+
+        child = func_label_to_frame(a, idvar_toll(id));
+        nclo = seqvar_size(child->af_closures);
+        for (k = 0; k < nclo; k++) {
+                if (idata[i + 1 + k].code != INSTR_ADD_CLOSURE)
+                        return -1;
+        }
+        if (!inline_body_ok(child, nargs))
+                return -1;
+
+        fn->child = child;
+        fn->clo = NULL;
+        if (nclo) {
+                fn->clo = emalloc(nclo * sizeof(instruction_t));
+                memcpy(fn->clo, &idata[i + 1], nclo * sizeof(instruction_t));
+        }
+        return i + 1 + nclo;
+}
+
+/*
+ * Instructions @fstart up to (not including) @fend push a function
+ * that takes @nargs arguments.  If it is called right away and nothing
+ * else is done with it, return the index of the CALL_FUNC.  Otherwise
+ * return -1.
+ */
+static int
+inline_site(struct as_frame_t *fr, struct stack_walk_t *w,
+            int fstart, int fend, int nargs)
+{
+        instruction_t *idata = (instruction_t *)fr->af_instr.s;
+        const short *labels = (short *)fr->af_labels.s;
+        int k, call, d, n = as_frame_ninstr(fr);
+
+        if ((d = w->depth[fstart]) < 0)
+                return -1;
+
+        /* It stays on the stack until the call that consumes it */
+        for (call = fend; call < n; call++) {
+                if (w->depth[call] <= d)
+                        return -1;
+                if (idata[call].code == INSTR_CALL_FUNC &&
+                    w->depth[call] == d + 3) {
+                        break;
+                }
+                if (flow_ends_block(idata[call]) &&
+                    !instr_uses_jump(idata[call])) {
+                        return -1;
+                }
+        }
+        if (call >= n || call - 2 < fend)
+                return -1;
+        if (idata[call - 1].code != INSTR_LOAD_CONST ||
+            as_frame_rodata(fr)[idata[call - 1].arg2] != NullVar ||
+            idata[call - 2].code != INSTR_DEFLIST ||
+            idata[call - 2].arg2 != nargs) {
+                return -1;
+        }
+
+        /* No jumping into or out of the arguments */
+        for (k = 0; k < n; k++) {
+                int t;
+                if (!instr_uses_jump(idata[k]))
+                        continue;
+                t = labels[idata[k].arg2];
+                if (k >= fend && k < call) {
+                        if (t < fend || t > call)
+                                return -1;
+                } else if (t > fstart && t <= call) {
+                        return -1;
+                }
+        }
+        return call;
+}
+
+/*
+ * Return true if any LOAD_LOCAL of FP+@idx can be reached without
+ * going through instruction @def.
+ */
+static bool
+inline_read_before(struct as_frame_t *fr, int def, int idx)
+{
+        instruction_t *idata = (instruction_t *)fr->af_instr.s;
+        const short *labels = (short *)fr->af_labels.s;
+        int i, n = as_frame_ninstr(fr);
+        int *todo, ntodo = 0;
+        char *seen;
+        bool ret = false;
+
+        todo = emalloc(n * sizeof(int));
+        seen = ecalloc(n);
+
+#define REACH(i_) do {                          \
+        int i__ = (i_);                         \
+        if (i__ < n && i__ != def && !seen[i__]) { \
+                seen[i__] = 1;                  \
+                todo[ntodo++] = i__;            \
+        }                                       \
+} while (0)
+
+        REACH(0);
+        while (ntodo > 0) {
+                instruction_t ii;
+
+                i = todo[--ntodo];
+                ii = idata[i];
+                if (ii.code == INSTR_LOAD_LOCAL &&
+                    ii.arg1 == IARG_PTR_FP && ii.arg2 == idx) {
+                        ret = true;
+                        break;
+                }
+                if (instr_uses_jump(ii))
+                        REACH(labels[ii.arg2]);
+                switch (ii.code) {
+                case INSTR_B:
+                case INSTR_RETURN_VALUE:
+                case INSTR_THROW:
+                case INSTR_BREAK:
+                case INSTR_CONTINUE:
+                case INSTR_END:
+                        break;
+                default:
+                        REACH(i + 1);
+                        break;
+                }
+        }
+#undef REACH
+
+        efree(seen);
+        efree(todo);
+        return ret;
+}
+
+/*
+ * Instruction @def stores function @fn in local FP+@idx.  If every use
+ * of the local is a call that can be inlined, add them all to @sites
+ * and return how many there are.  Otherwise return -1.
+ */
+static int
+inline_local_sites(struct as_frame_t *fr, struct stack_walk_t *w,
+                   int def, int idx, struct inline_fn_t *fn,
+                   struct inline_site_t *sites)
+{
+        instruction_t *idata = (instruction_t *)fr->af_instr.s;
+        int i, nsites = 0, n = as_frame_ninstr(fr);
+        int nargs = fn->child->af_nargs;
+
+        for (i = 0; i < n; i++) {
+                instruction_t ii = idata[i];
+                bool fp = ii.arg1 == IARG_PTR_FP && ii.arg2 == idx;
+
+                switch (ii.code) {
+                case INSTR_LOAD_LOCAL:
+                        if (!fp)
+                                break;
+                        sites[nsites].fn = fn;
+                        sites[nsites].call = inline_site(fr, w, i, i + 1,
+                                                         nargs);
+                        if (sites[nsites].call < 0)
+                                return -1;
+                        nsites++;
+                        break;
+                case INSTR_ASSIGN_LOCAL:
+                case INSTR_ADD_CLOSURE:
+                        if (fp && i != def)
+                                return -1;
+                        break;
+                case INSTR_RANGE_ITER:
+                        if (ii.arg1 == idx)
+                                return -1;
+                        break;
+                default:
+                        break;
+                }
+        }
+        if (inline_read_before(fr, def, idx))
+                return -1;
+        return nsites;
+}
+
+/*
+ * Return true if anything jumps to an instruction from @from through
+ * @to.  If so, the ASSIGN_LOCAL at @to might store something other
+ * than the function, eg. 'let f = a or function() {...};'
+ */
+static bool
+inline_jumped_into(struct as_frame_t *fr, int from, int to)
+{
+        instruction_t *idata = (instruction_t *)fr->af_instr.s;
+        const short *labels = (short *)fr->af_labels.s;
+        int k, n = as_frame_ninstr(fr);
+
+        for (k = 0; k < n; k++) {
+                int t;
+                if (!instr_uses_jump(idata[k]))
+                        continue;
+                t = labels[idata[k].arg2];
+                if (t >= from && t <= to)
+                        return true;
+        }
+        return false;
+}
+
+/* Add a label to @fr for source line @line, return its number */
+static int
+inline_new_label(struct as_frame_t *fr, int line)
+{
+        buffer_putd(&fr->af_locations, &line, sizeof(line));
+        return assemble_frame_next_label(fr);
+}
+
+/*
+ * Return the location of instruction @i in @fr, using only the first
+ * @nlabel labels.
+ */
+static int
+inline_location(struct as_frame_t *fr, int i, int nlabel)
+{
+        const short *labels = (short *)fr->af_labels.s;
+        const int *loc = (int *)fr->af_locations.s;
+        int j, ret = -1, best = -1;
+
+        for (j = 0; j < nlabel; j++) {
+                if (loc[j] >= 0 && labels[j] <= i && labels[j] >= best) {
+                        best = labels[j];
+                        ret = loc[j];
+                }
+        }
+        return ret;
+}
+
+/*
+ * Append to @b the code that replaces call @site.  @nlabel is how many
+ * labels @fr had before we started; @nullidx is .rodata for null.
+ */
+static void
+inline_expand(struct assemble_t *a, struct as_frame_t *fr,
+              struct buffer_t *b, struct inline_site_t *site,
+              int nlabel, int nullidx)
+{
+        struct inline_fn_t *fn = site->fn;
+        struct as_frame_t *child = fn->child;
+        instruction_t *cdata = (instruction_t *)child->af_instr.s;
+        short *clabels = (short *)child->af_labels.s;
+        const int *cloc = (int *)child->af_locations.s;
+        int cn = as_frame_ninstr(child);
+        int cnlabel = as_frame_nlabel(child);
+        int cnloc = as_frame_nlocation(child);
+        int cninl;
+        const struct xptr_inline_t *cinl;
+        int nlocals = child->af_nlocals;
+        int nargs = child->af_nargs;
+        int k, label_base, end_label, *cmap;
+        struct xptr_inline_t inl;
+        struct stack_walk_t w;
+
+        /* The arguments' line is the function's, not the caller's */
+        inl.start = inline_new_label(fr, child->line);
+        assemble_frame_set_label(fr, inl.start,
+                                 buffer_size(b) / sizeof(instruction_t));
+        for (k = nargs - 1; k >= 0; k--)
+                emit_instr(b, INSTR_ASSIGN_LOCAL, IARG_PTR_FP, fn->base + k);
+        for (k = nargs; k < nlocals; k++) {
+                emit_instr(b, INSTR_LOAD_CONST, 0, nullidx);
+                emit_instr(b, INSTR_ASSIGN_LOCAL, IARG_PTR_FP, fn->base + k);
+        }
+
+        label_base = as_frame_nlabel(fr);
+        for (k = 0; k < cnlabel; k++)
+                inline_new_label(fr, k < cnloc ? cloc[k] : -1);
+        inl.line = inline_location(fr, site->call, nlabel);
+        end_label = inline_new_label(fr, inl.line);
+
+        stack_walk(&w, cdata, cn, clabels);
+        cmap = emalloc((cn + 1) * sizeof(int));
+        for (k = 0; k < cn; k++) {
+                instruction_t ii = cdata[k];
+
+                cmap[k] = buffer_size(b) / sizeof(instruction_t);
+                if (w.depth[k] < 0)
+                        continue;
+
+                switch (ii.code) {
+                case INSTR_LOAD_LOCAL:
+                case INSTR_ASSIGN_LOCAL:
+                        if (ii.arg1 == IARG_PTR_FP) {
+                                ii.arg2 += fn->base;
+                        } else {
+                                ii.arg1 = fn->clo[ii.arg2].arg1;
+                                ii.arg2 = fn->clo[ii.arg2].arg2;
+                        }
+                        break;
+                case INSTR_RETURN_VALUE:
+                        ii.code = INSTR_B;
+                        ii.arg1 = 0;
+                        ii.arg2 = end_label;
+                        break;
+                default:
+                        if (instr_uses_rodata(ii)) {
+                                Object *v = as_frame_rodata(child)[ii.arg2];
+                                ii.arg2 = seek_rodata(a, fr, VAR_NEW_REF(v));
+                        } else if (instr_uses_jump(ii)) {
+                                ii.arg2 += label_base;
+                        }
+                        break;
+                }
+                buffer_putd(b, &ii, sizeof(ii));
+        }
+        cmap[cn] = buffer_size(b) / sizeof(instruction_t);
+
+        for (k = 0; k < cnlabel; k++) {
+                assemble_frame_set_label(fr, label_base + k,
+                                         cmap[clabels[k]]);
+        }
+        assemble_frame_set_label(fr, end_label, cmap[cn]);
+        for (k = 0; k < nlocals; k++) {
+                emit_instr(b, INSTR_LOAD_CONST, 0, nullidx);
+                emit_instr(b, INSTR_ASSIGN_LOCAL, IARG_PTR_FP, fn->base + k);
+        }
+
+        /* So a traceback can still show the call, see DOC above */
+        inl.end = end_label;
+        inl.funcname = child->af_funcname;
+        if (inl.funcname)
+                VAR_INCR_REF(inl.funcname);
+        buffer_putd(&fr->af_inlined, &inl, sizeof(inl));
+
+        /* ...and the calls that had been pasted into @child */
+        cinl = (struct xptr_inline_t *)child->af_inlined.s;
+        cninl = buffer_size(&child->af_inlined) / sizeof(inl);
+        for (k = 0; k < cninl; k++) {
+                inl = cinl[k];
+                inl.start += label_base;
+                inl.end += label_base;
+                if (inl.funcname)
+                        VAR_INCR_REF(inl.funcname);
+                buffer_putd(&fr->af_inlined, &inl, sizeof(inl));
+        }
+
+        efree(cmap);
+        efree(w.depth);
+}
+
+/*
+ * Find the calls in @fr that can be inlined, and inline them.  Return
+ * true if anything was.
+ */
+static bool
+inline_calls(struct assemble_t *a, struct as_frame_t *fr)
+{
+        instruction_t *idata = (instruction_t *)fr->af_instr.s;
+        int n = as_frame_ninstr(fr);
+        struct stack_walk_t w;
+        struct inline_fn_t *fns;
+        struct inline_site_t *sites;
+        int i, k, nfns, nsites, grow, nlabel, nullidx, ninl, ninl_old;
+        int *site_at, *map, *loc;
+        short *labels;
+        struct xptr_inline_t *inl;
+        struct buffer_t b;
+
+        for (i = 0; i < n; i++) {
+                if (idata[i].code == INSTR_DEFFUNC)
+                        break;
+        }
+        if (i == n)
+                return false;
+
+        stack_walk(&w, idata, n, (short *)fr->af_labels.s);
+        fns = emalloc(n * sizeof(*fns));
+        sites = emalloc(n * sizeof(*sites));
+        nfns = nsites = grow = 0;
+
+        for (i = 0; i < n; i++) {
+                struct inline_fn_t *fn = &fns[nfns];
+                int e, fstart, added, size, local;
+
+                if (idata[i].code != INSTR_DEFFUNC || w.depth[i] < 0)
+                        continue;
+                if ((e = inline_candidate(a, fr, i, fn)) < 0)
+                        continue;
+
+                fstart = i - 2;
+                local = -1;
+                if (idata[e].code == INSTR_ASSIGN_LOCAL &&
+                    idata[e].arg1 == IARG_PTR_FP &&
+                    !inline_jumped_into(fr, fstart, e)) {
+                        local = idata[e].arg2;
+                        added = inline_local_sites(fr, &w, e, local,
+                                                   fn, &sites[nsites]);
+                        e++;
+                } else {
+                        sites[nsites].fn = fn;
+                        sites[nsites].call = inline_site(fr, &w, fstart, e,
+                                                fn->child->af_nargs);
+                        added = sites[nsites].call < 0 ? -1 : 1;
+                }
+
+                size = INLINE_MAX_INSTR + 4 * fn->child->af_nlocals;
+                if (added < 0 || n + grow + added * size > INLINE_MAX_FRAME) {
+                        if (fn->clo)
+                                efree(fn->clo);
+                        continue;
+                }
+                grow += added * size;
+                nsites += added;
+
+                /* Remove everything that makes and loads the function */
+                for (k = fstart; k < e; k++)
+                        idata[k].code = INSTR_NOP;
+                for (k = 0; local >= 0 && k < n; k++) {
+                        if (idata[k].code == INSTR_LOAD_LOCAL &&
+                            idata[k].arg1 == IARG_PTR_FP &&
+                            idata[k].arg2 == local) {
+                                idata[k].code = INSTR_NOP;
+                        }
+                }
+
+                fn->base = fr->af_nlocals;
+                fr->af_nlocals += fn->child->af_nlocals;
+                for (k = 0; k < fn->child->af_nlocals; k++) {
+                        array_append(fr->af_names,
+                                array_borrowitem(fn->child->af_names, k));
+                }
+                nfns++;
+        }
+        efree(w.depth);
+
+        if (!nsites) {
+                efree(sites);
+                efree(fns);
+                return false;
+        }
+
+        /* Keep locations parallel to labels, see resolve_locations() */
+        nlabel = as_frame_nlabel(fr);
+        while (as_frame_nlocation(fr) < nlabel) {
+                int tmp = -1;
+                buffer_putd(&fr->af_locations, &tmp, sizeof(tmp));
+        }
+        nullidx = seek_rodata(a, fr, VAR_NEW_REF(NullVar));
+
+        site_at = emalloc(n * sizeof(int));
+        for (i = 0; i < n; i++)
+                site_at[i] = -1;
+        for (k = 0; k < nsites; k++)
+                site_at[sites[k].call] = k;
+
+        /* Copy the code into @b, pasting in the inlined functions */
+        ninl_old = buffer_size(&fr->af_inlined) / sizeof(*inl);
+        map = emalloc((n + 1) * sizeof(int));
+        buffer_init(&b);
+        for (i = 0; i < n; i++) {
+                map[i] = buffer_size(&b) / sizeof(instruction_t);
+                if (i + 2 < n && site_at[i + 2] >= 0) {
+                        /* DEFLIST; LOAD_CONST null; CALL_FUNC */
+                        inline_expand(a, fr, &b, &sites[site_at[i + 2]],
+                                      nlabel, nullidx);
+                        map[i + 1] = map[i + 2] = map[i];
+                        i += 2;
+                        continue;
+                }
+                if (idata[i].code != INSTR_NOP)
+                        buffer_putd(&b, &idata[i], sizeof(idata[i]));
+        }
+        map[n] = buffer_size(&b) / sizeof(instruction_t);
+
+        labels = (short *)fr->af_labels.s;
+        for (i = 0; i < nlabel; i++)
+                labels[i] = map[labels[i]];
+
+        /*
+         * A statement that starts with a call we pasted in has its
+         * label at the start of the copy, where its line would hide
+         * the function's.  The copy's end label has the statement's
+         * line for whatever comes after.
+         */
+        loc = (int *)fr->af_locations.s;
+        inl = (struct xptr_inline_t *)fr->af_inlined.s;
+        ninl = buffer_size(&fr->af_inlined) / sizeof(*inl);
+        for (k = ninl_old; k < ninl; k++) {
+                for (i = 0; i < nlabel; i++) {
+                        if (labels[i] == labels[inl[k].start])
+                                loc[i] = -1;
+                }
+        }
+
+        buffer_free(&fr->af_instr);
+        fr->af_instr = b;
+
+        /* The inlined functions are now unused */
+        for (k = 0; k < nfns; k++) {
+                if (fns[k].clo)
+                        efree(fns[k].clo);
+                assemble_frame_free(fns[k].child);
+        }
+        remove_unused_rodata(fr);
+
+        efree(map);
+        efree(site_at);
+        efree(sites);
+        efree(fns);
+        return true;
+}
+
+/*
+ * DOC: Loop blocks
+ *
+ * Every loop pushes a LOOP block, and every braced loop body pushes a
+ * CONTINUE block once per pass, only so that BREAK and CONTINUE know
+ * where to go and how much of the stack to throw away when they get
+ * there.  Exceptions only ever stop at TRY blocks, so a loop block is
+ * useless unless some BREAK or CONTINUE can stop at it.
+ *
+ * Blocks nest lexically, so the stack walk already knows which block
+ * every BREAK or CONTINUE would stop at, and how deep the stack is both
+ * there and at the block's PUSH_BLOCK.  That's all the VM would have
+ * figured out at run time.  So a BREAK becomes a POP of the difference
+ * and a B to the block's label, and a POP_BLOCK becomes a POP of
+ * whatever the loop had left on the stack, like a FOREACH iterator.
+ *
+ * The VM pops every block between a BREAK and the one it stops at, so
+ * this only works if all of those blocks go away too.  A TRY block in
+ * between must stay, and so then must every block its BREAK would
+ * have popped.  TRY blocks themselves are left alone.
+ */
+
+/* Return the block that BREAK or CONTINUE @i stops at, or -1 if none */
+static int
+loop_block_target(const instruction_t *idata,
+                  const struct stack_walk_t *w, int i)
+{
+        int type = idata[i].code == INSTR_BREAK ? IARG_LOOP : IARG_CONTINUE;
+        int k;
+
+        for (k = w->blk[i]; k >= 0; k = w->blk[k]) {
+                if (idata[k].arg1 == type)
+                        return k;
+        }
+        return -1;
+}
+
+/*
+ * Mark in @keep which PUSH_BLOCK instructions must stay, and return
+ * true if any do that didn't before.  See DOC above.
+ */
+static bool
+loop_blocks_needed(const instruction_t *idata, int n,
+                   const struct stack_walk_t *w, char *keep)
+{
+        bool changed = false;
+        int i, k, t;
+
+        for (i = 0; i < n; i++) {
+                if (w->depth[i] < 0 ||
+                    (idata[i].code != INSTR_BREAK &&
+                     idata[i].code != INSTR_CONTINUE)) {
+                        continue;
+                }
+
+                t = loop_block_target(idata, w, i);
+                for (k = w->blk[i]; t >= 0 && k != t; k = w->blk[k]) {
+                        if (keep[k])
+                                break;
+                }
+                if (t >= 0 && k == t && !keep[t])
+                        continue;
+
+                /* The VM has to do this one, so it needs every block */
+                for (k = w->blk[i]; k >= 0; k = w->blk[k]) {
+                        if (!keep[k]) {
+                                keep[k] = 1;
+                                changed = true;
+                        }
+                        if (k == t)
+                                break;
+                }
+        }
+        return changed;
+}
+
+/* Do at assembly time what the VM does for loop blocks.  See DOC above. */
+static void
+remove_loop_blocks(struct assemble_t *a, struct as_frame_t *fr)
+{
+        instruction_t *idata = (instruction_t *)fr->af_instr.s;
+        short *labels = (short *)fr->af_labels.s;
+        int n = as_frame_ninstr(fr);
+        int i, k, nlabel, *map;
+        struct stack_walk_t w;
+        struct buffer_t b;
+        char *keep;
+
+        for (i = 0; i < n; i++) {
+                if (idata[i].code == INSTR_PUSH_BLOCK &&
+                    idata[i].arg1 != IARG_TRY) {
+                        break;
+                }
+        }
+        if (i == n)
+                return;
+
+        stack_walk(&w, idata, n, labels);
+        keep = emalloc(n);
+        for (i = 0; i < n; i++) {
+                keep[i] = idata[i].code == INSTR_PUSH_BLOCK &&
+                          (idata[i].arg1 == IARG_TRY || w.depth[i] < 0);
+        }
+        while (loop_blocks_needed(idata, n, &w, keep))
+                ;
+
+        map = emalloc((n + 1) * sizeof(int));
+        buffer_init(&b);
+        for (i = 0; i < n; i++) {
+                instruction_t ii = idata[i];
+
+                map[i] = buffer_size(&b) / sizeof(instruction_t);
+                if (w.depth[i] < 0)
+                        goto copy;
+
+                switch (ii.code) {
+                case INSTR_PUSH_BLOCK:
+                        if (!keep[i])
+                                continue;
+                        break;
+                case INSTR_POP_BLOCK:
+                        k = w.blk[i];
+                        if (keep[k])
+                                break;
+                        if (w.depth[i] > w.depth[k]) {
+                                emit_instr(&b, INSTR_POP, IARG_POP_NORMAL,
+                                           w.depth[i] - w.depth[k]);
+                        }
+                        continue;
+                case INSTR_BREAK:
+                case INSTR_CONTINUE:
+                        k = loop_block_target(idata, &w, i);
+                        if (k < 0 || keep[k])
+                                break;
+                        if (w.depth[i] > w.depth[k]) {
+                                emit_instr(&b, INSTR_POP, IARG_POP_NORMAL,
+                                           w.depth[i] - w.depth[k]);
+                        }
+                        emit_instr(&b, INSTR_B, 0, idata[k].arg2);
+                        continue;
+                }
+copy:
+                buffer_putd(&b, &ii, sizeof(ii));
+        }
+        map[n] = buffer_size(&b) / sizeof(instruction_t);
+
+        nlabel = as_frame_nlabel(fr);
+        for (i = 0; i < nlabel; i++)
+                labels[i] = map[labels[i]];
+
+        buffer_free(&fr->af_instr);
+        fr->af_instr = b;
+
+        efree(map);
+        efree(keep);
+        efree(w.depth);
+}
+
+/*
+ * DOC: Lazy assembly
+ *
+ * A script, and a library module even more so, may define many more
+ * functions than a given run ever calls.  The parser has to read all of
+ * them to find where each one ends and to report syntax errors, and
+ * since it generates code as it goes, their raw instructions come along
+ * for free.  Everything after that--the optimizations, locations, jump
+ * labels, and XptrType objects--is about half the time it takes to load
+ * a file, so for script files we put it off for each function until the
+ * first time something needs the function's code.
+ *
+ * assemble_post() finishes only the entry point.  Each function it
+ * defines gets an XptrType object holding a struct as_lazy_t: that
+ * function's frame and the frames of every function nested in it, just
+ * as the parser left them.  xptr_ready() later finishes the function the
+ * same way, leaving its own nested functions for later still.
+ *
+ * The passes that peek into a nested function, to inline it or to see
+ * if it changes a closure, then see its raw code.  That only makes them
+ * more conservative.
+ */
+
+/**
+ * struct as_lazy_t - A function whose assembly has been put off
+ * @frames:     The function's frame first, then the frames of all the
+ *              functions nested in it
+ * @file_name:  Name of the source file
+ */
+struct as_lazy_t {
+        struct list_t frames;
+        char *file_name;
+};
+
+/* Move @fr and all the frames nested in it from @a to @dst */
+static void
+lazy_claim(struct assemble_t *a, struct as_frame_t *fr, struct list_t *dst)
+{
+        Object **rodata = as_frame_rodata(fr);
+        int i, n = as_frame_nconst(fr);
+
+        list_remove(&fr->list);
+        list_add_tail(&fr->list, dst);
+        for (i = 0; i < n; i++) {
+                if (rodata[i]->v_type != &IdType)
+                        continue;
+                lazy_claim(a, func_label_to_frame(a, idvar_toll(rodata[i])),
+                           dst);
+        }
+}
+
+/* Get an XptrType object for @fr that will be finished on demand */
+static Object *
+lazy_xptr_new(struct assemble_t *a, struct as_frame_t *fr)
+{
+        struct as_lazy_t *lazy = emalloc(sizeof(*lazy));
+        struct xptr_cfg_t cfg;
+
+        list_init(&lazy->frames);
+        lazy_claim(a, fr, &lazy->frames);
+        lazy->file_name = estrdup(a->file_name);
+
+        memset(&cfg, 0, sizeof(cfg));
+        cfg.file_name   = a->file_name;
+        cfg.file_line   = fr->line;
+        cfg.funcname    = fr->af_funcname;
+        cfg.lazy        = lazy;
+        return xptrvar_new(&cfg);
+}
+
+/*
+ * Replace the IDs of @fr's nested functions in its .rodata with their
+ * XptrType objects.
+ */
+static enum result_t
+resolve_nested_functions(struct assemble_t *a, struct as_frame_t *fr)
+{
+        Object **rodata;
+        int i, n_rodata;
+
+        n_rodata = as_frame_nconst(fr);
+        rodata = as_frame_rodata(fr);
+        for (i = 0; i < n_rodata; i++) {
+                long long idval;
+                struct as_frame_t *child;
+                Object *obj;
+
+                obj = rodata[i];
+                if (obj->v_type != &IdType)
+                        continue;
+                idval = idvar_toll(obj);
+                child = func_label_to_frame(a, idval);
+                bug_on(!child || child == fr);
+                VAR_DECR_REF(rodata[i]);
+                if (a->lazy)
+                        rodata[i] = lazy_xptr_new(a, child);
+                else
+                        rodata[i] = assemble_frame_to_xptr(a, child);
+                if (rodata[i] == ErrorVar) {
+                        /*
+                         * Setting to NullVar so we have something non-NULL
+                         * to decrement reference on when parent object is
+                         * cleaned up.
+                         */
+                        rodata[i] = VAR_NEW_REF(NullVar);
+                        return RES_ERROR;
+                }
+        }
+        return RES_OK;
+}
+
+/* Fill in @cfg from finished frame @fr */
+static void
+frame_to_cfg(struct assemble_t *a, struct as_frame_t *fr,
+             struct xptr_cfg_t *cfg)
+{
+        cfg->file_name  = a->file_name;
+        cfg->file_line  = fr->line;
+        cfg->n_instr    = as_frame_ninstr(fr);
+        cfg->rodata     = fr->af_rodata;
+        cfg->instr      = buffer_trim(&fr->af_instr);
+        cfg->n_locals   = fr->af_nlocals;
+        cfg->max_stack  = max_stack_depth(cfg->instr, cfg->n_instr);
+        superinstr_fuse(cfg->instr, cfg->n_instr);
+        cfg->names      = fr->af_names;
+        cfg->funcname   = fr->af_funcname;
+        cfg->locations  = fr->af_locations_packed;
+        cfg->locations_size = fr->af_locations_packed_size;
+        cfg->n_inlined  = buffer_size(&fr->af_inlined)
+                          / sizeof(struct xptr_inline_t);
+        cfg->inlined    = cfg->n_inlined
+                          ? buffer_trim(&fr->af_inlined) : NULL;
+        cfg->lazy       = NULL;
+}
+
+/**
+ * assemble_frame_to_xptr - Resolve XptrType pointers in .rodata, create
+ *                          final XptrType objects, and return entry-point
+ *                          XptrType object.
+ * @fr: Entry-level assembly frame.  This function will recursively call
+ *      itself to create all the descendant XptrType objects, or if
+ *      @a->lazy is set, lazy ones for its immediate children.
+ */
+Object *
+assemble_frame_to_xptr(struct assemble_t *a, struct as_frame_t *fr)
+{
+        static long recursion;
+
+        Object *x;
+        struct xptr_cfg_t cfg;
+
+        /*
+         * Resolve any nested function defintions from a magic number to
+         * a pointer to another XptrType object.  This means that we have
+         * to process the most deeply nested functions first, hence the
+         * recursion.  assembler.c already checked against runaway
+         * recursion for us, and in the case of reassemble(), that
+         * disassembly was generated from code that also was checked by
+         * assemble() some time in the past.
+         *
+         * ...but we'd be reckless to assume it, so add this inexpensive
+         * recursion guard anyway.
+         */
+        if (recursion >= RECURSION_MAX) {
+                err_setstr(RecursionError, "Recursion limit reached");
+                return ErrorVar;
+        }
+        recursion++;
+
+        if (resolve_nested_functions(a, fr) == RES_ERROR) {
+                x = ErrorVar;
+        } else {
+                frame_to_cfg(a, fr, &cfg);
+                x = xptrvar_new(&cfg);
+        }
+
+        recursion--;
+        return x;
+}
+
+static size_t
+count_unique_locations(const int *loc_lines, size_t nr_loc_lines)
+{
+        size_t i, count = 0;
+        for (i = 0; i < nr_loc_lines; i++) {
+                if (loc_lines[i] < 0)
+                        continue;
+                count++;
+        }
+        return count;
+}
+
+static int
+loc_compar(const void *a, const void *b)
+{
+        struct location_t *alice = (struct location_t *)a;
+        struct location_t *bob = (struct location_t *)b;
+
+        /*
+         * qsort() isn't stable, so break ties the same way every time.
+         * Labels left at the same instruction are usually statements
+         * that produced no code, so the later line is the better guess.
+         */
+        if (alice->loc_instruction != bob->loc_instruction)
+                return (int)alice->loc_instruction - (int)bob->loc_instruction;
+        return (int)alice->loc_startline - (int)bob->loc_startline;
+}
+
+static struct location_t *
+fill_locations_unpacked(const int *loc_lines,
+                        size_t nr_loc_lines, const short *labels,
+                        size_t count)
+{
+        size_t i, j = 0;
+        struct location_t *loc_buf = emalloc(sizeof(*loc_buf) * count);
+        for (i = 0; i < nr_loc_lines; i++) {
+                struct location_t *loc;
+                int line;
+
+                if (loc_lines[i] < 0)
+                        continue;
+                line = loc_lines[i];
+
+                bug_on(j >= count);
+                loc = &loc_buf[j];
+
+                loc->loc_startline = line;
+                loc->loc_instruction = labels[i];
+                j++;
+        }
+        bug_on(j != count);
+
+        qsort(loc_buf, count, sizeof(*loc_buf), loc_compar);
+        return loc_buf;
+}
+
+static unsigned char *
+fill_locations_packed(const struct location_t *loc_buf,
+                      size_t count, size_t *bufidx_out)
+{
+        size_t i;
+        unsigned char *buf;
+        size_t bufsize, bufidx;
+
+        bufsize = 16;
+        bufidx = 0;
+        buf = erealloc(NULL, bufsize);
+
+        for (i = 0; i < count; i++) {
+                ssize_t packed;
+
+                if ((i > 0) &&
+                    (loc_buf[i].loc_startline
+                     == loc_buf[i-1].loc_startline)) {
+                        continue;
+                }
+
+                while ((packed = location_pack(&buf[bufidx],
+                                               bufsize - bufidx,
+                                               &loc_buf[i])) < 0) {
+                        bufsize += 16;
+                        buf = erealloc(buf, bufsize);
+                }
+                bufidx += packed;
+        }
+        *bufidx_out = bufidx;
+        return buf;
+}
+
+static int
+inline_compar(const void *a, const void *b)
+{
+        const struct xptr_inline_t *alice = a;
+        const struct xptr_inline_t *bob = b;
+
+        /* A call comes before the calls that were pasted inside it */
+        if (alice->start != bob->start)
+                return alice->start - bob->start;
+        return bob->end - alice->end;
+}
+
+/*
+ * Turn the labels of @fr's inlined calls into instruction indices, in
+ * the order that debug_print_trace() expects them.  A call whose code
+ * was all optimized away is left with @start == @end, which no error
+ * can be in.
+ */
+static void
+resolve_inlined(struct as_frame_t *fr)
+{
+        const short *labels = (short *)fr->af_labels.s;
+        struct xptr_inline_t *inl = (struct xptr_inline_t *)fr->af_inlined.s;
+        size_t i, n = buffer_size(&fr->af_inlined) / sizeof(*inl);
+
+        for (i = 0; i < n; i++) {
+                inl[i].start = labels[inl[i].start];
+                inl[i].end = labels[inl[i].end];
+        }
+        if (n > 1)
+                qsort(inl, n, sizeof(*inl), inline_compar);
+}
+
+/*
+ * Instruction set is now frozen, so labels won't shift around anymore.
+ * This means we can now set our labels in place properly.  The same
+ * goes for the labels around inlined calls.
+ */
+static void
+resolve_locations(struct assemble_t *a, struct as_frame_t *fr)
+{
+        const int *loc_lines;
+        size_t nr_loc_lines;
+        short *labels;
+        struct location_t *loc_buf;
+        unsigned char *buf;
+        size_t bufidx, count;
+
+        labels = (short *)fr->af_labels.s;
+        loc_lines = (int *)(fr->af_locations.s);
+        nr_loc_lines = as_frame_nlocation(fr);
+
+        /*
+         * #labels could only be greater than nr_loc_lines (due to a
+         * label being produced in remove_save_flags()) or equal to it,
+         * but never less than it.
+         */
+        bug_on(as_frame_nlabel(fr) < nr_loc_lines);
+
+        count = count_unique_locations(loc_lines, nr_loc_lines);
+        if (count) {
+                loc_buf = fill_locations_unpacked(loc_lines, nr_loc_lines,
+                                                  labels, count);
+                buf = fill_locations_packed(loc_buf, count, &bufidx);
+                efree(loc_buf);
+        } else {
+                buf = NULL;
+                bufidx = 0;
+        }
+
+        fr->af_locations_packed = buf;
+        fr->af_locations_packed_size = bufidx;
+
+        resolve_inlined(fr);
+}
+
+/*
+ * Do for a single frame what assemble_post() does for all of them, for
+ * lazy assembly.  Its nested functions stay as they are.
+ */
+static void
+finish_frame(struct assemble_t *a, struct as_frame_t *fr)
+{
+        if (TRY_INLINE_FUNCTIONS)
+                inline_calls(a, fr);
+        optimize_instructions_in_frame(a, fr);
+        if (TRY_REMOVE_LOOP_BLOCKS)
+                remove_loop_blocks(a, fr);
+        resolve_local_access(a, fr);
+        flow_optimize(a, fr);
+        replace_fake_instructions(a, fr);
+        resolve_locations(a, fr);
+        resolve_jump_labels(a, fr);
+}
+
+/**
+ * assemble_post - Helper function for assemble()
+ *
+ * All the opcodes have been compiled.  Still to do...
+ * 1. Paste small local functions into the code that calls them
+ * 2. If any binary operators perform on two consts, perform them here
+ *    and reduce three instructions to a single LOAD_CONST.
+ * 3. Garbage-collect any .rodata that the above procedure rendered
+ *    no longer necessary.
+ * 4. Replace loop blocks with plain jumps and pops where possible
+ * 5. Pick the fastest opcodes for local-variable access
+ * 6. Forward stores, and remove dead stores and redundant loads
+ * 7. Resolve local jump addresses
+ * 8. Convert it all into a tree of XptrType objects, with the entry
+ *    point at the top, fusing common runs of instructions into
+ *    superinstructions on the way.
+ */
+Object *
+assemble_post(struct assemble_t *a)
+{
+        struct list_t *li;
+        Object *x;
+
+        index_frames(a);
+        if (a->lazy) {
+                struct as_frame_t *fr = list2frame(a->finished_frames.next);
+
+                finish_frame(a, fr);
+                x = assemble_frame_to_xptr(a, fr);
+                unindex_frames(a);
+                return x;
+        }
+
+        /* Callees before callers, so inlined code is already inlined */
+        if (TRY_INLINE_FUNCTIONS) {
+                list_foreach_rev(li, &a->finished_frames)
+                        inline_calls(a, list2frame(li));
+        }
+
+        optimize_instructions(a);
+
+        if (TRY_REMOVE_LOOP_BLOCKS) {
+                list_foreach(li, &a->finished_frames)
+                        remove_loop_blocks(a, list2frame(li));
+        }
+
+        list_foreach(li, &a->finished_frames)
+                resolve_local_access(a, list2frame(li));
+
+        list_foreach(li, &a->finished_frames)
+                flow_optimize(a, list2frame(li));
+
+        list_foreach(li, &a->finished_frames) {
+                struct as_frame_t *fr = list2frame(li);
+                /*
+                 * Do this before resolving jump labels,
+                 * because some "fake" instructions exist
+                 * within.
+                 */
+                replace_fake_instructions(a, fr);
+                resolve_locations(a, fr);
+                resolve_jump_labels(a, fr);
         }
 
         /*
          * See as_frame_pop().
          * First child of finished_frames is also our entry point.
          */
-        return assemble_frame_to_xptr(
-                        a, list2frame(a->finished_frames.next));
+        x = assemble_frame_to_xptr(a, list2frame(a->finished_frames.next));
+        unindex_frames(a);
+        return x;
+}
+
+/**
+ * assemble_lazy - Finish assembling a function put off by assemble_post()
+ * @x: XptrType object whose @lazy field is set.  When this returns, it
+ *     has its code, and its @lazy field is NULL.
+ *
+ * See DOC "Lazy assembly".  This can't fail: the parser found any errors
+ * long ago, and the only other one, runaway recursion, comes from
+ * finishing nested functions, which this doesn't do.
+ */
+void
+assemble_lazy(struct xptrvar_t *x)
+{
+        struct as_lazy_t *lazy = x->lazy;
+        struct assemble_t a;
+        struct as_frame_t *fr;
+        struct xptr_cfg_t cfg;
+        struct list_t *li, *tmp;
+
+        bug_on(!lazy);
+
+        memset(&a, 0, sizeof(a));
+        a.file_name = lazy->file_name;
+        a.lazy = true;
+        list_init(&a.active_frames);
+        list_init(&a.finished_frames);
+        list_foreach_safe(li, tmp, &lazy->frames) {
+                list_remove(li);
+                list_add_tail(li, &a.finished_frames);
+        }
+
+        index_frames(&a);
+        fr = list2frame(a.finished_frames.next);
+        finish_frame(&a, fr);
+        if (resolve_nested_functions(&a, fr) != RES_OK)
+                bug();
+        frame_to_cfg(&a, fr, &cfg);
+        xptr_set_code(x, &cfg);
+        unindex_frames(&a);
+
+        /* whatever is left was inlined or thrown away as dead code */
+        list_foreach_safe(li, tmp, &a.finished_frames)
+                assemble_frame_free(list2frame(li));
+        efree(lazy->file_name);
+        efree(lazy);
 }
 
+/**
+ * assemble_lazy_free - Free a function that was never called
+ * @lazy: Lazy unit of an XptrType object being destroyed
+ */
+void
+assemble_lazy_free(struct as_lazy_t *lazy)
+{
+        struct list_t *li, *tmp;
 
+        list_foreach_safe(li, tmp, &lazy->frames)
+                assemble_frame_free(list2frame(li));
+        efree(lazy->file_name);
+        efree(lazy);
+}
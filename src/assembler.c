@@ -43,6 +43,7 @@
 #include <evilcandy/types/dict.h>
 #include <evilcandy/types/tuple.h>
 #include <evilcandy/types/number_types.h>
+#include <evilcandy/types/string.h>
 #include <internal/type_registry.h>
 #include <internal/token.h>
 #include <internal/assemble.h>
@@ -458,11 +459,10 @@ as_set_label(struct assemble_t *a, int jmp)
         assemble_frame_set_label(a->fr, jmp, val);
 
         if (a->oc) {
-                struct buffer_t *b = &a->fr->af_locations;
-                struct token_t **locations = (struct token_t **)(b->s);
-                bug_on(jmp >= buffer_size(b) / sizeof(void *));
-                bug_on(locations[jmp] != NULL);
-                locations[jmp] = a->oc;
+                int *locations = (int *)a->fr->af_locations.s;
+                bug_on(jmp >= as_frame_nlocation(a->fr));
+                bug_on(locations[jmp] != -1);
+                locations[jmp] = a->oc->start_line;
         }
 
         return 0;
@@ -472,7 +472,7 @@ static int
 as_next_label(struct assemble_t *a)
 {
         /* Ensure location is available when calling as_set_label() */
-        void *tmp_loc = NULL;
+        int tmp_loc = -1;
         buffer_putd(&a->fr->af_locations, &tmp_loc, sizeof(tmp_loc));
 
         return assemble_frame_next_label(a->fr);
@@ -887,6 +887,12 @@ assemble_function_body(struct assemble_t *a,
         add_instr(a, INSTR_DEFFUNC, 0, 0);
 
         assemble_frame_push(a, funcno, name);
+        if (a->slots) {
+                /* Only if the first argument can be "self" */
+                if (alist->n > 0 && alist->star != 0 && alist->starstar != 0)
+                        a->fr->af_slots = VAR_NEW_REF(a->slots);
+                a->slots = NULL;
+        }
         {
                 struct list_t *p;
                 bool have_brace;
@@ -896,10 +902,19 @@ assemble_function_body(struct assemble_t *a,
                         if (as_add_local(a, tok->v) < 0)
                                 return -1;
                 }
+                a->fr->af_nargs = a->fr->af_nlocals;
 
                 if (as_lex(a) < 0)
                         return -1;
                 have_brace = a->oc->t == OC_LBRACE;
+                /*
+                 * No statement will give a braceless lambda a source
+                 * location, but a traceback still needs one.
+                 */
+                if (lambda && !have_brace) {
+                        if (as_set_label(a, as_next_label(a)) < 0)
+                                return -1;
+                }
                 as_unlex(a);
 
                 if (lambda && !have_brace) {
@@ -1228,6 +1243,51 @@ clean_private_data(struct list_t *private_data_list)
         }
 }
 
+/*
+ * Parse the value of __slots__ in a class definition.  It must be a
+ * tuple or list of string literals, so that we know the slots while
+ * assembling the class's methods.  See as_slot_hint().  Append the
+ * names to @slots.
+ */
+static int
+assemble_slots(struct assemble_t *a, Object *slots)
+{
+        int count = 0;
+        int close;
+
+        if (as_lex(a) < 0)
+                return -1;
+        if (a->oc->t == OC_LPAR)
+                close = OC_RPAR;
+        else if (a->oc->t == OC_LBRACK)
+                close = OC_RBRACK;
+        else
+                goto bad;
+
+        do {
+                if (as_lex(a) < 0)
+                        return -1;
+                if (a->oc->t == close)
+                        break;
+                if (a->oc->t != OC_STRING)
+                        goto bad;
+                ainstr_load_const(a, a->oc);
+                array_append(slots, a->oc->v);
+                count++;
+                if (as_lex(a) < 0)
+                        return -1;
+        } while (a->oc->t == OC_COMMA);
+        if (a->oc->t != close)
+                goto bad;
+        add_instr(a, INSTR_DEFTUPLE, 0, count);
+        return 0;
+
+bad:
+        err_setstr(SyntaxError,
+                   "__slots__ must be a tuple or list of string literals");
+        return -1;
+}
+
 /*
  * for class() {... and namespace {..., the opening brace has already
  * been collected.
@@ -1248,6 +1308,8 @@ assemble_object_literal(struct assemble_t *a,
                         struct list_t *private_data_list)
 {
         int count = 0;
+        Object *slots = NULL;
+        Object *outer_slots = a->slots;
 
         do {
                 bool collect_private = false;
@@ -1276,10 +1338,27 @@ assemble_object_literal(struct assemble_t *a,
                 if (collect_private)
                         add_private_datum(private_data_list, a->oc);
                 ainstr_load_const(a, a->oc);
-                if (as_errlex(a, OC_EQ) < 0)
-                        goto err_cleanup;
-                if (assemble_expr(a, 0) < 0)
-                        goto err_cleanup;
+                if (private_data_list &&
+                    a->oc->v == STRCONST_ID(__slots__)) {
+                        if (slots) {
+                                err_setstr(SyntaxError,
+                                           "__slots__ declared twice");
+                                goto err_cleanup;
+                        }
+                        slots = arrayvar_new(0);
+                        if (as_errlex(a, OC_EQ) < 0)
+                                goto err_cleanup;
+                        if (assemble_slots(a, slots) < 0)
+                                goto err_cleanup;
+                } else {
+                        if (as_errlex(a, OC_EQ) < 0)
+                                goto err_cleanup;
+                        /* Methods after __slots__ get slot hints */
+                        a->slots = slots;
+                        if (assemble_expr(a, 0) < 0)
+                                goto err_cleanup;
+                        a->slots = outer_slots;
+                }
                 if (as_lex(a) < 0)
                         goto err_cleanup;
                 count++;
@@ -1288,9 +1367,14 @@ assemble_object_literal(struct assemble_t *a,
                 err_ae_brace();
                 goto err_cleanup;
         }
+        if (slots)
+                VAR_DECR_REF(slots);
         return count;
 
 err_cleanup:
+        a->slots = outer_slots;
+        if (slots)
+                VAR_DECR_REF(slots);
         if (private_data_list)
                 clean_private_data(private_data_list);
         return -1;
@@ -1447,14 +1531,21 @@ assemble_namespace(struct assemble_t *a, struct token_t *name)
 static int
 assemble_fstring(struct assemble_t *a)
 {
-        int count = 0;
+        Object *parts;
+        token_pos_t pos;
+        size_t i, n;
+        int count;
+
+        /*
+         * The template, with the literal text and conversion specs,
+         * comes last in the OC_FSTRING_END token, but we need it before
+         * the first expression.  Peek ahead for it, then come back.
+         */
+        pos = as_savetok(a, NULL);
         do {
-                if (assemble_expr(a, FE_CHECKTUPLE) < 0)
-                        return -1;
-                count++;
                 if (as_lex(a) < 0)
                         return -1;
-        } while (a->oc->t == OC_FSTRING_CONTINUE);
+        } while (a->oc->t != OC_FSTRING_END && a->oc->t != OC_EOF);
 
         if (a->oc->t != OC_FSTRING_END) {
                 /*
@@ -1465,10 +1556,59 @@ assemble_fstring(struct assemble_t *a)
                 return -1;
         }
 
-        add_instr(a, INSTR_DEFTUPLE, 0, count);
-        ainstr_load_const(a, a->oc);
-        add_instr(a, INSTR_FORMAT, 0, 0);
+        parts = string_fstring_parts(a->oc->v);
+        if (parts == ErrorVar)
+                return -1;
+        (void)as_swap_pos(a, pos);
+
+        /*
+         * parts is [lit0, spec0, ... litN], so there are N expressions.
+         * Each literal gets pushed as-is and each expression gets a
+         * FORMAT_VALUE, then one BUILD_STRING joins them all.
+         */
+        n = seqvar_size(parts) / 2;
+        count = 0;
+        for (i = 0; ; i++) {
+                Object *lit, *spec;
+
+                lit = array_borrowitem(parts, 2 * i);
+                if (seqvar_size(lit) > 0) {
+                        ainstr_load_const_obj(a, VAR_NEW_REF(lit));
+                        count++;
+                }
+                if (i == n)
+                        break;
+
+                if (assemble_expr(a, FE_CHECKTUPLE) < 0)
+                        goto err;
+
+                spec = array_borrowitem(parts, 2 * i + 1);
+                if (spec == NullVar) {
+                        add_instr(a, INSTR_FORMAT_VALUE, 0, 0);
+                } else {
+                        string_precompile_format(spec);
+                        ainstr_load_const_obj(a, VAR_NEW_REF(spec));
+                        add_instr(a, INSTR_FORMAT_VALUE, 1, 0);
+                }
+                count++;
+
+                if (as_lex(a) < 0)
+                        goto err;
+                if (a->oc->t != (i == n - 1
+                                 ? OC_FSTRING_END : OC_FSTRING_CONTINUE)) {
+                        err_setstr(SyntaxError, "Malformed f-string");
+                        goto err;
+                }
+        }
+
+        if (count > 1)
+                add_instr(a, INSTR_BUILD_STRING, 0, count);
+        VAR_DECR_REF(parts);
         return 0;
+
+err:
+        VAR_DECR_REF(parts);
+        return -1;
 }
 
 /*
@@ -1597,8 +1737,12 @@ ainstr_assign_initializer(struct assemble_t *a, unsigned int flags,
         return 0;
 }
 
+/*
+ * @method: true if the function was loaded with LOAD_METHOD, so it has
+ *          to be called with CALL_METHOD.
+ */
 static int
-assemble_call_func(struct assemble_t *a)
+assemble_call_func(struct assemble_t *a, bool method)
 {
         int n_items = 0;
         int kwind = -1;
@@ -1706,7 +1850,7 @@ assemble_call_func(struct assemble_t *a)
                 err_ae_par();
                 return -1;
         }
-        add_instr(a, INSTR_CALL_FUNC, 0, 0);
+        add_instr(a, method ? INSTR_CALL_METHOD : INSTR_CALL_FUNC, 0, 0);
         return 0;
 }
 
@@ -2167,12 +2311,43 @@ assemble_preassign(struct assemble_t *a, int t)
         return 0;
 }
 
+/*
+ * If we're in a method of a class with __slots__, the object whose
+ * attribute @name we're about to get or set was just loaded from the
+ * method's first argument, and @name is a slot, return the slot's index
+ * plus one.  Otherwise return zero.  This goes in arg2 of GETATTR or
+ * SETATTR.  It's only a hint, since the first argument might not be an
+ * instance of the class at all, so the VM checks it before using it.
+ */
+static int
+as_slot_hint(struct assemble_t *a, Object *name)
+{
+        instruction_t *ii;
+        size_t i, n;
+        int ninstr = as_frame_ninstr(a->fr);
+
+        if (!a->fr->af_slots || ninstr == 0)
+                return 0;
+        ii = &((instruction_t *)a->fr->af_instr.s)[ninstr - 1];
+        if (ii->code != INSTR_LOAD_LOCAL ||
+            ii->arg1 != IARG_PTR_FP || ii->arg2 != 0) {
+                return 0;
+        }
+        n = seqvar_size(a->fr->af_slots);
+        for (i = 0; i < n; i++) {
+                if (array_borrowitem(a->fr->af_slots, i) == name)
+                        return i + 1;
+        }
+        return 0;
+}
+
 /*
  * return -1 if error, 1 if attribute modified, 0 if not
  * @attr: if true, instruction is xxxATTR, not xxxITEM
+ * @hint: arg2 for GETATTR or SETATTR, see as_slot_hint()
  */
 static int
-maybe_modattr(struct assemble_t *a, unsigned int flags, bool attr)
+maybe_modattr(struct assemble_t *a, unsigned int flags, bool attr, int hint)
 {
         int instr;
         if (flags == FEE_DEL) {
@@ -2203,12 +2378,12 @@ maybe_modattr(struct assemble_t *a, unsigned int flags, bool attr)
                         instr = attr ? INSTR_GETATTR : INSTR_GETITEM;
                         add_instr(a, INSTR_COPY, 0, 2);
                         add_instr(a, INSTR_COPY, 0, 2);
-                        add_instr(a, instr, 0, 0);
+                        add_instr(a, instr, 0, hint);
                         if (assemble_preassign(a, t) < 0)
                                 return -1;
                 }
                 instr = attr ? INSTR_SETATTR : INSTR_SETITEM;
-                add_instr(a, instr, 0, 0);
+                add_instr(a, instr, 0, hint);
                 return 1;
         } else {
                 bug_on(flags != FEE_EVAL);
@@ -2231,20 +2406,30 @@ maybe_modattr(struct assemble_t *a, unsigned int flags, bool attr)
 static int
 assemble_primary_elements(struct assemble_t *a, unsigned int flags)
 {
+        bool method = false;
+
         flags &= FEE_MASK;
         while (istok_indirection(a->oc->t)) {
-                int mres;
+                int mres, hint;
                 switch (a->oc->t) {
                 case OC_PER:
                         if (as_errlex(a, OC_IDENTIFIER) < 0)
                                 return -1;
+                        hint = as_slot_hint(a, a->oc->v);
                         ainstr_load_const(a, a->oc);
-                        mres = maybe_modattr(a, flags, true);
+                        mres = maybe_modattr(a, flags, true, hint);
                         if (mres < 0)
                                 return -1;
                         else if (mres)
                                 return 0;
-                        add_instr(a, INSTR_GETATTR, 0, 0);
+
+                        /* "x.y(...)", call y without binding it to x */
+                        if (as_lex(a) < 0)
+                                return -1;
+                        method = a->oc->t == OC_LPAR;
+                        as_unlex(a);
+                        add_instr(a, method ? INSTR_LOAD_METHOD
+                                            : INSTR_GETATTR, 0, hint);
                         break;
 
                 case OC_LBRACK:
@@ -2253,7 +2438,7 @@ assemble_primary_elements(struct assemble_t *a, unsigned int flags)
                         if (as_lex(a) < 0)
                                 return -1;
                         if (a->oc->t == OC_RBRACK) {
-                                mres = maybe_modattr(a, flags, false);
+                                mres = maybe_modattr(a, flags, false, 0);
                                 if (mres < 0)
                                         return -1;
                                 else if (mres)
@@ -2267,8 +2452,9 @@ assemble_primary_elements(struct assemble_t *a, unsigned int flags)
 
                 case OC_LPAR:
                         as_unlex(a);
-                        if (assemble_call_func(a) < 0)
+                        if (assemble_call_func(a, method) < 0)
                                 return -1;
+                        method = false;
                         if (flags == FEE_DEL) {
                                 int t;
                                 if (as_lex(a) < 0)
@@ -2734,6 +2920,7 @@ static int
 assemble_while(struct assemble_t *a)
 {
         int start = as_next_label(a);
+        int done = as_next_label(a);
         int breakto = as_next_label(a);
 
         if (ainstr_push_block(a, IARG_LOOP, breakto) < 0)
@@ -2745,11 +2932,14 @@ assemble_while(struct assemble_t *a)
         if (assemble_expr(a, FE_CHECKTUPLE) < 0)
                 return -1;
 
-        add_instr(a, INSTR_B_IF, 0, breakto);
+        /* not to breakto, the loop block still needs popping */
+        add_instr(a, INSTR_B_IF, 0, done);
         if (assemble_stmt(a, FE_CONTINUE, start) < 0)
                 return -1;
         add_instr(a, INSTR_B, 0, start);
 
+        if (as_set_label(a, done) < 0)
+                return -1;
         ainstr_pop_block(a, IARG_LOOP);
 
         if (as_set_label(a, breakto) < 0)
@@ -2833,6 +3023,175 @@ assemble_foreach2(struct assemble_t *a, struct list_t *names,
         return 0;
 }
 
+/*
+ * Return true if the next tokens are a call to range() with one to
+ * three plain arguments, and nothing else: ie. the whole 'haystack' of
+ * 'for i in range(...)'.  Nothing is consumed.
+ */
+static bool
+as_peek_range_call(struct assemble_t *a, bool have_par)
+{
+        token_pos_t pos = as_savetok(a, NULL);
+        bool ret = false;
+        bool argstart = true;
+        int depth, nargs = 0;
+
+        if (as_lex(a) < 0 || !as_curtok_is_softkey(a, "range"))
+                goto out;
+        if (as_lex(a) < 0 || a->oc->t != OC_LPAR)
+                goto out;
+
+        depth = 1;
+        while (depth > 0) {
+                if (as_lex(a) < 0)
+                        goto out;
+                switch (a->oc->t) {
+                case OC_EOF:
+                        goto out;
+                case OC_LPAR:
+                case OC_LBRACK:
+                case OC_LBRACE:
+                        depth++;
+                        break;
+                case OC_RPAR:
+                case OC_RBRACK:
+                case OC_RBRACE:
+                        depth--;
+                        break;
+                case OC_COMMA:
+                        if (depth == 1) {
+                                argstart = true;
+                                continue;
+                        }
+                        break;
+                case OC_MUL:
+                case OC_POW:
+                        /* starred argument */
+                        if (depth == 1 && argstart)
+                                goto out;
+                        break;
+                case OC_EQ:
+                        /* keyword argument */
+                        if (depth == 1)
+                                goto out;
+                        break;
+                default:
+                        break;
+                }
+                if (argstart && depth > 0) {
+                        nargs++;
+                        argstart = false;
+                }
+        }
+        if (nargs < 1 || nargs > 3)
+                goto out;
+
+        /*
+         * Make sure the call isn't just the start of a longer
+         * expression, like 'range(3) + x'.  It's followed by the loop
+         * body, which starts with something that can't continue an
+         * expression.
+         */
+        if (as_lex(a) < 0)
+                goto out;
+        switch (a->oc->t) {
+        case OC_RPAR:
+                ret = have_par;
+                break;
+        case OC_LBRACE:
+        case OC_SEMI:
+        case OC_IDENTIFIER:
+        case OC_DELETE:
+        case OC_LET:
+        case OC_RETURN:
+        case OC_YIELD:
+        case OC_IMPORT:
+        case OC_BREAK:
+        case OC_CONTINUE:
+        case OC_IF:
+        case OC_WHILE:
+        case OC_DO:
+        case OC_FOR:
+        case OC_GBL:
+        case OC_TRY:
+        case OC_THROW:
+                ret = !have_par;
+                break;
+        default:
+                break;
+        }
+
+out:
+        err_clear();
+        (void)as_swap_pos(a, pos);
+        return ret;
+}
+
+/*
+ * 'for i in range(...)' as a counted loop.  The calling code already
+ * knows from as_peek_range_call() that the syntax is right.
+ */
+static int
+assemble_range_loop(struct assemble_t *a, struct list_t *names,
+                    bool have_par)
+{
+        struct names_t *n = AS_LIST2NAMES(names->next);
+        struct token_t *tok = AS_NAME2TOK(a, n);
+        int forelse = as_next_label(a);
+        int iter = as_next_label(a);
+        int iternext = as_next_label(a);
+        int argc = 0;
+
+        /* load whatever 'range' is, RANGE_SETUP will check */
+        if (as_lex(a) < 0)
+                return -1;
+        if (ainstr_load_symbol(a, as_savetok(a, NULL)) < 0)
+                return -1;
+        if (as_errlex(a, OC_LPAR) < 0)
+                return -1;
+        do {
+                if (as_lex(a) < 0)
+                        return -1;
+                if (a->oc->t == OC_RPAR)
+                        break;
+                as_unlex(a);
+                if (assemble_expr(a, 0) < 0)
+                        return -1;
+                argc++;
+                if (as_lex(a) < 0)
+                        return -1;
+        } while (a->oc->t == OC_COMMA);
+        if (a->oc->t != OC_RPAR) {
+                err_ae_expect(a, OC_RPAR);
+                return -1;
+        }
+        if (have_par) {
+                if (as_errlex(a, OC_RPAR) < 0)
+                        return -1;
+        }
+        add_instr(a, INSTR_RANGE_SETUP, 0, argc);
+
+        if (ainstr_push_block(a, IARG_BLOCK, 0) < 0)
+                return -1;
+        bug_on(!tok->v);
+        n->namei = as_add_local(a, tok->v);
+        if (n->namei < 0)
+                return -1;
+        if (as_set_label(a, iter) < 0)
+                return -1;
+        add_instr(a, INSTR_RANGE_ITER, n->namei, forelse);
+        if (assemble_stmt(a, FE_CONTINUE, iternext) < 0)
+                return -1;
+        if (as_set_label(a, iternext) < 0)
+                return -1;
+        ainstr_pop_block(a, IARG_BLOCK);
+        add_instr(a, INSTR_B, 0, iter);
+
+        if (as_set_label(a, forelse) < 0)
+                return -1;
+        return 0;
+}
+
 static int
 assemble_foreach1(struct assemble_t *a, int breakto)
 {
@@ -2866,6 +3225,17 @@ assemble_foreach1(struct assemble_t *a, int breakto)
                 goto err_cleanup;
         }
 
+        /*
+         * RANGE_ITER's arg1 holds the loop variable's index, so it
+         * only works for the first 256 locals.
+         */
+        if (needsize == 1 && a->fr->af_nlocals < 256
+            && as_peek_range_call(a, have_par)) {
+                if (assemble_range_loop(a, &names, have_par) < 0)
+                        goto err_cleanup;
+                goto nobreak;
+        }
+
         /* push 'haystack onto the stack */
         if (assemble_expr(a, FE_CHECKTUPLE) < 0)
                 goto err_cleanup;
@@ -2891,6 +3261,7 @@ assemble_foreach1(struct assemble_t *a, int breakto)
 
         if (as_set_label(a, forelse) < 0)
                 goto err_cleanup;
+nobreak:
         if (as_lex(a) < 0)
                 goto err_cleanup;
         if (a->oc->t == OC_NOBREAK) {
@@ -3293,6 +3664,7 @@ new_assembler(const char *source_file_name, FILE *fp,
                 a->inp_type = a->fp ? AS_SCRIPT : AS_STRING;
                 a->localdict = NULL;
         }
+        a->lazy = a->inp_type == AS_SCRIPT;
         list_init(&a->active_frames);
         list_init(&a->finished_frames);
         assemble_frame_push(a, as_next_funcno(a), NULL);
@@ -3316,30 +3688,8 @@ static void
 as_delete_frame_list(struct list_t *parent_list)
 {
         struct list_t *li, *tmp;
-        list_foreach_safe(li, tmp, parent_list) {
-                struct as_frame_t *fr = list2frame(li);
-                list_remove(&fr->list);
-
-                VAR_DECR_REF(fr->af_locals);
-                VAR_DECR_REF(fr->af_closures);
-                VAR_DECR_REF(fr->af_rodata);
-                VAR_DECR_REF(fr->af_names);
-                if (fr->af_funcname)
-                        VAR_DECR_REF(fr->af_funcname);
-
-                buffer_free(&fr->af_localmap);
-                buffer_free(&fr->af_labels);
-                buffer_free(&fr->af_instr);
-                buffer_free(&fr->af_locations);
-
-                /*
-                 * Do not free af_locations_packed.
-                 * If that was ever set, then ownership has already
-                 * passed to xptr.c code.
-                 */
-
-                efree(fr);
-        }
+        list_foreach_safe(li, tmp, parent_list)
+                assemble_frame_free(list2frame(li));
 }
 
 static void
@@ -3375,6 +3725,7 @@ assemble_next(struct assemble_t *a, bool toeof, unsigned int flags)
         /* need to reserve space for top-level args */
         as_add_local(a, STRCONST_ID(__optarg__));
         as_add_local(a, STRCONST_ID(__kwarg__));
+        a->fr->af_nargs = a->fr->af_nlocals;
         do {
                 if (assemble_stmt(a, flags, -1) < 0) {
                         bug_on(!err_occurred());
@@ -3466,6 +3817,7 @@ assemble_frame_push(struct assemble_t *a, long long funcno, Object *name)
         buffer_init(&fr->af_labels);
         buffer_init(&fr->af_instr);
         buffer_init(&fr->af_locations);
+        buffer_init(&fr->af_inlined);
 
         fr->funcno = funcno;
         fr->line = a->oc ? a->oc->start_line : 1;
@@ -3499,6 +3851,50 @@ assemble_frame_pop(struct assemble_t *a)
                 a->fr = list2frame(a->active_frames.prev);
 }
 
+/*
+ * Remove @fr from whichever list it's in and destroy it.  For frames
+ * whose code was never turned into an XptrType object, eg. because
+ * assemble_post() pasted it all into its caller.
+ */
+void
+assemble_frame_free(struct as_frame_t *fr)
+{
+        struct xptr_inline_t *inl;
+        size_t i, n;
+
+        list_remove(&fr->list);
+
+        VAR_DECR_REF(fr->af_locals);
+        VAR_DECR_REF(fr->af_closures);
+        VAR_DECR_REF(fr->af_rodata);
+        VAR_DECR_REF(fr->af_names);
+        if (fr->af_funcname)
+                VAR_DECR_REF(fr->af_funcname);
+        if (fr->af_slots)
+                VAR_DECR_REF(fr->af_slots);
+
+        buffer_free(&fr->af_localmap);
+        buffer_free(&fr->af_labels);
+        buffer_free(&fr->af_instr);
+        buffer_free(&fr->af_locations);
+
+        inl = (struct xptr_inline_t *)fr->af_inlined.s;
+        n = buffer_size(&fr->af_inlined) / sizeof(*inl);
+        for (i = 0; i < n; i++) {
+                if (inl[i].funcname)
+                        VAR_DECR_REF(inl[i].funcname);
+        }
+        buffer_free(&fr->af_inlined);
+
+        /*
+         * Do not free af_locations_packed.
+         * If that was ever set, then ownership has already
+         * passed to xptr.c code.
+         */
+
+        efree(fr);
+}
+
 #if DBUG_PROFILE_LOAD_TIME
 # define CLOCK_DECLARE() clock_t __FUNCTION__##clk
 # define CLOCK_SAVE() \
@@ -21,6 +21,7 @@
 #include <evilcandy/types/class.h>
 #include <evilcandy/types/dict.h>
 #include <evilcandy/types/function.h>
+#include <evilcandy/types/memoryview.h>
 #include <evilcandy/types/string.h>
 #include <evilcandy/types/tuple.h>
 #include <evilcandy/types/number_types.h>
@@ -40,6 +41,7 @@
 #include <errno.h>
 #include <unistd.h>
 #include <limits.h>
+#include <string.h>
 #include <sys/stat.h> /* fstat() */
 
 enum file_type_t {
@@ -255,17 +257,30 @@ raw_read(struct rawfile_t *raw, ssize_t size)
                 return ErrorVar;
         }
         if (nread != size)
-                buf = erealloc(buf, nread);
+                buf = erealloc(buf, nread ? nread : 1);
         return bytesvar_nocopy(buf, nread);
 }
 
+/* @bo is bytes or anything else bytes-like, eg. a memoryview */
 static ssize_t
 raw_write(struct rawfile_t *raw, Object *bo)
 {
-        bug_on(!isvar_bytes(bo));
-        return raw_write_wrapper(raw->fr_fd,
-                                 bytes_get_data(bo),
-                                 seqvar_size(bo));
+        const unsigned char *buf;
+        size_t len;
+        Object *tmp;
+        ssize_t ret;
+
+        if (isvar_bytes(bo)) {
+                return raw_write_wrapper(raw->fr_fd,
+                                         bytes_get_data(bo),
+                                         seqvar_size(bo));
+        }
+        buf = bytes_like_acquire(bo, &len, &tmp);
+        if (!buf)
+                return -1;
+        ret = raw_write_wrapper(raw->fr_fd, buf, len);
+        bytes_like_release(bo, tmp);
+        return ret;
 }
 
 static Object *
@@ -293,6 +308,48 @@ do_raw_read(Frame *fr)
         return raw_read(raw, (ssize_t)size);
 }
 
+/*
+ * n = f.readinto(buf)
+ *
+ * Read up to length(buf) bytes straight into @buf, without allocating
+ * anything.  @buf is a bytearray or a writable memoryview of one.
+ * Return the number of bytes read, which is less than length(buf) only
+ * at end of file.
+ */
+static Object *
+do_raw_readinto(Frame *fr)
+{
+        Object *fo, *bo;
+        struct rawfile_t *raw;
+        unsigned char *buf;
+        size_t len;
+        ssize_t nread;
+
+        if (vm_getargs(fr, "<*>[<*>!]{!}:readinto", &fo, &bo) == RES_ERROR)
+                return ErrorVar;
+        bug_on(fo->v_type != &RawFileType);
+
+        raw = (struct rawfile_t *)fo;
+        if (raw->fr_fd < 0) {
+                filerr_closed("readinto");
+                return ErrorVar;
+        }
+
+        if (!raw->fr_readable) {
+                filerr_permit("readinto", 0);
+                return ErrorVar;
+        }
+
+        buf = bytes_like_acquire_rw(bo, &len);
+        if (!buf)
+                return ErrorVar;
+        nread = raw_read_wrapper(raw->fr_fd, buf, len);
+        bytes_like_release(bo, NULL);
+        if (nread < 0)
+                return ErrorVar;
+        return intvar_new(nread);
+}
+
 static Object *
 do_raw_write(Frame *fr)
 {
@@ -300,7 +357,7 @@ do_raw_write(Frame *fr)
         Object *bo, *fo;
         struct rawfile_t *raw;
 
-        if (vm_getargs(fr, "<*>[<b>!]{!}:write", &fo, &bo) == RES_ERROR)
+        if (vm_getargs(fr, "<*>[<*>!]{!}:write", &fo, &bo) == RES_ERROR)
                 return ErrorVar;
         bug_on(fo->v_type != &RawFileType);
 
@@ -531,6 +588,22 @@ bin_flush(struct binfile_t *bin)
         return res;
 }
 
+/* Write @bo with no buffering.  Flush first. */
+static ssize_t
+bin_write_through(struct binfile_t *bin, Object *bo)
+{
+        Object *result;
+        ssize_t nwritten;
+
+        result = file_call_1arg(bin->fb_raw, STRCONST_ID(write), bo);
+        if (result == ErrorVar)
+                return -1;
+        bug_on(!result || !isvar_int(result));
+        nwritten = intvar_toll(result);
+        VAR_DECR_REF(result);
+        return nwritten;
+}
+
 static Object *
 bin_read(struct binfile_t *bin, ssize_t size)
 {
@@ -600,10 +673,101 @@ bin_read(struct binfile_t *bin, ssize_t size)
         return ret;
 }
 
+/*
+ * Like bin_read, but fill @size bytes at @dst instead of returning a new
+ * bytes object.  Return the number of bytes read or -1 if error.
+ */
+static ssize_t
+bin_readinto(struct binfile_t *bin, unsigned char *dst, size_t size)
+{
+        Object *inbuf;
+        size_t pos, avail, n;
+        ssize_t nread;
+
+        pos = 0;
+        inbuf = bin->fb_inbuf;
+        if (inbuf) {
+                avail = seqvar_size(inbuf) - bin->fb_inbuf_pos;
+                n = avail < size ? avail : size;
+                memcpy(dst, bytes_get_data(inbuf) + bin->fb_inbuf_pos, n);
+                pos = n;
+                if (n < avail) {
+                        bin->fb_inbuf_pos += n;
+                        return pos;
+                }
+                VAR_DECR_REF(inbuf);
+                bin->fb_inbuf = NULL;
+                bin->fb_inbuf_pos = 0;
+        }
+        if (pos == size)
+                return pos;
+
+        if (bin_flush(bin) < 0) {
+                err_clear();
+                filerr_sys("flush (during read)");
+        }
+
+        /*
+         * If the rest is at least as big as our own buffer, buffering
+         * it would only add a copy, so read it straight into @dst.
+         */
+        if (size - pos >= IO_BUFFER_SIZE) {
+                nread = raw_read_wrapper(BINFILE_FILENO(bin),
+                                         dst + pos, size - pos);
+                if (nread < 0)
+                        return -1;
+                return pos + nread;
+        }
+
+        inbuf = file_call_1arg_int(bin->fb_raw,
+                                   STRCONST_ID(read), IO_BUFFER_SIZE);
+        if (inbuf == ErrorVar)
+                return -1;
+        avail = seqvar_size(inbuf);
+        n = avail < size - pos ? avail : size - pos;
+        memcpy(dst + pos, bytes_get_data(inbuf), n);
+        pos += n;
+        if (n < avail) {
+                bin->fb_inbuf = inbuf;
+                bin->fb_inbuf_pos = n;
+        } else {
+                VAR_DECR_REF(inbuf);
+        }
+        return pos;
+}
+
 static ssize_t
 bin_write(struct binfile_t *bin, Object *bo)
 {
-        bug_on(!isvar_bytes(bo));
+        ssize_t ret;
+
+        if (!isvar_bytes(bo)) {
+                const unsigned char *buf;
+                size_t len;
+                Object *tmp;
+
+                buf = bytes_like_acquire(bo, &len, &tmp);
+                if (!buf)
+                        return -1;
+                if (len < IO_BUFFER_SIZE) {
+                        /*
+                         * @bo's contents may change before the next
+                         * flush, so buffer a copy.
+                         */
+                        Object *copy = len ? bytesvar_new(buf, len)
+                                           : gbl_new_empty_bytes();
+                        bytes_like_release(bo, tmp);
+                        ret = bin_write(bin, copy);
+                        VAR_DECR_REF(copy);
+                        return ret;
+                }
+                bytes_like_release(bo, tmp);
+
+                /* Too big to be worth copying, write it straight out */
+                if (bin_flush(bin) < 0)
+                        return -1;
+                return bin_write_through(bin, bo);
+        }
 
         if (!bin->fb_outbuf) {
                 bin->fb_outbuf = arrayvar_new(0);
@@ -643,6 +807,41 @@ do_bin_read(Frame *fr)
         return bin_read(bin, (ssize_t)size);
 }
 
+/* n = f.readinto(buf), see do_raw_readinto */
+static Object *
+do_bin_readinto(Frame *fr)
+{
+        Object *fo, *bo;
+        struct binfile_t *bin;
+        unsigned char *buf;
+        size_t len;
+        ssize_t nread;
+
+        if (vm_getargs(fr, "<*>[<*>!]{!}:readinto", &fo, &bo) == RES_ERROR)
+                return ErrorVar;
+        bug_on(!fo || fo->v_type != &BinFileType);
+
+        bin = (struct binfile_t *)fo;
+        if (BINFILE_CLOSED(bin)) {
+                filerr_closed("readinto");
+                return ErrorVar;
+        }
+
+        if (!BINFILE_READABLE(bin)) {
+                filerr_permit("readinto", 0);
+                return ErrorVar;
+        }
+
+        buf = bytes_like_acquire_rw(bo, &len);
+        if (!buf)
+                return ErrorVar;
+        nread = bin_readinto(bin, buf, len);
+        bytes_like_release(bo, NULL);
+        if (nread < 0)
+                return ErrorVar;
+        return intvar_new(nread);
+}
+
 static Object *
 do_bin_write(Frame *fr)
 {
@@ -650,7 +849,7 @@ do_bin_write(Frame *fr)
         Object *bo, *fo;
         struct binfile_t *bin;
 
-        if (vm_getargs(fr, "<*>[<b>!]{!}:write", &fo, &bo) == RES_ERROR)
+        if (vm_getargs(fr, "<*>[<*>!]{!}:write", &fo, &bo) == RES_ERROR)
                 return ErrorVar;
         bug_on(!fo || fo->v_type != &BinFileType);
 
@@ -1911,6 +2110,7 @@ static const struct type_method_t textfile_methods[] = {
 
 static const struct type_method_t binfile_methods[] = {
         {"read",       do_bin_read},
+        {"readinto",   do_bin_readinto},
         {"write",      do_bin_write},
         {"flush",      do_bin_flush},
         {"tell",       do_bin_tell},
@@ -1922,6 +2122,7 @@ static const struct type_method_t binfile_methods[] = {
 
 static const struct type_method_t rawfile_methods[] = {
         {"read",       do_raw_read},
+        {"readinto",   do_raw_readinto},
         {"write",      do_raw_write},
         {"close",      do_raw_close},
         {"tell",       do_raw_tell},
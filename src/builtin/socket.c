@@ -36,6 +36,7 @@
  * sk.listen()             Listen for connections on a socket
  * sk.recv()               Receive data from a connected socket
  * sk.recvfrom()           Receive data from an unconnected socket
+ * sk.recv_into()          Receive data into an existing buffer
  * sk.send()               Send data over a connected socket
  * sk.sendto()             Send data over an unconnected socket
  * sk.close()              Close a socket
@@ -50,6 +51,7 @@
 #include <evilcandy/types/class.h>
 #include <evilcandy/types/dict.h>
 #include <evilcandy/types/function.h>
+#include <evilcandy/types/memoryview.h>
 #include <evilcandy/types/string.h>
 #include <evilcandy/types/number_types.h>
 #include <internal/types/string.h>
@@ -560,6 +562,27 @@ recv_cb(struct socketvar_t *skv, void *buf, size_t len, int flags, void *data)
         return recv(skv->fd, buf, len, flags);
 }
 
+/* Call @cb until it succeeds or fails with something other than EINTR */
+static ssize_t
+recv_retry(struct socketvar_t *skv,
+           ssize_t (*cb)(struct socketvar_t *, void *,
+                         size_t, int, void *),
+           void *buf, size_t length, int flags, void *data,
+           const char *fname)
+{
+        ssize_t n;
+
+        do {
+                errno = 0;
+                n = cb(skv, buf, length, flags, data);
+                if (n < 0 && errno != EINTR) {
+                        skerr_syscall(fname);
+                        return -1;
+                }
+        } while (n < 0);
+        return n;
+}
+
 /* common to recv and recvfrom */
 static Object *
 recv_common_(Frame *fr,
@@ -593,15 +616,11 @@ recv_common_(Frame *fr,
                 return ErrorVar;
         }
         buf = emalloc(length);
-        do {
-                errno = 0;
-                n = cb(skv, buf, length, flags, data);
-                if (n < 0 && errno != EINTR) {
-                        skerr_syscall(fname);
-                        efree(buf);
-                        return ErrorVar;
-                }
-        } while (n < 0);
+        n = recv_retry(skv, cb, buf, length, flags, data, fname);
+        if (n < 0) {
+                efree(buf);
+                return ErrorVar;
+        }
         if (n != length)
                 buf = erealloc(buf, n ? n : 1);
         return bytesvar_nocopy(buf, n);
@@ -626,6 +645,60 @@ do_recv(Frame *fr)
         return recv_common(fr, recv_cb, NULL, "recv");
 }
 
+/*
+ * n = sk.recv_into(buf, [nbytes=0], [flags=0]);
+ *
+ * Like sk.recv, but receive into @buf instead of a new bytes object, so
+ * the same buffer can be reused for every message.  @buf is a bytearray
+ * or a writable memoryview of one.  At most
+ * @nbytes are received, or length(buf) if @nbytes is zero.  @flags is
+ * the same as with sk.recv.
+ *
+ * @n is the number of bytes received, starting at buf[0].
+ */
+static Object *
+do_recv_into(Frame *fr)
+{
+        struct socketvar_t *skv;
+        Object *skobj, *bao;
+        int flags;
+        long long length;
+        unsigned char *buf;
+        size_t len;
+        ssize_t n;
+
+        flags = 0;
+        length = 0;
+        if (vm_getargs(fr, "<*>[<*>|l!]{|i}:recv_into", &skobj, &bao,
+                       &length, STRCONST_ID(flags), &flags) == RES_ERROR) {
+                return ErrorVar;
+        }
+        bug_on(skobj->v_type != &SocketType);
+
+        skv = (struct socketvar_t *)skobj;
+        if (skv->fd < 0) {
+                skerr_closed("recv_into");
+                return ErrorVar;
+        }
+        buf = bytes_like_acquire_rw(bao, &len);
+        if (!buf)
+                return ErrorVar;
+        if (length < 0LL || length > len) {
+                bytes_like_release(bao, NULL);
+                skerr(ValueError, "buffer too small for nbytes",
+                      "recv_into");
+                return ErrorVar;
+        }
+        if (length == 0LL)
+                length = len;
+
+        n = recv_retry(skv, recv_cb, buf, length, flags, NULL, "recv_into");
+        bytes_like_release(bao, NULL);
+        if (n < 0)
+                return ErrorVar;
+        return intvar_new(n);
+}
+
 /*
  * (msg, addr) = sk.recvfrom(bufsize, [flags=0]);
  *
@@ -657,27 +730,15 @@ do_recvfrom(Frame *fr)
 
 
 /*
- * send_wrapper - helper to do_send, block until all data is sent or
+ * send_buf - helper to do_send, block until all data is sent or
  * there was an error other than EINTR.
  */
 static enum result_t
-send_wrapper(int fd, Object *msg, int flags,
-             const struct sockaddr *addr, size_t addrlen)
+send_buf(int fd, const void *buf, size_t bufsize, int flags,
+         const struct sockaddr *addr, size_t addrlen)
 {
         ssize_t n;
-        const void *buf, *end;
-        size_t bufsize;
-
-        if (isvar_string(msg)) {
-                buf = string_cstring(msg);
-                bufsize = string_nbytes(msg);
-        } else {
-                bug_on(!isvar_bytes(msg));
-
-                buf = bytes_get_data(msg);
-                bufsize = seqvar_size(msg);
-        }
-        end = voidp_add(buf, bufsize);
+        const void *end = voidp_add(buf, bufsize);
 
         while (buf < end) {
                 ssize_t sendlen = voidp_diff(end, buf);
@@ -700,10 +761,37 @@ send_wrapper(int fd, Object *msg, int flags,
         return RES_OK;
 }
 
+/*
+ * send_wrapper - send a string or any bytes-like object, see send_buf
+ */
+static enum result_t
+send_wrapper(int fd, Object *msg, int flags,
+             const struct sockaddr *addr, size_t addrlen)
+{
+        const void *buf;
+        size_t bufsize;
+        Object *tmp;
+        enum result_t res;
+
+        if (isvar_string(msg)) {
+                buf = string_cstring(msg);
+                bufsize = string_nbytes(msg);
+                return send_buf(fd, buf, bufsize, flags, addr, addrlen);
+        }
+
+        buf = bytes_like_acquire(msg, &bufsize, &tmp);
+        if (!buf)
+                return RES_ERROR;
+        res = send_buf(fd, buf, bufsize, flags, addr, addrlen);
+        bytes_like_release(msg, tmp);
+        return res;
+}
+
 /*
  * sk.send(msg, **kwargs), kwargs are { flags: 0 }
  *
- * @msg:        a string or bytes object
+ * @msg:        a string or bytes-like object, eg. bytes, bytearray,
+ *              or memoryview
  * @flags:      an integer bitfield of any of the following flags:
  *              MSG_OOB, MSG_DONTROUTE.  If caller does not provide them
  *              then they must be NULL.
@@ -718,7 +806,7 @@ do_send(Frame *fr)
         msg = NULL;
         flags = 0;
 
-        if (vm_getargs(fr, "<*>[<bs>!]{|i}:send", &skobj, &msg,
+        if (vm_getargs(fr, "<*>[<*>!]{|i}:send", &skobj, &msg,
                        STRCONST_ID(flags), &flags) == RES_ERROR) {
                 return ErrorVar;
         }
@@ -738,7 +826,8 @@ do_send(Frame *fr)
 /*
  * sk.sendto(msg, addr, **wkargs), kwargs are { flags: 0 }
  *
- * @msg:        a string or bytes object
+ * @msg:        a string or bytes-like object, eg. bytes, bytearray,
+ *              or memoryview
  * @addr:       Address to send to, see top of this file re: addresses
  * @flags:      an integer bitfield of any of the following flags:
  *              MSG_OOB, MSG_DONTROUTE.  If caller does not provide them
@@ -754,7 +843,7 @@ do_sendto(Frame *fr)
 
         flags = 0;
         msg = ao = NULL;
-        if (vm_getargs(fr, "<*>[<bs><*>!]{|i}:sendto", &skobj, &msg, &ao,
+        if (vm_getargs(fr, "<*>[<*><*>!]{|i}:sendto", &skobj, &msg, &ao,
                         STRCONST_ID(flags), &flags) == RES_ERROR) {
                 return ErrorVar;
         }
@@ -923,6 +1012,7 @@ static const struct type_method_t socket_methods[] = {
         {"listen",   do_listen},
         {"recv",     do_recv},
         {"recvfrom", do_recvfrom},
+        {"recv_into", do_recv_into},
         {"send",     do_send},
         {"sendto",   do_sendto},
         {"close",    do_close},
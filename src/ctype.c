@@ -3,25 +3,53 @@
  * Thus far they only manage ASCII chars.
  */
 #include <evilcandy/evc_ctype.h>
-#include <ctype.h>
 
-bool evc_isalnum(unsigned long c) { return c < 128 && isalnum(c); }
-bool evc_isalpha(unsigned long c) { return c < 128 && isalpha(c); }
-bool evc_isdigit(unsigned long c) { return c < 128 && isdigit(c); }
-bool evc_isprint(unsigned long c) { return c < 128 && isprint(c); }
-bool evc_isspace(unsigned long c) { return c < 128 && isspace(c); }
-bool evc_isupper(unsigned long c) { return c < 128 && isupper(c); }
-bool evc_islower(unsigned long c) { return c < 128 && islower(c); }
-bool evc_isgraph(unsigned long c) { return c < 128 && isgraph(c); }
+#define S  EVC_CT_SPACE
+#define PG (EVC_CT_PRINT | EVC_CT_GRAPH)
+#define SP (EVC_CT_SPACE | EVC_CT_PRINT)
+#define D  (EVC_CT_DIGIT | PG)
+#define U  (EVC_CT_UPPER | PG)
+#define L  (EVC_CT_LOWER | PG)
+
+/*
+ * Same as the C locale's <ctype.h>, but as a table so the string code
+ * can test whole ASCII buffers without a function call per character.
+ */
+const unsigned char evc_ascii_ctype[128] = {
+        0,  0,  0,  0,  0,  0,  0,  0,  0,  S,  S,  S,  S,  S,  0,  0,
+        0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+        SP, PG, PG, PG, PG, PG, PG, PG, PG, PG, PG, PG, PG, PG, PG, PG,
+        D,  D,  D,  D,  D,  D,  D,  D,  D,  D,  PG, PG, PG, PG, PG, PG,
+        PG, U,  U,  U,  U,  U,  U,  U,  U,  U,  U,  U,  U,  U,  U,  U,
+        U,  U,  U,  U,  U,  U,  U,  U,  U,  U,  U,  PG, PG, PG, PG, PG,
+        PG, L,  L,  L,  L,  L,  L,  L,  L,  L,  L,  L,  L,  L,  L,  L,
+        L,  L,  L,  L,  L,  L,  L,  L,  L,  L,  L,  PG, PG, PG, PG, 0,
+};
+
+#undef S
+#undef PG
+#undef SP
+#undef D
+#undef U
+#undef L
+
+bool evc_isalnum(unsigned long c) { return evc_isctype(c, EVC_CT_ALNUM); }
+bool evc_isalpha(unsigned long c) { return evc_isctype(c, EVC_CT_ALPHA); }
+bool evc_isdigit(unsigned long c) { return evc_isctype(c, EVC_CT_DIGIT); }
+bool evc_isprint(unsigned long c) { return evc_isctype(c, EVC_CT_PRINT); }
+bool evc_isspace(unsigned long c) { return evc_isctype(c, EVC_CT_SPACE); }
+bool evc_isupper(unsigned long c) { return evc_isctype(c, EVC_CT_UPPER); }
+bool evc_islower(unsigned long c) { return evc_isctype(c, EVC_CT_LOWER); }
+bool evc_isgraph(unsigned long c) { return evc_isctype(c, EVC_CT_GRAPH); }
 
 unsigned long
 evc_toupper(unsigned long c)
 {
-        return c < 128 ? toupper(c) : c;
+        return evc_isctype(c, EVC_CT_LOWER) ? c - 'a' + 'A' : c;
 }
 
 unsigned long
 evc_tolower(unsigned long c)
 {
-        return c < 128 ? tolower(c) : c;
+        return evc_isctype(c, EVC_CT_UPPER) ? c - 'A' + 'a' : c;
 }
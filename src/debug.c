@@ -281,6 +281,30 @@ close:
         fclose(fpin);
 }
 
+/* Print one line of a traceback, and the source line it names */
+static void
+print_trace_line(FILE *fp, ssize_t layer, bool outermost,
+                 Object *fname_obj, const char *filename, int line,
+                 bool print_lines)
+{
+        const char *funcname;
+
+        print_trace_chars(fp, layer);
+
+        if (fname_obj)
+                funcname = string_cstring(fname_obj);
+        else
+                funcname = "<anonymous>";
+        if (!outermost)
+                fprintf(fp, "called from %s ", funcname);
+        else
+                fprintf(fp, "in function %s ", funcname);
+
+        fprintf(fp, "in file %s line %d\n", filename, line);
+        if (print_lines && filename[0] != '<')
+                print_err_line(fp, filename, line, layer);
+}
+
 /**
  * debug_print_trace - Print trace of locations, used for
  *                     error messages.
@@ -294,7 +318,7 @@ close:
 void
 debug_print_trace(Object *dbg, FILE *fp, bool print_lines)
 {
-        ssize_t i, n;
+        ssize_t i, n, inlined = 0;
 
         /* print nothing */
         if (!debug_error)
@@ -305,11 +329,12 @@ debug_print_trace(Object *dbg, FILE *fp, bool print_lines)
 
         n = seqvar_size(dbg);
         for (i = n - 1; i >= 0; i--) {
-                Object *tup, *instr_offs, *xptr, *fname_obj;
+                Object *tup, *instr_offs, *xptr;
                 struct xptrvar_t *ex;
                 struct location_t locations;
-                const char *funcname, *filename;
-                ssize_t layer = n - 1 - i;
+                const char *filename;
+                long long offs;
+                int j, line;
 
                 tup = tuple_borrowitem(dbg, i);
                 if (!isvar_tuple(tup))
@@ -326,36 +351,38 @@ debug_print_trace(Object *dbg, FILE *fp, bool print_lines)
                 }
 
                 ex = (struct xptrvar_t *)xptr;
+                offs = intvar_toll(instr_offs);
                 if (location_unpack(ex->locations,
                                     ex->locations_size,
-                                    intvar_toll(instr_offs),
-                                    &locations) == RES_ERROR) {
+                                    offs, &locations) == RES_ERROR) {
                         /* anything else we print is likely unreliable */
                         goto bail;
                 }
 
-                print_trace_chars(fp, layer);
-
-                fname_obj = ex->funcname;
-                if (fname_obj)
-                        funcname = string_cstring(fname_obj);
-                else
-                        funcname = "<anonymous>";
-                if (i > 0)
-                        fprintf(fp, "called from %s ", funcname);
-                else
-                        fprintf(fp, "in function %s ", funcname);
-
                 filename = ex->file_name;
                 if (!filename)
                         filename = "<unnamed>";
-                fprintf(fp, "in file %s line %d\n", filename,
-                        (int)locations.loc_startline);
-                if (print_lines && filename[0] != '<') {
-                        print_err_line(fp, filename,
-                                       locations.loc_startline,
-                                       layer);
+
+                /*
+                 * If the error is in a call that the assembler pasted
+                 * in, print the calls it would have made, innermost
+                 * first.
+                 */
+                line = locations.loc_startline;
+                for (j = ex->n_inlined - 1; j >= 0; j--) {
+                        struct xptr_inline_t *inl = &ex->inlined[j];
+                        if (offs < inl->start || offs >= inl->end)
+                                continue;
+                        print_trace_line(fp, n - 1 - i + inlined, false,
+                                         inl->funcname, filename, line,
+                                         print_lines);
+                        line = inl->line;
+                        inlined++;
                 }
+
+                print_trace_line(fp, n - 1 - i + inlined, i == 0,
+                                 ex->funcname, filename, line,
+                                 print_lines);
         }
         return;
 
@@ -8,6 +8,7 @@
 #include <evilcandy/disassemble.h>
 #include <internal/token.h>
 #include <internal/instruction_name.h>
+#include <internal/superinstr.h>
 #include <internal/types/xptr.h>
 #include <internal/types/string.h>
 #include <internal/types/sequential_types.h>
@@ -31,6 +32,7 @@ static const char *ATTR_NAMES[] = {
 static const char *PTR_NAMES[] = {
         IARGP(FP),
         IARGP(CP),
+        IARGP(COPY),
 };
 
 static const char *POP_NAMES[] = {
@@ -156,6 +158,10 @@ static void
 dump_rodata(FILE *fp, struct xptrvar_t *ex)
 {
         int i;
+
+        /* xptrvar_new() leaves this NULL if there are no consts */
+        if (!ex->rodata)
+                return;
         for (i = 0; i < seqvar_size(ex->rodata); i++) {
                 fprintf(fp, ".rodata ");
                 print_rodata_str(fp, ex, i, false);
@@ -199,7 +205,9 @@ disinstr(FILE *fp, struct xptrvar_t *ex, unsigned int i,
         size_t len = 0;
         const char *argname;
 
-        instruction_t *ii = &ex->instr[i];
+        /* Show the plain instructions, so this can be reassembled */
+        instruction_t plain = superinstr_unfuse(ex->instr[i]);
+        instruction_t *ii = &plain;
         if (label >= 0) {
                 putc('\n', fp);
                 fprintf(fp, "%d:\n", label);
@@ -216,6 +224,11 @@ disinstr(FILE *fp, struct xptrvar_t *ex, unsigned int i,
         switch (ii->code) {
         case INSTR_ASSIGN_LOCAL:
         case INSTR_LOAD_LOCAL:
+        case INSTR_STORE_FAST:
+        case INSTR_LOAD_FAST:
+        case INSTR_STORE_CELL:
+        case INSTR_LOAD_CELL:
+        case INSTR_ADD_CLOSURE:
                 argname = SAFE_NAME(PTR, ii->arg1);
                 break;
         case INSTR_CMP:
@@ -253,7 +266,9 @@ disinstr(FILE *fp, struct xptrvar_t *ex, unsigned int i,
                         print_rodata_str(fp, ex, ii->arg2, true);
                 } else if (ex->names && ii->arg1 == IARG_PTR_FP &&
                            (ii->code == INSTR_LOAD_LOCAL ||
-                            ii->code == INSTR_ASSIGN_LOCAL)) {
+                            ii->code == INSTR_ASSIGN_LOCAL ||
+                            ii->code == INSTR_LOAD_FAST ||
+                            ii->code == INSTR_STORE_FAST)) {
                         Object *name = tuple_borrowitem_(ex->names, ii->arg2);
                         if (name) {
                                 if (len < COMNTPOS)
@@ -299,6 +314,7 @@ disassemble_recursive(FILE *fp, struct xptrvar_t *ex, unsigned int flags)
         size_t nlabel;
         short *labels = NULL;
 
+        xptr_ready(ex);
         fprintf(fp, ".start <%p>\n", (void *)ex);
         if (!!(flags & DF_VERBOSE)) {
                 if (ex->funcname) {
@@ -307,6 +323,8 @@ disassemble_recursive(FILE *fp, struct xptrvar_t *ex, unsigned int flags)
                 }
                 fprintf(fp, "# in file \"%s\"\n", ex->file_name);
                 fprintf(fp, "# starting at line %d\n", ex->file_line);
+                fprintf(fp, "# %d locals, max stack depth %d\n",
+                        ex->n_locals, ex->max_stack);
                 labels = build_labels(ex, &nlabel);
         } else {
                 labels = NULL;
@@ -323,6 +341,8 @@ disassemble_recursive(FILE *fp, struct xptrvar_t *ex, unsigned int flags)
         dump_rodata(fp, ex);
         fprintf(fp, ".end\n\n\n");
 
+        if (!ex->rodata)
+                return;
         for (i = 0; i < seqvar_size(ex->rodata); i++) {
                 Object *v = tuple_borrowitem_(ex->rodata, i);
                 if (isvar_xptr(v)) {
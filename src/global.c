@@ -112,6 +112,10 @@ initialize_string_consts(void)
                 STRCONST_CSTR(tell),
                 STRCONST_CSTR(seek),
                 STRCONST_CSTR(call_trace),
+                STRCONST_CSTR(__slots__),
+                STRCONST_CSTR(key),
+                STRCONST_CSTR(reverse),
+                STRCONST_CSTR(maxlen),
                 [STRCONST_IDX_spc] = " ",
                 [STRCONST_IDX_mpty] = "",
                 [STRCONST_IDX_wtspc] = " \r\n\t\v\f",
@@ -6,6 +6,11 @@
 #include <ctype.h>
 #include <string.h>
 #include <stdarg.h>
+#if defined(__AVX2__)
+# include <immintrin.h>
+#elif defined(__SSE2__)
+# include <emmintrin.h>
+#endif
 
 /**
  * x2bin - interpret a hex char
@@ -184,7 +189,7 @@ memmem(const void *haystack, size_t hlen,
         if (!nlen)
                 return NULL;
 
-        while (hlen > nlen) {
+        while (hlen >= nlen) {
                 if (!memcmp(haystack, needle, nlen))
                         return (void *)haystack;
                 hlen--;
@@ -203,7 +208,7 @@ memrmem(const void *haystack, size_t hlen,
         const void *needle, size_t nlen)
 {
         const void *end;
-        if (!nlen)
+        if (!nlen || nlen > hlen)
                 return NULL;
 
         end = voidp_add(haystack, hlen - nlen);
@@ -265,52 +270,133 @@ slide(const char *src, const char *sep)
 bool
 mem_is_ascii(const void *p, size_t size)
 {
-        const void *tmp_end, *true_end;
-        size_t tlen;
-
-        /* XXX: awfully involved, only faster if @size is very long */
-        true_end = voidp_add(p, size);
-        tlen = (size_t)p;
-        tlen &= (ALIGN - 1);
-        if (tlen)
-                tlen = ALIGN - tlen;
+        return mem_find_nonascii(p, size) == size;
+}
 
-        if (tlen > size)
-                tlen = size;
+/**
+ * mem_find_nonascii - Find the first byte in @p with its high bit set
+ * @p:          Buffer to scan
+ * @size:       Size of @p in bytes
+ *
+ * This is the hot path for nearly every decode, so it scans 32 or 16
+ * bytes at a time when built with AVX2 or SSE2 support, and one long
+ * at a time otherwise.  The vector and SWAR loops only detect which
+ * block has the non-ASCII byte; the byte loop at the end pins it down.
+ *
+ * Return: Index of the first non-ASCII byte, or @size if all of @p is
+ *         ASCII.
+ */
+size_t
+mem_find_nonascii(const void *p, size_t size)
+{
+        const unsigned char *s = p;
+        size_t i = 0;
 
-        tmp_end = voidp_add(p, tlen);
-        while (p < tmp_end) {
-                if ((*(unsigned char *)p & 0x80) != 0)
-                        return false;
-                voidp_incr(&p);
+#if defined(__AVX2__)
+        for (; i + 32 <= size; i += 32) {
+                __m256i v = _mm256_loadu_si256((const __m256i *)&s[i]);
+                if (_mm256_movemask_epi8(v) != 0)
+                        break;
         }
-
-        tmp_end = voidp_add(true_end, -ALIGN);
-        while (p < tmp_end) {
-                if ((*(unsigned long *)p & ASCIILONG) != 0)
-                        return false;
-                p = voidp_add(p, ALIGN);
+#endif
+#if defined(__SSE2__)
+        for (; i + 16 <= size; i += 16) {
+                __m128i v = _mm_loadu_si128((const __m128i *)&s[i]);
+                if (_mm_movemask_epi8(v) != 0)
+                        break;
         }
-
-        while (p < true_end) {
-                if ((*(unsigned char *)p & 0x80) != 0)
-                        return false;
-                voidp_incr(&p);
+#endif
+        for (; i + ALIGN <= size; i += ALIGN) {
+                unsigned long v;
+                /* memcpy, not a cast, @p need not be aligned */
+                memcpy(&v, &s[i], ALIGN);
+                if ((v & ASCIILONG) != 0)
+                        break;
+        }
+        for (; i < size; i++) {
+                if ((s[i] & 0x80) != 0)
+                        break;
         }
-        return true;
+        return i;
 }
 
-size_t
-mem_find_nonascii(const void *p, size_t size)
+/**
+ * mem_ascii_case - Change the case of letters in an ASCII buffer
+ * @dst:        Buffer to write to, at least @size bytes
+ * @src:        Buffer to read from, which must be all ASCII
+ * @size:       Size of @src
+ * @flags:      ASCII_TOLOWER to lowercase upper-case letters,
+ *              ASCII_TOUPPER to uppercase lower-case letters, or both
+ *              to swap them.
+ *
+ * Since ASCII letters only differ by case in bit 5, this flips that bit
+ * for every letter that needs it, a vector or long at a time.
+ */
+void
+mem_ascii_case(void *dst, const void *src, size_t size, unsigned int flags)
 {
-        const void *start = p;
-        const void *end = voidp_add(p, size);
-        while (p < end) {
-                if ((*(unsigned char *)p & 0x80) != 0)
-                        break;
-                voidp_incr(&p);
+        const unsigned char *s = src;
+        unsigned char *d = dst;
+        size_t i = 0;
+
+#if defined(__SSE2__)
+        {
+                const __m128i bit5 = _mm_set1_epi8(0x20);
+                __m128i ulo, uhi, llo, lhi;
+
+                /* compare is signed, but ASCII is never negative */
+                ulo = _mm_set1_epi8(!!(flags & ASCII_TOLOWER) ? 'A' - 1 : 127);
+                uhi = _mm_set1_epi8('Z' + 1);
+                llo = _mm_set1_epi8(!!(flags & ASCII_TOUPPER) ? 'a' - 1 : 127);
+                lhi = _mm_set1_epi8('z' + 1);
+                for (; i + 16 <= size; i += 16) {
+                        __m128i v, m;
+                        v = _mm_loadu_si128((const __m128i *)&s[i]);
+                        m = _mm_or_si128(
+                                _mm_and_si128(_mm_cmpgt_epi8(v, ulo),
+                                              _mm_cmplt_epi8(v, uhi)),
+                                _mm_and_si128(_mm_cmpgt_epi8(v, llo),
+                                              _mm_cmplt_epi8(v, lhi)));
+                        v = _mm_xor_si128(v, _mm_and_si128(m, bit5));
+                        _mm_storeu_si128((__m128i *)&d[i], v);
+                }
+        }
+#endif
+        {
+                /*
+                 * Adding (0x80 - lo) sets a byte's high bit if it's >= lo,
+                 * adding (0x80 - hi - 1) sets it if it's > hi.  No byte
+                 * is over 0x7f, so the adds never carry into the next.
+                 */
+                const unsigned long ones = ASCIILONG / 0x80;
+                unsigned long ulo = 0, uhi = 0, llo = 0, lhi = 0;
+                if (!!(flags & ASCII_TOLOWER)) {
+                        ulo = ones * (0x80 - 'A');
+                        uhi = ones * (0x80 - 'Z' - 1);
+                }
+                if (!!(flags & ASCII_TOUPPER)) {
+                        llo = ones * (0x80 - 'a');
+                        lhi = ones * (0x80 - 'z' - 1);
+                }
+                for (; i + ALIGN <= size; i += ALIGN) {
+                        unsigned long v, m = 0;
+                        memcpy(&v, &s[i], ALIGN);
+                        if (ulo)
+                                m |= (v + ulo) & ~(v + uhi);
+                        if (llo)
+                                m |= (v + llo) & ~(v + lhi);
+                        v ^= (m & ASCIILONG) >> 2;
+                        memcpy(&d[i], &v, ALIGN);
+                }
+        }
+        for (; i < size; i++) {
+                unsigned char c = s[i];
+                if ((!!(flags & ASCII_TOLOWER) && c >= 'A' && c <= 'Z')
+                    || (!!(flags & ASCII_TOUPPER) && c >= 'a' && c <= 'z')) {
+                        c ^= 0x20;
+                }
+                d[i] = c;
         }
-        return (size_t)((char *)p - (char *)start);
 }
 
 #undef ALIGN
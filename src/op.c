@@ -41,6 +41,12 @@ get_binop_method(Object *a, Object *b)
         if (at == bt)
                 return at->opm;
 
+        /* numarrays and such, which do math with numbers */
+        if (!!(at->flags & OBF_BROADCAST) && isvar_real(b))
+                return at->opm;
+        if (!!(bt->flags & OBF_BROADCAST) && isvar_real(a))
+                return bt->opm;
+
         if (!isvar_number(a) || !isvar_number(b))
                 return NULL;
 
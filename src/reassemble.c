@@ -124,14 +124,26 @@ parse_opcodes(struct reassemble_t *ra, const char *pc)
                 return -1;
         }
 
-        if ((code == INSTR_ASSIGN_LOCAL || code == INSTR_LOAD_LOCAL) &&
-            arg1 == IARG_PTR_FP) {
-                int idx = arg2;
+        switch (code) {
+        case INSTR_ASSIGN_LOCAL:
+        case INSTR_LOAD_LOCAL:
+        case INSTR_STORE_FAST:
+        case INSTR_LOAD_FAST:
+        case INSTR_ADD_CLOSURE:
+                if (arg1 == IARG_PTR_CP)
+                        break;
+                /* fall through */
+        case INSTR_RANGE_ITER: {
+                int idx = code == INSTR_RANGE_ITER ? arg1 : arg2;
                 int max = ra->a->fr->af_nlocals;
                 if (idx < 0)
                         goto err;
                 if (idx >= max)
                         ra->a->fr->af_nlocals = idx + 1;
+                break;
+        }
+        default:
+                break;
         }
 
         assemble_add_instr(ra->a, code, arg1, arg2);
@@ -448,6 +460,9 @@ reassemble(struct assemble_t *a)
         ssize_t nread;
         int havefunc;
 
+        /* This was optimized when it was first assembled */
+        a->lazy = false;
+
         ra.a = a;
         ra.fp = a->fp;
         ra.lineno = 0;
@@ -0,0 +1,554 @@
+/*
+ * sort.c - Stable sort for arrays of objects
+ *
+ * This is a natural merge sort in the style of TimSort: the input is cut
+ * into runs which are already ascending or strictly descending (the
+ * latter are reversed in place), short runs are extended with a binary
+ * insertion sort, and the runs are merged using the "powersort" policy
+ * to decide which neighbors to merge first.  Presorted or reversed
+ * input is a single run, so it costs only n - 1 comparisons.
+ *
+ * Before sorting, the keys are scanned.  If they are all ints, all
+ * floats, or all strings, a comparison function specific to that type
+ * is used, which skips var_compare()'s type dispatch and can never
+ * fail.  Otherwise var_compare() is used, and the sort stops at the
+ * first error.  Even then the array is left holding the same objects
+ * it started with, only in some partially-sorted order.
+ *
+ * The merge is a plain one, without TimSort's "galloping" mode, except
+ * that before each merge, a binary search trims off the beginning of
+ * the left run and the end of the right run, which are already where
+ * they belong.
+ */
+#include <evilcandy/debug.h>
+#include <evilcandy/ewrappers.h>
+#include <evilcandy/var.h>
+#include <internal/sort.h>
+#include <internal/type_registry.h>
+#include <internal/types/number_types.h>
+#include <internal/types/string.h>
+
+#include <string.h>
+
+/* Runs shorter than this are extended with insertion sort */
+#define SORT_MIN_MERGE  64
+
+/*
+ * Most runs waiting to be merged.  Powersort keeps the runs' powers
+ * strictly increasing from the bottom of the stack, and a power can't
+ * exceed the number of bits in size_t, so this can never overflow.
+ */
+#define SORT_MAX_PENDING (sizeof(size_t) * 8 + 1)
+
+/*
+ * Return 1 if a < b, 0 if not, or -1 if they can't be compared, in
+ * which case an exception has been set.
+ */
+typedef int (*sort_lt_t)(Object *a, Object *b);
+
+struct sort_run_t {
+        size_t base;
+        size_t len;
+        int power;
+};
+
+/**
+ * struct sort_state_t - State of one call to sort_objects()
+ * @keys:       Objects being compared
+ * @vals:       Objects being sorted by @keys, moved along with them, or
+ *              NULL if the objects are their own keys.
+ * @n:          Length of @keys and @vals
+ * @lt:         Comparison function picked for @keys
+ * @tmp:        Merge buffer.  If @vals is non-NULL, the first half of it
+ *              is for keys and the second half is for values.
+ * @tmp_size:   Number of elements in each half of @tmp
+ * @runs:       Stack of runs not yet merged
+ * @n_runs:     Number of runs in @runs
+ */
+struct sort_state_t {
+        Object **keys;
+        Object **vals;
+        size_t n;
+        sort_lt_t lt;
+        Object **tmp;
+        size_t tmp_size;
+        struct sort_run_t runs[SORT_MAX_PENDING];
+        int n_runs;
+};
+
+/* **********************************************************************
+ *                      Comparison functions
+ ***********************************************************************/
+
+static int
+sort_lt_int(Object *a, Object *b)
+{
+        return intvar_toll(a) < intvar_toll(b);
+}
+
+static int
+sort_lt_float(Object *a, Object *b)
+{
+        return floatvar_tod(a) < floatvar_tod(b);
+}
+
+/*
+ * UTF-8 preserves code-point order, so a byte-wise compare is correct
+ * for any two strings, ASCII or not.  This matches string_cmp().
+ */
+static int
+sort_lt_string(Object *a, Object *b)
+{
+        size_t na = string_nbytes(a);
+        size_t nb = string_nbytes(b);
+        int cmp;
+
+        cmp = memcmp(string_cstring(a), string_cstring(b),
+                     na < nb ? na : nb);
+        return cmp ? cmp < 0 : na < nb;
+}
+
+static int
+sort_lt_generic(Object *a, Object *b)
+{
+        int cmp;
+
+        if (var_compare(a, b, &cmp) == RES_ERROR)
+                return -1;
+        return cmp < 0;
+}
+
+static sort_lt_t
+sort_pick_lt(Object **keys, size_t n)
+{
+        struct type_t *tp = keys[0]->v_type;
+        size_t i;
+
+        for (i = 1; i < n; i++) {
+                if (keys[i]->v_type != tp)
+                        return sort_lt_generic;
+        }
+        if (tp == &IntType)
+                return sort_lt_int;
+        if (tp == &FloatType)
+                return sort_lt_float;
+        if (tp == &StringType)
+                return sort_lt_string;
+        return sort_lt_generic;
+}
+
+/* **********************************************************************
+ *                      Moving keys and values
+ ***********************************************************************/
+
+static inline Object **
+sort_tmpvals(struct sort_state_t *st)
+{
+        return st->tmp + st->tmp_size;
+}
+
+static void
+sort_reserve(struct sort_state_t *st, size_t need)
+{
+        if (need <= st->tmp_size)
+                return;
+        if (st->tmp)
+                efree(st->tmp);
+        st->tmp_size = need;
+        st->tmp = emalloc(need * (st->vals ? 2 : 1) * sizeof(Object *));
+}
+
+static void
+sort_reverse(struct sort_state_t *st, size_t lo, size_t hi)
+{
+        Object *t;
+
+        while (lo + 1 < hi) {
+                hi--;
+                t = st->keys[lo];
+                st->keys[lo] = st->keys[hi];
+                st->keys[hi] = t;
+                if (st->vals) {
+                        t = st->vals[lo];
+                        st->vals[lo] = st->vals[hi];
+                        st->vals[hi] = t;
+                }
+                lo++;
+        }
+}
+
+/* **********************************************************************
+ *                      Runs and insertion sort
+ ***********************************************************************/
+
+/*
+ * Get the length of the run starting at @lo, reversing it first if it
+ * is descending.  Descending means strictly descending, so reversing it
+ * never swaps equal elements.  Return 0 if there was an error.
+ */
+static size_t
+sort_count_run(struct sort_state_t *st, size_t lo, size_t hi)
+{
+        Object **k = st->keys;
+        size_t i;
+        int r;
+
+        if (hi - lo < 2)
+                return hi - lo;
+
+        r = st->lt(k[lo + 1], k[lo]);
+        if (r < 0)
+                return 0;
+        if (r) {
+                for (i = lo + 2; i < hi; i++) {
+                        r = st->lt(k[i], k[i - 1]);
+                        if (r < 0)
+                                return 0;
+                        if (!r)
+                                break;
+                }
+                sort_reverse(st, lo, i);
+        } else {
+                for (i = lo + 2; i < hi; i++) {
+                        r = st->lt(k[i], k[i - 1]);
+                        if (r < 0)
+                                return 0;
+                        if (r)
+                                break;
+                }
+        }
+        return i - lo;
+}
+
+/*
+ * Sort [@lo, @hi) by inserting each of [@start, @hi) into the
+ * already-sorted [@lo, @start).
+ */
+static enum result_t
+sort_insertion(struct sort_state_t *st, size_t lo, size_t start, size_t hi)
+{
+        Object **k = st->keys;
+        Object **v = st->vals;
+        size_t i;
+
+        for (i = start; i < hi; i++) {
+                Object *pivot = k[i];
+                size_t l = lo, r = i;
+
+                /* find the first element greater than pivot */
+                while (l < r) {
+                        size_t m = l + (r - l) / 2;
+                        int res = st->lt(pivot, k[m]);
+                        if (res < 0)
+                                return RES_ERROR;
+                        if (res)
+                                r = m;
+                        else
+                                l = m + 1;
+                }
+                if (l == i)
+                        continue;
+
+                memmove(&k[l + 1], &k[l], (i - l) * sizeof(Object *));
+                k[l] = pivot;
+                if (v) {
+                        Object *pv = v[i];
+                        memmove(&v[l + 1], &v[l], (i - l) * sizeof(Object *));
+                        v[l] = pv;
+                }
+        }
+        return RES_OK;
+}
+
+/*
+ * Minimum run length for an array of @n elements: a number between
+ * SORT_MIN_MERGE / 2 and SORT_MIN_MERGE, chosen so @n divided by it is
+ * a power of two or a little less than one.  See Tim Peters's
+ * listsort.txt.
+ */
+static size_t
+sort_min_run(size_t n)
+{
+        size_t r = 0;
+
+        while (n >= SORT_MIN_MERGE) {
+                r |= n & 1;
+                n >>= 1;
+        }
+        return n + r;
+}
+
+/* **********************************************************************
+ *                              Merging
+ ***********************************************************************/
+
+/*
+ * Number of elements in sorted [@lo, @hi) which are less than or equal
+ * to @key (if @right) or less than @key (if not), or -1 if error.
+ */
+static ssize_t
+sort_search(struct sort_state_t *st, Object *key,
+            size_t lo, size_t hi, bool right)
+{
+        size_t l = lo, r = hi;
+
+        while (l < r) {
+                size_t m = l + (r - l) / 2;
+                int res = right ? st->lt(key, st->keys[m])
+                                : st->lt(st->keys[m], key);
+                if (res < 0)
+                        return -1;
+                if (res == right)
+                        r = m;
+                else
+                        l = m + 1;
+        }
+        return l - lo;
+}
+
+/*
+ * Merge [@a, @a + @na) with [@a + @na, @a + @na + @nb), where @na is
+ * the shorter one, by copying the left run out and merging from the
+ * front.  On error, the rest of the left run is copied back in, so
+ * nothing is lost.
+ */
+static enum result_t
+sort_merge_lo(struct sort_state_t *st, size_t a, size_t na, size_t nb)
+{
+        Object **k = st->keys, **v = st->vals;
+        Object **tk, **tv;
+        size_t pa = 0, pb = a + na, end = a + na + nb, dst = a;
+        enum result_t ret = RES_OK;
+
+        sort_reserve(st, na);
+        tk = st->tmp;
+        tv = sort_tmpvals(st);
+        memcpy(tk, &k[a], na * sizeof(Object *));
+        if (v)
+                memcpy(tv, &v[a], na * sizeof(Object *));
+
+        while (pa < na && pb < end) {
+                int res = st->lt(k[pb], tk[pa]);
+                if (res < 0) {
+                        ret = RES_ERROR;
+                        break;
+                }
+                if (res) {
+                        k[dst] = k[pb];
+                        if (v)
+                                v[dst] = v[pb];
+                        pb++;
+                } else {
+                        k[dst] = tk[pa];
+                        if (v)
+                                v[dst] = tv[pa];
+                        pa++;
+                }
+                dst++;
+        }
+        /* Whatever's left of the right run is already in place */
+        memcpy(&k[dst], &tk[pa], (na - pa) * sizeof(Object *));
+        if (v)
+                memcpy(&v[dst], &tv[pa], (na - pa) * sizeof(Object *));
+        return ret;
+}
+
+/* Same as sort_merge_lo, but @nb is the shorter one, so merge from the end */
+static enum result_t
+sort_merge_hi(struct sort_state_t *st, size_t a, size_t na, size_t nb)
+{
+        Object **k = st->keys, **v = st->vals;
+        Object **tk, **tv;
+        size_t b = a + na;
+        /* counts, not indexes, so they stop at zero */
+        size_t pa = na, pb = nb, dst = na + nb;
+        enum result_t ret = RES_OK;
+
+        sort_reserve(st, nb);
+        tk = st->tmp;
+        tv = sort_tmpvals(st);
+        memcpy(tk, &k[b], nb * sizeof(Object *));
+        if (v)
+                memcpy(tv, &v[b], nb * sizeof(Object *));
+
+        while (pa > 0 && pb > 0) {
+                int res = st->lt(tk[pb - 1], k[a + pa - 1]);
+                if (res < 0) {
+                        ret = RES_ERROR;
+                        break;
+                }
+                dst--;
+                if (res) {
+                        k[a + dst] = k[a + pa - 1];
+                        if (v)
+                                v[a + dst] = v[a + pa - 1];
+                        pa--;
+                } else {
+                        k[a + dst] = tk[pb - 1];
+                        if (v)
+                                v[a + dst] = tv[pb - 1];
+                        pb--;
+                }
+        }
+        /* Whatever's left of the left run is already in place */
+        memcpy(&k[a + pa], tk, pb * sizeof(Object *));
+        if (v)
+                memcpy(&v[a + pa], tv, pb * sizeof(Object *));
+        return ret;
+}
+
+/* Merge the runs at @i and @i + 1 of the stack */
+static enum result_t
+sort_merge_at(struct sort_state_t *st, int i)
+{
+        struct sort_run_t *ra = &st->runs[i];
+        struct sort_run_t *rb = &st->runs[i + 1];
+        size_t a = ra->base, na = ra->len;
+        size_t b = rb->base, nb = rb->len;
+        ssize_t skip;
+
+        bug_on(a + na != b);
+        ra->len = na + nb;
+        if (i == st->n_runs - 3)
+                st->runs[i + 1] = st->runs[i + 2];
+        st->n_runs--;
+
+        /* Elements of A not greater than B[0] are already in place */
+        skip = sort_search(st, st->keys[b], a, b, true);
+        if (skip < 0)
+                return RES_ERROR;
+        a += skip;
+        na -= skip;
+        if (na == 0)
+                return RES_OK;
+
+        /* Elements of B not less than A's last are already in place */
+        skip = sort_search(st, st->keys[b - 1], b, b + nb, false);
+        if (skip < 0)
+                return RES_ERROR;
+        nb = skip;
+        if (nb == 0)
+                return RES_OK;
+
+        if (na <= nb)
+                return sort_merge_lo(st, a, na, nb);
+        return sort_merge_hi(st, a, na, nb);
+}
+
+/*
+ * Powersort's "power" of the boundary between the run at @s1 of length
+ * @n1 and the one after it of length @n2: the depth of the node in a
+ * perfectly balanced merge tree where the midpoints of the two runs
+ * first fall on different sides.  See Munro & Wild, "Nearly-Optimal
+ * Mergesorts", 2018, or CPython's listsort.txt.
+ */
+static int
+sort_power(size_t s1, size_t n1, size_t n2, size_t n)
+{
+        /* twice the midpoints, so they're integers */
+        size_t a = 2 * s1 + n1;
+        size_t b = a + n1 + n2;
+        int power = 0;
+
+        for (;;) {
+                power++;
+                if (a >= n) {
+                        a -= n;
+                        b -= n;
+                } else if (b >= n) {
+                        break;
+                }
+                a <<= 1;
+                b <<= 1;
+        }
+        return power;
+}
+
+/* Push the run at @base of length @len, merging runs below it first */
+static enum result_t
+sort_push_run(struct sort_state_t *st, size_t base, size_t len)
+{
+        if (st->n_runs > 0) {
+                struct sort_run_t *top = &st->runs[st->n_runs - 1];
+                int power = sort_power(top->base, top->len, len, st->n);
+
+                while (st->n_runs > 1 &&
+                       st->runs[st->n_runs - 2].power > power) {
+                        if (sort_merge_at(st, st->n_runs - 2) == RES_ERROR)
+                                return RES_ERROR;
+                }
+                st->runs[st->n_runs - 1].power = power;
+        }
+        bug_on(st->n_runs >= SORT_MAX_PENDING);
+        st->runs[st->n_runs].base = base;
+        st->runs[st->n_runs].len = len;
+        st->runs[st->n_runs].power = 0;
+        st->n_runs++;
+        return RES_OK;
+}
+
+/**
+ * sort_objects - Stable sort an array of objects
+ * @items:      Objects to sort, in place
+ * @keys:       If non-NULL, @keys[i] is the sort key for @items[i], and
+ *              @keys is rearranged along with @items.  If NULL, the
+ *              items are their own keys.
+ * @n:          Number of items
+ *
+ * No references are produced or consumed, so the objects must not be
+ * touched by anyone else while this runs.
+ *
+ * Return: RES_ERROR if two keys could not be compared, in which case
+ * an exception has been set and @items (and @keys) are in some
+ * unspecified order.  RES_OK otherwise.
+ */
+enum result_t
+sort_objects(Object **items, Object **keys, size_t n)
+{
+        struct sort_state_t st;
+        size_t lo, min_run;
+        enum result_t ret = RES_OK;
+
+        if (n < 2)
+                return RES_OK;
+
+        st.keys = keys ? keys : items;
+        st.vals = keys ? items : NULL;
+        st.n = n;
+        st.lt = sort_pick_lt(st.keys, n);
+        st.tmp = NULL;
+        st.tmp_size = 0;
+        st.n_runs = 0;
+
+        min_run = sort_min_run(n);
+        for (lo = 0; lo < n; ) {
+                size_t len = sort_count_run(&st, lo, n);
+
+                if (len == 0)
+                        goto err;
+                if (len < min_run) {
+                        size_t force = n - lo < min_run ? n - lo : min_run;
+                        if (sort_insertion(&st, lo, lo + len,
+                                           lo + force) == RES_ERROR) {
+                                goto err;
+                        }
+                        len = force;
+                }
+                if (sort_push_run(&st, lo, len) == RES_ERROR)
+                        goto err;
+                lo += len;
+        }
+        while (st.n_runs > 1) {
+                if (sort_merge_at(&st, st.n_runs - 2) == RES_ERROR)
+                        goto err;
+        }
+
+out:
+        if (st.tmp)
+                efree(st.tmp);
+        return ret;
+
+err:
+        ret = RES_ERROR;
+        goto out;
+}
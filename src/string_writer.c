@@ -8,6 +8,7 @@
 #include <evilcandy/debug.h>
 #include <evilcandy/ewrappers.h>
 #include <lib/helpers.h>
+#include <lib/utf8.h>
 #include <string.h>
 
 static long
@@ -38,6 +39,59 @@ string_writer_init(struct string_writer_t *wr, size_t width)
         wr->pos = wr->pos_i = wr->n_alloc = 0;
 }
 
+/*
+ * Re-write what's been written so far at a larger width.  This should
+ * be rare; most callers know or can guess the width they need.
+ */
+static void
+string_writer_widen(struct string_writer_t *wr, size_t width)
+{
+        struct string_writer_t wr2;
+        size_t i;
+
+        bug_on(width <= wr->width);
+
+        string_writer_init(&wr2, width);
+        wr2.n_alloc = wr->pos_i * width;
+        if (wr2.n_alloc)
+                wr2.p.p = emalloc(wr2.n_alloc);
+        for (i = 0; i < wr->pos_i; i++) {
+                unsigned long oldchar;
+                switch (wr->width) {
+                case 1:
+                        oldchar = wr->p.u8[i];
+                        break;
+                case 2:
+                        oldchar = wr->p.u16[i];
+                        break;
+                default:
+                        bug();
+                        return;
+                }
+                if (width == 2)
+                        wr2.p.u16[i] = oldchar;
+                else
+                        wr2.p.u32[i] = oldchar;
+        }
+        wr2.pos_i = wr->pos_i;
+        wr2.pos = wr->pos_i * width;
+        if (wr->p.p)
+                efree(wr->p.p);
+        memcpy(wr, &wr2, sizeof(wr2));
+}
+
+/* Make sure there is room for @n more points without reallocating */
+static void
+string_writer_reserve(struct string_writer_t *wr, size_t n)
+{
+        size_t need_size = wr->pos + n * wr->width;
+        if (need_size > wr->n_alloc) {
+                need_size = (need_size + 63) & ~((size_t)63);
+                wr->p.p = erealloc(wr->p.p, need_size);
+                wr->n_alloc = need_size;
+        }
+}
+
 /**
  * string_writer_get_ascii - fill leading characters of @buf into
  *                      @wr if they are ASCII.
@@ -53,7 +107,6 @@ string_writer_get_ascii(struct string_writer_t *wr,
 {
         size_t n_ascii;
 
-        /* XXX: faster to do in loop below? */
         n_ascii = mem_find_nonascii(buf, max);
         if (!n_ascii)
                 return 0;
@@ -66,12 +119,7 @@ string_writer_get_ascii(struct string_writer_t *wr,
                  * n_alloc bytes, caller will ultimately stuff at minimum
                  * @max bytes.
                  */
-                size_t need_size = wr->pos + max;
-                if (need_size > wr->n_alloc) {
-                        need_size = (need_size + 63) & ~((size_t)63);
-                        wr->p.p = erealloc(wr->p.p, need_size);
-                        wr->n_alloc = need_size;
-                }
+                string_writer_reserve(wr, max);
                 memcpy(voidp_add(wr->p.p, wr->pos), buf, n_ascii);
                 wr->pos += n_ascii;
                 wr->pos_i = wr->pos;
@@ -103,41 +151,9 @@ string_writer_append(struct string_writer_t *wr, unsigned long c)
                  * Ugh, need to resize.  This should only occur from
                  * string_parse, when we're loading a source file.
                  */
-                struct string_writer_t wr2;
-                size_t width;
-                size_t i;
-
                 bug_on(c > 0x10fffful);
-
-                if (c > 0xfffful) {
-                        width = 4;
-                } else if (c > 0xfful) {
-                        width = 2;
-                } else{
-                        bug();
-                        return;
-                }
-
-                string_writer_init(&wr2, width);
-                for (i = 0; i < wr->pos_i; i++) {
-                        unsigned long oldchar;
-                        switch (wr->width) {
-                        case 1:
-                                oldchar = wr->p.u8[i];
-                                break;
-                        case 2:
-                                oldchar = wr->p.u16[i];
-                                break;
-                        default:
-                                bug();
-                                return;
-                        }
-                        string_writer_append(&wr2, oldchar);
-                }
-                if (wr->p.p)
-                        efree(wr->p.p);
-                bug_on(wr->pos_i != wr2.pos_i);
-                memcpy(wr, &wr2, sizeof(wr2));
+                bug_on(c <= 0xfful);
+                string_writer_widen(wr, c > 0xfffful ? 4 : 2);
                 /* fall through, we still have to write c */
         }
 
@@ -165,6 +181,68 @@ string_writer_append(struct string_writer_t *wr, unsigned long c)
         wr->pos += wr->width;
 }
 
+/**
+ * string_writer_append_utf8 - Append already-validated UTF-8 text
+ * @wr:         Writer to append to
+ * @buf:        UTF-8 text which has been checked by utf8_scan()
+ * @nbytes:     Size of @buf in bytes
+ * @npoints:    Number of points in @buf, from utf8_scan()
+ * @maxchr:     Largest point in @buf, from utf8_scan()
+ *
+ * Since the width and size are known ahead of time, @wr is resized at
+ * most once, and nothing is checked per-character.  Pure-ASCII text
+ * going into a width-1 writer is just a memcpy.
+ */
+void
+string_writer_append_utf8(struct string_writer_t *wr, const void *buf,
+                          size_t nbytes, size_t npoints,
+                          unsigned long maxchr)
+{
+        const unsigned char *s, *end;
+        size_t i;
+
+        if (maxchr > wr->maxchr)
+                string_writer_widen(wr, maxchr > 0xfffful ? 4 : 2);
+        string_writer_reserve(wr, npoints);
+
+        s = buf;
+        end = s + nbytes;
+        i = wr->pos_i;
+        if (wr->width == 1) {
+                if (npoints == nbytes) {
+                        memcpy(&wr->p.u8[i], s, nbytes);
+                        i += nbytes;
+                } else {
+                        while (s < end) {
+                                size_t nascii = mem_find_nonascii(s, end - s);
+                                memcpy(&wr->p.u8[i], s, nascii);
+                                i += nascii;
+                                s += nascii;
+                                if (s < end)
+                                        wr->p.u8[i++] = utf8_decode_valid(&s);
+                        }
+                }
+        } else if (wr->width == 2) {
+                while (s < end) {
+                        if (*s < 0x80u)
+                                wr->p.u16[i++] = *s++;
+                        else
+                                wr->p.u16[i++] = utf8_decode_valid(&s);
+                }
+        } else {
+                bug_on(wr->width != 4);
+                while (s < end) {
+                        if (*s < 0x80u)
+                                wr->p.u32[i++] = *s++;
+                        else
+                                wr->p.u32[i++] = utf8_decode_valid(&s);
+                }
+        }
+        bug_on(i - wr->pos_i != npoints);
+        wr->pos_i = i;
+        wr->pos = i * wr->width;
+}
+
 /**
  * string_writer_appends - Append an ASCII C string.
  * @wr:   Writer to append to
@@ -234,6 +312,18 @@ string_writer_appendb(struct string_writer_t *wr,
         struct string_writer_t wr2;
         size_t i;
 
+        if (!len)
+                return;
+
+        if (width == wr->width) {
+                /* Fast path, same width means no conversion needed */
+                string_writer_reserve(wr, len);
+                memcpy(wr->p.u8 + wr->pos, buf, len * width);
+                wr->pos_i += len;
+                wr->pos += len * width;
+                return;
+        }
+
         /* Fill in just what we need for string_writer_getidx */
         wr2.width  = width;
         wr2.p.p    = (void *)buf;
@@ -225,7 +225,16 @@ strtod_scanonly(const char *s, int *may_be_int)
         struct string_reader_t rd;
         ssize_t nscanned;
 
-        string_reader_init_cstring(&rd, s);
+        /*
+         * Not string_reader_init_cstring(), because @s may be the rest
+         * of a whole file, and its strlen() would make the tokenizer
+         * quadratic.  Nothing past these characters can be part of the
+         * number anyway.
+         */
+        rd.dat = s;
+        rd.wid = 1;
+        rd.len = strspn(s, "0123456789.eE+-");
+        rd.pos = 0;
         /*
          * FIXME: We're assuming this is called from tokenizer, hence
          * interpret_enums is false, but that may not forever be the case.
@@ -0,0 +1,101 @@
+/*
+ * superinstr.c - Fuse runs of instructions into superinstructions
+ *
+ * DOC: Superinstructions
+ *
+ * A superinstruction does the work of two or three instructions that
+ * often run back to back, so the VM only has to dispatch once for all
+ * of them.  Which runs are common enough is found by profiling, see
+ * DBUG_PROFILE_OPCODES and tools/superinstructions.
+ *
+ * Only the first instruction's code is replaced.  The others stay
+ * where they are, and the superinstruction takes their arguments from
+ * there and steps the program counter past each one in turn.  So the
+ * code is the same length, the same branch offsets and location table
+ * still work, and anything that branches into the middle of a run
+ * lands on a real instruction.  An error in any part of it happens
+ * with the program counter right where it would have been without
+ * fusing, so it reports the same location.
+ *
+ * This is done after everything else in assemble_post.c, which only
+ * ever sees plain instructions.  The disassembler undoes it, so its
+ * output can be reassembled.
+ */
+#include <evilcandy/debug.h>
+#include <internal/superinstr.h>
+#include <lib/helpers.h>
+
+struct superinstr_t {
+        unsigned char code;
+        unsigned char n;
+        unsigned char seq[3];
+};
+
+static const struct superinstr_t SUPERINSTRUCTIONS[] = {
+#include "superinstr_gen.c.h"
+};
+
+/* tools/gen.c puts superinstructions after all the plain ones */
+#define FIRST_SUPERINSTR (N_INSTR - (int)ARRAY_SIZE(SUPERINSTRUCTIONS))
+
+/**
+ * superinstr_fuse - Replace runs of instructions with superinstructions
+ * @instr:      Finished instructions of a function
+ * @n_instr:    Number of instructions in @instr
+ */
+void
+superinstr_fuse(instruction_t *instr, size_t n_instr)
+{
+        size_t i, j, k;
+
+        /* Profile the plain instructions, not these */
+        if (DBUG_PROFILE_OPCODES)
+                return;
+
+        for (i = 0; i < n_instr; i++) {
+                const struct superinstr_t *sup = NULL;
+
+                /* first match wins, see tools/superinstructions */
+                for (j = 0; j < ARRAY_SIZE(SUPERINSTRUCTIONS); j++) {
+                        sup = &SUPERINSTRUCTIONS[j];
+                        if (i + sup->n > n_instr)
+                                continue;
+                        for (k = 0; k < sup->n; k++) {
+                                if (instr[i + k].code != sup->seq[k])
+                                        break;
+                        }
+                        if (k == sup->n)
+                                break;
+                }
+                if (j == ARRAY_SIZE(SUPERINSTRUCTIONS))
+                        continue;
+
+                instr[i].code = sup->code;
+                /*
+                 * The rest of the run won't be dispatched unless
+                 * something branches to it, so don't bother with it.
+                 */
+                i += sup->n - 1;
+        }
+}
+
+/**
+ * superinstr_unfuse - Get the plain instruction a superinstruction
+ *                     starts with
+ * @ii: Instruction, which may or may not be a superinstruction
+ *
+ * Return: @ii, with its code changed back if it was a superinstruction
+ */
+instruction_t
+superinstr_unfuse(instruction_t ii)
+{
+        if (ii.code >= FIRST_SUPERINSTR) {
+                const struct superinstr_t *sup;
+
+                bug_on(ii.code >= N_INSTR);
+                sup = &SUPERINSTRUCTIONS[ii.code - FIRST_SUPERINSTR];
+                bug_on(sup->code != ii.code);
+                ii.code = sup->seq[0];
+        }
+        return ii;
+}
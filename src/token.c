@@ -7,7 +7,6 @@
 #include <evilcandy/global.h>
 #include <evilcandy/types/bytes.h>
 #include <evilcandy/types/string.h>
-#include <evilcandy/types/set.h>
 #include <evilcandy/types/number_types.h>
 #include <internal/token.h>
 #include <internal/type_registry.h>
@@ -17,7 +16,9 @@
 #include <setjmp.h>
 #include <ctype.h>
 #include <string.h>
-#include <unistd.h> /* isatty */
+#include <unistd.h> /* isatty, sysconf */
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <internal/global.h> /* iatok definition */
 
 /*
@@ -57,19 +58,26 @@ enum {
  * struct token_state_t - Keep track of all the tokenize calls
  *                        for a given input stream.
  * @lineno:     Current line number in file.
- * @dedup:      Dictionary designed to eliminate duplicate strings,
- *              which are everywhere in a source file.
  * @tok:        Last parsed token, not literal()-ized yet.  Library use
- *              only.
+ *              only.  Empty if @tok_len is set.
+ * @tok_start:  Start of the last parsed token in the input, if its text
+ *              was left there instead of being copied into @tok
+ * @tok_len:    Length of the text at @tok_start, or zero if the text is
+ *              in @tok.  See tok_text().
  * @s:          Current pointer into @line, where to look for next token
  * @_slen:      Length of line buffer, for egetline calls
- * @line:       line buffer, for egetline calls
+ * @line:       line buffer, for egetline calls.  If @inp is TKINP_MMAP,
+ *              the start of the current line in @map instead.
+ * @map:        The whole file, if @inp is TKINP_MMAP.  See
+ *              token_map_file().
+ * @map_size:   Size of @map's mapping, in bytes
+ * @map_end:    End of the file's contents in @map
  * @fp:         File we're getting input from
  * @pgm:        Buffer struct containing array of parsed tokens
  * @ntok:       Number of tokens in @pgm
  * @nexttok:    Next token in @pgm to get with get_tok()
  * @eof:        True if @fp has reached EOF
- * @inp:        Type of input, file, tty, or string
+ * @inp:        Type of input, file, tty, string, or mapped file
  * @fstring:    single- or double-quote char if tokenizer is in the middle
  *              of an F-string, nullchar otherwise.
  * @env:        Jump buffer, USE ONLY IN THE tokenize_helper() CONTEXT!
@@ -80,12 +88,16 @@ enum {
  */
 struct token_state_t {
         int lineno;
-        Object *dedup;
         struct buffer_t fstring_tok;
         struct buffer_t tok;
+        const char *tok_start;
+        size_t tok_len;
         char *s;
         size_t _slen;
         char *line;
+        char *map;
+        size_t map_size;
+        char *map_end;
         FILE *fp;
         struct buffer_t pgm;
         int ntok;
@@ -95,6 +107,7 @@ struct token_state_t {
                 TKINP_FILE = 0,
                 TKINP_TTY,
                 TKINP_STRING,
+                TKINP_MMAP,
         } inp;
         char fstring;
         size_t fstring_pos;
@@ -132,6 +145,30 @@ tokc_isident1(int c)
         return (unsigned)c < 128 && (c == '_' || isalpha(c));
 }
 
+/*
+ * The tokenizer takes a nulchar to mean end of line, but a mapped file
+ * might have one before its end.  When reading a line at a time, the
+ * rest of that line is dropped, so do the same here: skip to the start
+ * of the next line, if there is one.
+ */
+static int
+tok_next_mapped_line(struct token_state_t *state)
+{
+        char *nul, *nl;
+
+        /* Scanning never goes past a nulchar, so it's the first one */
+        if (state->line >= state->map_end)
+                return -1;
+        nul = memchr(state->line, '\0', state->map_end - state->line);
+        if (!nul)
+                return -1;
+        nl = memchr(nul, '\n', state->map_end - nul);
+        if (!nl || nl + 1 >= state->map_end)
+                return -1;
+        state->line = nl + 1;
+        return state->map_end - state->line;
+}
+
 static int
 tok_next_line(struct token_state_t *state)
 {
@@ -152,6 +189,9 @@ tok_next_line(struct token_state_t *state)
         case TKINP_STRING:
                 res = -1;
                 break;
+        case TKINP_MMAP:
+                res = tok_next_mapped_line(state);
+                break;
         default:
                 bug();
         }
@@ -165,6 +205,32 @@ tok_next_line(struct token_state_t *state)
         return res;
 }
 
+/*
+ * A mapped file is one long string, so there's no tok_next_line() to
+ * count lines for us.  Call this when stepping past the newline at @nl.
+ */
+static inline void
+tok_newline(struct token_state_t *state, char *nl)
+{
+        if (state->inp == TKINP_MMAP) {
+                state->lineno++;
+                state->line = nl + 1;
+        }
+}
+
+/*
+ * Make sure @state->tok holds the text of the last token, copying it
+ * out of the input if it was left there.
+ */
+static void
+tok_text(struct token_state_t *state)
+{
+        if (state->tok_len) {
+                buffer_nputs_all(&state->tok, state->tok_start, state->tok_len);
+                state->tok_len = 0;
+        }
+}
+
 static int
 str_slide(struct token_state_t *state, struct buffer_t *tok,
           char *pc, const char *charset, bool rstring)
@@ -177,6 +243,8 @@ again:
                 /* XXX: portable behavior of strchr? */
                 bug_on(c == '\0');
                 buffer_putc(tok, c);
+                if (c == '\n')
+                        tok_newline(state, pc - 1);
 
                 /* make sure we don't misinterpret special chars */
                 if (clast != '\\' && c == '\\' &&
@@ -255,6 +323,37 @@ rstring_finish(struct token_state_t *state, char *pc, int q)
         return true;
 }
 
+/*
+ * If the string literal at state->s, quoted with @q, is all on one line
+ * and has nothing to interpret, leave its text in the input, and let
+ * tokenize() make the string straight out of it.  That's most string
+ * literals.  The input has to stay put until the next token, in case
+ * another literal is glued onto this one, so only do this when it's all
+ * in memory.
+ */
+static bool
+get_tok_plain_string(struct token_state_t *state, int q)
+{
+        const char *pc = state->s + 1;
+        int c;
+
+        if (state->inp != TKINP_MMAP && state->inp != TKINP_STRING)
+                return false;
+
+        while ((c = *pc) != q) {
+                if (c == '\0' || c == '\n' || c == '\\' ||
+                    (unsigned char)c > 127) {
+                        return false;
+                }
+                pc++;
+        }
+        pc++;
+        state->tok_start = state->s;
+        state->tok_len = pc - state->s;
+        state->s = (char *)pc;
+        return true;
+}
+
 /*
  * Get string literal, or return false if token is something different.
  * state->s points at first quote
@@ -269,12 +368,18 @@ get_tok_string(struct token_state_t *state)
                 if (!isquote(q))
                         return false;
 
+                tok_text(state);
                 buffer_putc(tok, q);
                 return rstring_finish(state, state->s + 2, q);
         } else if (!isquote(q)) {
                 return false;
         }
 
+        if (!state->tok_len && buffer_size(tok) == 0 &&
+            get_tok_plain_string(state, q)) {
+                return true;
+        }
+        tok_text(state);
         buffer_putc(tok, q);
         return str_or_bytes_finish(state, state->s + 1, q);
 }
@@ -330,8 +435,8 @@ get_tok_fstring(struct token_state_t *state)
         if (fstring_continue(state) == q) {
                 /*
                  * f-string without any conversion specifiers.
-                 * Do the {{ -> { stuff here, since FORMAT instruction
-                 * will not be used.
+                 * Do the {{ -> { stuff here, since the assembler
+                 * will never see this as an f-string.
                  */
                 const char *src = tok->s;
                 int c;
@@ -372,6 +477,8 @@ skip_comment(struct token_state_t *state)
                                 if (tok_next_line(state) == -1)
                                         token_errset(state, TE_UNTERM_COMMENT);
                                 pc = state->s;
+                        } else if (*pc == '\n') {
+                                tok_newline(state, pc);
                         }
                 } while (!(pc[0] == '*' && pc[1] == '/'));
                 state->s = pc + 2;
@@ -393,21 +500,35 @@ oneline:
 static bool
 get_tok_identifier(struct token_state_t *state)
 {
-        struct buffer_t *tok = &state->tok;
         char *pc = state->s;
         if (!tokc_isident1(*pc))
                 return false;
         while (tokc_isident(*pc))
-                buffer_putc(tok, *pc++);
+                pc++;
+        state->tok_start = state->s;
+        state->tok_len = pc - state->s;
         state->s = pc;
         return true;
 }
 
+/* Return OC_xxx if the identifier just parsed is a keyword, -1 if not */
+static int
+tok_keyword(struct token_state_t *state)
+{
+        /* longer than any keyword */
+        char kw[16];
+
+        if (state->tok_len >= sizeof(kw))
+                return -1;
+        memcpy(kw, state->tok_start, state->tok_len);
+        kw[state->tok_len] = '\0';
+        return token_kw_seek__(kw);
+}
+
 /* parse hex/binary int if token begins with '0x' or '0b' */
 static bool
 get_tok_int_hdr(struct token_state_t *state)
 {
-        struct buffer_t *tok = &state->tok;
         int count = 0;
         char *pc = state->s;
 
@@ -417,34 +538,34 @@ get_tok_int_hdr(struct token_state_t *state)
         switch (pc[1]) {
         case 'x':
         case 'X':
-                buffer_putc(tok, *pc++);
-                buffer_putc(tok, *pc++);
+                pc++;
+                pc++;
                 if (!isxdigit(*pc))
                         goto e_malformed;
                 while (isxdigit((int)(*pc))) {
                         if (count++ >= 16)
                                 goto e_toobig;
-                        buffer_putc(tok, *pc++);
+                        pc++;
                 }
                 break;
 
         case 'b':
         case 'B':
-                buffer_putc(tok, *pc++);
-                buffer_putc(tok, *pc++);
+                pc++;
+                pc++;
                 if (*pc != '0' && *pc != '1')
                         goto e_malformed;
                 while (*pc == '0' || *pc == '1') {
                         if (count++ >= 64)
                                 goto e_toobig;
-                        buffer_putc(tok, *pc++);
+                        pc++;
                 }
                 break;
 
         case 'o':
         case 'O':
-                buffer_putc(tok, *pc++);
-                buffer_putc(tok, *pc++);
+                pc++;
+                pc++;
                 if (!isodigit(*pc))
                         goto e_malformed;
                 while (isodigit(*pc)) {
@@ -454,7 +575,7 @@ get_tok_int_hdr(struct token_state_t *state)
                          */
                         if (count++ >= 22)
                                 goto e_toobig;
-                        buffer_putc(tok, *pc++);
+                        pc++;
                 }
                 break;
 
@@ -466,6 +587,8 @@ get_tok_int_hdr(struct token_state_t *state)
 
         /* TODO: Support things like 0x1j */
 
+        state->tok_start = state->s;
+        state->tok_len = pc - state->s;
         state->s = pc;
         return true;
 
@@ -502,6 +625,12 @@ get_tok_number(struct token_state_t *state)
         if (state->s[0] == '-' || state->s[0] == '+')
                 return 0;
 
+        /* Saves a trip to strtod_scanonly() for most tokens */
+        if (!isdigit(state->s[0]) &&
+            !(state->s[0] == '.' && isdigit(state->s[1]))) {
+                return 0;
+        }
+
         if (get_tok_int_hdr(state))
                 return OC_INTEGER;
 
@@ -529,8 +658,8 @@ get_tok_number(struct token_state_t *state)
         }
 
         bug_on(pc == start);
-        while (start < pc)
-                buffer_putc(&state->tok, *start++);
+        state->tok_start = start;
+        state->tok_len = pc - start;
         state->s = pc;
         return ret;
 
@@ -545,14 +674,10 @@ malformed:
 static bool
 get_tok_delim(int *ret, struct token_state_t *state)
 {
+        /* No text to save, the OC_xxx code says it all */
         int count = token_delim_seek__(state->s, ret);
         if (count) {
-                char *s = state->s;
                 state->s += count;
-                while (s < state->s) {
-                        buffer_putc(&state->tok, *s);
-                        s++;
-                }
                 return true;
         }
         return false;
@@ -575,8 +700,11 @@ skip_whitespace(struct token_state_t *state)
                          * thing when the do loop reiterates.
                          */
                         s = state->s;
-                        while (*s != '\0' && isspace((int)(*s)))
+                        while (*s != '\0' && isspace((int)(*s))) {
+                                if (*s == '\n')
+                                        tok_newline(state, s);
                                 ++s;
+                        }
                 } while (*s == '\0' && tok_next_line(state) != -1);
                 state->s = s;
                 if (*s == '\0')
@@ -636,6 +764,7 @@ tokenize_helper(struct token_state_t *state)
                 struct buffer_t *tok = &state->tok;
 
                 buffer_reset(tok);
+                state->tok_len = 0;
 
                 /* repurpose ret to be a token-type result */
                 if ((ret = skip_whitespace(state)) == OC_EOF)
@@ -696,7 +825,7 @@ tokenize_helper(struct token_state_t *state)
                         } while (ret != OC_EOF && get_tok_bytes(state));
                         return OC_BYTES;
                 } else if (get_tok_identifier(state)) {
-                        if ((ret = token_kw_seek__(tok->s)) >= 0)
+                        if ((ret = tok_keyword(state)) >= 0)
                                 return ret;
                         return OC_IDENTIFIER;
                 }
@@ -764,6 +893,7 @@ tokenize(struct token_state_t *state)
                 case OC_INTEGER:
                     {
                         long long i;
+                        tok_text(state);
                         if (evc_strtol(state->tok.s, NULL, 0, &i) == RES_ERROR) {
                                 ret = bad_literal(state, "integer");
                         } else {
@@ -774,6 +904,7 @@ tokenize(struct token_state_t *state)
                 case OC_FLOAT:
                     {
                         double f;
+                        tok_text(state);
                         if (evc_strtod(state->tok.s, NULL, &f) == RES_ERROR) {
                                 ret = bad_literal(state, "double");
                         } else {
@@ -784,6 +915,7 @@ tokenize(struct token_state_t *state)
                 case OC_COMPLEX:
                     {
                         double im;
+                        tok_text(state);
                         if (evc_strtod(state->tok.s, NULL, &im) == RES_ERROR) {
                                 ret = bad_literal(state, "double");
                         } else {
@@ -792,11 +924,20 @@ tokenize(struct token_state_t *state)
                         break;
                     }
                 case OC_IDENTIFIER:
-                        oc->v = gbl_intern_string(stringvar_new(state->tok.s));
+                        oc->v = gbl_intern_string(
+                                stringvar_newn(state->tok_start,
+                                               state->tok_len));
                         break;
                 case OC_STRING:
                 case OC_FSTRING_END:
-                        oc->v = stringvar_from_source(state->tok.s, true);
+                        if (state->tok_len) {
+                                /* see get_tok_plain_string() */
+                                oc->v = stringvar_newn(state->tok_start + 1,
+                                                       state->tok_len - 2);
+                        } else {
+                                oc->v = stringvar_from_source(state->tok.s,
+                                                              true);
+                        }
                         if (oc->v == ErrorVar) {
                                 ret = bad_literal(state, "string");
                                 oc->v = NULL;
@@ -808,27 +949,71 @@ tokenize(struct token_state_t *state)
                         oc->v = NULL;
                 }
 
-                if (state->dedup && oc->v && isvar_string(oc->v)) {
-                        enum result_t res;
-                        res = set_additem(state->dedup, oc->v, &oc->v);
-                        bug_on(res != RES_OK);
-                        (void)res;
-                }
-
                 TOKBUF_PUT(state, oc);
         }
         state->ntok++;
         return ret;
 }
 
+/*
+ * Map regular file state->fp whole, so it can be tokenized in place
+ * rather than copied out a line at a time.  Everything here expects a
+ * nulchar after the last line, so reserve zero-filled pages one byte
+ * bigger than the file and map the file over the front of them.  The
+ * rest of the file's last page reads as zero too.
+ *
+ * Return: true if mapped, false to read the file a line at a time.
+ */
+static bool
+token_map_file(struct token_state_t *state)
+{
+        struct stat st;
+        size_t pgsize, size;
+        off_t start;
+        char *map;
+        int fd;
+
+        fd = fileno(state->fp);
+        if (fd < 0 || fstat(fd, &st) < 0 || !S_ISREG(st.st_mode))
+                return false;
+        start = ftello(state->fp);
+        if (start < 0 || start >= st.st_size)
+                return false;
+
+        pgsize = sysconf(_SC_PAGESIZE);
+        size = ((size_t)st.st_size + pgsize) & ~(pgsize - 1);
+        map = mmap(NULL, size, PROT_READ,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (map == MAP_FAILED)
+                return false;
+        if (mmap(map, st.st_size, PROT_READ,
+                 MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+                munmap(map, size);
+                return false;
+        }
+
+        state->map      = map;
+        state->map_size = size;
+        state->map_end  = map + st.st_size;
+        state->line     = map + start;
+        state->s        = state->line;
+        state->lineno   = 1;
+        return true;
+}
+
 static void
 token_init_state(struct token_state_t *state, FILE *fp)
 {
         buffer_init(&state->tok);
         buffer_init(&state->fstring_tok);
+        state->tok_start = NULL;
+        state->tok_len  = 0;
         state->line     = NULL;
         state->_slen    = 0;
         state->s        = NULL;
+        state->map      = NULL;
+        state->map_size = 0;
+        state->map_end  = NULL;
         state->fp       = fp;
         state->lineno   = 0;
 
@@ -839,11 +1024,6 @@ token_init_state(struct token_state_t *state, FILE *fp)
         state->fstring  = false;
         state->fstring_pos = 0;
 
-        /*
-         * if not file, we're just parsing a line, so interning
-         * is more overhead than it's worth
-         */
-        state->dedup = fp ? setvar_new(NULL) : NULL;
         if (fp) {
                 if (isatty(fileno(fp))) {
                         state->inp = TKINP_TTY;
@@ -851,6 +1031,8 @@ token_init_state(struct token_state_t *state, FILE *fp)
                 } else {
                         state->inp = TKINP_FILE;
                         state->prompt = NULL;
+                        if (token_map_file(state))
+                                state->inp = TKINP_MMAP;
                 }
         } else {
                 state->inp = TKINP_STRING;
@@ -1062,7 +1244,9 @@ token_state_free(struct token_state_t *state)
 
         buffer_free(&state->tok);
         buffer_free(&state->fstring_tok);
-        if (state->line && state->inp != TKINP_STRING)
+        if (state->map)
+                munmap(state->map, state->map_size);
+        else if (state->line && state->inp != TKINP_STRING)
                 token_state_free_line(state);
         n = TOKBUF_SIZE(state);
         bug_on(n != state->ntok);
@@ -1084,10 +1268,6 @@ token_state_free(struct token_state_t *state)
         for (i = 0; i < n; i++)
                 free_one_token(tokbuf[i]);
         buffer_free(&state->pgm);
-
-        if (state->dedup)
-                VAR_DECR_REF(state->dedup);
-
         efree(state);
 }
 
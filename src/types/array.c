@@ -19,6 +19,7 @@
 #include <evilcandy/global.h>
 #include <internal/uarg.h>
 #include <internal/errmsg.h>
+#include <internal/sort.h>
 #include <internal/type_registry.h>
 #include <internal/types/sequential_types.h>
 /*
@@ -27,7 +28,6 @@
  */
 #include <internal/vm.h>
 
-#include <stdlib.h> /*< XXX for qsort only, will be made manua later */
 #include <string.h>
 
 #define V2ARR(v_)       ((struct arrayvar_t *)(v_))
@@ -398,33 +398,109 @@ array_setslice(Object *obj, ssize_t start,
         }
 }
 
-/* helper to array_sort */
-static int
-array_sort_cmp(const void *a, const void *b)
+/* seq_methods_t .sort callback */
+static enum result_t
+array_sort(Object *array)
 {
-        int cmpres;
-        enum result_t status;
+        struct arrayvar_t *a = V2ARR(array);
+        if (seqvar_size(array) < 2)
+                return RES_OK;
+        bug_on(!a->items);
+        return sort_objects(a->items, NULL, seqvar_size(array));
+}
 
-        if (err_occurred())
-                return 0;
+/* Reverse @n elements of @items, and of @keys if it's not NULL */
+static void
+array_sort_reverse(Object **items, Object **keys, size_t n)
+{
+        size_t i;
 
-        status = var_compare(*(Object **)a, *(Object **)b, &cmpres);
-        if (status == RES_ERROR)
-                return 0;
-        return cmpres;
+        for (i = 0; i < n / 2; i++) {
+                Object *t = items[i];
+                items[i] = items[n - 1 - i];
+                items[n - 1 - i] = t;
+                if (keys) {
+                        t = keys[i];
+                        keys[i] = keys[n - 1 - i];
+                        keys[n - 1 - i] = t;
+                }
+        }
 }
 
-/* seq_methods_t .sort callback */
+/*
+ * Sort @array by the results of @keyfunc, if not NULL, and then reverse
+ * it if @reverse.  Each item's key is computed once before sorting.
+ *
+ * The items are taken out of the array while it's being sorted, since
+ * @keyfunc could do anything to it.  If the array isn't empty again by
+ * the time the sort is done, that's an error.
+ */
 static enum result_t
-array_sort(Object *array)
+array_sort_by(Frame *fr, Object *array, Object *keyfunc, bool reverse)
 {
         struct arrayvar_t *a = V2ARR(array);
-        if (seqvar_size(array) < 2)
+        Object **items, **keys;
+        size_t i, n, n_keys, alloc_size;
+        enum result_t ret = RES_OK;
+
+        n = seqvar_size(array);
+        if (n < 2)
                 return RES_OK;
-        bug_on(!a->items);
-        qsort(a->items, seqvar_size(array),
-              sizeof(Object *), array_sort_cmp);
-        return err_occurred() ? RES_ERROR : RES_OK;
+
+        items = a->items;
+        alloc_size = a->alloc_size;
+        a->items = NULL;
+        a->alloc_size = 0;
+        seqvar_set_size(array, 0);
+        array_resize(array, 0);
+
+        keys = NULL;
+        n_keys = 0;
+        if (keyfunc) {
+                keys = emalloc(n * sizeof(Object *));
+                while (n_keys < n) {
+                        Object *args, *k;
+
+                        args = arrayvar_from_stack(&items[n_keys], 1, false);
+                        k = vm_exec_func(fr, keyfunc, args, NULL);
+                        VAR_DECR_REF(args);
+                        if (k == ErrorVar) {
+                                ret = RES_ERROR;
+                                goto out;
+                        }
+                        keys[n_keys++] = k;
+                }
+        }
+
+        /*
+         * Sorting the reversed array and then reversing the result
+         * keeps equal elements in their original order.
+         */
+        if (reverse)
+                array_sort_reverse(items, keys, n);
+        ret = sort_objects(items, keys, n);
+        if (reverse)
+                array_sort_reverse(items, keys, n);
+
+out:
+        if (keys) {
+                for (i = 0; i < n_keys; i++)
+                        VAR_DECR_REF(keys[i]);
+                efree(keys);
+        }
+
+        if (seqvar_size(array) != 0) {
+                if (ret == RES_OK) {
+                        err_setstr(ValueError, "list modified during sort");
+                        ret = RES_ERROR;
+                }
+                array_delete_chunk(array, 0, seqvar_size(array));
+        }
+        efree(a->items);
+        a->items = items;
+        a->alloc_size = alloc_size;
+        seqvar_set_size(array, n);
+        return ret;
 }
 
 /**
@@ -1026,6 +1102,26 @@ do_array_reverse(Frame *fr)
         return NULL;
 }
 
+static Object *
+do_array_sort(Frame *fr)
+{
+        Object *self, *key;
+        long long reverse;
+
+        key = NULL;
+        reverse = 0ll;
+        if (vm_getargs(fr, "<[]>[!]{|<*>l}:sort", &self,
+                       STRCONST_ID(key), &key,
+                       STRCONST_ID(reverse), &reverse) == RES_ERROR) {
+                return ErrorVar;
+        }
+        if (key == NullVar)
+                key = NULL;
+        if (array_sort_by(fr, self, key, !!reverse) == RES_ERROR)
+                return ErrorVar;
+        return NULL;
+}
+
 static enum result_t
 array_create_append_one(Object *item, void *data)
 {
@@ -1121,7 +1217,7 @@ static const struct type_method_t array_cb_methods[] = {
         {"pop",        do_array_pop},
         {"remove",     do_array_remove},
         {"reverse",    do_array_reverse},
-        /* TODO: sort */
+        {"sort",       do_array_sort},
         {NULL, NULL},
 };
 
@@ -0,0 +1,900 @@
+/*
+ * bytearray.c - Mutable byte buffers
+ *
+ * A bytes object is immutable, so building a message one piece at a
+ * time, or reading a file into the same buffer over and over again,
+ * allocates a new bytes object for every step.  A bytearray is a
+ * growable buffer instead.  Its storage grows geometrically, so
+ * appending to it is amortized O(1), and it can be handed to a file's
+ * .readinto() or a socket's .recv_into() method to be filled in place.
+ *
+ * While a memoryview of a bytearray exists, the bytearray may be
+ * changed in place but not resized, since that could move @data out
+ * from under the view.
+ */
+#include <evilcandy/debug.h>
+#include <evilcandy/err.h>
+#include <evilcandy/errmsg.h>
+#include <evilcandy/ewrappers.h>
+#include <evilcandy/global.h>
+#include <evilcandy/vm.h>
+#include <evilcandy/types/bytearray.h>
+#include <evilcandy/types/bytes.h>
+#include <evilcandy/types/number_types.h>
+#include <evilcandy/types/string.h>
+#include <internal/type_registry.h>
+#include <internal/types/number_types.h>
+#include <internal/types/sequential_types.h>
+#include <internal/types/string.h>
+#include <lib/buffer.h>
+#include <lib/helpers.h>
+
+#include <string.h>
+
+/* Smallest allocation, so @data is never NULL */
+#define BYTEARRAY_MIN_ALLOC     16
+
+/**
+ * struct bytearrayvar_t - Handle to a bytearray
+ * @data:       Buffer.  The number of bytes in use is the seqvar size.
+ * @alloc:      Number of bytes allocated for @data
+ * @exports:    Number of memoryviews (or other borrowers) of @data
+ */
+struct bytearrayvar_t {
+        struct seqvar_t base;
+        unsigned char *data;
+        size_t alloc;
+        int exports;
+};
+
+#define V2BA(v_)        ((struct bytearrayvar_t *)(v_))
+
+static Object *
+bytearray_alloc(size_t size)
+{
+        Object *ret = var_new(&BytearrayType);
+        struct bytearrayvar_t *ba = V2BA(ret);
+
+        ba->alloc = BYTEARRAY_MIN_ALLOC;
+        while (ba->alloc < size)
+                ba->alloc *= 2;
+        ba->data = emalloc(ba->alloc);
+        ba->exports = 0;
+        seqvar_set_size(ret, size);
+        return ret;
+}
+
+/* Raise an exception if @b may not be resized right now */
+static enum result_t
+bytearray_check_resize(Object *b)
+{
+        if (V2BA(b)->exports) {
+                err_setstr(RuntimeError,
+                           "cannot resize a bytearray while it is viewed");
+                return RES_ERROR;
+        }
+        return RES_OK;
+}
+
+/* Make sure there is room for @need bytes */
+static void
+bytearray_reserve(Object *b, size_t need)
+{
+        struct bytearrayvar_t *ba = V2BA(b);
+        size_t alloc = ba->alloc;
+
+        if (need <= alloc)
+                return;
+        while (alloc < need)
+                alloc *= 2;
+        ba->data = erealloc(ba->data, alloc);
+        ba->alloc = alloc;
+}
+
+/* Give back memory if less than a quarter of the buffer is in use */
+static void
+bytearray_maybe_shrink(Object *b)
+{
+        struct bytearrayvar_t *ba = V2BA(b);
+        size_t alloc = ba->alloc;
+        size_t n = seqvar_size(b);
+
+        while (alloc > BYTEARRAY_MIN_ALLOC && alloc / 4 > n)
+                alloc /= 2;
+        if (alloc != ba->alloc) {
+                ba->data = erealloc(ba->data, alloc);
+                ba->alloc = alloc;
+        }
+}
+
+/*
+ * Replace the @ndel bytes at @at with the @nins bytes at @src.
+ * @src may point into @b itself.
+ */
+static enum result_t
+bytearray_splice(Object *b, size_t at, size_t ndel,
+                 const unsigned char *src, size_t nins)
+{
+        struct bytearrayvar_t *ba = V2BA(b);
+        size_t n = seqvar_size(b);
+        unsigned char *tmp = NULL;
+
+        bug_on(at + ndel > n);
+        if (nins != ndel && bytearray_check_resize(b) == RES_ERROR)
+                return RES_ERROR;
+        if (nins && src >= ba->data && src < ba->data + ba->alloc) {
+                /* reserve() or the memmove below could clobber it */
+                tmp = ememdup(src, nins);
+                src = tmp;
+        }
+
+        if (nins > ndel)
+                bytearray_reserve(b, n - ndel + nins);
+        if (nins != ndel && at + ndel < n) {
+                memmove(&ba->data[at + nins], &ba->data[at + ndel],
+                        n - at - ndel);
+        }
+        if (nins)
+                memcpy(&ba->data[at], src, nins);
+        seqvar_set_size(b, n - ndel + nins);
+        if (nins < ndel)
+                bytearray_maybe_shrink(b);
+
+        if (tmp)
+                efree(tmp);
+        return RES_OK;
+}
+
+/* Like intvar_to_byte() in bytes.c, but type-checks @o too */
+static enum result_t
+bytearray_byte_of(Object *o, unsigned char *p)
+{
+        long long ival;
+
+        if (!isvar_int(o)) {
+                err_setstr(TypeError,
+                           "bytearray expected integer but found %s",
+                           typestr(o));
+                return RES_ERROR;
+        }
+        ival = intvar_toll(o);
+        if (ival < 0LL || ival > 255LL) {
+                err_setstr(ValueError,
+                           "Expected: value between 0 and 255");
+                return RES_ERROR;
+        }
+        *p = (unsigned char)ival;
+        return RES_OK;
+}
+
+/*
+ * If @o is bytes or bytearray, get its data without copying it.
+ * Return false if @o is some other type.
+ */
+static bool
+bytearray_peek(Object *o, const unsigned char **buf, size_t *len)
+{
+        if (isvar_bytes(o)) {
+                *buf = bytes_get_data(o);
+        } else if (isvar_bytearray(o)) {
+                *buf = V2BA(o)->data;
+        } else {
+                return false;
+        }
+        *len = seqvar_size(o);
+        return true;
+}
+
+static enum result_t
+bytearray_unpack_one(Object *item, void *data)
+{
+        unsigned char c;
+
+        if (bytearray_byte_of(item, &c) == RES_ERROR)
+                return RES_ERROR;
+        buffer_putd((struct buffer_t *)data, &c, 1);
+        return RES_OK;
+}
+
+/*
+ * Get the bytes that @o represents: its data if it's bytes-like,
+ * otherwise @o must be an iterable of integers from 0 to 255, which
+ * are unpacked into @b.  @b must be freed with buffer_free() whether
+ * or not it was used.
+ */
+static enum result_t
+bytearray_unpack(Object *o, struct buffer_t *b,
+                 const unsigned char **buf, size_t *len, const char *fname)
+{
+        buffer_init(b);
+        if (bytearray_peek(o, buf, len))
+                return RES_OK;
+        if (isvar_string(o)) {
+                err_setstr(TypeError,
+                           "%s() cannot use a string without encoding it",
+                           fname);
+                return RES_ERROR;
+        }
+        if (var_traverse(o, bytearray_unpack_one, b, fname) == RES_ERROR)
+                return RES_ERROR;
+        *buf = (unsigned char *)b->s;
+        *len = buffer_size(b);
+        return RES_OK;
+}
+
+/* **********************************************************************
+ *                      Built-in methods
+ ***********************************************************************/
+
+static Object *
+do_bytearray_append(Frame *fr)
+{
+        Object *self, *item;
+        unsigned char c;
+
+        if (vm_getargs(fr, "<*>[<*>!]{!}:append", &self, &item)
+            == RES_ERROR) {
+                return ErrorVar;
+        }
+        bug_on(!isvar_bytearray(self));
+        if (bytearray_byte_of(item, &c) == RES_ERROR)
+                return ErrorVar;
+        if (bytearray_append(self, &c, 1) == RES_ERROR)
+                return ErrorVar;
+        return NULL;
+}
+
+static Object *
+do_bytearray_extend(Frame *fr)
+{
+        Object *self, *seq;
+        struct buffer_t b;
+        const unsigned char *buf;
+        size_t len;
+        enum result_t res;
+
+        if (vm_getargs(fr, "<*>[<*>!]{!}:extend", &self, &seq)
+            == RES_ERROR) {
+                return ErrorVar;
+        }
+        bug_on(!isvar_bytearray(self));
+        res = bytearray_unpack(seq, &b, &buf, &len, "extend");
+        if (res == RES_OK)
+                res = bytearray_append(self, buf, len);
+        buffer_free(&b);
+        return res == RES_OK ? NULL : ErrorVar;
+}
+
+static Object *
+do_bytearray_insert(Frame *fr)
+{
+        Object *self, *item;
+        ssize_t at;
+        size_t n;
+        unsigned char c;
+
+        if (vm_getargs(fr, "<*>[z<*>!]{!}:insert", &self, &at, &item)
+            == RES_ERROR) {
+                return ErrorVar;
+        }
+        bug_on(!isvar_bytearray(self));
+        if (bytearray_byte_of(item, &c) == RES_ERROR)
+                return ErrorVar;
+
+        /* Same forgiveness as list.insert() */
+        n = seqvar_size(self);
+        if (at < 0) {
+                at += n;
+                if (at < 0)
+                        at = 0;
+        }
+        if (at > n)
+                at = n;
+        if (bytearray_splice(self, at, 0, &c, 1) == RES_ERROR)
+                return ErrorVar;
+        return NULL;
+}
+
+/* .pop(i=-1)  Remove and return the byte at @i, by default the last */
+static Object *
+do_bytearray_pop(Frame *fr)
+{
+        Object *self;
+        ssize_t at = -1;
+        unsigned int c;
+
+        if (vm_getargs(fr, "<*>[|z!]{!}:pop", &self, &at) == RES_ERROR)
+                return ErrorVar;
+        bug_on(!isvar_bytearray(self));
+        if (seqvar_size(self) == 0) {
+                err_setstr(IndexError, "pop from empty bytearray");
+                return ErrorVar;
+        }
+        if (var_index_capi(seqvar_size(self), &at, NULL, ERRH_EXCEPTION)
+            == RES_ERROR) {
+                return ErrorVar;
+        }
+        c = V2BA(self)->data[at];
+        if (bytearray_splice(self, at, 1, NULL, 0) == RES_ERROR)
+                return ErrorVar;
+        return intvar_new(c);
+}
+
+static Object *
+do_bytearray_clear(Frame *fr)
+{
+        Object *self;
+
+        if (vm_getargs(fr, "<*>[!]{!}:clear", &self) == RES_ERROR)
+                return ErrorVar;
+        bug_on(!isvar_bytearray(self));
+        if (bytearray_check_resize(self) == RES_ERROR)
+                return ErrorVar;
+        seqvar_set_size(self, 0);
+        bytearray_maybe_shrink(self);
+        return NULL;
+}
+
+static Object *
+do_bytearray_copy(Frame *fr)
+{
+        Object *self;
+
+        if (vm_getargs(fr, "<*>[!]{!}:copy", &self) == RES_ERROR)
+                return ErrorVar;
+        bug_on(!isvar_bytearray(self));
+        return bytearrayvar_new(V2BA(self)->data, seqvar_size(self));
+}
+
+static Object *
+do_bytearray_count(Frame *fr)
+{
+        Object *self, *arg;
+        const unsigned char *needle;
+        size_t nlen;
+        unsigned char c;
+
+        if (vm_getargs(fr, "<*>[<*>!]{!}:count", &self, &arg)
+            == RES_ERROR) {
+                return ErrorVar;
+        }
+        bug_on(!isvar_bytearray(self));
+        if (!bytearray_peek(arg, &needle, &nlen)) {
+                if (bytearray_byte_of(arg, &c) == RES_ERROR)
+                        return ErrorVar;
+                needle = &c;
+                nlen = 1;
+        }
+        return intvar_new(memcount(V2BA(self)->data, seqvar_size(self),
+                                   needle, nlen));
+}
+
+enum {
+        BAF_RIGHT       = 0x01,
+        BAF_SUPPRESS    = 0x02,
+};
+
+static Object *
+bytearray_index_or_find_(Frame *fr, unsigned int flags, const char *fmt)
+{
+        Object *self, *arg;
+        const unsigned char *haystack, *needle, *found;
+        size_t nlen;
+        unsigned char c;
+        void *(*locfn)(const void *, size_t, const void *, size_t);
+
+        if (vm_getargs(fr, fmt, &self, &arg) == RES_ERROR)
+                return ErrorVar;
+        bug_on(!isvar_bytearray(self));
+        if (!bytearray_peek(arg, &needle, &nlen)) {
+                if (bytearray_byte_of(arg, &c) == RES_ERROR)
+                        return ErrorVar;
+                needle = &c;
+                nlen = 1;
+        }
+
+        locfn = !!(flags & BAF_RIGHT) ? memrmem : memmem;
+        haystack = V2BA(self)->data;
+        found = locfn(haystack, seqvar_size(self), needle, nlen);
+        if (!found) {
+                if (!(flags & BAF_SUPPRESS)) {
+                        err_setstr(ValueError, "subbytes not found");
+                        return ErrorVar;
+                }
+                return intvar_new(-1LL);
+        }
+        return intvar_new(found - haystack);
+}
+
+#define bytearray_index_or_find(fr, flg, fname) \
+        bytearray_index_or_find_(fr, flg, "<*>[<*>!]{!}:" fname)
+
+static Object *
+do_bytearray_find(Frame *fr)
+{
+        return bytearray_index_or_find(fr, BAF_SUPPRESS, "find");
+}
+
+static Object *
+do_bytearray_index(Frame *fr)
+{
+        return bytearray_index_or_find(fr, 0, "index");
+}
+
+static Object *
+do_bytearray_rfind(Frame *fr)
+{
+        return bytearray_index_or_find(fr, BAF_RIGHT | BAF_SUPPRESS, "rfind");
+}
+
+static Object *
+do_bytearray_rindex(Frame *fr)
+{
+        return bytearray_index_or_find(fr, BAF_RIGHT, "rindex");
+}
+
+#undef bytearray_index_or_find
+
+static Object *
+bytearray_getprop_length(Object *self)
+{
+        bug_on(!isvar_bytearray(self));
+        return intvar_new(seqvar_size(self));
+}
+
+/* **********************************************************************
+ *                      Type methods
+ ***********************************************************************/
+
+static Object *
+bytearray_getitem(Object *b, size_t i)
+{
+        bug_on(i >= seqvar_size(b));
+        return intvar_new(V2BA(b)->data[i]);
+}
+
+/* NULL @child means delete byte @i */
+static enum result_t
+bytearray_setitem(Object *b, size_t i, Object *child)
+{
+        unsigned char c;
+
+        bug_on(i >= seqvar_size(b));
+        if (!child)
+                return bytearray_splice(b, i, 1, NULL, 0);
+        if (bytearray_byte_of(child, &c) == RES_ERROR)
+                return RES_ERROR;
+        V2BA(b)->data[i] = c;
+        return RES_OK;
+}
+
+static bool
+bytearray_hasitem(Object *b, Object *item)
+{
+        const unsigned char *needle;
+        size_t nlen;
+
+        if (isvar_int(item)) {
+                long long ival = intvar_toll(item);
+                if (ival < 0LL || ival > 255LL)
+                        return false;
+                return memchr(V2BA(b)->data, (int)ival,
+                              seqvar_size(b)) != NULL;
+        }
+        if (bytearray_peek(item, &needle, &nlen)) {
+                return memmem(V2BA(b)->data, seqvar_size(b),
+                              needle, nlen) != NULL;
+        }
+        return false;
+}
+
+/* comparisons, helpers to bytearray_getslice */
+static bool slice_cmp_lt(ssize_t a, ssize_t b) { return a < b; }
+static bool slice_cmp_gt(ssize_t a, ssize_t b) { return a > b; }
+
+static Object *
+bytearray_getslice(Object *b, ssize_t start, ssize_t stop, ssize_t step)
+{
+        Object *ret;
+        unsigned char *src, *dst;
+        bool (*cmp)(ssize_t, ssize_t);
+
+        if (step == 1) {
+                if (stop < start)
+                        stop = start;
+                return bytearrayvar_new(&V2BA(b)->data[start], stop - start);
+        }
+
+        ret = bytearray_alloc(var_slice_size(start, stop, step));
+        src = V2BA(b)->data;
+        dst = V2BA(ret)->data;
+        cmp = start < stop ? slice_cmp_lt : slice_cmp_gt;
+        while (cmp(start, stop)) {
+                *dst++ = src[start];
+                start += step;
+        }
+        bug_on(dst - V2BA(ret)->data != seqvar_size(ret));
+        return ret;
+}
+
+/* b[start:stop:step] = NULL, ie. delete the slice */
+static enum result_t
+bytearray_delslice(Object *b, ssize_t start, ssize_t stop, ssize_t step)
+{
+        unsigned char *data = V2BA(b)->data;
+        size_t i, j, n, nslc;
+
+        if (step < 0) {
+                nslc = var_slice_size(start, stop, step);
+                if (!nslc)
+                        return RES_OK;
+                stop = start + 1;
+                start = start + step * (ssize_t)(nslc - 1);
+                step = -step;
+        }
+        if (stop <= start)
+                return RES_OK;
+        if (step == 1)
+                return bytearray_splice(b, start, stop - start, NULL, 0);
+        if (bytearray_check_resize(b) == RES_ERROR)
+                return RES_ERROR;
+
+        /* keep everything not on the slice's stride */
+        n = seqvar_size(b);
+        for (i = j = start; i < n; i++) {
+                if (i < stop && (i - start) % step == 0)
+                        continue;
+                data[j++] = data[i];
+        }
+        seqvar_set_size(b, j);
+        bytearray_maybe_shrink(b);
+        return RES_OK;
+}
+
+static enum result_t
+bytearray_setslice(Object *b, ssize_t start, ssize_t stop,
+                   ssize_t step, Object *val)
+{
+        struct buffer_t tmp;
+        const unsigned char *src;
+        size_t i, len, nslc;
+        enum result_t res = RES_ERROR;
+
+        if (!val)
+                return bytearray_delslice(b, start, stop, step);
+
+        if (bytearray_unpack(val, &tmp, &src, &len, "bytearray")
+            == RES_ERROR) {
+                goto out;
+        }
+
+        if (step == 1) {
+                /* Only simple slices may change the size */
+                nslc = stop > start ? stop - start : 0;
+                res = bytearray_splice(b, start, nslc, src, len);
+                goto out;
+        }
+
+        nslc = var_slice_size(start, stop, step);
+        if (len != nslc) {
+                err_setstr(ValueError,
+                           "attempt to assign %lu bytes to extended slice of size %lu",
+                           (unsigned long)len, (unsigned long)nslc);
+                goto out;
+        }
+        /* @src may be our own data, but then len == n and step == -1 */
+        if (len && src == V2BA(b)->data) {
+                unsigned char *copy = ememdup(src, len);
+                for (i = 0; i < len; i++)
+                        V2BA(b)->data[start + step * (ssize_t)i] = copy[i];
+                efree(copy);
+        } else {
+                for (i = 0; i < len; i++)
+                        V2BA(b)->data[start + step * (ssize_t)i] = src[i];
+        }
+        res = RES_OK;
+
+out:
+        buffer_free(&tmp);
+        return res;
+}
+
+static Object *
+bytearray_cat(Object *a, Object *b)
+{
+        Object *ret;
+        size_t alen;
+
+        if (!b)
+                return bytearray_alloc(0);
+        alen = seqvar_size(a);
+        ret = bytearray_alloc(alen + seqvar_size(b));
+        memcpy(V2BA(ret)->data, V2BA(a)->data, alen);
+        memcpy(V2BA(ret)->data + alen, V2BA(b)->data, seqvar_size(b));
+        return ret;
+}
+
+static Object *
+bytearray_str(Object *b)
+{
+        Object *tmp, *bstr, *ret;
+
+        /* Borrow the bytes type's escaping rules */
+        tmp = bytesvar_new(V2BA(b)->data, seqvar_size(b));
+        bstr = var_str(tmp);
+        ret = stringvar_from_format("bytearray(%s)", string_cstring(bstr));
+        VAR_DECR_REF(bstr);
+        VAR_DECR_REF(tmp);
+        return ret;
+}
+
+static enum result_t
+bytearray_cmp(Object *a, Object *b, int *result)
+{
+        size_t alen, blen;
+        int cmp;
+
+        bug_on(a->v_type != b->v_type);
+        alen = seqvar_size(a);
+        blen = seqvar_size(b);
+        cmp = memcmp(V2BA(a)->data, V2BA(b)->data, alen < blen ? alen : blen);
+        if (!cmp && alen != blen)
+                *result = alen > blen ? 1 : -1;
+        else
+                *result = cmp > 0 ? 1 : (cmp < 0 ? -1 : 0);
+        return RES_OK;
+}
+
+static bool
+bytearray_cmpeq(Object *a, Object *b)
+{
+        size_t len = seqvar_size(a);
+
+        bug_on(a->v_type != b->v_type);
+        if (len != seqvar_size(b))
+                return false;
+        return !memcmp(V2BA(a)->data, V2BA(b)->data, len);
+}
+
+static bool
+bytearray_cmpz(Object *b)
+{
+        return seqvar_size(b) == 0;
+}
+
+static void
+bytearray_reset(Object *b)
+{
+        bug_on(V2BA(b)->exports);
+        efree(V2BA(b)->data);
+}
+
+static enum result_t
+bytearray_getbuffer(Object *b, struct buffer_export_t *exp)
+{
+        bug_on(!isvar_bytearray(b));
+        exp->buf      = V2BA(b)->data;
+        exp->n        = seqvar_size(b);
+        exp->itemsize = 1;
+        exp->stride   = 1;
+        exp->kind     = EXPORT_BYTE;
+        exp->readonly = false;
+        V2BA(b)->exports++;
+        return RES_OK;
+}
+
+static void
+bytearray_releasebuffer(Object *b)
+{
+        bug_on(V2BA(b)->exports <= 0);
+        V2BA(b)->exports--;
+}
+
+/*
+ * bytearray(init)
+ *
+ * @init is optional.  If it's an integer, the bytearray has that many
+ * zeros.  Otherwise it is bytes, bytearray, or an iterable of integers
+ * from 0 to 255.
+ */
+static Object *
+bytearray_create(Frame *fr)
+{
+        Object *init = NULL, *ret;
+        struct buffer_t tmp;
+        const unsigned char *src;
+        size_t len;
+
+        if (vm_getargs(fr, "[|<*>!]{!}:bytearray", &init) == RES_ERROR)
+                return ErrorVar;
+        if (!init || init == NullVar)
+                return bytearray_alloc(0);
+        if (isvar_int(init)) {
+                long long n = intvar_toll(init);
+                if (n < 0) {
+                        err_setstr(ValueError,
+                                   "bytearray() size may not be negative");
+                        return ErrorVar;
+                }
+                ret = bytearray_alloc(n);
+                memset(V2BA(ret)->data, 0, n);
+                return ret;
+        }
+        if (bytearray_unpack(init, &tmp, &src, &len, "bytearray")
+            == RES_ERROR) {
+                ret = ErrorVar;
+        } else {
+                ret = bytearrayvar_new(src, len);
+        }
+        buffer_free(&tmp);
+        return ret;
+}
+
+/* **********************************************************************
+ *                              Iterator
+ ***********************************************************************/
+
+struct bytearray_iterator_t {
+        Object base;
+        Object *target;
+        size_t i;
+};
+
+#define O2BAIT(o)       ((struct bytearray_iterator_t *)(o))
+
+static Object *
+bytearray_iter_next(Object *it)
+{
+        struct bytearray_iterator_t *bit = O2BAIT(it);
+
+        if (!bit->target)
+                return NULL;
+        /* Unlike deque, changing size while iterating is allowed */
+        if (bit->i < seqvar_size(bit->target))
+                return intvar_new(V2BA(bit->target)->data[bit->i++]);
+
+        VAR_DECR_REF(bit->target);
+        bit->target = NULL;
+        return NULL;
+}
+
+static void
+bytearray_iter_reset(Object *it)
+{
+        struct bytearray_iterator_t *bit = O2BAIT(it);
+        if (bit->target)
+                VAR_DECR_REF(bit->target);
+        bit->target = NULL;
+}
+
+struct type_t BytearrayIterType = {
+        .name   = "bytearray_iterator",
+        .reset  = bytearray_iter_reset,
+        .size   = sizeof(struct bytearray_iterator_t),
+        .iter_next = bytearray_iter_next,
+};
+
+static Object *
+bytearray_get_iter(Object *b)
+{
+        Object *ret = var_new(&BytearrayIterType);
+        O2BAIT(ret)->target = VAR_NEW_REF(b);
+        O2BAIT(ret)->i = 0;
+        return ret;
+}
+
+/* **********************************************************************
+ *                              CAPI
+ ***********************************************************************/
+
+/**
+ * bytearrayvar_new - Create a bytearray
+ * @buf:        Initial contents to copy, may be NULL if @len is zero
+ * @len:        Length of @buf
+ */
+Object *
+bytearrayvar_new(const unsigned char *buf, size_t len)
+{
+        Object *ret = bytearray_alloc(len);
+        if (len)
+                memcpy(V2BA(ret)->data, buf, len);
+        return ret;
+}
+
+/**
+ * bytearray_get_data - Get a bytearray's buffer
+ *
+ * seqvar_size(b) is the number of valid bytes.  The pointer is only
+ * good until the next time @b changes size.
+ */
+unsigned char *
+bytearray_get_data(Object *b)
+{
+        bug_on(!isvar_bytearray(b));
+        return V2BA(b)->data;
+}
+
+/**
+ * bytearray_append - Append @len bytes from @buf to the end of @b
+ *
+ * Return: RES_OK, or RES_ERROR with an exception raised if @b is
+ *      being viewed and cannot be resized.
+ */
+enum result_t
+bytearray_append(Object *b, const unsigned char *buf, size_t len)
+{
+        size_t n = seqvar_size(b);
+
+        bug_on(!isvar_bytearray(b));
+        if (!len)
+                return RES_OK;
+        if (buf >= V2BA(b)->data && buf < V2BA(b)->data + V2BA(b)->alloc) {
+                /* appending to ourself, let splice deal with it */
+                return bytearray_splice(b, n, 0, buf, len);
+        }
+        if (bytearray_check_resize(b) == RES_ERROR)
+                return RES_ERROR;
+        bytearray_reserve(b, n + len);
+        memcpy(&V2BA(b)->data[n], buf, len);
+        seqvar_set_size(b, n + len);
+        return RES_OK;
+}
+
+static const struct type_method_t bytearray_cb_methods[] = {
+        {"append",      do_bytearray_append},
+        {"clear",       do_bytearray_clear},
+        {"copy",        do_bytearray_copy},
+        {"count",       do_bytearray_count},
+        {"extend",      do_bytearray_extend},
+        {"find",        do_bytearray_find},
+        {"index",       do_bytearray_index},
+        {"insert",      do_bytearray_insert},
+        {"pop",         do_bytearray_pop},
+        {"rfind",       do_bytearray_rfind},
+        {"rindex",      do_bytearray_rindex},
+        {NULL, NULL},
+};
+
+static const struct type_prop_t bytearray_prop_getsets[] = {
+        { .name = "length", .getprop = bytearray_getprop_length, .setprop = NULL },
+        { .name = NULL },
+};
+
+static const struct operator_methods_t bytearray_op_methods = {
+        .add            = bytearray_cat,
+};
+
+static const struct seq_methods_t bytearray_seq_methods = {
+        .getitem        = bytearray_getitem,
+        .setitem        = bytearray_setitem,
+        .hasitem        = bytearray_hasitem,
+        .getslice       = bytearray_getslice,
+        .setslice       = bytearray_setslice,
+        .cat            = bytearray_cat,
+        .sort           = NULL,
+};
+
+static const struct buffer_methods_t bytearray_buffer_methods = {
+        .getbuffer      = bytearray_getbuffer,
+        .releasebuffer  = bytearray_releasebuffer,
+};
+
+struct type_t BytearrayType = {
+        .flags  = 0,
+        .name   = "bytearray",
+        .opm    = &bytearray_op_methods,
+        .cbm    = bytearray_cb_methods,
+        .mpm    = NULL,
+        .sqm    = &bytearray_seq_methods,
+        .size   = sizeof(struct bytearrayvar_t),
+        .str    = bytearray_str,
+        .cmp    = bytearray_cmp,
+        .cmpz   = bytearray_cmpz,
+        .cmpeq  = bytearray_cmpeq,
+        .reset  = bytearray_reset,
+        .prop_getsets = bytearray_prop_getsets,
+        .create = bytearray_create,
+        .hash   = NULL,
+        .get_iter = bytearray_get_iter,
+        .bfm    = &bytearray_buffer_methods,
+};
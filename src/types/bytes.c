@@ -9,6 +9,7 @@
 #include <evilcandy/ewrappers.h>
 #include <evilcandy/hash.h>
 #include <evilcandy/types/array.h>
+#include <evilcandy/types/bytearray.h>
 #include <evilcandy/types/bytes.h>
 #include <evilcandy/types/string.h>
 #include <evilcandy/types/tuple.h>
@@ -906,50 +907,58 @@ do_bytes_rjust(Frame *fr)
 
 #undef do_bytes_lrjust
 
-static Object *
-bytes_lrsplit(Frame *fr, unsigned int flags)
+/*
+ * The split helpers below are called twice, first with @items NULL
+ * to count the fields, then again to fill in @items once the result
+ * array can be allocated at its final size.  @n is the number of
+ * fields stored so far.
+ */
+static void
+bytes_split_store(Object **items, size_t *n,
+                  const unsigned char *buf, size_t len)
 {
-        enum { LRSPLIT_STACK_SIZE = 64 };
-
-        Object *separg, *ret, *self_o;
-        const unsigned char *self, *sep;
-        size_t selflen, seplen;
-        int maxsplit;
-        bool combine;
-        const char *fmt;
-
-        combine = false;
-        separg = NULL;
-        maxsplit = -1;
-        fmt = !!(flags & BF_RIGHT) ? "<b>[!]{|<b>i}:rsplit" : "<b>[!]{|<b>i}:split";
-        if (vm_getargs(fr, fmt, &self_o, STRCONST_ID(sep), &separg,
-                       STRCONST_ID(maxsplit), &maxsplit) == RES_ERROR) {
-                return ErrorVar;
+        if (items) {
+                items[*n] = len ? bytesvar_new(buf, len)
+                                : gbl_new_empty_bytes();
         }
+        (*n)++;
+}
 
-        self = bytes_get_data(self_o);
-        selflen = seqvar_size(self_o);
+/* Make an array from the @n new references in @items, and free @items */
+static Object *
+bytes_split_finish(Object **items, size_t n, bool reverse)
+{
+        Object *ret;
 
-        if (!separg) {
-                combine = true;
-                separg = bytesvar_new((const unsigned char *)" ", 1);
-        } else {
-                VAR_INCR_REF(separg);
-        }
-        if ((seplen = seqvar_size(separg)) == 0) {
-                err_setstr(ValueError, "Separator may not be empty");
-                VAR_DECR_REF(separg);
-                return ErrorVar;
+        if (!n)
+                return arrayvar_new(0);
+
+        if (reverse) {
+                size_t i, j;
+                for (i = 0, j = n - 1; i < j; i++, j--) {
+                        Object *tmp = items[i];
+                        items[i] = items[j];
+                        items[j] = tmp;
+                }
         }
+        ret = arrayvar_from_stack(items, n, true);
+        efree(items);
+        return ret;
+}
 
-        /* error until proven success */
-        ret = ErrorVar;
+/*
+ * Helper to bytes_lrsplit().  For right splits, the fields are stored
+ * last one first.
+ */
+static size_t
+bytes_split_fields(Object **items, const unsigned char *self,
+                   size_t selflen, const unsigned char *sep,
+                   size_t seplen, int maxsplit, bool combine, bool right)
+{
+        size_t n = 0;
 
-        sep = bytes_get_data(separg);
-        ret = arrayvar_new(0);
-        if (!!(flags & BF_RIGHT)) {
+        if (right) {
                 while (maxsplit != 0 && selflen != 0) {
-                        size_t tlen;
                         const unsigned char *psep, *pnext;
 
                         maxsplit--;
@@ -957,20 +966,16 @@ bytes_lrsplit(Frame *fr, unsigned int flags)
                         if (!psep)
                                 break;
                         pnext = psep + seplen;
-                        tlen = selflen - (pnext - self);
-                        array_append(ret, bytesvar_new(pnext, tlen));
+                        bytes_split_store(items, &n, pnext,
+                                          selflen - (pnext - self));
                         while (combine && psep >= &self[seplen] &&
                                     !memcmp(psep - seplen, sep, seplen)) {
                                 psep -= seplen;
                         }
                         selflen = psep - self;
                 }
-                if (selflen != 0)
-                        array_append(ret, bytesvar_new(self, selflen));
-                array_reverse(ret);
         } else {
                 while (maxsplit != 0 && selflen != 0) {
-                        Object *new;
                         size_t tlen;
                         const unsigned char *psep;
 
@@ -979,10 +984,8 @@ bytes_lrsplit(Frame *fr, unsigned int flags)
                         psep = memmem(self, selflen, sep, seplen);
                         if (!psep)
                                 break;
-                        tlen = (ssize_t)(psep - self);
-                        new = tlen ? bytesvar_new(self, tlen)
-                                   : gbl_new_empty_bytes();
-                        array_append(ret, new);
+                        tlen = (size_t)(psep - self);
+                        bytes_split_store(items, &n, self, tlen);
                         self = psep + seplen;
                         selflen -= (tlen + seplen);
                         while (combine && selflen > seplen &&
@@ -991,11 +994,61 @@ bytes_lrsplit(Frame *fr, unsigned int flags)
                                 selflen -= seplen;
                         }
                 }
-                if (selflen != 0)
-                        array_append(ret, bytesvar_new(self, selflen));
         }
-        VAR_DECR_REF(separg);
-        return ret;
+        if (selflen != 0)
+                bytes_split_store(items, &n, self, selflen);
+        return n;
+}
+
+static Object *
+bytes_lrsplit(Frame *fr, unsigned int flags)
+{
+        Object *separg, *self_o, **items;
+        const unsigned char *self, *sep;
+        size_t selflen, seplen, n;
+        int maxsplit;
+        bool combine, right;
+        const char *fmt;
+
+        combine = false;
+        separg = NULL;
+        maxsplit = -1;
+        right = !!(flags & BF_RIGHT);
+        fmt = right ? "<b>[!]{|<b>i}:rsplit" : "<b>[!]{|<b>i}:split";
+        if (vm_getargs(fr, fmt, &self_o, STRCONST_ID(sep), &separg,
+                       STRCONST_ID(maxsplit), &maxsplit) == RES_ERROR) {
+                return ErrorVar;
+        }
+
+        self = bytes_get_data(self_o);
+        selflen = seqvar_size(self_o);
+
+        if (!separg) {
+                combine = true;
+                sep = (const unsigned char *)" ";
+                seplen = 1;
+        } else {
+                sep = bytes_get_data(separg);
+                seplen = seqvar_size(separg);
+        }
+        if (seplen == 0) {
+                err_setstr(ValueError, "Separator may not be empty");
+                return ErrorVar;
+        }
+
+        items = NULL;
+        n = bytes_split_fields(NULL, self, selflen, sep, seplen,
+                               maxsplit, combine, right);
+        if (n) {
+                size_t n2;
+
+                items = emalloc(n * sizeof(Object *));
+                n2 = bytes_split_fields(items, self, selflen, sep, seplen,
+                                        maxsplit, combine, right);
+                bug_on(n2 != n);
+                (void)n2;
+        }
+        return bytes_split_finish(items, n, right);
 }
 
 static Object *
@@ -1264,24 +1317,13 @@ do_bytes_upper(Frame *fr)
         return bytes_convert_case(self, evc_toupper);
 }
 
-static Object *
-do_bytes_splitlines(Frame *fr)
+/* Helper to do_bytes_splitlines(), see bytes_split_store() */
+static size_t
+bytes_splitlines_fields(Object **items, const unsigned char *src,
+                        size_t srclen, bool keepends)
 {
-        const unsigned char *src;
-        size_t srclen;
-        int keepends;
-        Object *ret, *self;
+        size_t n = 0;
 
-        keepends = 0;
-        if (vm_getargs(fr, "<b>[!]{|i}:splitlines", &self,
-                       STRCONST_ID(keepends), &keepends) == RES_ERROR) {
-                return ErrorVar;
-        }
-
-        src = bytes_get_data(self);
-        srclen = seqvar_size(self);
-
-        ret = arrayvar_new(0);
         while (srclen) {
                 size_t next, i;
                 for (i = 0; i < srclen; i++) {
@@ -1289,7 +1331,7 @@ do_bytes_splitlines(Frame *fr)
                                 break;
                 }
                 if (i == srclen) {
-                        array_append(ret, bytesvar_new(src, srclen));
+                        bytes_split_store(items, &n, src, srclen);
                         break;
                 }
                 next = i + 1;
@@ -1297,18 +1339,48 @@ do_bytes_splitlines(Frame *fr)
                 case '\n':
                         break;
                 case '\r':
-                        if (i < srclen - 1 && src[i+1] == '\r')
+                        if (i < srclen - 1 && src[i+1] == '\n')
                                 next++;
                         break;
                 default:
                         bug();
                 }
-                array_append(ret, bytesvar_new(src, keepends ? next : i));
+                bytes_split_store(items, &n, src, keepends ? next : i);
                 src += next;
                 srclen -= next;
         }
+        return n;
+}
 
-        return ret;
+static Object *
+do_bytes_splitlines(Frame *fr)
+{
+        const unsigned char *src;
+        size_t srclen, n;
+        int keepends;
+        Object *self, **items;
+
+        keepends = 0;
+        if (vm_getargs(fr, "<b>[!]{|i}:splitlines", &self,
+                       STRCONST_ID(keepends), &keepends) == RES_ERROR) {
+                return ErrorVar;
+        }
+
+        src = bytes_get_data(self);
+        srclen = seqvar_size(self);
+
+        items = NULL;
+        n = bytes_splitlines_fields(NULL, src, srclen, !!keepends);
+        if (n) {
+                size_t n2;
+
+                items = emalloc(n * sizeof(Object *));
+                n2 = bytes_splitlines_fields(items, src, srclen,
+                                             !!keepends);
+                bug_on(n2 != n);
+                (void)n2;
+        }
+        return bytes_split_finish(items, n, false);
 }
 
 static Object *
@@ -1475,6 +1547,12 @@ bytes_create_without_encoding(Object *val)
         }
         if (isvar_bytes(val))
                 return VAR_NEW_REF(val);
+        if (isvar_bytearray(val)) {
+                if (!seqvar_size(val))
+                        return gbl_new_empty_bytes();
+                return bytesvar_new(bytearray_get_data(val),
+                                    seqvar_size(val));
+        }
         if (isvar_seq(val)) {
                 size_t i, n;
                 unsigned char *buf;
@@ -1549,6 +1627,20 @@ bytes_hash(Object *b)
         return bv->hash;
 }
 
+/* bytes never change, so there's nothing to release */
+static enum result_t
+bytes_getbuffer(Object *b, struct buffer_export_t *exp)
+{
+        bug_on(!isvar_bytes(b));
+        exp->buf      = bytes_get_data(b);
+        exp->n        = seqvar_size(b);
+        exp->itemsize = 1;
+        exp->stride   = 1;
+        exp->kind     = EXPORT_BYTE;
+        exp->readonly = true;
+        return RES_OK;
+}
+
 struct bytes_iterator_t {
         Object base;
         Object *target;
@@ -1658,6 +1750,11 @@ static const struct seq_methods_t bytes_seq_methods = {
         .sort           = NULL,
 };
 
+static const struct buffer_methods_t bytes_buffer_methods = {
+        .getbuffer      = bytes_getbuffer,
+        .releasebuffer  = NULL,
+};
+
 struct type_t BytesType = {
         .flags  = 0,
         .name   = "bytes",
@@ -1675,5 +1772,6 @@ struct type_t BytesType = {
         .create = bytes_create,
         .hash   = bytes_hash,
         .get_iter = bytes_get_iter,
+        .bfm    = &bytes_buffer_methods,
 };
 
@@ -10,6 +10,8 @@
 #include <evilcandy/var.h>
 #include <evilcandy/global.h>
 #include <evilcandy/err.h>
+#include <evilcandy/errmsg.h>
+#include <evilcandy/hash.h>
 #include <evilcandy/types/array.h>
 #include <evilcandy/types/class.h>
 #include <evilcandy/types/function.h>
@@ -23,26 +25,57 @@
 #include <internal/type_registry.h>
 #include <internal/types/string.h>
 #include <internal/types/sequential_types.h>
+#include <internal/types/shape.h>
 
 enum {
         INST_FLAG_GETATTR_LOCK = 0x01,
 };
 
+/*
+ * An instance stores its attributes one of two ways:
+ *
+ * - Shaped: @inst_shape holds the names, shared with other instances
+ *   of the class (see shape.c), and @inst_values holds the values, in
+ *   the same order.  @inst_attr is NULL.  This is how every instance
+ *   starts out.
+ * - Dictionary: @inst_attr holds both names and values, and
+ *   @inst_shape and @inst_values are NULL.  An instance switches to
+ *   this if an attribute is deleted or if its class has too many
+ *   shapes.  It never switches back.
+ *
+ * If the class has __slots__, the instance is always shaped, its
+ * shape is the class's only one, and @inst_values points at
+ * @inst_slots, which is allocated along with the instance.
+ */
 struct instance_t {
         Object obj_head;
+        struct shape_t *inst_shape;
+        Object **inst_values;
+        size_t inst_alloc;
         Object *inst_attr;
         unsigned int inst_flags;
+        Object *inst_slots[];
 };
 
 #define V2TP(obj_)        ((struct type_t *)(obj_))
 #define V2INST(obj_)      ((struct instance_t *)(obj_))
 
+/*
+ * If @maybe_function is a function that belongs to @instance, return a
+ * method binding the two together.  Or, if @self is not NULL, leave the
+ * function alone and store @instance in @self, without producing a
+ * reference, so the caller can bind them itself.  See var_getmethod().
+ */
 static Object *
-maybe_bind_function(Object *instance, Object *maybe_function)
+maybe_bind_function(Object *instance, Object *maybe_function, Object **self)
 {
         if (isvar_function(maybe_function) &&
             !(instance->v_type->flags & OBF_NO_BIND_FUNCTION_ATTRS)) {
                 Object *tmp = maybe_function;
+                if (self) {
+                        *self = instance;
+                        return maybe_function;
+                }
                 maybe_function = methodvar_new(tmp, instance);
                 VAR_DECR_REF(tmp);
         }
@@ -131,6 +164,116 @@ type_getitem(Frame *fr, Object *type, Object *key)
         return NULL;
 }
 
+/* Release a shaped instance's values */
+static void
+instance_release_values(struct instance_t *inst)
+{
+        Object **values = inst->inst_values;
+        size_t i, n = shape_size(inst->inst_shape);
+
+        inst->inst_values = NULL;
+        inst->inst_shape = NULL;
+        inst->inst_alloc = 0;
+        for (i = 0; i < n; i++)
+                VAR_DECR_REF(values[i]);
+        if (values && values != inst->inst_slots)
+                efree(values);
+}
+
+/* Switch @inst from shaped to dictionary storage */
+static void
+instance_to_dict(struct instance_t *inst)
+{
+        Object *dict;
+        size_t i, n;
+
+        bug_on(!inst->inst_shape);
+        bug_on(!!(inst->obj_head.v_type->flags & OBF_SLOTS));
+        dict = dictvar_new();
+        n = shape_size(inst->inst_shape);
+        for (i = 0; i < n; i++) {
+                enum result_t res;
+                res = dict_setitem(dict, shape_key(inst->inst_shape, i),
+                                   inst->inst_values[i]);
+                bug_on(res != RES_OK);
+                (void)res;
+        }
+        instance_release_values(inst);
+        inst->inst_attr = dict;
+}
+
+/*
+ * Get @key from @inst's own attributes, not its class's.
+ * Return NULL if not found.  Do not raise an exception.
+ */
+static Object *
+instance_getitem(struct instance_t *inst, Object *key)
+{
+        hash_t hash;
+        ssize_t i;
+
+        if (inst->inst_attr)
+                return dict_getitem(inst->inst_attr, key);
+
+        hash = var_hash(key);
+        if (hash == HASH_ERROR)
+                return NULL;
+        i = shape_lookup(inst->inst_shape, key, hash);
+        if (i < 0)
+                return NULL;
+        return VAR_NEW_REF(inst->inst_values[i]);
+}
+
+/* Add or change an attribute of a shaped instance */
+static enum result_t
+instance_setitem_shaped(struct instance_t *inst, Object *key,
+                        Object *value)
+{
+        struct shape_t *next;
+        hash_t hash;
+        ssize_t i;
+        size_t n;
+
+        hash = var_hash(key);
+        if (hash == HASH_ERROR) {
+                err_hashable(key, NULL);
+                return RES_ERROR;
+        }
+
+        i = shape_lookup(inst->inst_shape, key, hash);
+        if (i >= 0) {
+                Object *old = inst->inst_values[i];
+                inst->inst_values[i] = VAR_NEW_REF(value);
+                VAR_DECR_REF(old);
+                return RES_OK;
+        }
+
+        /* Can't add attributes that aren't in __slots__ */
+        if (!!(inst->obj_head.v_type->flags & OBF_SLOTS))
+                return RES_ERROR;
+
+        next = shape_add(inst->inst_shape, key, hash);
+        if (!next) {
+                instance_to_dict(inst);
+                return dict_setitem(inst->inst_attr, key, value);
+        }
+
+        n = shape_size(inst->inst_shape);
+        if (n == inst->inst_alloc) {
+                size_t alloc = inst->inst_alloc * 2;
+                if (alloc < next->root->hint)
+                        alloc = next->root->hint;
+                if (alloc < 4)
+                        alloc = 4;
+                inst->inst_values = erealloc(inst->inst_values,
+                                        alloc * sizeof(Object *));
+                inst->inst_alloc = alloc;
+        }
+        inst->inst_values[n] = VAR_NEW_REF(value);
+        inst->inst_shape = next;
+        return RES_OK;
+}
+
 static void
 instance_reset(Object *instance)
 {
@@ -139,6 +282,9 @@ instance_reset(Object *instance)
 
         bug_on(!isvar_instance(instance));
 
+        if (inst->inst_shape)
+                instance_release_values(inst);
+
         x = inst->inst_attr;
         inst->inst_attr = NULL;
         if (x)
@@ -482,6 +628,88 @@ type_init_private(Object *class, Object *priv_tup)
         return RES_OK;
 }
 
+/*
+ * tp->methods and tp->mro must already be configured.
+ *
+ * If the class declares __slots__, give its instances a fixed set of
+ * attributes: the slots of any base classes that have __slots__, then
+ * its own.  Bases' slots go first so that with single inheritance they
+ * keep the same indices as in the base class.  A slot starts out as
+ * this class's attribute of the same name, if it has one (this is also
+ * how to declare a private slot), or null otherwise.
+ */
+static enum result_t
+type_init_slots(Object *class)
+{
+        struct type_t *tp = V2TP(class);
+        struct shape_t *shape;
+        Object *slots;
+        size_t i, n;
+
+        slots = dict_getitem(tp->methods, STRCONST_ID(__slots__));
+        if (!slots)
+                return RES_OK;
+
+        if (!isvar_tuple(slots) && !isvar_array(slots)) {
+                err_setstr(TypeError,
+                           "__slots__ must be a tuple or list of names");
+                goto err;
+        }
+
+        shape = shape_new_root();
+        tp->shape = shape;
+
+        n = tp->mro ? seqvar_size(tp->mro) : 0;
+        for (i = n; i-- > 0; ) {
+                struct type_t *base = V2TP(tuple_borrowitem_(tp->mro, i));
+                size_t j;
+
+                if (!(base->flags & OBF_SLOTS))
+                        continue;
+                for (j = 0; j < shape_size(base->shape); j++) {
+                        struct htentry_t *e = &base->shape->keys.entries[j];
+                        /* Diamond inheritance may repeat some */
+                        shape_add_slot(shape, e->key, e->hash, e->val);
+                }
+        }
+
+        n = seqvar_size(slots);
+        for (i = 0; i < n; i++) {
+                Object *name, *init;
+                hash_t hash;
+                bool added;
+
+                name = isvar_tuple(slots) ? tuple_borrowitem_(slots, i)
+                                          : array_borrowitem(slots, i);
+                if (!isvar_string(name) || seqvar_size(name) == 0) {
+                        err_setstr(TypeError,
+                                   "__slots__ items must be non-empty strings");
+                        goto err;
+                }
+                hash = var_hash(name);
+                init = dict_getitem(tp->methods, name);
+                added = shape_add_slot(shape, name, hash,
+                                       init ? init : NullVar);
+                if (init)
+                        VAR_DECR_REF(init);
+                if (!added) {
+                        err_setstr(TypeError, "duplicate slot '%s'",
+                                   string_cstring(name));
+                        goto err;
+                }
+        }
+
+        tp->flags |= OBF_SLOTS;
+        tp->size = sizeof(struct instance_t)
+                   + shape_size(shape) * sizeof(Object *);
+        VAR_DECR_REF(slots);
+        return RES_OK;
+
+err:
+        VAR_DECR_REF(slots);
+        return RES_ERROR;
+}
+
 
 static enum result_t
 type_validate_new_attr(Object *name, void *unused)
@@ -493,6 +721,7 @@ type_validate_new_attr(Object *name, void *unused)
         static const char *valid_dunders[] = {
                 "__init__",
                 "__str__",
+                "__slots__",
                 NULL,
         };
         const char **dunder, *s;
@@ -570,6 +799,10 @@ type_reset(Object *type)
         if (x)
                 VAR_DECR_REF(x);
 
+        if (tp->shape)
+                shape_free(tp->shape);
+        tp->shape = NULL;
+
         if (tp->name)
                 efree((char *)tp->name);
         tp->name = NULL;
@@ -577,27 +810,15 @@ type_reset(Object *type)
         tp->size = 0;
 }
 
-/**
- * instance_getattr - Get an instance attribute
- * @fr: Frame, so we can tell if we have permission, should @key be for
- *      a private attribute.  If @fr is NULL, then only try to access
- *      public attributes.
- * @instance: Instance to get attribute from
- * @key: Key to the attribute
- *
- * Return: attribute if found, or NULL.
- *
- * This does not raise an error if not found.
- */
-Object *
-instance_getattr(Frame *fr, Object *instance, Object *key)
+static Object *
+instance_getattr_(Frame *fr, Object *instance, Object *key, Object **self)
 {
         Object *ret;
         struct instance_t *inst;
 
         inst = V2INST(instance);
         bug_on(!isvar_instance(instance));
-        bug_on(!inst->inst_attr);
+        bug_on(!inst->inst_attr && !inst->inst_shape);
 
         if (!!(inst->inst_flags & INST_FLAG_GETATTR_LOCK))
                 return NULL;
@@ -606,7 +827,7 @@ instance_getattr(Frame *fr, Object *instance, Object *key)
         if (!item_access_permitted(fr, instance->v_type, key))
                 goto notfound;
 
-        ret = dict_getitem(inst->inst_attr, key);
+        ret = instance_getitem(inst, key);
         if (ret)
                 goto found;
         ret = type_getitem(fr, (Object *)(instance->v_type), key);
@@ -614,8 +835,7 @@ instance_getattr(Frame *fr, Object *instance, Object *key)
                 goto found;
 
         if (instance->v_type->delegate_name && isvar_instance(instance)) {
-                Object *delegate = dict_getitem(
-                                        V2INST(instance)->inst_attr,
+                Object *delegate = instance_getitem(inst,
                                         instance->v_type->delegate_name);
                 if (delegate) {
                         ret = NULL;
@@ -632,7 +852,37 @@ notfound:
 
 found:
         inst->inst_flags &= ~INST_FLAG_GETATTR_LOCK;
-        return maybe_bind_function(instance, ret);
+        return maybe_bind_function(instance, ret, self);
+}
+
+/**
+ * instance_getattr - Get an instance attribute
+ * @fr: Frame, so we can tell if we have permission, should @key be for
+ *      a private attribute.  If @fr is NULL, then only try to access
+ *      public attributes.
+ * @instance: Instance to get attribute from
+ * @key: Key to the attribute
+ *
+ * Return: attribute if found, or NULL.
+ *
+ * This does not raise an error if not found.
+ */
+Object *
+instance_getattr(Frame *fr, Object *instance, Object *key)
+{
+        return instance_getattr_(fr, instance, key, NULL);
+}
+
+/**
+ * instance_getmethod - Like instance_getattr(), but do not bind
+ * @self: Set to @instance if the return value is a function which
+ *        instance_getattr() would have bound to it.  Left alone
+ *        otherwise.
+ */
+Object *
+instance_getmethod(Frame *fr, Object *instance, Object *key, Object **self)
+{
+        return instance_getattr_(fr, instance, key, self);
 }
 
 /**
@@ -648,13 +898,111 @@ found:
 enum result_t
 instance_setattr(Frame *fr, Object *instance, Object *key, Object *value)
 {
-        Object *dict;
+        struct instance_t *inst = V2INST(instance);
 
         if (!item_write_access_permitted(fr, instance->v_type, key))
                 return RES_ERROR;
 
-        dict = V2INST(instance)->inst_attr;
-        return dict_setitem(dict, key, value);
+        if (inst->inst_shape) {
+                Object *old;
+
+                if (value)
+                        return instance_setitem_shaped(inst, key, value);
+
+                /*
+                 * Deleting.  Shapes never lose keys, so switch to a
+                 * dictionary, but only if there's something to delete.
+                 * Slots can't be deleted at all.
+                 */
+                if (!!(instance->v_type->flags & OBF_SLOTS))
+                        return RES_ERROR;
+                old = instance_getitem(inst, key);
+                if (!old)
+                        return RES_ERROR;
+                VAR_DECR_REF(old);
+                instance_to_dict(inst);
+        }
+        return dict_setitem(inst->inst_attr, key, value);
+}
+
+/*
+ * Check a hint from the assembler that @key is at index @idx in
+ * @instance's values.  See the GETATTR and SETATTR handlers in vm.c
+ */
+static bool
+instance_slot_hint_ok(Object *instance, size_t idx, Object *key)
+{
+        struct shape_t *shape = V2INST(instance)->inst_shape;
+        return shape && idx < shape_size(shape)
+               && shape_key(shape, idx) == key;
+}
+
+/**
+ * instance_getslot - Get an instance attribute by its index
+ * @fr:         Frame, as with instance_getattr()
+ * @instance:   Instance to get attribute from
+ * @idx:        Where the assembler expects @key to be stored
+ * @key:        Key to the attribute
+ *
+ * Return: The attribute, or NULL if @key isn't at @idx or is not
+ * accessible.  In the latter case, the caller should fall back to
+ * instance_getattr(), which will sort out what to do.  This does not
+ * raise an exception.
+ */
+Object *
+instance_getslot(Frame *fr, Object *instance, size_t idx, Object *key)
+{
+        return instance_getslot_method(fr, instance, idx, key, NULL);
+}
+
+/**
+ * instance_getslot_method - Like instance_getslot(), but do not bind
+ * @self: Same as with instance_getmethod().  If NULL, this is the same
+ *        as instance_getslot().
+ */
+Object *
+instance_getslot_method(Frame *fr, Object *instance, size_t idx,
+                        Object *key, Object **self)
+{
+        bug_on(!isvar_instance(instance));
+
+        if (!instance_slot_hint_ok(instance, idx, key))
+                return NULL;
+        if (!item_access_permitted(fr, instance->v_type, key))
+                return NULL;
+        return maybe_bind_function(instance,
+                        VAR_NEW_REF(V2INST(instance)->inst_values[idx]),
+                        self);
+}
+
+/**
+ * instance_setslot - Set an instance attribute by its index
+ * @fr:         Frame, as with instance_setattr()
+ * @instance:   Instance to set attribute in
+ * @idx:        Where the assembler expects @key to be stored
+ * @key:        Key to the attribute
+ * @value:      Value to set attribute to
+ *
+ * Return: RES_OK if the attribute was set, RES_ERROR if @key isn't at
+ * @idx or is not writable.  In the latter case, the caller should fall
+ * back to instance_setattr().  This does not raise an exception.
+ */
+enum result_t
+instance_setslot(Frame *fr, Object *instance, size_t idx,
+                 Object *key, Object *value)
+{
+        Object *old;
+
+        bug_on(!isvar_instance(instance));
+
+        if (!instance_slot_hint_ok(instance, idx, key))
+                return RES_ERROR;
+        if (!item_write_access_permitted(fr, instance->v_type, key))
+                return RES_ERROR;
+        old = V2INST(instance)->inst_values[idx];
+        V2INST(instance)->inst_values[idx] = VAR_NEW_REF(value);
+        VAR_DECR_REF(old);
+        return RES_OK;
 }
 
 /**
@@ -716,7 +1064,7 @@ instance_super_getattr(Object *instance, Object *attribute_name)
                 Object *super = tuple_borrowitem_(bases, i);
                 Object *attr = type_getitem(NULL, super, attribute_name);
                 if (attr)
-                        return maybe_bind_function(instance, attr);
+                        return maybe_bind_function(instance, attr, NULL);
         }
 
         return NULL;
@@ -749,7 +1097,9 @@ instancevar_new(Object *class, Object *args,
         bug_on(kwargs && !isvar_dict(kwargs));
         bug_on(!isvar_type(class));
         bug_on(!(tp->flags & OBF_HEAP));
-        bug_on(tp->size != sizeof(struct instance_t));
+        bug_on(tp->size != sizeof(struct instance_t) +
+               (tp->shape && !!(tp->flags & OBF_SLOTS)
+                ? shape_size(tp->shape) * sizeof(Object *) : 0));
 
         ret = var_new(tp);
 
@@ -763,7 +1113,20 @@ instancevar_new(Object *class, Object *args,
          */
         VAR_INCR_REF(class);
 
-        V2INST(ret)->inst_attr = dictvar_new();
+        if (!tp->shape)
+                tp->shape = shape_new_root();
+        V2INST(ret)->inst_shape = tp->shape;
+        if (!!(tp->flags & OBF_SLOTS)) {
+                struct instance_t *inst = V2INST(ret);
+                size_t i, n = shape_size(tp->shape);
+
+                for (i = 0; i < n; i++) {
+                        inst->inst_slots[i] =
+                                VAR_NEW_REF(shape_slot_init(tp->shape, i));
+                }
+                inst->inst_values = inst->inst_slots;
+                inst->inst_alloc = n;
+        }
 
         if (call_init) {
                 init_result = instance_call(ret, STRCONST_ID(__init__),
@@ -799,7 +1162,14 @@ instance_dir(Object *instance)
         inst = V2INST(instance);
         class = instance->v_type;
 
-        set = setvar_new(inst->inst_attr);
+        if (inst->inst_shape) {
+                size_t i, n = shape_size(inst->inst_shape);
+                set = setvar_new(NULL);
+                for (i = 0; i < n; i++)
+                        set_additem(set, shape_key(inst->inst_shape, i), NULL);
+        } else {
+                set = setvar_new(inst->inst_attr);
+        }
         set_extend(set, class->methods);
 
         if (class->bases) {
@@ -820,20 +1190,9 @@ instance_dir(Object *instance)
         return ret;
 }
 
-/**
- * type_get_builtin_attr - Get an attribute from a type methods dictionary
- * @tp: Type
- * @obj: Owner to get an attribute from
- * @key: Key to the attribute
- *
- * Return: NULL if not found.  Otherwise return the attribute.  If it is
- *         a function and @tp is configured to bind its methods, then
- *         a MethodType wrapper will be returned instead of the function.
- *
- * This function will not raise an exception if @key is not found.
- */
-Object *
-type_get_builtin_attr(struct type_t *tp, Object *obj, Object *key)
+static Object *
+type_get_builtin_attr_(struct type_t *tp, Object *obj,
+                       Object *key, Object **self)
 {
         Object *ret = dict_getitem(tp->methods, key);
         if (!ret)
@@ -850,7 +1209,39 @@ type_get_builtin_attr(struct type_t *tp, Object *obj, Object *key)
                 return ret;
         }
 
-        return maybe_bind_function(obj, ret);
+        return maybe_bind_function(obj, ret, self);
+}
+
+/**
+ * type_get_builtin_attr - Get an attribute from a type methods dictionary
+ * @tp: Type
+ * @obj: Owner to get an attribute from
+ * @key: Key to the attribute
+ *
+ * Return: NULL if not found.  Otherwise return the attribute.  If it is
+ *         a function and @tp is configured to bind its methods, then
+ *         a MethodType wrapper will be returned instead of the function.
+ *
+ * This function will not raise an exception if @key is not found.
+ */
+Object *
+type_get_builtin_attr(struct type_t *tp, Object *obj, Object *key)
+{
+        return type_get_builtin_attr_(tp, obj, key, NULL);
+}
+
+/**
+ * type_get_builtin_method - Like type_get_builtin_attr(), but do not
+ *                           bind
+ * @self: Set to @obj if the return value is a function which
+ *        type_get_builtin_attr() would have bound to it.  Left alone
+ *        otherwise.
+ */
+Object *
+type_get_builtin_method(struct type_t *tp, Object *obj,
+                        Object *key, Object **self)
+{
+        return type_get_builtin_attr_(tp, obj, key, self);
 }
 
 /**
@@ -1064,6 +1455,11 @@ typevar_new_user(Object *bases, Object *dict,
                 return ErrorVar;
         }
 
+        if (type_init_slots(ret) == RES_ERROR) {
+                VAR_DECR_REF(ret);
+                return ErrorVar;
+        }
+
         if (name)
                 tp->name = estrdup(string_cstring(name));
         else
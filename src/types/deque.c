@@ -0,0 +1,791 @@
+/*
+ * deque.c - Double-ended queue
+ *
+ * A list is a flat array, so taking an item off its front moves every
+ * item after it.  A deque is a ring buffer instead: the items may wrap
+ * around from the end of the buffer back to its start, so items can be
+ * added to or removed from either end in O(1) time.  Indexing is still
+ * O(1).  Inserting or deleting in the middle is O(n), same as for a
+ * list.
+ *
+ * If a deque has a maximum length, adding an item to a full deque drops
+ * an item from the opposite end.
+ */
+#include <evilcandy/debug.h>
+#include <evilcandy/err.h>
+#include <evilcandy/errmsg.h>
+#include <evilcandy/ewrappers.h>
+#include <evilcandy/global.h>
+#include <evilcandy/string_writer.h>
+#include <evilcandy/vm.h>
+#include <evilcandy/types/array.h>
+#include <evilcandy/types/deque.h>
+#include <evilcandy/types/number_types.h>
+#include <evilcandy/types/string.h>
+#include <internal/type_registry.h>
+#include <internal/types/number_types.h>
+#include <internal/types/sequential_types.h>
+
+#include <stdio.h>
+#include <string.h>
+
+/* Smallest buffer, must be a power of two */
+#define DEQUE_MIN_CAP   8
+
+/**
+ * struct dequevar_t - Handle to a deque
+ * @items:      Ring buffer
+ * @cap:        Number of slots in @items, a power of two
+ * @head:       Index into @items of the first item
+ * @maxlen:     Maximum length, or -1 if unbounded
+ * @state:      Incremented whenever an item is added or removed, so
+ *              iterators can tell if the deque changed under them
+ * @lock:       Display lock, see deque_str
+ *
+ * The number of items is the seqvar size.  The i'th item is at
+ * @items[(@head + i) & (@cap - 1)].
+ */
+struct dequevar_t {
+        struct seqvar_t base;
+        Object **items;
+        size_t cap;
+        size_t head;
+        ssize_t maxlen;
+        unsigned long state;
+        int lock;
+};
+
+#define V2DQ(v_)        ((struct dequevar_t *)(v_))
+
+static inline size_t
+deque_slot(struct dequevar_t *dq, size_t i)
+{
+        return (dq->head + i) & (dq->cap - 1);
+}
+
+static inline Object *
+deque_at(Object *d, size_t i)
+{
+        return V2DQ(d)->items[deque_slot(V2DQ(d), i)];
+}
+
+static Object *
+deque_alloc(ssize_t maxlen)
+{
+        Object *ret = var_new(&DequeType);
+        struct dequevar_t *dq = V2DQ(ret);
+
+        dq->cap = DEQUE_MIN_CAP;
+        dq->items = emalloc(dq->cap * sizeof(Object *));
+        dq->head = 0;
+        dq->maxlen = maxlen;
+        dq->state = 0;
+        dq->lock = 0;
+        seqvar_set_size(ret, 0);
+        return ret;
+}
+
+/* Move the items into a buffer of @cap slots, starting at slot 0 */
+static void
+deque_realloc(Object *d, size_t cap)
+{
+        struct dequevar_t *dq = V2DQ(d);
+        size_t n = seqvar_size(d);
+        size_t first = dq->cap - dq->head;
+        Object **items;
+
+        bug_on(cap < n || (cap & (cap - 1)) != 0);
+        items = emalloc(cap * sizeof(Object *));
+        if (first >= n) {
+                memcpy(items, &dq->items[dq->head], n * sizeof(Object *));
+        } else {
+                memcpy(items, &dq->items[dq->head], first * sizeof(Object *));
+                memcpy(&items[first], dq->items,
+                       (n - first) * sizeof(Object *));
+        }
+        efree(dq->items);
+        dq->items = items;
+        dq->cap = cap;
+        dq->head = 0;
+}
+
+static void
+deque_grow(Object *d)
+{
+        if (seqvar_size(d) == V2DQ(d)->cap)
+                deque_realloc(d, V2DQ(d)->cap * 2);
+}
+
+static void
+deque_shrink(Object *d)
+{
+        struct dequevar_t *dq = V2DQ(d);
+        if (dq->cap > DEQUE_MIN_CAP && seqvar_size(d) < dq->cap / 4)
+                deque_realloc(d, dq->cap / 2);
+}
+
+/*
+ * The four basic operations.  The push functions consume the reference
+ * to @item, and the pop functions hand over the deque's reference.
+ * They don't enforce maxlen; that's deque_append's job.
+ */
+static void
+deque_push_right(Object *d, Object *item)
+{
+        struct dequevar_t *dq = V2DQ(d);
+        size_t n = seqvar_size(d);
+
+        deque_grow(d);
+        dq->items[deque_slot(dq, n)] = item;
+        seqvar_set_size(d, n + 1);
+        dq->state++;
+}
+
+static void
+deque_push_left(Object *d, Object *item)
+{
+        struct dequevar_t *dq = V2DQ(d);
+
+        deque_grow(d);
+        dq->head = (dq->head - 1) & (dq->cap - 1);
+        dq->items[dq->head] = item;
+        seqvar_set_size(d, seqvar_size(d) + 1);
+        dq->state++;
+}
+
+static Object *
+deque_pop_right(Object *d)
+{
+        struct dequevar_t *dq = V2DQ(d);
+        size_t n = seqvar_size(d);
+        Object *ret;
+
+        bug_on(n == 0);
+        ret = dq->items[deque_slot(dq, n - 1)];
+        seqvar_set_size(d, n - 1);
+        dq->state++;
+        deque_shrink(d);
+        return ret;
+}
+
+static Object *
+deque_pop_left(Object *d)
+{
+        struct dequevar_t *dq = V2DQ(d);
+        Object *ret;
+
+        bug_on(seqvar_size(d) == 0);
+        ret = dq->items[dq->head];
+        dq->head = (dq->head + 1) & (dq->cap - 1);
+        seqvar_set_size(d, seqvar_size(d) - 1);
+        dq->state++;
+        deque_shrink(d);
+        return ret;
+}
+
+/**
+ * deque_append - Add an item to one end of a deque
+ * @d:          Deque
+ * @item:       Item to add.  A reference is produced for it.
+ * @left:       If true, add to the left end, otherwise the right end
+ *
+ * If @d is full, an item is dropped from the other end.
+ */
+void
+deque_append(Object *d, Object *item, bool left)
+{
+        struct dequevar_t *dq = V2DQ(d);
+
+        bug_on(!isvar_deque(d));
+        if (dq->maxlen == 0)
+                return;
+        if (dq->maxlen > 0 && seqvar_size(d) >= (size_t)dq->maxlen) {
+                Object *drop = left ? deque_pop_right(d)
+                                    : deque_pop_left(d);
+                VAR_DECR_REF(drop);
+        }
+        VAR_INCR_REF(item);
+        if (left)
+                deque_push_left(d, item);
+        else
+                deque_push_right(d, item);
+}
+
+/**
+ * deque_pop - Remove an item from one end of a deque
+ * @d:          Deque
+ * @left:       If true, remove from the left end, otherwise the right
+ *
+ * Return: The item, or ErrorVar if @d is empty.  A reference is
+ * handed over to the caller.
+ */
+Object *
+deque_pop(Object *d, bool left)
+{
+        bug_on(!isvar_deque(d));
+        if (seqvar_size(d) == 0) {
+                err_setstr(IndexError, "pop from an empty deque");
+                return ErrorVar;
+        }
+        return left ? deque_pop_left(d) : deque_pop_right(d);
+}
+
+/* Rotate right by @n steps, left if @n is negative */
+static void
+deque_rotate(Object *d, long long n)
+{
+        struct dequevar_t *dq = V2DQ(d);
+        long long len = seqvar_size(d);
+
+        if (len < 2)
+                return;
+        n %= len;
+        if (n < 0)
+                n += len;
+        if (n == 0)
+                return;
+
+        if (len == dq->cap) {
+                /* Full buffer, nothing to move */
+                dq->head = (dq->head - n) & (dq->cap - 1);
+        } else if (n <= len / 2) {
+                while (n-- > 0) {
+                        size_t last = deque_slot(dq, len - 1);
+                        dq->head = (dq->head - 1) & (dq->cap - 1);
+                        dq->items[dq->head] = dq->items[last];
+                }
+        } else {
+                for (n = len - n; n > 0; n--) {
+                        size_t next = deque_slot(dq, len);
+                        dq->items[next] = dq->items[dq->head];
+                        dq->head = (dq->head + 1) & (dq->cap - 1);
+                }
+        }
+        dq->state++;
+}
+
+static void
+deque_clear(Object *d)
+{
+        struct dequevar_t *dq = V2DQ(d);
+        size_t i, n = seqvar_size(d);
+        Object **old = dq->items;
+        size_t head = dq->head, mask = dq->cap - 1;
+
+        /*
+         * Empty the deque before dropping the references, in case an
+         * item's destructor looks at it.
+         */
+        dq->cap = DEQUE_MIN_CAP;
+        dq->items = emalloc(dq->cap * sizeof(Object *));
+        dq->head = 0;
+        seqvar_set_size(d, 0);
+        dq->state++;
+
+        for (i = 0; i < n; i++)
+                VAR_DECR_REF(old[(head + i) & mask]);
+        efree(old);
+}
+
+static enum result_t
+deque_extend_one(Object *item, void *data)
+{
+        deque_append((Object *)data, item, false);
+        return RES_OK;
+}
+
+static enum result_t
+deque_extendleft_one(Object *item, void *data)
+{
+        deque_append((Object *)data, item, true);
+        return RES_OK;
+}
+
+static enum result_t
+deque_extend(Object *d, Object *seq, bool left)
+{
+        enum result_t res;
+
+        /* Don't iterate over ourselves while we're growing */
+        if (seq == d) {
+                Object *tmp = arrayvar_new(0);
+                size_t i, n = seqvar_size(d);
+                for (i = 0; i < n; i++)
+                        array_append(tmp, deque_at(d, i));
+                res = deque_extend(d, tmp, left);
+                VAR_DECR_REF(tmp);
+                return res;
+        }
+        return var_traverse(seq,
+                            left ? deque_extendleft_one : deque_extend_one,
+                            d, left ? "extendleft" : "extend");
+}
+
+/* **********************************************************************
+ *                      Built-in methods
+ ***********************************************************************/
+
+static Object *
+do_deque_append(Frame *fr)
+{
+        Object *self, *item;
+
+        if (vm_getargs(fr, "<*>[<*>!]{!}:append", &self, &item)
+            == RES_ERROR) {
+                return ErrorVar;
+        }
+        bug_on(!isvar_deque(self));
+        deque_append(self, item, false);
+        return NULL;
+}
+
+static Object *
+do_deque_appendleft(Frame *fr)
+{
+        Object *self, *item;
+
+        if (vm_getargs(fr, "<*>[<*>!]{!}:appendleft", &self, &item)
+            == RES_ERROR) {
+                return ErrorVar;
+        }
+        bug_on(!isvar_deque(self));
+        deque_append(self, item, true);
+        return NULL;
+}
+
+static Object *
+do_deque_pop(Frame *fr)
+{
+        Object *self;
+
+        if (vm_getargs(fr, "<*>[!]{!}:pop", &self) == RES_ERROR)
+                return ErrorVar;
+        return deque_pop(self, false);
+}
+
+static Object *
+do_deque_popleft(Frame *fr)
+{
+        Object *self;
+
+        if (vm_getargs(fr, "<*>[!]{!}:popleft", &self) == RES_ERROR)
+                return ErrorVar;
+        return deque_pop(self, true);
+}
+
+static Object *
+do_deque_extend(Frame *fr)
+{
+        Object *self, *seq;
+
+        if (vm_getargs(fr, "<*>[<*>!]{!}:extend", &self, &seq)
+            == RES_ERROR) {
+                return ErrorVar;
+        }
+        bug_on(!isvar_deque(self));
+        return deque_extend(self, seq, false) == RES_OK ? NULL : ErrorVar;
+}
+
+static Object *
+do_deque_extendleft(Frame *fr)
+{
+        Object *self, *seq;
+
+        if (vm_getargs(fr, "<*>[<*>!]{!}:extendleft", &self, &seq)
+            == RES_ERROR) {
+                return ErrorVar;
+        }
+        bug_on(!isvar_deque(self));
+        return deque_extend(self, seq, true) == RES_OK ? NULL : ErrorVar;
+}
+
+/* .rotate(n=1)  Move the last n items to the front */
+static Object *
+do_deque_rotate(Frame *fr)
+{
+        Object *self;
+        long long n = 1;
+
+        if (vm_getargs(fr, "<*>[|l!]{!}:rotate", &self, &n) == RES_ERROR)
+                return ErrorVar;
+        bug_on(!isvar_deque(self));
+        deque_rotate(self, n);
+        return NULL;
+}
+
+static Object *
+do_deque_clear(Frame *fr)
+{
+        Object *self;
+
+        if (vm_getargs(fr, "<*>[!]{!}:clear", &self) == RES_ERROR)
+                return ErrorVar;
+        bug_on(!isvar_deque(self));
+        deque_clear(self);
+        return NULL;
+}
+
+static Object *
+do_deque_copy(Frame *fr)
+{
+        Object *self, *ret;
+        size_t i, n;
+
+        if (vm_getargs(fr, "<*>[!]{!}:copy", &self) == RES_ERROR)
+                return ErrorVar;
+        bug_on(!isvar_deque(self));
+        ret = deque_alloc(V2DQ(self)->maxlen);
+        n = seqvar_size(self);
+        for (i = 0; i < n; i++)
+                deque_append(ret, deque_at(self, i), false);
+        return ret;
+}
+
+static Object *
+do_deque_count(Frame *fr)
+{
+        Object *self, *item;
+        size_t i, n, count = 0;
+
+        if (vm_getargs(fr, "<*>[<*>!]{!}:count", &self, &item)
+            == RES_ERROR) {
+                return ErrorVar;
+        }
+        bug_on(!isvar_deque(self));
+        n = seqvar_size(self);
+        for (i = 0; i < n; i++) {
+                if (var_matches(deque_at(self, i), item))
+                        count++;
+        }
+        return intvar_new(count);
+}
+
+static Object *
+deque_getprop_length(Object *self)
+{
+        bug_on(!isvar_deque(self));
+        return intvar_new(seqvar_size(self));
+}
+
+static Object *
+deque_getprop_maxlen(Object *self)
+{
+        bug_on(!isvar_deque(self));
+        if (V2DQ(self)->maxlen < 0)
+                return VAR_NEW_REF(NullVar);
+        return intvar_new(V2DQ(self)->maxlen);
+}
+
+/* **********************************************************************
+ *                      Type methods
+ ***********************************************************************/
+
+static Object *
+deque_getitem(Object *d, size_t i)
+{
+        Object *ret;
+
+        bug_on(i >= seqvar_size(d));
+        ret = deque_at(d, i);
+        VAR_INCR_REF(ret);
+        return ret;
+}
+
+/* NULL @child means delete item @i, shifting the shorter side over */
+static enum result_t
+deque_setitem(Object *d, size_t i, Object *child)
+{
+        struct dequevar_t *dq = V2DQ(d);
+        size_t j, n = seqvar_size(d);
+        size_t slot;
+        Object *old;
+
+        bug_on(i >= n);
+        slot = deque_slot(dq, i);
+        old = dq->items[slot];
+        if (child) {
+                dq->items[slot] = VAR_NEW_REF(child);
+                VAR_DECR_REF(old);
+                return RES_OK;
+        }
+
+        if (i < n / 2) {
+                for (j = i; j > 0; j--) {
+                        dq->items[deque_slot(dq, j)] =
+                                dq->items[deque_slot(dq, j - 1)];
+                }
+                dq->head = (dq->head + 1) & (dq->cap - 1);
+        } else {
+                for (j = i; j < n - 1; j++) {
+                        dq->items[deque_slot(dq, j)] =
+                                dq->items[deque_slot(dq, j + 1)];
+                }
+        }
+        seqvar_set_size(d, n - 1);
+        dq->state++;
+        deque_shrink(d);
+        VAR_DECR_REF(old);
+        return RES_OK;
+}
+
+static bool
+deque_hasitem(Object *d, Object *item)
+{
+        size_t i, n = seqvar_size(d);
+
+        for (i = 0; i < n; i++) {
+                if (var_matches(deque_at(d, i), item))
+                        return true;
+        }
+        return false;
+}
+
+static Object *
+deque_str(Object *d)
+{
+        struct string_writer_t wr;
+        size_t i, n;
+
+        if (V2DQ(d)->lock)
+                return stringvar_new("deque([...])");
+        V2DQ(d)->lock = true;
+
+        string_writer_init(&wr, 1);
+        string_writer_appends(&wr, "deque([");
+        n = seqvar_size(d);
+        for (i = 0; i < n; i++) {
+                Object *item;
+                if (i > 0)
+                        string_writer_appends(&wr, ", ");
+                item = var_str(deque_at(d, i));
+                string_writer_append_strobj(&wr, item);
+                VAR_DECR_REF(item);
+        }
+        string_writer_append(&wr, ']');
+        if (V2DQ(d)->maxlen >= 0) {
+                char buf[32];
+                snprintf(buf, sizeof(buf), ", maxlen=%lld",
+                         (long long)V2DQ(d)->maxlen);
+                string_writer_appends(&wr, buf);
+        }
+        string_writer_append(&wr, ')');
+
+        V2DQ(d)->lock = false;
+        return stringvar_from_writer(&wr);
+}
+
+static bool
+deque_cmpeq(Object *a, Object *b)
+{
+        static long recursion = 0;
+        size_t i, n;
+        bool res;
+
+        bug_on(!isvar_deque(a) || !isvar_deque(b));
+        n = seqvar_size(a);
+        if (n != seqvar_size(b))
+                return false;
+
+        /* Same guard as array_cmpeq() */
+        if (recursion >= RECURSION_MAX)
+                return false;
+        recursion++;
+
+        res = true;
+        for (i = 0; i < n; i++) {
+                if (!var_matches(deque_at(a, i), deque_at(b, i))) {
+                        res = false;
+                        break;
+                }
+        }
+
+        recursion--;
+        return res;
+}
+
+static bool
+deque_cmpz(Object *d)
+{
+        return seqvar_size(d) == 0;
+}
+
+static void
+deque_reset(Object *d)
+{
+        struct dequevar_t *dq = V2DQ(d);
+        size_t i, n = seqvar_size(d);
+
+        for (i = 0; i < n; i++)
+                VAR_DECR_REF(deque_at(d, i));
+        efree(dq->items);
+}
+
+/*
+ * deque(iterable, maxlen)
+ *
+ * Both arguments are optional.  maxlen may also be given by keyword,
+ * and it may be null, meaning unbounded.
+ */
+static Object *
+deque_create(Frame *fr)
+{
+        Object *seq = NULL, *maxlen_o = NULL, *maxlen_kw = NULL;
+        Object *ret;
+        ssize_t maxlen = -1;
+
+        if (vm_getargs(fr, "[|<*><*>!]{|<*>}:deque", &seq, &maxlen_o,
+                       STRCONST_ID(maxlen), &maxlen_kw) == RES_ERROR) {
+                return ErrorVar;
+        }
+        if (maxlen_kw) {
+                if (maxlen_o) {
+                        err_setstr(ArgumentError,
+                                   "deque() got maxlen twice");
+                        return ErrorVar;
+                }
+                maxlen_o = maxlen_kw;
+        }
+        if (maxlen_o && maxlen_o != NullVar) {
+                if (!isvar_int(maxlen_o)) {
+                        err_setstr(TypeError,
+                                   "deque() maxlen must be integer or null, not %s",
+                                   typestr(maxlen_o));
+                        return ErrorVar;
+                }
+                if (intvar_toll(maxlen_o) < 0) {
+                        err_setstr(ValueError,
+                                   "deque() maxlen may not be negative");
+                        return ErrorVar;
+                }
+                maxlen = intvar_toll(maxlen_o);
+        }
+
+        ret = deque_alloc(maxlen);
+        if (seq && seq != NullVar) {
+                if (deque_extend(ret, seq, false) == RES_ERROR) {
+                        VAR_DECR_REF(ret);
+                        return ErrorVar;
+                }
+        }
+        return ret;
+}
+
+/* **********************************************************************
+ *                              Iterator
+ ***********************************************************************/
+
+struct deque_iterator_t {
+        Object base;
+        Object *target;
+        size_t i;
+        unsigned long state;
+};
+
+#define O2DQIT(o)       ((struct deque_iterator_t *)(o))
+
+static Object *
+deque_iter_next(Object *it)
+{
+        struct deque_iterator_t *dit = O2DQIT(it);
+
+        if (!dit->target)
+                return NULL;
+        if (dit->state != V2DQ(dit->target)->state) {
+                err_setstr(RuntimeError, "deque mutated during iteration");
+                return ErrorVar;
+        }
+        if (dit->i < seqvar_size(dit->target))
+                return deque_getitem(dit->target, dit->i++);
+
+        VAR_DECR_REF(dit->target);
+        dit->target = NULL;
+        return NULL;
+}
+
+static void
+deque_iter_reset(Object *it)
+{
+        struct deque_iterator_t *dit = O2DQIT(it);
+        if (dit->target)
+                VAR_DECR_REF(dit->target);
+        dit->target = NULL;
+}
+
+struct type_t DequeIterType = {
+        .name   = "deque_iterator",
+        .reset  = deque_iter_reset,
+        .size   = sizeof(struct deque_iterator_t),
+        .iter_next = deque_iter_next,
+};
+
+static Object *
+deque_get_iter(Object *d)
+{
+        Object *ret = var_new(&DequeIterType);
+        O2DQIT(ret)->target = VAR_NEW_REF(d);
+        O2DQIT(ret)->i = 0;
+        O2DQIT(ret)->state = V2DQ(d)->state;
+        return ret;
+}
+
+/* **********************************************************************
+ *                              CAPI
+ ***********************************************************************/
+
+/**
+ * dequevar_new - Create an empty deque
+ * @maxlen:     Maximum length, or -1 for unbounded
+ */
+Object *
+dequevar_new(ssize_t maxlen)
+{
+        return deque_alloc(maxlen);
+}
+
+static const struct type_method_t deque_cb_methods[] = {
+        {"append",      do_deque_append},
+        {"appendleft",  do_deque_appendleft},
+        {"clear",       do_deque_clear},
+        {"copy",        do_deque_copy},
+        {"count",       do_deque_count},
+        {"extend",      do_deque_extend},
+        {"extendleft",  do_deque_extendleft},
+        {"pop",         do_deque_pop},
+        {"popleft",     do_deque_popleft},
+        {"rotate",      do_deque_rotate},
+        {NULL, NULL},
+};
+
+static const struct type_prop_t deque_prop_getsets[] = {
+        { .name = "length", .getprop = deque_getprop_length, .setprop = NULL },
+        { .name = "maxlen", .getprop = deque_getprop_maxlen, .setprop = NULL },
+        { .name = NULL },
+};
+
+static const struct seq_methods_t deque_seq_methods = {
+        .getitem        = deque_getitem,
+        .setitem        = deque_setitem,
+        .hasitem        = deque_hasitem,
+        .getslice       = NULL,
+        .cat            = NULL,
+        .sort           = NULL,
+};
+
+struct type_t DequeType = {
+        .flags  = 0,
+        .name   = "deque",
+        .opm    = NULL,
+        .cbm    = deque_cb_methods,
+        .mpm    = NULL,
+        .sqm    = &deque_seq_methods,
+        .size   = sizeof(struct dequevar_t),
+        .str    = deque_str,
+        .cmp    = NULL,
+        .cmpz   = deque_cmpz,
+        .cmpeq  = deque_cmpeq,
+        .reset  = deque_reset,
+        .prop_getsets = deque_prop_getsets,
+        .create = deque_create,
+        .hash   = NULL,
+        .get_iter = deque_get_iter,
+};
@@ -5,8 +5,16 @@
  * Calling one kind of an object an 'object' to distinguish it from another
  * kind of object is kind of janky, so I'm going with Python on this one.
  *
- * TODO: For the sake of non-string keys, store the hash number with
- * d_keys, d_vals.
+ * The hash table itself is in hashtable.c, which sets also use.
+ *
+ * Dictionaries keyed by small non-negative integers (id maps, sparse
+ * arrays) get a shortcut.  While a dictionary has only int keys, and
+ * none of them is much larger than the number of entries, it also keeps
+ * a "dense index" which maps each key directly to its entry, so a
+ * lookup is one array index with no hashing or probing.  The hash table
+ * is kept up to date either way, so iteration order and lookups by
+ * other kinds of numbers (1.0 for 1) work the same.  The first non-int
+ * key drops the dense index for good, or until the dict is cleared.
  */
 #include <evilcandy/iterator.h>
 #include <evilcandy/string_writer.h>
@@ -24,39 +32,37 @@
 #include <evilcandy/types/number_types.h>
 #include <internal/uarg.h>
 #include <internal/type_registry.h>
+#include <internal/types/hashtable.h>
 #include <internal/types/string.h>
 #include <internal/types/internal_types.h>
-#include <lib/helpers.h>
+#include <internal/types/number_types.h>
 
 #include <limits.h>
+#include <string.h>
 
 /**
  * struct dictvar_t - Descriptor for an object handle
- * @d_size:             Array size of d_keys/d_vals, always a power of 2
- * @d_used:             Active entries in hash table
- * @d_count:            Active + removed ('dead') entries in hash table
- * @d_grow_size:        Next threshold for expanding
- * @d_shrink_size:      Next threshold for shrinking
- * @d_keys:             Array of keys
- * @d_vals:             Array of values, whose indices match those of keys.
- * @d_map:              Array mapping entries in order to their indices
- *                      in @d_keys/@d_vals.  Used for iterating.
+ * @d_table:            Hash table of keys and values, in insertion order
  * @d_lock:             Display lock
- *
- * d_keys, d_vals, and d_map are allocated in one call each time the
- * table resizes.  The allocation pointer is at d_keys.
+ * @d_intkeys:          True if every key is an int
+ * @d_maxkey:           If @d_intkeys, the largest key ever added since
+ *                      the dict was last empty, or LLONG_MAX if any of
+ *                      them was negative.  Removing keys doesn't lower
+ *                      it.
+ * @d_dense:            Dense index, or NULL.  If not NULL, every key is
+ *                      an int in [0, @d_dense_size), and @d_dense[k] is
+ *                      one plus the index of key k's entry in
+ *                      @d_table.entries, or zero if k is not a key.
+ * @d_dense_size:       Number of elements in @d_dense
  */
 struct dictvar_t {
         struct seqvar_t base;
-        size_t d_size;
-        size_t d_used;
-        size_t d_count;
-        size_t d_grow_size;
-        size_t d_shrink_size;
-        Object **d_keys;
-        Object **d_vals;
-        void *d_map;
+        struct htable_t d_table;
         int d_lock;
+        bool d_intkeys;
+        long long d_maxkey;
+        uint32_t *d_dense;
+        size_t d_dense_size;
 };
 
 #define V2D(v)          ((struct dictvar_t *)(v))
@@ -68,308 +74,162 @@ struct dictvar_t {
  *                      Hash table helpers
  ***********************************************************************/
 
-#define BUCKET_DEAD     ((void *)-1)
+enum {
+        /* Smallest dense index, in elements */
+        DENSE_MIN       = 16,
+        /* Largest dense index */
+        DENSE_MAX       = 1 << 24,
+};
 
 /*
- * this initial size is small enough to not be a burden
- * but large enough that for 90% use-cases, no resizing
- * need occur.
+ * True if @n int keys, the largest of which is @maxkey, are compact
+ * enough for a dense index.  It's allowed to be up to about 4x as big
+ * as the number of entries, which at 4 bytes per element still costs
+ * less than a hash table entry.
  */
-enum { INIT_SIZE = 16 };
-
-static void
-index_write__(void *p, size_t dsize, size_t idx, ssize_t val)
-{
-        bug_on(dsize > INT_MAX);
-        if (dsize > 0x7fff)
-                ((int32_t *)p)[idx] = val;
-        else if (dsize > 0x7f)
-                ((int16_t *)p)[idx] = val;
-        else
-                ((int8_t *)p)[idx] = val;
-}
-
-static void
-index_write(struct dictvar_t *d, size_t idx, ssize_t val)
-{
-        index_write__(d->d_map, d->d_size, idx, val);
-}
-
-static ssize_t
-index_read__(void *p, size_t dsize, size_t idx)
+static bool
+dense_fits(long long maxkey, size_t n)
 {
-        bug_on(dsize > INT_MAX);
-        if (dsize > 0x7fff)
-                return ((int32_t *)p)[idx];
-        else if (dsize > 0x7f)
-                return ((int16_t *)p)[idx];
-        else {
-                /* Not so sure 8-bit signed is universally supported */
-                ssize_t ret = ((int8_t *)p)[idx];
-                return ret >= 128 ? -1 : ret;
-        }
+        return maxkey >= 0 && maxkey < DENSE_MAX
+               && (size_t)maxkey < 4 * n + DENSE_MIN;
 }
 
-static ssize_t
-index_read(struct dictvar_t *d, size_t idx)
+static size_t
+dense_size_for(long long maxkey)
 {
-        return index_read__(d->d_map, d->d_size, idx);
+        size_t size = DENSE_MIN;
+        while (size <= (size_t)maxkey)
+                size *= 2;
+        return size;
 }
 
-static size_t
-index_width(size_t dsize)
+static void
+dict_dense_free(struct dictvar_t *d)
 {
-        bug_on(dsize > INT_MAX);
-        if (dsize > 0x7fff)
-                return sizeof(int32_t);
-        else if (dsize > 0x7f)
-                return sizeof(int16_t);
-        else
-                return sizeof(int8_t);
+        if (d->d_dense)
+                efree(d->d_dense);
+        d->d_dense = NULL;
+        d->d_dense_size = 0;
 }
 
 /*
- * d_keys and d_vals will be clobbered, they're assumed to have
- * been saved.
+ * Build the dense index from scratch, if the keys allow it.  Called
+ * whenever the hash table was rebuilt, since that moves the entries.
  */
 static void
-bucket_alloc(struct dictvar_t *dict)
+dict_dense_rebuild(struct dictvar_t *d)
 {
-        /* d_keys, d_vals, and d_map are all alloc'd together */
-        size_t nelem = dict->d_size;
-        size_t wid = index_width(nelem);
-        dict->d_keys = emalloc(nelem * (sizeof(Object *) * 2 + wid));
-        dict->d_vals = &dict->d_keys[nelem];
-        dict->d_map = (void *)(&dict->d_vals[nelem]);
-        memset(dict->d_keys, 0, sizeof(Object *) * 2 * nelem);
-        /* Don't need to memset map, that's done in transfer_table() */
-}
-
-static bool
-key_match(Object *key1, Object *key2, hash_t key2_hash)
-{
-        /*
-         * Since we already have the hash of key2 and since keys are
-         * usually strings, try to fast-path this.
-         */
-        if (isvar_string(key1)) {
-                if (isvar_string(key2)) {
-                        if (var_hash(key1) != key2_hash)
-                                return false;
-                        return string_eq(key1, key2);
-                }
-                return false;
-        }
-        return var_matches(key1, key2);
+        struct htentry_t *e;
+        size_t idx;
+
+        dict_dense_free(d);
+        if (!d->d_intkeys || !dense_fits(d->d_maxkey, d->d_table.used))
+                return;
+
+        d->d_dense_size = dense_size_for(d->d_maxkey);
+        d->d_dense = ecalloc(d->d_dense_size * sizeof(uint32_t));
+        idx = 0;
+        while ((e = htable_next(&d->d_table, &idx)) != NULL)
+                d->d_dense[intvar_toll(e->key)] = idx;
 }
 
+/*
+ * Update the dense index after adding entry @e.  @entries is
+ * d->d_table.entries from before the insertion.
+ */
 static void
-append_to_map(struct dictvar_t *dict, int i)
+dict_dense_add(struct dictvar_t *d, struct htentry_t *e,
+               struct htentry_t *entries)
 {
-        index_write(dict, dict->d_count, i);
-}
+        long long k;
 
-static inline int
-bucketi(struct dictvar_t *dict, hash_t hash)
-{
-        return hash & (dict->d_size - 1);
-}
+        if (!d->d_intkeys)
+                return;
 
-static int
-seek_helper(struct dictvar_t *dict, Object *key)
-{
-        Object *k;
-        hash_t hash;
-        unsigned long perturb;
-        int i;
+        k = intvar_toll(e->key);
+        if (k < 0)
+                d->d_maxkey = LLONG_MAX;
+        else if (k > d->d_maxkey)
+                d->d_maxkey = k;
 
-        hash = var_hash(key);
-        if (hash == HASH_ERROR)
-                return -1;
-
-        perturb = hash;
-        i = bucketi(dict, hash);
-        while ((k = dict->d_keys[i]) != NULL) {
-                if (k != BUCKET_DEAD && key_match(k, key, hash))
-                        break;
+        if (d->d_table.entries != entries || !d->d_dense) {
                 /*
-                 * Collision or dead entry.
-                 *
-                 * Way to cope with a power-of-2-sized hash table, esp.
-                 * an open-address one.  Idea & algo taken from Python.
-                 * See cpython source code, "Object/dictobject.c" at
-                 *
-                 *      https://github.com/python/cpython.git
-                 *
-                 * Don't just seek the next adjacent empty slot.  For any
-                 * non-trivial alpha, this quickly degenerates into a
-                 * linear array search.  "Perturb it" instead.  This will
-                 * not spinlock because:
-                 *
-                 * 1. There is always at least one blank entry
-                 *
-                 * 2. We will eventually hit an empty slot, even in the
-                 *    worst-case scenario, because after floor(64/5)=12
-                 *    iterations, perturb will become zero, and
-                 *    (i*5+1) % SIZE will eventually hit every index at
-                 *    least once when size is a power of 2.  (I don't
-                 *    know the proof, but every which way I've tested it,
-                 *    it turns out to be true.  Also, very smart people
-                 *    claim to have proven it and they're smart.)
+                 * Table was rebuilt, or there's no index yet.  Only try
+                 * to start one on the first key; otherwise wait for
+                 * the next rebuild, so this stays amortized O(1).
                  */
-                perturb >>= 5;
-                i = bucketi(dict, i * 5 + perturb + 1);
+                if (d->d_table.entries != entries || d->d_table.used == 1)
+                        dict_dense_rebuild(d);
+                return;
         }
-        bug_on(i < 0 || i >= dict->d_size);
-        return i;
-}
 
-static void
-transfer_table(struct dictvar_t *dict, size_t old_size)
-{
-        ssize_t i;  /* Old keys/vals index */
-        ssize_t j;  /* New keys/vals index */
-        ssize_t m;  /* Old map index */
-        ssize_t n;  /* New map index */
-        ssize_t iwid;
-        Object **old_keys = dict->d_keys;
-        Object **old_vals = dict->d_vals;
-        void *old_map = dict->d_map;
-
-        bucket_alloc(dict);
-
-        n = 0;
-        for (m = 0; m < old_size; m++) {
-                unsigned long perturb;
-                Object *k;
-                hash_t hash;
-
-                i = index_read__(old_map, old_size, m);
-                if (i < 0)
-                        continue;
-
-                k = old_keys[i];
-                if (k == NULL || k == BUCKET_DEAD)
-                        continue;
-
-                hash = var_hash(k);
-
-                perturb = hash;
-                j = bucketi(dict, hash);
-                while (dict->d_keys[j] != NULL) {
-                        perturb >>= 5;
-                        j = bucketi(dict, j * 5 + perturb + 1);
+        if (k < 0 || (size_t)k >= d->d_dense_size) {
+                size_t oldsize = d->d_dense_size;
+
+                if (!dense_fits(k, d->d_table.used)) {
+                        dict_dense_free(d);
+                        return;
                 }
-                dict->d_keys[j] = k; /* ie 'old_keys[i]' */
-                dict->d_vals[j] = old_vals[i];
-                index_write(dict, n, j);
-                n++;
+                d->d_dense_size = dense_size_for(k);
+                d->d_dense = erealloc(d->d_dense,
+                                      d->d_dense_size * sizeof(uint32_t));
+                memset(&d->d_dense[oldsize], 0,
+                       (d->d_dense_size - oldsize) * sizeof(uint32_t));
         }
-
-        dict->d_count = dict->d_used = n;
-
-        /* Default remaining d_map to -1 */
-        iwid = index_width(dict->d_size);
-        memset(voidp_add(dict->d_map, n * iwid),
-               -1, (dict->d_size - n) * iwid);
-        /*
-         * old_vals, old_map were alloc'd with old_keys, so they're
-         * freed here too.
-         */
-        efree(old_keys);
+        d->d_dense[k] = e - d->d_table.entries + 1;
 }
 
+/* Like dict_dense_add(), but after removing @key */
 static void
-refresh_grow_markers(struct dictvar_t *dict)
+dict_dense_remove(struct dictvar_t *d, Object *key,
+                  struct htentry_t *entries)
 {
-        /*
-         * XXX REVISIT: "/3" is arbitrary division
-         *
-         * alpha=75%, "(x*3)>>2" is quicker, but its near the poor-
-         * performance range for open-address tables. alpha=50%, "x>>1",
-         * is a lot of wasted real-estate, probably resulting in lots of
-         * cache misses, killing the advantage that open-address has over
-         * chaining.  I'm assuming that amortization is reason enough not
-         * to care about any of this.
-         *
-         * TODO 4/2025: not necessary: if size * 3 > growsize * 2, grow it.
-         * If size * 2 < shrinksize * 3, shrink it.  Then each time we
-         * resize we multiply/divide all values by 2.  The division is
-         * no longer arbitrary.
-         * Do that instead of this below.
-         */
-        dict->d_grow_size = (dict->d_size << 1) / 3;
-        dict->d_shrink_size = dict->d_used <= INIT_SIZE
-                            ? 0: dict->d_grow_size / 3;
-}
-
-static void
-maybe_grow_table(struct dictvar_t *dict)
-{
-        size_t old_size = dict->d_size;
-        while (dict->d_count > dict->d_grow_size) {
-                /*
-                 * size must always be a power of 2 or else the
-                 * perturbation algo could spinlock.
-                 */
-                dict->d_size *= 2;
-                refresh_grow_markers(dict);
+        if (!d->d_dense)
+                return;
+        if (d->d_table.entries != entries) {
+                dict_dense_rebuild(d);
+                return;
         }
-
-        if (dict->d_size != old_size)
-                transfer_table(dict, old_size);
+        d->d_dense[intvar_toll(key)] = 0;
 }
 
-static void
-maybe_shrink_table(struct dictvar_t *dict)
+/* Look up int @key in the dense index, which must exist */
+static inline struct htentry_t *
+dict_dense_lookup(struct dictvar_t *d, Object *key)
 {
-        size_t old_size = dict->d_size;
-        while (dict->d_used < dict->d_shrink_size) {
-                dict->d_size /= 2;
-                refresh_grow_markers(dict);
-        }
-
-        if (dict->d_size < INIT_SIZE)
-                dict->d_size = INIT_SIZE;
-
-        if (dict->d_size != old_size)
-                transfer_table(dict, old_size);
-}
+        long long k = intvar_toll(key);
+        uint32_t i;
 
-static void
-insert_common(struct dictvar_t *dict, Object *key,
-              Object *data, int i)
-{
-        dict->d_keys[i] = key;
-        dict->d_vals[i] = data;
-        dict->d_count++;
-        dict->d_used++;
-        maybe_grow_table(dict);
+        if (k < 0 || (unsigned long long)k >= d->d_dense_size)
+                return NULL;
+        i = d->d_dense[k];
+        return i ? &d->d_table.entries[i - 1] : NULL;
 }
 
+/* Drop references to all entries, but don't free the table */
 static void
-dict_clear_noresize(struct dictvar_t *dict)
+dict_release_entries(struct dictvar_t *dict)
 {
-        int i;
-        for (i = 0; i < dict->d_size; i++) {
-                if (dict->d_keys[i] == BUCKET_DEAD) {
-                        dict->d_keys[i] = NULL;
-                } else if (dict->d_keys[i] != NULL) {
-                        VAR_DECR_REF(dict->d_vals[i]);
-                        VAR_DECR_REF(dict->d_keys[i]);
-                        dict->d_keys[i] = NULL;
-                        dict->d_vals[i] = NULL;
-                }
+        struct htentry_t *e;
+        size_t idx = 0;
+
+        while ((e = htable_next(&dict->d_table, &idx)) != NULL) {
+                VAR_DECR_REF(e->val);
+                VAR_DECR_REF(e->key);
+                e->key = NULL;
+                e->val = NULL;
         }
-        dict->d_count = dict->d_used = 0;
-        seqvar_set_size((Object *)dict, dict->d_used);
 }
 
 static void
 dict_clear(struct dictvar_t *dict)
 {
-        dict_clear_noresize(dict);
-        maybe_shrink_table(dict);
+        dict_release_entries(dict);
+        dict_dense_free(dict);
+        dict->d_intkeys = true;
+        dict->d_maxkey = -1;
+        htable_reset(&dict->d_table);
+        seqvar_set_size((Object *)dict, 0);
 }
 
 static enum result_t
@@ -395,82 +255,125 @@ enum {
         DF_EXCL = 2,
 };
 
+/* dict_insert(), but @hash is already known */
 static enum result_t
-dict_insert(Object *dict, Object *key,
-            Object *attr, unsigned int flags)
+dict_insert_hashed(Object *dict, Object *key, hash_t hash,
+                   Object *attr, unsigned int flags)
 {
-        int i;
-        struct dictvar_t *d;
-
-        bug_on(!!(flags & DF_EXCL) && attr == NULL);
-        bug_on(!!(flags & DF_SWAP) && attr == NULL);
-        bug_on((flags & (DF_SWAP|DF_EXCL)) == (DF_SWAP|DF_EXCL));
-        bug_on(!isvar_dict(dict));
-
-        d = V2D(dict);
+        struct dictvar_t *d = V2D(dict);
+        struct htentry_t *e, *entries;
 
-        i = seek_helper(d, key);
-        if (i < 0) {
-                err_hashable(key, NULL);
-                return RES_ERROR;
+        if (attr && d->d_intkeys && !isvar_int(key)) {
+                d->d_intkeys = false;
+                dict_dense_free(d);
         }
 
-        /* @child is either the former entry replaced by @attr or NULL */
+        entries = d->d_table.entries;
         if (attr) {
-                /* insert */
-                if (d->d_keys[i] != NULL) {
-                        /* replace old, don't grow table */
-                        if (!!(flags & DF_EXCL))
+                Object *oldkey, *oldval;
+                bool found;
+
+                if (d->d_dense) {
+                        e = dict_dense_lookup(d, key);
+                        found = e != NULL;
+                        if (!found) {
+                                if (!!(flags & DF_SWAP))
+                                        return RES_ERROR;
+                                e = htable_append(&d->d_table,
+                                                  key, hash);
+                        }
+                } else if (!!(flags & DF_SWAP)) {
+                        e = htable_lookup(&d->d_table, key, hash);
+                        if (!e)
                                 return RES_ERROR;
-
-                        VAR_INCR_REF(attr);
-                        VAR_INCR_REF(key);
-                        VAR_DECR_REF(d->d_vals[i]);
-                        VAR_DECR_REF(d->d_keys[i]);
-                        d->d_keys[i] = key;
-                        d->d_vals[i] = attr;
+                        found = true;
                 } else {
-                        /* put */
-                        if (!!(flags & DF_SWAP))
-                                return RES_ERROR;
+                        e = htable_insert(&d->d_table, key, hash, &found);
+                }
 
-                        VAR_INCR_REF(key);
-                        VAR_INCR_REF(attr);
-                        append_to_map(d, i);
-                        insert_common(d, key, attr, i);
-                        bug_on(d->d_used != seqvar_size(dict) + 1);
-                        seqvar_set_size(dict, d->d_used);
+                if (!found) {
+                        /* put */
+                        e->key = VAR_NEW_REF(key);
+                        e->val = VAR_NEW_REF(attr);
+                        bug_on(d->d_table.used != seqvar_size(dict) + 1);
+                        seqvar_set_size(dict, d->d_table.used);
+                        dict_dense_add(d, e, entries);
+                        return RES_OK;
                 }
+
+                /* replace old, don't grow table */
+                if (!!(flags & DF_EXCL))
+                        return RES_ERROR;
+
+                oldkey = e->key;
+                oldval = e->val;
+                e->key = VAR_NEW_REF(key);
+                e->val = VAR_NEW_REF(attr);
+                VAR_DECR_REF(oldval);
+                VAR_DECR_REF(oldkey);
         } else {
                 /* remove */
-                if (d->d_keys[i] == NULL)
+                struct htentry_t old;
+                if (!htable_remove(&d->d_table, key, hash, &old))
                         return RES_ERROR;
 
-                VAR_DECR_REF(d->d_vals[i]);
-                VAR_DECR_REF(d->d_keys[i]);
-                d->d_keys[i] = BUCKET_DEAD;
-                d->d_used--;
-                maybe_shrink_table(d);
-                bug_on(d->d_used != seqvar_size(dict) - 1);
-                seqvar_set_size(dict, d->d_used);
+                dict_dense_remove(d, old.key, entries);
+                VAR_DECR_REF(old.val);
+                VAR_DECR_REF(old.key);
+                bug_on(d->d_table.used != seqvar_size(dict) - 1);
+                seqvar_set_size(dict, d->d_table.used);
+        }
+        return RES_OK;
+}
+
+static enum result_t
+dict_insert(Object *dict, Object *key,
+            Object *attr, unsigned int flags)
+{
+        hash_t hash;
+
+        bug_on(!!(flags & DF_EXCL) && attr == NULL);
+        bug_on(!!(flags & DF_SWAP) && attr == NULL);
+        bug_on((flags & (DF_SWAP|DF_EXCL)) == (DF_SWAP|DF_EXCL));
+        bug_on(!isvar_dict(dict));
+
+        hash = var_hash(key);
+        if (hash == HASH_ERROR) {
+                err_hashable(key, NULL);
+                return RES_ERROR;
         }
         /*
          * XXX: If !attr and !b, trying to remove something that doesn't
          * exist.  Throw error and print msg?
          */
-        return RES_OK;
+        return dict_insert_hashed(dict, key, hash, attr, flags);
+}
+
+/* Return @key's entry in @dict, or NULL if it doesn't exist or isn't
+ * hashable.
+ */
+static struct htentry_t *
+dict_lookup(Object *dict, Object *key)
+{
+        struct dictvar_t *d = V2D(dict);
+        hash_t hash;
+
+        if (d->d_dense && isvar_int(key))
+                return dict_dense_lookup(d, key);
+
+        hash = var_hash(key);
+        if (hash == HASH_ERROR)
+                return NULL;
+        return htable_lookup(&d->d_table, key, hash);
 }
 
 static int
 dict_hasitem(Object *dict, Object *key)
 {
-        int i;
         if (!key)
                 return 0;
         bug_on(!isvar_dict(dict));
-
-        i = seek_helper(V2D(dict), key);
-        return i >= 0 && V2D(dict)->d_keys[i] != NULL;
+        return dict_lookup(dict, key) != NULL;
 }
 
 /*
@@ -487,18 +390,22 @@ static enum result_t
 dict_copyto_with_flags(Object *to, Object *from,
                         Object *owner, unsigned int flags)
 {
-        int i;
+        struct htentry_t *e;
+        size_t idx = 0;
         struct dictvar_t *d = V2D(from);
 
         bug_on(!isvar_dict(to) || !isvar_dict(from));
-        for (i = 0; i < d->d_size; i++) {
-                Object *k, *v;
-
-                k = d->d_keys[i];
-                if (k == NULL || k == BUCKET_DEAD)
-                        continue;
-                v = d->d_vals[i];
-                if (dict_setitem(to, k, v) != RES_OK) {
+        if (to != from) {
+                struct dictvar_t *dto = V2D(to);
+                struct htentry_t *entries = dto->d_table.entries;
+
+                htable_reserve(&dto->d_table, d->d_table.used);
+                if (dto->d_table.entries != entries)
+                        dict_dense_rebuild(dto);
+        }
+        while ((e = htable_next(&d->d_table, &idx)) != NULL) {
+                if (dict_insert_hashed(to, e->key, e->hash,
+                                       e->val, 0) != RES_OK) {
                         return RES_ERROR;
                 }
         }
@@ -515,7 +422,8 @@ static bool
 dict_cmpeq(Object *a, Object *b)
 {
         struct dictvar_t *da;
-        size_t i;
+        struct htentry_t *e;
+        size_t idx;
         bool ret;
 
         bug_on(!isvar_dict(a) && !isvar_dict(b));
@@ -531,24 +439,17 @@ dict_cmpeq(Object *a, Object *b)
                 return false;
 
         ret = true;
-        for (i = 0; i < da->d_size; i++) {
-                Object *k, *vb;
-                k = da->d_keys[i];
-                if (k == NULL || k == BUCKET_DEAD)
-                        continue;
-
-                vb = dict_getitem(b, k);
-                if (!vb) {
+        idx = 0;
+        while ((e = htable_next(&da->d_table, &idx)) != NULL) {
+                struct htentry_t *eb;
+
+                eb = htable_lookup(&V2D(b)->d_table, e->key, e->hash);
+                if (!eb || !var_matches(e->val, eb->val)) {
                         ret = false;
-                        goto unlock;
-                }
-                ret = var_matches(da->d_vals[i], vb);
-                VAR_DECR_REF(vb);
-                if (!ret)
                         break;
+                }
         }
 
-unlock:
         dict_unlock(da);
         return ret;
 }
@@ -565,8 +466,9 @@ dict_reset(Object *o)
         struct dictvar_t *dict = V2D(o);
         bug_on(!isvar_dict(o));
 
-        dict_clear_noresize(dict);
-        efree(dict->d_keys);
+        dict_release_entries(dict);
+        dict_dense_free(dict);
+        htable_free(&dict->d_table);
 }
 
 static Object *
@@ -574,7 +476,9 @@ dict_str(Object *o)
 {
         struct dictvar_t *d;
         struct string_writer_t wr;
-        int i, count;
+        struct htentry_t *e;
+        size_t idx;
+        int count;
         Object *ret;
 
         bug_on(!isvar_dict(o));
@@ -587,17 +491,15 @@ dict_str(Object *o)
         string_writer_append(&wr, '{');
 
         count = 0;
-        for (i = 0; i < d->d_size; i++) {
-                Object *k = d->d_keys[i];
+        idx = 0;
+        while ((e = htable_next(&d->d_table, &idx)) != NULL) {
                 Object *vstr, *kstr;
-                if (k == NULL || k == BUCKET_DEAD)
-                        continue;
 
                 if (count > 0)
                         string_writer_appends(&wr, ", ");
 
-                kstr = var_str(d->d_keys[i]);
-                vstr = var_str(d->d_vals[i]);
+                kstr = var_str(e->key);
+                vstr = var_str(e->val);
                 string_writer_append_strobj(&wr, kstr);
                 string_writer_appends(&wr, ": ");
                 string_writer_append_strobj(&wr, vstr);
@@ -684,7 +586,9 @@ do_dict_values(Frame *fr)
 {
         Object *ret, *self;
         struct dictvar_t *dict;
-        int i, j;
+        struct htentry_t *e;
+        size_t idx;
+        int j;
 
         if (vm_getargs(fr, "<{}>[!]{!}:values", &self) == RES_ERROR)
                 return ErrorVar;
@@ -692,11 +596,9 @@ do_dict_values(Frame *fr)
         dict = V2D(self);
         ret = arrayvar_new(seqvar_size(self));
         j = 0;
-        for (i = 0; i < dict->d_size; i++) {
-                Object *k = dict->d_keys[i];
-                if (k == NULL || k == BUCKET_DEAD)
-                        continue;
-                array_setitem(ret, j, dict->d_vals[i]);
+        idx = 0;
+        while ((e = htable_next(&dict->d_table, &idx)) != NULL) {
+                array_setitem(ret, j, e->val);
                 bug_on(j >= seqvar_size(self));
                 j++;
         }
@@ -860,7 +762,7 @@ struct dict_items_t {
 struct dict_items_iterator_t {
         struct seqvar_t base;
         Object *target;
-        int i;
+        size_t i;
 };
 
 static Object *
@@ -870,23 +772,18 @@ dict_items_iterator_next(Object *it)
         struct dictvar_t *d = (struct dictvar_t *)(dit->target);
         size_t idx = dit->i;
 
+        struct htentry_t *e;
+
         if (!d)
                 return NULL;
-        for (; idx < d->d_size; idx++) {
-                Object *key, *kv[2], *ret;
-                ssize_t index = index_read(d, idx);
-                if (index < 0)
-                        continue;
-                key = d->d_keys[index];
-                if (key == NULL || key == BUCKET_DEAD)
-                        continue;
-
-                kv[0] = key;
-                kv[1] = d->d_vals[index];
-                ret = tuplevar_from_stack(kv, 2, false);
-
-                dit->i = idx + 1;
-                return ret;
+        e = htable_next(&d->d_table, &idx);
+        if (e) {
+                Object *kv[2];
+
+                kv[0] = e->key;
+                kv[1] = e->val;
+                dit->i = idx;
+                return tuplevar_from_stack(kv, 2, false);
         }
 
         VAR_DECR_REF(dit->target);
@@ -952,18 +849,14 @@ dict_iter_next(Object *it)
         struct dictvar_t *d = (struct dictvar_t *)(dit->target);
         size_t idx = dit->i;
 
+        struct htentry_t *e;
+
         if (!d)
                 return NULL;
-        for (; idx < d->d_size; idx++) {
-                Object *key;
-                ssize_t index = index_read(d, idx);
-                if (index < 0)
-                        continue;
-                key = d->d_keys[index];
-                if (key == NULL || key == BUCKET_DEAD)
-                        continue;
-                dit->i = idx + 1;
-                return VAR_NEW_REF(key);
+        e = htable_next(&d->d_table, &idx);
+        if (e) {
+                dit->i = idx;
+                return VAR_NEW_REF(e->key);
         }
 
         VAR_DECR_REF(dit->target);
@@ -1004,7 +897,8 @@ dict_keys(Object *obj, bool sorted)
 {
         Object *keys;
         struct dictvar_t *d;
-        int i;
+        struct htentry_t *e;
+        size_t idx;
         int array_i;
 
         bug_on(!isvar_dict(obj));
@@ -1012,13 +906,9 @@ dict_keys(Object *obj, bool sorted)
         keys = arrayvar_new(OBJ_SIZE(obj));
 
         array_i = 0;
-
-        for (i = 0; i < d->d_size; i++) {
-                Object *ks = d->d_keys[i];
-                if (ks == NULL || ks == BUCKET_DEAD)
-                        continue;
-
-                array_setitem(keys, array_i, ks);
+        idx = 0;
+        while ((e = htable_next(&d->d_table, &idx)) != NULL) {
+                array_setitem(keys, array_i, e->key);
                 array_i++;
         }
 
@@ -1037,12 +927,11 @@ dictvar_new(void)
         struct dictvar_t *d = V2D(o);
         seqvar_set_size(o, 0);
 
-        d->d_size = INIT_SIZE;
-        d->d_used = 0;
-        d->d_count = 0;
-        refresh_grow_markers(d);
-        bucket_alloc(d);
-        memset(d->d_map, -1, INIT_SIZE);
+        htable_init(&d->d_table);
+        d->d_intkeys = true;
+        d->d_maxkey = -1;
+        d->d_dense = NULL;
+        d->d_dense_size = 0;
         return o;
 }
 
@@ -1092,18 +981,15 @@ dictvar_from_methods(Object *parent,
 Object *
 dict_getitem(Object *o, Object *key)
 {
-        struct dictvar_t *d;
-        int i;
+        struct htentry_t *e;
 
-        d = V2D(o);
         bug_on(!isvar_dict(o));
 
-        i = seek_helper(d, key);
-        if (i < 0 || d->d_keys[i] == NULL)
+        e = dict_lookup(o, key);
+        if (!e)
                 return NULL;
 
-        VAR_INCR_REF(d->d_vals[i]);
-        return d->d_vals[i];
+        return VAR_NEW_REF(e->val);
 }
 
 /*
@@ -1186,17 +1072,13 @@ dict_setitem_replace(Object *dict,
 void
 dict_add_to_globals(Object *dict)
 {
-        int i;
+        struct htentry_t *e;
+        size_t idx = 0;
         struct dictvar_t *d = V2D(dict);
         bug_on(!isvar_dict(dict));
 
-        for (i = 0; i < d->d_size; i++) {
-                Object *k = d->d_keys[i];
-                if (k == NULL || k == BUCKET_DEAD)
-                        continue;
-
-                vm_add_global(k, d->d_vals[i]);
-        }
+        while ((e = htable_next(&d->d_table, &idx)) != NULL)
+                vm_add_global(e->key, e->val);
 }
 
 /**
@@ -326,6 +326,18 @@ func_reset(Object *func)
         }
 }
 
+/*
+ * Return a new reference to @x's constants.  xptrvar_new() leaves
+ * @x->rodata NULL if there are none, so make an empty tuple for it.
+ */
+static Object *
+func_rodata(struct xptrvar_t *x)
+{
+        if (!x->rodata)
+                return tuplevar_new(0);
+        return VAR_NEW_REF(x->rodata);
+}
+
 static Object *
 func_getcode(Object *self)
 {
@@ -338,10 +350,11 @@ func_getcode(Object *self)
                 return ErrorVar;
         }
         x = V2FUNC(self)->f_ex;
+        xptr_ready(x);
 
         tp[0] = bytesvar_new((unsigned char *)x->instr,
                                 x->n_instr * sizeof(instruction_t));
-        tp[1] = VAR_NEW_REF(x->rodata);
+        tp[1] = func_rodata(x);
         return tuplevar_from_stack(tp, 2, true);
 }
 
@@ -356,7 +369,8 @@ func_getrodata(Object *self)
                 return ErrorVar;
         }
         x = V2FUNC(self)->f_ex;
-        return VAR_NEW_REF(x->rodata);
+        xptr_ready(x);
+        return func_rodata(x);
 }
 
 static const struct type_prop_t func_prop_getsets[] = {
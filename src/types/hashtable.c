@@ -0,0 +1,461 @@
+/*
+ * hashtable.c - Open-addressing hash table used by dictionaries and sets
+ *
+ * This is a "Swiss table", after the design in Google's Abseil library.
+ * The slots are split into groups of HT_GROUP, and each slot has a
+ * one-byte control code in a dense array, @ctrl:
+ *
+ *      CTRL_EMPTY      Slot has never been used
+ *      CTRL_DELETED    Slot's entry was removed
+ *      0x00...0x7f     Slot is full, and this is 7 bits of its hash
+ *                      (the "tag")
+ *
+ * A lookup compares the key's tag against a whole group of control
+ * bytes at once, 16 at a time with SSE2.  Only the slots whose tags
+ * match--nearly always just the one we're looking for--have their
+ * entries looked at.  Nothing else dereferences a key pointer, which
+ * is what makes large tables cache-miss bound.  A lookup stops at the
+ * first group with an empty slot.
+ *
+ * Groups are probed in triangular order (g, g+1, g+3, g+6...), which
+ * visits every group when the number of groups is a power of 2.
+ *
+ * The slots do not hold the entries themselves, just their indices in
+ * @entries, which are stored in insertion order the way CPython does
+ * it.  So dictionaries iterate in insertion order, and the entries
+ * stay dense enough that iterating over them is a linear scan.  A
+ * removed entry leaves a hole in @entries until the next rebuild.
+ */
+#include <evilcandy/debug.h>
+#include <evilcandy/ewrappers.h>
+#include <evilcandy/var.h>
+#include <internal/type_registry.h>
+#include <internal/types/hashtable.h>
+#include <internal/types/number_types.h>
+#include <internal/types/string.h>
+
+#include <string.h>
+
+#if defined(__SSE2__)
+# include <emmintrin.h>
+#endif
+
+enum {
+        HT_GROUP        = 16,
+        HT_MIN_SIZE     = HT_GROUP,
+        CTRL_EMPTY      = 0x80,
+        CTRL_DELETED    = 0xfe,
+};
+
+/* Maximum number of entries for a table of @size slots, alpha=7/8 */
+static inline size_t
+max_entries_for(size_t size)
+{
+        return size - size / 8;
+}
+
+/*
+ * Some of our hash functions are weak in their low bits (integers hash
+ * to themselves, pointers are shifted left), but we take both the tag
+ * and the group from the low bits, so scramble them first.
+ */
+static inline uint64_t
+ht_mix(hash_t hash)
+{
+        uint64_t h = hash;
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdull;
+        h ^= h >> 33;
+        return h;
+}
+
+static inline uint8_t
+ht_tag(uint64_t mixed)
+{
+        return mixed & 0x7f;
+}
+
+static inline size_t
+ht_group(struct htable_t *ht, uint64_t mixed)
+{
+        return (mixed >> 7) & (ht->size / HT_GROUP - 1);
+}
+
+static inline unsigned int
+lowest_bit(unsigned int bits)
+{
+#if defined(__GNUC__)
+        return __builtin_ctz(bits);
+#else
+        unsigned int i = 0;
+        while (!(bits & 1)) {
+                bits >>= 1;
+                i++;
+        }
+        return i;
+#endif
+}
+
+/*
+ * A group's entry indices fill one cache line.  Fetching it at the same
+ * time as the group's control bytes keeps a lookup from taking two
+ * cache misses back to back.
+ */
+static inline void
+ht_prefetch(const void *p)
+{
+#if defined(__GNUC__)
+        __builtin_prefetch(p);
+#else
+        (void)p;
+#endif
+}
+
+/*
+ * The group_xxx() helpers return a bitmask with bit i set if control
+ * byte @g[i] meets the condition.
+ */
+
+/* ...is full and has tag @tag */
+static inline unsigned int
+group_match(const uint8_t *g, uint8_t tag)
+{
+#if defined(__SSE2__)
+        __m128i v = _mm_loadu_si128((const __m128i *)g);
+        return _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8(tag)));
+#else
+        unsigned int i, bits = 0;
+        for (i = 0; i < HT_GROUP; i++)
+                bits |= (g[i] == tag) << i;
+        return bits;
+#endif
+}
+
+/* ...is empty */
+static inline unsigned int
+group_empty(const uint8_t *g)
+{
+#if defined(__SSE2__)
+        __m128i v = _mm_loadu_si128((const __m128i *)g);
+        return _mm_movemask_epi8(
+                _mm_cmpeq_epi8(v, _mm_set1_epi8((char)CTRL_EMPTY)));
+#else
+        unsigned int i, bits = 0;
+        for (i = 0; i < HT_GROUP; i++)
+                bits |= (g[i] == CTRL_EMPTY) << i;
+        return bits;
+#endif
+}
+
+/* ...is empty or deleted, ie. its high bit is set */
+static inline unsigned int
+group_free(const uint8_t *g)
+{
+#if defined(__SSE2__)
+        __m128i v = _mm_loadu_si128((const __m128i *)g);
+        return _mm_movemask_epi8(v);
+#else
+        unsigned int i, bits = 0;
+        for (i = 0; i < HT_GROUP; i++)
+                bits |= (g[i] >> 7) << i;
+        return bits;
+#endif
+}
+
+/*
+ * Equal objects must have equal hashes, so the hash compare rejects
+ * nearly every mismatch without calling the type's comparison.
+ */
+static inline bool
+key_match(struct htentry_t *e, Object *key, hash_t hash)
+{
+        if (e->hash != hash)
+                return false;
+        if (e->key == key)
+                return true;
+        if (isvar_string(e->key)) {
+                if (isvar_string(key))
+                        return string_eq(e->key, key);
+                return false;
+        }
+        if (isvar_int(e->key) && isvar_int(key))
+                return intvar_toll(e->key) == intvar_toll(key);
+        return var_matches(e->key, key);
+}
+
+/* Return the slot holding @key, or -1 if it isn't in the table */
+static ssize_t
+find_slot(struct htable_t *ht, Object *key, hash_t hash, uint64_t mixed)
+{
+        size_t g, step, mask;
+        uint8_t tag = ht_tag(mixed);
+
+        mask = ht->size / HT_GROUP - 1;
+        g = ht_group(ht, mixed);
+        for (step = 1; ; step++) {
+                const uint8_t *ctrl = &ht->ctrl[g * HT_GROUP];
+                unsigned int bits;
+
+                ht_prefetch(&ht->slots[g * HT_GROUP]);
+                bits = group_match(ctrl, tag);
+                while (bits) {
+                        size_t slot = g * HT_GROUP + lowest_bit(bits);
+                        if (key_match(&ht->entries[ht->slots[slot]],
+                                      key, hash)) {
+                                return slot;
+                        }
+                        bits &= bits - 1;
+                }
+                if (group_empty(ctrl))
+                        return -1;
+                /*
+                 * There is always at least one empty slot, so this
+                 * doesn't spin forever.
+                 */
+                g = (g + step) & mask;
+        }
+}
+
+/* Return the first empty or deleted slot in @mixed's probe sequence */
+static size_t
+find_free_slot(struct htable_t *ht, uint64_t mixed)
+{
+        size_t g, step, mask;
+
+        mask = ht->size / HT_GROUP - 1;
+        g = ht_group(ht, mixed);
+        for (step = 1; ; step++) {
+                unsigned int bits = group_free(&ht->ctrl[g * HT_GROUP]);
+                if (bits)
+                        return g * HT_GROUP + lowest_bit(bits);
+                g = (g + step) & mask;
+        }
+}
+
+static void
+table_alloc(struct htable_t *ht, size_t size)
+{
+        size_t maxent = max_entries_for(size);
+        void *p;
+
+        bug_on(size < HT_MIN_SIZE || (size & (size - 1)) != 0);
+        bug_on(maxent > UINT32_MAX);
+
+        /* ctrl is first, so the slots and entries stay aligned */
+        p = emalloc(size * (1 + sizeof(uint32_t))
+                    + maxent * sizeof(struct htentry_t));
+        ht->ctrl = p;
+        ht->slots = (uint32_t *)(&ht->ctrl[size]);
+        ht->entries = (struct htentry_t *)(&ht->slots[size]);
+        ht->size = size;
+        ht->max_entries = maxent;
+        memset(ht->ctrl, CTRL_EMPTY, size);
+        /* slots and entries are only read where ctrl says they're valid */
+}
+
+/*
+ * Move the live entries into a new table of @size slots.  The entries
+ * keep their order and their cached hashes, so this never calls a
+ * type's .hash or comparison callback.
+ */
+static void
+rebuild(struct htable_t *ht, size_t size)
+{
+        struct htable_t old = *ht;
+        size_t i, n;
+
+        table_alloc(ht, size);
+        n = 0;
+        for (i = 0; i < old.n_entries; i++) {
+                struct htentry_t *e = &old.entries[i];
+                uint64_t mixed;
+                size_t slot;
+
+                if (!e->key)
+                        continue;
+
+                mixed = ht_mix(e->hash);
+                slot = find_free_slot(ht, mixed);
+                ht->ctrl[slot] = ht_tag(mixed);
+                ht->slots[slot] = n;
+                ht->entries[n++] = *e;
+        }
+        bug_on(n != old.used);
+        ht->n_entries = ht->used = n;
+        efree(old.ctrl);
+}
+
+/* Smallest table size which is no more than half full with @n entries */
+static size_t
+size_for(size_t n)
+{
+        size_t size = HT_MIN_SIZE;
+        while (max_entries_for(size) < n * 2)
+                size *= 2;
+        return size;
+}
+
+/**
+ * htable_init - Initialize an empty hash table
+ */
+void
+htable_init(struct htable_t *ht)
+{
+        table_alloc(ht, HT_MIN_SIZE);
+        ht->used = ht->n_entries = 0;
+}
+
+/**
+ * htable_free - Free @ht's memory
+ *
+ * The owner must already have released its references to the keys and
+ * values.
+ */
+void
+htable_free(struct htable_t *ht)
+{
+        efree(ht->ctrl);
+        ht->ctrl = NULL;
+        ht->slots = NULL;
+        ht->entries = NULL;
+        ht->size = ht->max_entries = ht->used = ht->n_entries = 0;
+}
+
+/**
+ * htable_reset - Remove all entries, and shrink @ht to the minimum size
+ *
+ * Same caveat as with htable_free().
+ */
+void
+htable_reset(struct htable_t *ht)
+{
+        htable_free(ht);
+        htable_init(ht);
+}
+
+/**
+ * htable_reserve - Make room for @n more entries without rebuilding
+ *
+ * Used before bulk inserts when the number of new entries is known.
+ */
+void
+htable_reserve(struct htable_t *ht, size_t n)
+{
+        if (ht->n_entries + n > ht->max_entries)
+                rebuild(ht, size_for(ht->used + n));
+}
+
+/**
+ * htable_lookup - Find an entry
+ * @ht:         Hash table
+ * @key:        Key to search for
+ * @hash:       Result of var_hash(@key)
+ *
+ * Return: The entry matching @key, or NULL if there isn't one.  The
+ * pointer is only valid until the next insertion.
+ */
+struct htentry_t *
+htable_lookup(struct htable_t *ht, Object *key, hash_t hash)
+{
+        ssize_t slot = find_slot(ht, key, hash, ht_mix(hash));
+        return slot < 0 ? NULL : &ht->entries[ht->slots[slot]];
+}
+
+/**
+ * htable_insert - Find an entry, or add one if it doesn't exist
+ * @ht:         Hash table
+ * @key:        Key to search for
+ * @hash:       Result of var_hash(@key)
+ * @found:      Set to true if @key was already in @ht, false if not
+ *
+ * Return: The entry matching @key.  If *@found is false, this is a new
+ * entry whose .key and .hash are set, whose .val is NULL, and which the
+ * caller must fill in with its references.  The pointer is only valid
+ * until the next insertion.
+ */
+struct htentry_t *
+htable_insert(struct htable_t *ht, Object *key, hash_t hash, bool *found)
+{
+        ssize_t slot = find_slot(ht, key, hash, ht_mix(hash));
+
+        if (slot >= 0) {
+                *found = true;
+                return &ht->entries[ht->slots[slot]];
+        }
+
+        *found = false;
+        return htable_append(ht, key, hash);
+}
+
+/**
+ * htable_append - Add an entry for a key known not to be in the table
+ * @ht:         Hash table
+ * @key:        Key to add
+ * @hash:       Result of var_hash(@key)
+ *
+ * This is htable_insert() without the search, for callers which have a
+ * faster way to know that @key is new.
+ *
+ * Return: The new entry, same as htable_insert() when it adds one.
+ */
+struct htentry_t *
+htable_append(struct htable_t *ht, Object *key, hash_t hash)
+{
+        uint64_t mixed = ht_mix(hash);
+        struct htentry_t *e;
+        size_t slot;
+
+        if (ht->n_entries == ht->max_entries)
+                rebuild(ht, size_for(ht->used + 1));
+
+        slot = find_free_slot(ht, mixed);
+        ht->ctrl[slot] = ht_tag(mixed);
+        ht->slots[slot] = ht->n_entries;
+        e = &ht->entries[ht->n_entries++];
+        e->hash = hash;
+        e->key = key;
+        e->val = NULL;
+        ht->used++;
+        return e;
+}
+
+/**
+ * htable_remove - Remove an entry
+ * @ht:         Hash table
+ * @key:        Key of entry to remove
+ * @hash:       Result of var_hash(@key)
+ * @removed:    Where to store a copy of the removed entry, so the
+ *              caller can release its references
+ *
+ * Return: true if @key was found and removed, false if it wasn't in @ht
+ */
+bool
+htable_remove(struct htable_t *ht, Object *key,
+              hash_t hash, struct htentry_t *removed)
+{
+        struct htentry_t *e;
+        size_t g;
+        ssize_t slot = find_slot(ht, key, hash, ht_mix(hash));
+        if (slot < 0)
+                return false;
+
+        e = &ht->entries[ht->slots[slot]];
+        *removed = *e;
+        e->key = NULL;
+        e->val = NULL;
+        ht->used--;
+
+        /*
+         * A lookup stops at the first group with an empty slot, so if
+         * this slot's group still has one, no probe sequence goes past
+         * this group and the slot can be marked empty again.  Once a
+         * group fills up, none of its slots are empty until the next
+         * rebuild, so this is true for all of time.
+         */
+        g = slot & ~(size_t)(HT_GROUP - 1);
+        ht->ctrl[slot] = group_empty(&ht->ctrl[g]) ? CTRL_EMPTY : CTRL_DELETED;
+
+        if (ht->size > HT_MIN_SIZE && ht->used < ht->max_entries / 8)
+                rebuild(ht, size_for(ht->used));
+        return true;
+}
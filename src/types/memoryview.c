@@ -0,0 +1,799 @@
+/*
+ * memoryview.c - Views into other objects' memory
+ *
+ * Slicing bytes or a bytearray copies the slice.  A memoryview instead
+ * points into the memory of the object it was made from (its
+ * "exporter"), so slicing a view only makes another small view of the
+ * same memory.  Any type with a .bfm (struct buffer_methods_t) can be
+ * an exporter: bytes, bytearray, and numarray.
+ *
+ * A view holds a reference to its exporter and an export of its memory
+ * until the view is released, either by .release() or by being
+ * destroyed.  A bytearray refuses to resize while any export is held,
+ * so a view's pointer can never dangle.
+ *
+ * Views of bytes are read-only, and only read-only byte views are
+ * hashable.
+ */
+#include <evilcandy/debug.h>
+#include <evilcandy/err.h>
+#include <evilcandy/ewrappers.h>
+#include <evilcandy/global.h>
+#include <evilcandy/hash.h>
+#include <evilcandy/vm.h>
+#include <evilcandy/types/array.h>
+#include <evilcandy/types/bytes.h>
+#include <evilcandy/types/memoryview.h>
+#include <evilcandy/types/number_types.h>
+#include <evilcandy/types/string.h>
+#include <internal/type_registry.h>
+#include <internal/types/number_types.h>
+#include <internal/types/sequential_types.h>
+
+#include <string.h>
+
+/**
+ * struct memoryviewvar_t - Handle to a memoryview
+ * @obj:        The exporter, or NULL if the view has been released
+ * @exp:        The part of @obj's memory this view covers.  @exp.n is
+ *              also the seqvar size, except that the seqvar size is
+ *              zero after release.
+ * @exports:    Number of exports of this view itself, see
+ *              bytes_like_acquire()
+ * @hash:       Cached hash, or zero if not yet computed
+ */
+struct memoryviewvar_t {
+        struct seqvar_t base;
+        Object *obj;
+        struct buffer_export_t exp;
+        int exports;
+        hash_t hash;
+};
+
+#define V2MV(v_)        ((struct memoryviewvar_t *)(v_))
+
+static inline unsigned char *
+mv_at(Object *v, size_t i)
+{
+        return V2MV(v)->exp.buf + (ssize_t)i * V2MV(v)->exp.stride;
+}
+
+static void
+err_released(void)
+{
+        err_setstr(ValueError, "operation on a released memoryview");
+}
+
+static enum result_t
+mv_check(Object *v)
+{
+        if (!V2MV(v)->obj) {
+                err_released();
+                return RES_ERROR;
+        }
+        return RES_OK;
+}
+
+/*
+ * Make a view of @exp, which is @obj's memory or part of it.  Take a
+ * new export from @obj for the view to own.
+ */
+static Object *
+memoryview_from_export(Object *obj, const struct buffer_export_t *exp)
+{
+        struct buffer_export_t tmp;
+        Object *ret;
+
+        if (obj->v_type->bfm->getbuffer(obj, &tmp) == RES_ERROR)
+                return ErrorVar;
+        ret = var_new(&MemoryviewType);
+        V2MV(ret)->obj = VAR_NEW_REF(obj);
+        V2MV(ret)->exp = *exp;
+        V2MV(ret)->exports = 0;
+        V2MV(ret)->hash = 0;
+        seqvar_set_size(ret, exp->n);
+        return ret;
+}
+
+static void
+memoryview_release(Object *v)
+{
+        Object *obj = V2MV(v)->obj;
+
+        if (!obj)
+                return;
+        V2MV(v)->obj = NULL;
+        seqvar_set_size(v, 0);
+        if (obj->v_type->bfm->releasebuffer)
+                obj->v_type->bfm->releasebuffer(obj);
+        VAR_DECR_REF(obj);
+}
+
+/* Copy @exp's items, in order, into contiguous memory at @dst */
+static void
+export_gather(unsigned char *dst, const struct buffer_export_t *exp)
+{
+        size_t i;
+
+        if (exp->stride == (ssize_t)exp->itemsize) {
+                memcpy(dst, exp->buf, exp->n * exp->itemsize);
+                return;
+        }
+        for (i = 0; i < exp->n; i++) {
+                memcpy(dst, exp->buf + (ssize_t)i * exp->stride,
+                       exp->itemsize);
+                dst += exp->itemsize;
+        }
+}
+
+/* Reverse of export_gather() */
+static void
+export_scatter(const struct buffer_export_t *exp, const unsigned char *src)
+{
+        size_t i;
+
+        if (exp->stride == (ssize_t)exp->itemsize) {
+                memcpy(exp->buf, src, exp->n * exp->itemsize);
+                return;
+        }
+        for (i = 0; i < exp->n; i++) {
+                memcpy(exp->buf + (ssize_t)i * exp->stride, src,
+                       exp->itemsize);
+                src += exp->itemsize;
+        }
+}
+
+static Object *
+mv_unpack(const struct buffer_export_t *exp, const unsigned char *p)
+{
+        long long ival;
+        double dval;
+
+        switch (exp->kind) {
+        case EXPORT_INT:
+                memcpy(&ival, p, sizeof(ival));
+                return intvar_new(ival);
+        case EXPORT_FLOAT:
+                memcpy(&dval, p, sizeof(dval));
+                return floatvar_new(dval);
+        default:
+                return intvar_new(*p);
+        }
+}
+
+static enum result_t
+mv_pack(const struct buffer_export_t *exp, unsigned char *p, Object *v)
+{
+        long long ival;
+        double dval;
+
+        switch (exp->kind) {
+        case EXPORT_INT:
+                if (!isvar_int(v))
+                        goto badtype;
+                ival = intvar_toll(v);
+                memcpy(p, &ival, sizeof(ival));
+                break;
+        case EXPORT_FLOAT:
+                if (!isvar_real(v))
+                        goto badtype;
+                dval = realvar_tod(v);
+                memcpy(p, &dval, sizeof(dval));
+                break;
+        default:
+                if (!isvar_int(v))
+                        goto badtype;
+                ival = intvar_toll(v);
+                if (ival < 0LL || ival > 255LL) {
+                        err_setstr(ValueError,
+                                   "Expected: value between 0 and 255");
+                        return RES_ERROR;
+                }
+                *p = (unsigned char)ival;
+                break;
+        }
+        return RES_OK;
+
+badtype:
+        err_setstr(TypeError, "cannot store %s in this memoryview",
+                   typestr(v));
+        return RES_ERROR;
+}
+
+static bool
+mv_items_match(const struct buffer_export_t *a, const unsigned char *pa,
+               const struct buffer_export_t *b, const unsigned char *pb)
+{
+        long long ia, ib;
+        double da, db;
+
+        if (a->kind == EXPORT_BYTE && b->kind == EXPORT_BYTE)
+                return *pa == *pb;
+
+        if (a->kind == EXPORT_FLOAT || b->kind == EXPORT_FLOAT) {
+                if (a->kind == EXPORT_FLOAT) {
+                        memcpy(&da, pa, sizeof(da));
+                } else if (a->kind == EXPORT_INT) {
+                        memcpy(&ia, pa, sizeof(ia));
+                        da = (double)ia;
+                } else {
+                        da = (double)*pa;
+                }
+                if (b->kind == EXPORT_FLOAT) {
+                        memcpy(&db, pb, sizeof(db));
+                } else if (b->kind == EXPORT_INT) {
+                        memcpy(&ib, pb, sizeof(ib));
+                        db = (double)ib;
+                } else {
+                        db = (double)*pb;
+                }
+                return da == db;
+        }
+
+        if (a->kind == EXPORT_INT)
+                memcpy(&ia, pa, sizeof(ia));
+        else
+                ia = *pa;
+        if (b->kind == EXPORT_INT)
+                memcpy(&ib, pb, sizeof(ib));
+        else
+                ib = *pb;
+        return ia == ib;
+}
+
+/* **********************************************************************
+ *                      Built-in methods
+ ***********************************************************************/
+
+static Object *
+do_memoryview_release(Frame *fr)
+{
+        Object *self;
+
+        if (vm_getargs(fr, "<*>[!]{!}:release", &self) == RES_ERROR)
+                return ErrorVar;
+        bug_on(!isvar_memoryview(self));
+        if (V2MV(self)->exports) {
+                err_setstr(RuntimeError,
+                           "memoryview is in use and cannot be released");
+                return ErrorVar;
+        }
+        memoryview_release(self);
+        return NULL;
+}
+
+static Object *
+do_memoryview_tobytes(Frame *fr)
+{
+        Object *self;
+        unsigned char *buf;
+        size_t nbytes;
+
+        if (vm_getargs(fr, "<*>[!]{!}:tobytes", &self) == RES_ERROR)
+                return ErrorVar;
+        bug_on(!isvar_memoryview(self));
+        if (mv_check(self) == RES_ERROR)
+                return ErrorVar;
+        nbytes = V2MV(self)->exp.n * V2MV(self)->exp.itemsize;
+        if (!nbytes)
+                return gbl_new_empty_bytes();
+        buf = emalloc(nbytes);
+        export_gather(buf, &V2MV(self)->exp);
+        return bytesvar_nocopy(buf, nbytes);
+}
+
+static Object *
+do_memoryview_tolist(Frame *fr)
+{
+        Object *self, *ret;
+        size_t i, n;
+
+        if (vm_getargs(fr, "<*>[!]{!}:tolist", &self) == RES_ERROR)
+                return ErrorVar;
+        bug_on(!isvar_memoryview(self));
+        if (mv_check(self) == RES_ERROR)
+                return ErrorVar;
+        n = seqvar_size(self);
+        ret = arrayvar_new(n);
+        for (i = 0; i < n; i++) {
+                Object *item = mv_unpack(&V2MV(self)->exp, mv_at(self, i));
+                array_setitem(ret, i, item);
+                VAR_DECR_REF(item);
+        }
+        return ret;
+}
+
+static Object *
+memoryview_getprop_length(Object *self)
+{
+        bug_on(!isvar_memoryview(self));
+        return intvar_new(seqvar_size(self));
+}
+
+static Object *
+memoryview_getprop_nbytes(Object *self)
+{
+        bug_on(!isvar_memoryview(self));
+        return intvar_new(seqvar_size(self) * V2MV(self)->exp.itemsize);
+}
+
+static Object *
+memoryview_getprop_itemsize(Object *self)
+{
+        bug_on(!isvar_memoryview(self));
+        return intvar_new(V2MV(self)->exp.itemsize);
+}
+
+static Object *
+memoryview_getprop_readonly(Object *self)
+{
+        bug_on(!isvar_memoryview(self));
+        return gbl_new_bool(V2MV(self)->exp.readonly);
+}
+
+static Object *
+memoryview_getprop_obj(Object *self)
+{
+        bug_on(!isvar_memoryview(self));
+        if (!V2MV(self)->obj)
+                return VAR_NEW_REF(NullVar);
+        return VAR_NEW_REF(V2MV(self)->obj);
+}
+
+/* **********************************************************************
+ *                      Type methods
+ ***********************************************************************/
+
+static Object *
+memoryview_getitem(Object *v, size_t i)
+{
+        bug_on(i >= seqvar_size(v));
+        return mv_unpack(&V2MV(v)->exp, mv_at(v, i));
+}
+
+static enum result_t
+memoryview_setitem(Object *v, size_t i, Object *child)
+{
+        bug_on(i >= seqvar_size(v));
+        if (!child) {
+                err_setstr(TypeError, "cannot delete memoryview items");
+                return RES_ERROR;
+        }
+        if (V2MV(v)->exp.readonly) {
+                err_setstr(TypeError, "memoryview is read-only");
+                return RES_ERROR;
+        }
+        return mv_pack(&V2MV(v)->exp, mv_at(v, i), child);
+}
+
+static bool
+memoryview_hasitem(Object *v, Object *item)
+{
+        size_t i, n = seqvar_size(v);
+
+        for (i = 0; i < n; i++) {
+                Object *x = memoryview_getitem(v, i);
+                bool match = var_matches(x, item);
+                VAR_DECR_REF(x);
+                if (match)
+                        return true;
+        }
+        return false;
+}
+
+static Object *
+memoryview_getslice(Object *v, ssize_t start, ssize_t stop, ssize_t step)
+{
+        struct buffer_export_t exp;
+
+        if (mv_check(v) == RES_ERROR)
+                return ErrorVar;
+        exp = V2MV(v)->exp;
+        exp.n = var_slice_size(start, stop, step);
+        if (exp.n) {
+                exp.buf = mv_at(v, start);
+                exp.stride *= step;
+        }
+        return memoryview_from_export(V2MV(v)->obj, &exp);
+}
+
+/*
+ * Slice assignment can't change the size.  @val may be anything with
+ * memory of the same kind, or a sequence of numbers.
+ */
+static enum result_t
+memoryview_setslice(Object *v, ssize_t start, ssize_t stop,
+                    ssize_t step, Object *val)
+{
+        struct buffer_export_t dst;
+        unsigned char *tmp;
+        size_t i;
+        enum result_t res = RES_ERROR;
+
+        if (!val) {
+                err_setstr(TypeError, "cannot delete memoryview items");
+                return RES_ERROR;
+        }
+        if (mv_check(v) == RES_ERROR)
+                return RES_ERROR;
+        if (V2MV(v)->exp.readonly) {
+                err_setstr(TypeError, "memoryview is read-only");
+                return RES_ERROR;
+        }
+
+        dst = V2MV(v)->exp;
+        dst.n = var_slice_size(start, stop, step);
+        if (dst.n) {
+                dst.buf = mv_at(v, start);
+                dst.stride *= step;
+        }
+
+        /* gather first, in case source and destination overlap */
+        tmp = emalloc(dst.n * dst.itemsize + 1);
+        if (hasvar_buffer(val)) {
+                struct buffer_export_t src;
+
+                if (val->v_type->bfm->getbuffer(val, &src) == RES_ERROR)
+                        goto out;
+                if (src.kind != dst.kind || src.n != dst.n) {
+                        err_setstr(ValueError,
+                                   "memoryview slice assignment must keep the same size and type");
+                } else {
+                        export_gather(tmp, &src);
+                        res = RES_OK;
+                }
+                if (val->v_type->bfm->releasebuffer)
+                        val->v_type->bfm->releasebuffer(val);
+        } else if (isvar_seq_readable(val) && !isvar_string(val)) {
+                if (seqvar_size(val) != dst.n) {
+                        err_setstr(ValueError,
+                                   "memoryview slice assignment must keep the same size");
+                        goto out;
+                }
+                res = RES_OK;
+                for (i = 0; i < dst.n && res == RES_OK; i++) {
+                        Object *item = seqvar_getitem(val, i);
+                        res = mv_pack(&dst, tmp + i * dst.itemsize, item);
+                        VAR_DECR_REF(item);
+                }
+        } else {
+                err_setstr(TypeError,
+                           "cannot assign %s to a memoryview slice",
+                           typestr(val));
+        }
+        if (res == RES_OK)
+                export_scatter(&dst, tmp);
+
+out:
+        efree(tmp);
+        return res;
+}
+
+static Object *
+memoryview_str(Object *v)
+{
+        if (!V2MV(v)->obj)
+                return stringvar_new("<released memoryview>");
+        return stringvar_from_format("<memoryview of %s, length %d>",
+                                     typestr(V2MV(v)->obj),
+                                     (int)seqvar_size(v));
+}
+
+static bool
+memoryview_cmpeq(Object *a, Object *b)
+{
+        size_t i, n;
+
+        bug_on(!isvar_memoryview(a) || !isvar_memoryview(b));
+        if (!V2MV(a)->obj || !V2MV(b)->obj)
+                return a == b;
+        n = seqvar_size(a);
+        if (n != seqvar_size(b))
+                return false;
+        for (i = 0; i < n; i++) {
+                if (!mv_items_match(&V2MV(a)->exp, mv_at(a, i),
+                                    &V2MV(b)->exp, mv_at(b, i))) {
+                        return false;
+                }
+        }
+        return true;
+}
+
+static bool
+memoryview_cmpz(Object *v)
+{
+        return seqvar_size(v) == 0;
+}
+
+/* Same hash as bytes with the same contents, like they compare */
+static hash_t
+memoryview_hash(Object *v)
+{
+        struct memoryviewvar_t *mv = V2MV(v);
+        unsigned char *buf;
+
+        if (!mv->exp.readonly || mv->exp.kind != EXPORT_BYTE)
+                return HASH_ERROR;
+        if (!mv->hash) {
+                if (!mv->obj)
+                        return HASH_ERROR;
+                buf = emalloc(mv->exp.n + 1);
+                export_gather(buf, &mv->exp);
+                mv->hash = fnv_hash(buf, mv->exp.n);
+                efree(buf);
+        }
+        return mv->hash;
+}
+
+static void
+memoryview_reset(Object *v)
+{
+        bug_on(V2MV(v)->exports);
+        memoryview_release(v);
+}
+
+static Object *
+memoryview_create(Frame *fr)
+{
+        Object *obj;
+        struct buffer_export_t exp;
+        Object *ret;
+
+        if (vm_getargs(fr, "[<*>!]{!}:memoryview", &obj) == RES_ERROR)
+                return ErrorVar;
+
+        if (isvar_memoryview(obj)) {
+                /* view the same exporter, don't stack views */
+                if (mv_check(obj) == RES_ERROR)
+                        return ErrorVar;
+                return memoryview_from_export(V2MV(obj)->obj,
+                                              &V2MV(obj)->exp);
+        }
+        if (!hasvar_buffer(obj)) {
+                err_setstr(TypeError,
+                           "memoryview() cannot view %s object",
+                           typestr(obj));
+                return ErrorVar;
+        }
+        if (obj->v_type->bfm->getbuffer(obj, &exp) == RES_ERROR)
+                return ErrorVar;
+        ret = memoryview_from_export(obj, &exp);
+        if (obj->v_type->bfm->releasebuffer)
+                obj->v_type->bfm->releasebuffer(obj);
+        return ret;
+}
+
+/* A view exports the memory it views */
+static enum result_t
+memoryview_getbuffer(Object *v, struct buffer_export_t *exp)
+{
+        if (mv_check(v) == RES_ERROR)
+                return RES_ERROR;
+        *exp = V2MV(v)->exp;
+        V2MV(v)->exports++;
+        return RES_OK;
+}
+
+static void
+memoryview_releasebuffer(Object *v)
+{
+        bug_on(V2MV(v)->exports <= 0);
+        V2MV(v)->exports--;
+}
+
+/* **********************************************************************
+ *                              Iterator
+ ***********************************************************************/
+
+struct memoryview_iterator_t {
+        Object base;
+        Object *target;
+        size_t i;
+};
+
+#define O2MVIT(o)       ((struct memoryview_iterator_t *)(o))
+
+static Object *
+memoryview_iter_next(Object *it)
+{
+        struct memoryview_iterator_t *mit = O2MVIT(it);
+
+        if (!mit->target)
+                return NULL;
+        if (mit->i < seqvar_size(mit->target))
+                return memoryview_getitem(mit->target, mit->i++);
+
+        VAR_DECR_REF(mit->target);
+        mit->target = NULL;
+        return NULL;
+}
+
+static void
+memoryview_iter_reset(Object *it)
+{
+        struct memoryview_iterator_t *mit = O2MVIT(it);
+        if (mit->target)
+                VAR_DECR_REF(mit->target);
+        mit->target = NULL;
+}
+
+struct type_t MemoryviewIterType = {
+        .name   = "memoryview_iterator",
+        .reset  = memoryview_iter_reset,
+        .size   = sizeof(struct memoryview_iterator_t),
+        .iter_next = memoryview_iter_next,
+};
+
+static Object *
+memoryview_get_iter(Object *v)
+{
+        Object *ret = var_new(&MemoryviewIterType);
+        O2MVIT(ret)->target = VAR_NEW_REF(v);
+        O2MVIT(ret)->i = 0;
+        return ret;
+}
+
+/* **********************************************************************
+ *                              CAPI
+ ***********************************************************************/
+
+/**
+ * memoryviewvar_new - Create a view of all of @obj's memory
+ *
+ * Return: New memoryview, or ErrorVar if @obj has no memory to view
+ */
+Object *
+memoryviewvar_new(Object *obj)
+{
+        struct buffer_export_t exp;
+        Object *ret;
+
+        if (!hasvar_buffer(obj)) {
+                err_setstr(TypeError, "cannot view %s object",
+                           typestr(obj));
+                return ErrorVar;
+        }
+        if (obj->v_type->bfm->getbuffer(obj, &exp) == RES_ERROR)
+                return ErrorVar;
+        ret = memoryview_from_export(obj, &exp);
+        if (obj->v_type->bfm->releasebuffer)
+                obj->v_type->bfm->releasebuffer(obj);
+        return ret;
+}
+
+/**
+ * bytes_like_acquire - Borrow the raw bytes of a bytes-like object
+ * @o:          Object whose type can export its memory, eg. bytes,
+ *              bytearray, or memoryview
+ * @len:        Filled with the number of bytes
+ * @tmp:        Filled with NULL, or with a bytes object holding a copy
+ *              of @o's data if @o's memory is not contiguous
+ *
+ * Return: Pointer to the data, or NULL with an exception raised if @o
+ *      cannot export its memory.  The data is only good until
+ *      bytes_like_release(), which must be called if this succeeds.
+ */
+const unsigned char *
+bytes_like_acquire(Object *o, size_t *len, Object **tmp)
+{
+        struct buffer_export_t exp;
+
+        *tmp = NULL;
+        if (!hasvar_buffer(o)) {
+                err_setstr(TypeError,
+                           "a bytes-like object is required, not %s",
+                           typestr(o));
+                return NULL;
+        }
+        if (o->v_type->bfm->getbuffer(o, &exp) == RES_ERROR)
+                return NULL;
+
+        *len = exp.n * exp.itemsize;
+        if (exp.stride == (ssize_t)exp.itemsize)
+                return exp.buf;
+
+        if (*len) {
+                unsigned char *buf = emalloc(*len);
+                export_gather(buf, &exp);
+                *tmp = bytesvar_nocopy(buf, *len);
+        } else {
+                *tmp = gbl_new_empty_bytes();
+        }
+        return bytes_getbuf(*tmp);
+}
+
+/**
+ * bytes_like_acquire_rw - Borrow the raw bytes of a bytes-like object
+ *                         in order to fill them in
+ * @o:          Object whose memory is writable, contiguous, and made of
+ *              bytes, eg. a bytearray or a memoryview of one
+ * @len:        Filled with the number of bytes
+ *
+ * Return: Pointer to the data, or NULL with an exception raised.  If
+ *      this succeeds, call bytes_like_release(@o, NULL) when done.
+ */
+unsigned char *
+bytes_like_acquire_rw(Object *o, size_t *len)
+{
+        struct buffer_export_t exp;
+
+        if (!hasvar_buffer(o))
+                goto err;
+        if (o->v_type->bfm->getbuffer(o, &exp) == RES_ERROR)
+                return NULL;
+        if (exp.readonly || exp.kind != EXPORT_BYTE || exp.stride != 1) {
+                bytes_like_release(o, NULL);
+                goto err;
+        }
+        *len = exp.n;
+        return exp.buf;
+
+err:
+        err_setstr(TypeError,
+                   "a writable, contiguous bytes-like object is required, not %s",
+                   typestr(o));
+        return NULL;
+}
+
+/**
+ * bytes_like_release - Give back what bytes_like_acquire() borrowed
+ */
+void
+bytes_like_release(Object *o, Object *tmp)
+{
+        if (tmp)
+                VAR_DECR_REF(tmp);
+        if (o->v_type->bfm->releasebuffer)
+                o->v_type->bfm->releasebuffer(o);
+}
+
+static const struct type_method_t memoryview_cb_methods[] = {
+        {"release",     do_memoryview_release},
+        {"tobytes",     do_memoryview_tobytes},
+        {"tolist",      do_memoryview_tolist},
+        {NULL, NULL},
+};
+
+static const struct type_prop_t memoryview_prop_getsets[] = {
+        { .name = "itemsize", .getprop = memoryview_getprop_itemsize, .setprop = NULL },
+        { .name = "length",   .getprop = memoryview_getprop_length,   .setprop = NULL },
+        { .name = "nbytes",   .getprop = memoryview_getprop_nbytes,   .setprop = NULL },
+        { .name = "obj",      .getprop = memoryview_getprop_obj,      .setprop = NULL },
+        { .name = "readonly", .getprop = memoryview_getprop_readonly, .setprop = NULL },
+        { .name = NULL },
+};
+
+static const struct seq_methods_t memoryview_seq_methods = {
+        .getitem        = memoryview_getitem,
+        .setitem        = memoryview_setitem,
+        .hasitem        = memoryview_hasitem,
+        .getslice       = memoryview_getslice,
+        .setslice       = memoryview_setslice,
+        .cat            = NULL,
+        .sort           = NULL,
+};
+
+static const struct buffer_methods_t memoryview_buffer_methods = {
+        .getbuffer      = memoryview_getbuffer,
+        .releasebuffer  = memoryview_releasebuffer,
+};
+
+struct type_t MemoryviewType = {
+        .flags  = 0,
+        .name   = "memoryview",
+        .opm    = NULL,
+        .cbm    = memoryview_cb_methods,
+        .mpm    = NULL,
+        .sqm    = &memoryview_seq_methods,
+        .size   = sizeof(struct memoryviewvar_t),
+        .str    = memoryview_str,
+        .cmp    = NULL,
+        .cmpz   = memoryview_cmpz,
+        .cmpeq  = memoryview_cmpeq,
+        .reset  = memoryview_reset,
+        .prop_getsets = memoryview_prop_getsets,
+        .create = memoryview_create,
+        .hash   = memoryview_hash,
+        .get_iter = memoryview_get_iter,
+        .bfm    = &memoryview_buffer_methods,
+};
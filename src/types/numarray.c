@@ -0,0 +1,1353 @@
+/*
+ * numarray.c - Packed arrays of numbers
+ *
+ * A list of a million floats is a million float objects, plus a million
+ * pointers to them.  A numarray is the same million numbers packed into
+ * one C array of long long or double, so element-wise math and
+ * reductions are plain loops over contiguous memory, which the compiler
+ * can vectorize.
+ *
+ * The + - * / operators work element by element, either between two
+ * numarrays of the same length or between a numarray and a number on
+ * either side.  The comparison operators can only ever produce one true
+ * or false, so element-wise comparisons are methods instead:
+ * a.lt(b) is a numarray of ones and zeros.  a == b is still true if all
+ * of a and b's elements match.
+ *
+ * A numarray's length is fixed.  Slicing one returns a view which
+ * shares its memory, so writing to the view writes to the original.
+ * The view keeps a reference to the numarray which owns the memory.
+ */
+#include <evilcandy/debug.h>
+#include <evilcandy/err.h>
+#include <evilcandy/ewrappers.h>
+#include <evilcandy/global.h>
+#include <evilcandy/string_writer.h>
+#include <evilcandy/vm.h>
+#include <evilcandy/types/array.h>
+#include <evilcandy/types/bytes.h>
+#include <evilcandy/types/number_types.h>
+#include <evilcandy/types/numarray.h>
+#include <evilcandy/types/string.h>
+#include <internal/instructions.h>
+#include <internal/type_registry.h>
+#include <internal/types/number_types.h>
+#include <internal/types/sequential_types.h>
+
+#include <math.h>
+#include <string.h>
+
+#if defined(__AVX__)
+# include <immintrin.h>
+#elif defined(__SSE2__)
+# include <emmintrin.h>
+#endif
+
+/* Element types */
+enum {
+        NA_INT,         /* long long */
+        NA_FLOAT,       /* double */
+};
+
+/**
+ * struct numarrayvar_t - Handle to a numarray
+ * @kind:       NA_INT or NA_FLOAT
+ * @data:       Pointer to the first element
+ * @stride:     Distance between elements, in elements, not bytes.  This
+ *              is 1 unless the array is a view with a slice step other
+ *              than 1, and it may be negative.
+ * @owner:      If this is a view, the numarray which owns @data.
+ *              If NULL, this numarray owns @data.
+ */
+struct numarrayvar_t {
+        struct seqvar_t base;
+        int kind;
+        void *data;
+        ssize_t stride;
+        Object *owner;
+};
+
+#define V2NA(v_)        ((struct numarrayvar_t *)(v_))
+
+/* Operations for the binary-operator kernels */
+enum {
+        NA_ADD,
+        NA_SUB,
+        NA_MUL,
+        NA_DIV,
+};
+
+static inline long long
+na_int_at(Object *a, size_t i)
+{
+        return ((long long *)V2NA(a)->data)[(ssize_t)i * V2NA(a)->stride];
+}
+
+static inline double
+na_float_at(Object *a, size_t i)
+{
+        return ((double *)V2NA(a)->data)[(ssize_t)i * V2NA(a)->stride];
+}
+
+static inline double
+na_real_at(Object *a, size_t i)
+{
+        if (V2NA(a)->kind == NA_INT)
+                return (double)na_int_at(a, i);
+        return na_float_at(a, i);
+}
+
+static size_t
+na_elemsize(int kind)
+{
+        return kind == NA_INT ? sizeof(long long) : sizeof(double);
+}
+
+static Object *
+numarray_alloc(int kind, size_t n)
+{
+        Object *ret = var_new(&NumArrayType);
+        struct numarrayvar_t *na = V2NA(ret);
+
+        na->kind = kind;
+        /* one extra so emalloc never sees zero */
+        na->data = emalloc((n + 1) * na_elemsize(kind));
+        na->stride = 1;
+        na->owner = NULL;
+        seqvar_set_size(ret, n);
+        return ret;
+}
+
+/*
+ * Get @a's elements as a contiguous C array of @kind, copying them if
+ * they aren't stored that way already.  Pass the result to
+ * na_release() when done with it.  @kind may only be NA_INT if @a's
+ * elements are ints.
+ */
+static void *
+na_acquire(Object *a, int kind)
+{
+        struct numarrayvar_t *na = V2NA(a);
+        size_t i, n = seqvar_size(a);
+
+        if (na->kind == kind && na->stride == 1)
+                return na->data;
+
+        if (kind == NA_FLOAT) {
+                double *p = emalloc((n + 1) * sizeof(double));
+                for (i = 0; i < n; i++)
+                        p[i] = na_real_at(a, i);
+                return p;
+        } else {
+                long long *p = emalloc((n + 1) * sizeof(long long));
+                bug_on(na->kind != NA_INT);
+                for (i = 0; i < n; i++)
+                        p[i] = na_int_at(a, i);
+                return p;
+        }
+}
+
+static void
+na_release(Object *a, void *p)
+{
+        if (p != V2NA(a)->data)
+                efree(p);
+}
+
+/*
+ * One side of a binary operation: either a numarray, in which case @arr
+ * is set, or a number, in which case @i and @f are its value.
+ */
+struct na_operand_t {
+        Object *arr;
+        int kind;
+        long long i;
+        double f;
+};
+
+static enum result_t
+na_operand(struct na_operand_t *opd, Object *v, const char *what)
+{
+        opd->arr = NULL;
+        opd->i = 0;
+        opd->f = 0.0;
+        if (isvar_numarray(v)) {
+                opd->arr = v;
+                opd->kind = V2NA(v)->kind;
+        } else if (isvar_int(v)) {
+                opd->kind = NA_INT;
+                opd->i = intvar_toll(v);
+                opd->f = (double)opd->i;
+        } else if (isvar_float(v)) {
+                opd->kind = NA_FLOAT;
+                opd->f = floatvar_tod(v);
+        } else {
+                err_setstr(TypeError,
+                           "%s not permitted between numarray and %s",
+                           what, typestr(v));
+                return RES_ERROR;
+        }
+        return RES_OK;
+}
+
+/*
+ * Check operands @x and @y, and get the length and kind of the result
+ * of an operation between them.
+ */
+static enum result_t
+na_operands(struct na_operand_t *x, struct na_operand_t *y,
+            Object *a, Object *b, const char *what,
+            size_t *n, int *kind)
+{
+        if (na_operand(x, a, what) == RES_ERROR ||
+            na_operand(y, b, what) == RES_ERROR) {
+                return RES_ERROR;
+        }
+        bug_on(!x->arr && !y->arr);
+        if (x->arr && y->arr && seqvar_size(a) != seqvar_size(b)) {
+                err_setstr(ValueError,
+                           "%s between numarrays of different lengths (%lld and %lld)",
+                           what, (long long)seqvar_size(a),
+                           (long long)seqvar_size(b));
+                return RES_ERROR;
+        }
+        *n = seqvar_size(x->arr ? x->arr : y->arr);
+        *kind = (x->kind == NA_FLOAT || y->kind == NA_FLOAT)
+                ? NA_FLOAT : NA_INT;
+        return RES_OK;
+}
+
+/* **********************************************************************
+ *                              Kernels
+ *
+ * These are written as simple counted loops over restrict pointers,
+ * which GCC and Clang vectorize at -O2 or -O3.  In each of them, @x or
+ * @y is NULL if that side is a number, whose value is in @xs or @ys.
+ ***********************************************************************/
+
+#define NA_LOOPS(Expr_vv, Expr_vs, Expr_sv)                     \
+        do {                                                    \
+                if (x && y) {                                   \
+                        for (i = 0; i < n; i++)                 \
+                                r[i] = Expr_vv;                 \
+                } else if (x) {                                 \
+                        for (i = 0; i < n; i++)                 \
+                                r[i] = Expr_vs;                 \
+                } else {                                        \
+                        for (i = 0; i < n; i++)                 \
+                                r[i] = Expr_sv;                 \
+                }                                               \
+        } while (0)
+
+#define NA_BINOP_LOOPS(OP) \
+        NA_LOOPS(x[i] OP y[i], x[i] OP ys, xs OP y[i])
+
+static enum result_t
+float_binop(int op, double *restrict r, const double *restrict x,
+            const double *restrict y, double xs, double ys, size_t n)
+{
+        size_t i;
+
+        switch (op) {
+        case NA_ADD:
+                NA_BINOP_LOOPS(+);
+                break;
+        case NA_SUB:
+                NA_BINOP_LOOPS(-);
+                break;
+        case NA_MUL:
+                NA_BINOP_LOOPS(*);
+                break;
+        case NA_DIV:
+                /* same as float's '/', no inf or nan results */
+                if (y) {
+                        for (i = 0; i < n; i++) {
+                                if (y[i] == 0.0)
+                                        goto divzero;
+                        }
+                } else if (ys == 0.0) {
+                        goto divzero;
+                }
+                NA_BINOP_LOOPS(/);
+                break;
+        default:
+                bug();
+        }
+        return RES_OK;
+
+divzero:
+        err_setstr(NumberError, "Divide by zero");
+        return RES_ERROR;
+}
+
+/* x / y, but without trapping on LLONG_MIN / -1 */
+static inline long long
+int_div1(long long x, long long y)
+{
+        if (y == -1LL)
+                return (long long)(0ull - (unsigned long long)x);
+        return x / y;
+}
+
+/*
+ * Ints wrap on overflow the same way the int type's operators do, but
+ * do the math unsigned, where that's defined behavior.
+ */
+static enum result_t
+int_binop(int op, long long *r_, const long long *x_,
+          const long long *y_, long long xs_, long long ys_, size_t n)
+{
+        unsigned long long *restrict r = (unsigned long long *)r_;
+        const unsigned long long *restrict x = (const unsigned long long *)x_;
+        const unsigned long long *restrict y = (const unsigned long long *)y_;
+        unsigned long long xs = xs_, ys = ys_;
+        size_t i;
+
+        switch (op) {
+        case NA_ADD:
+                NA_BINOP_LOOPS(+);
+                break;
+        case NA_SUB:
+                NA_BINOP_LOOPS(-);
+                break;
+        case NA_MUL:
+                NA_BINOP_LOOPS(*);
+                break;
+        case NA_DIV:
+                if (y_) {
+                        for (i = 0; i < n; i++) {
+                                if (y_[i] == 0LL)
+                                        goto divzero;
+                        }
+                } else if (ys_ == 0LL) {
+                        goto divzero;
+                }
+                /* No SIMD for this one anyway */
+                for (i = 0; i < n; i++) {
+                        r_[i] = int_div1(x_ ? x_[i] : xs_,
+                                         y_ ? y_[i] : ys_);
+                }
+                break;
+        default:
+                bug();
+        }
+        return RES_OK;
+
+divzero:
+        err_setstr(NumberError, "Divide by zero");
+        return RES_ERROR;
+}
+
+#define NA_CMP_LOOPS(OP) \
+        NA_LOOPS(x[i] OP y[i], x[i] OP ys, xs OP y[i])
+
+#define NA_CMP_SWITCH()                                 \
+        do {                                            \
+                switch (op) {                           \
+                case IARG_EQ:                           \
+                        NA_CMP_LOOPS(==);               \
+                        break;                          \
+                case IARG_NEQ:                          \
+                        NA_CMP_LOOPS(!=);               \
+                        break;                          \
+                case IARG_LT:                           \
+                        NA_CMP_LOOPS(<);                \
+                        break;                          \
+                case IARG_LEQ:                          \
+                        NA_CMP_LOOPS(<=);               \
+                        break;                          \
+                case IARG_GT:                           \
+                        NA_CMP_LOOPS(>);                \
+                        break;                          \
+                case IARG_GEQ:                          \
+                        NA_CMP_LOOPS(>=);               \
+                        break;                          \
+                default:                                \
+                        bug();                          \
+                }                                       \
+        } while (0)
+
+/* @op is one of the IARG_xxx comparison enums */
+static void
+float_compare(int op, long long *restrict r, const double *restrict x,
+              const double *restrict y, double xs, double ys, size_t n)
+{
+        size_t i;
+        NA_CMP_SWITCH();
+}
+
+static void
+int_compare(int op, long long *restrict r, const long long *restrict x,
+            const long long *restrict y, long long xs, long long ys,
+            size_t n)
+{
+        size_t i;
+        NA_CMP_SWITCH();
+}
+
+/*
+ * Floating-point addition isn't associative, so the compiler won't
+ * vectorize a sum unless told it may reorder it (-ffast-math), which
+ * we don't want to force on the whole program.  These reorder it by
+ * hand instead: several partial sums, added together at the end.
+ */
+static double
+float_sum(const double *x, size_t n)
+{
+        size_t i = 0;
+        double sum;
+#if defined(__AVX__)
+        __m256d a0 = _mm256_setzero_pd();
+        __m256d a1 = _mm256_setzero_pd();
+        double lanes[4];
+
+        for (; i + 8 <= n; i += 8) {
+                a0 = _mm256_add_pd(a0, _mm256_loadu_pd(&x[i]));
+                a1 = _mm256_add_pd(a1, _mm256_loadu_pd(&x[i + 4]));
+        }
+        _mm256_storeu_pd(lanes, _mm256_add_pd(a0, a1));
+        sum = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+#elif defined(__SSE2__)
+        __m128d a0 = _mm_setzero_pd();
+        __m128d a1 = _mm_setzero_pd();
+        double lanes[2];
+
+        for (; i + 4 <= n; i += 4) {
+                a0 = _mm_add_pd(a0, _mm_loadu_pd(&x[i]));
+                a1 = _mm_add_pd(a1, _mm_loadu_pd(&x[i + 2]));
+        }
+        _mm_storeu_pd(lanes, _mm_add_pd(a0, a1));
+        sum = lanes[0] + lanes[1];
+#else
+        double s0 = 0.0, s1 = 0.0, s2 = 0.0, s3 = 0.0;
+
+        for (; i + 4 <= n; i += 4) {
+                s0 += x[i];
+                s1 += x[i + 1];
+                s2 += x[i + 2];
+                s3 += x[i + 3];
+        }
+        sum = (s0 + s1) + (s2 + s3);
+#endif
+        for (; i < n; i++)
+                sum += x[i];
+        return sum;
+}
+
+static double
+float_dot(const double *x, const double *y, size_t n)
+{
+        size_t i = 0;
+        double sum;
+#if defined(__AVX__)
+        __m256d a0 = _mm256_setzero_pd();
+        __m256d a1 = _mm256_setzero_pd();
+        double lanes[4];
+
+        for (; i + 8 <= n; i += 8) {
+                a0 = _mm256_add_pd(a0, _mm256_mul_pd(_mm256_loadu_pd(&x[i]),
+                                                     _mm256_loadu_pd(&y[i])));
+                a1 = _mm256_add_pd(a1, _mm256_mul_pd(_mm256_loadu_pd(&x[i + 4]),
+                                                     _mm256_loadu_pd(&y[i + 4])));
+        }
+        _mm256_storeu_pd(lanes, _mm256_add_pd(a0, a1));
+        sum = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+#elif defined(__SSE2__)
+        __m128d a0 = _mm_setzero_pd();
+        __m128d a1 = _mm_setzero_pd();
+        double lanes[2];
+
+        for (; i + 4 <= n; i += 4) {
+                a0 = _mm_add_pd(a0, _mm_mul_pd(_mm_loadu_pd(&x[i]),
+                                               _mm_loadu_pd(&y[i])));
+                a1 = _mm_add_pd(a1, _mm_mul_pd(_mm_loadu_pd(&x[i + 2]),
+                                               _mm_loadu_pd(&y[i + 2])));
+        }
+        _mm_storeu_pd(lanes, _mm_add_pd(a0, a1));
+        sum = lanes[0] + lanes[1];
+#else
+        double s0 = 0.0, s1 = 0.0, s2 = 0.0, s3 = 0.0;
+
+        for (; i + 4 <= n; i += 4) {
+                s0 += x[i] * y[i];
+                s1 += x[i + 1] * y[i + 1];
+                s2 += x[i + 2] * y[i + 2];
+                s3 += x[i + 3] * y[i + 3];
+        }
+        sum = (s0 + s1) + (s2 + s3);
+#endif
+        for (; i < n; i++)
+                sum += x[i] * y[i];
+        return sum;
+}
+
+/* Integer addition is associative, so these vectorize as they are */
+static long long
+int_sum(const long long *x_, size_t n)
+{
+        const unsigned long long *x = (const unsigned long long *)x_;
+        unsigned long long sum = 0;
+        size_t i;
+
+        for (i = 0; i < n; i++)
+                sum += x[i];
+        return (long long)sum;
+}
+
+static long long
+int_dot(const long long *x_, const long long *y_, size_t n)
+{
+        const unsigned long long *x = (const unsigned long long *)x_;
+        const unsigned long long *y = (const unsigned long long *)y_;
+        unsigned long long sum = 0;
+        size_t i;
+
+        for (i = 0; i < n; i++)
+                sum += x[i] * y[i];
+        return (long long)sum;
+}
+
+/* **********************************************************************
+ *                      Built-in Operator Callbacks
+ ***********************************************************************/
+
+static Object *
+na_binop(Object *a, Object *b, int op, const char *what)
+{
+        struct na_operand_t x, y;
+        void *px, *py;
+        Object *ret;
+        size_t n;
+        int kind;
+        enum result_t res;
+
+        if (na_operands(&x, &y, a, b, what, &n, &kind) == RES_ERROR)
+                return ErrorVar;
+
+        px = x.arr ? na_acquire(x.arr, kind) : NULL;
+        py = y.arr ? na_acquire(y.arr, kind) : NULL;
+        ret = numarray_alloc(kind, n);
+        if (kind == NA_FLOAT) {
+                res = float_binop(op, V2NA(ret)->data, px, py,
+                                  x.f, y.f, n);
+        } else {
+                res = int_binop(op, V2NA(ret)->data, px, py,
+                                x.i, y.i, n);
+        }
+        if (px)
+                na_release(x.arr, px);
+        if (py)
+                na_release(y.arr, py);
+
+        if (res == RES_ERROR) {
+                VAR_DECR_REF(ret);
+                return ErrorVar;
+        }
+        return ret;
+}
+
+static Object *
+numarray_add(Object *a, Object *b)
+{
+        return na_binop(a, b, NA_ADD, "+");
+}
+
+static Object *
+numarray_sub(Object *a, Object *b)
+{
+        return na_binop(a, b, NA_SUB, "-");
+}
+
+static Object *
+numarray_mul(Object *a, Object *b)
+{
+        return na_binop(a, b, NA_MUL, "*");
+}
+
+static Object *
+numarray_div(Object *a, Object *b)
+{
+        return na_binop(a, b, NA_DIV, "/");
+}
+
+static Object *
+na_unary(Object *a, bool absolute)
+{
+        size_t i, n = seqvar_size(a);
+        Object *ret = numarray_alloc(V2NA(a)->kind, n);
+        void *px = na_acquire(a, V2NA(a)->kind);
+
+        if (V2NA(a)->kind == NA_FLOAT) {
+                double *restrict r = V2NA(ret)->data;
+                const double *restrict x = px;
+                if (absolute) {
+                        for (i = 0; i < n; i++)
+                                r[i] = fabs(x[i]);
+                } else {
+                        for (i = 0; i < n; i++)
+                                r[i] = -x[i];
+                }
+        } else {
+                unsigned long long *restrict r = V2NA(ret)->data;
+                const long long *restrict x = px;
+                if (absolute) {
+                        for (i = 0; i < n; i++) {
+                                r[i] = x[i] < 0 ? 0ull - x[i]
+                                                : (unsigned long long)x[i];
+                        }
+                } else {
+                        for (i = 0; i < n; i++)
+                                r[i] = 0ull - x[i];
+                }
+        }
+        na_release(a, px);
+        return ret;
+}
+
+static Object *
+numarray_negate(Object *a)
+{
+        return na_unary(a, false);
+}
+
+static Object *
+numarray_abs(Object *a)
+{
+        return na_unary(a, true);
+}
+
+static bool
+numarray_cmpeq(Object *a, Object *b)
+{
+        size_t i, n;
+
+        if (a == b)
+                return true;
+        if (!isvar_numarray(a) || !isvar_numarray(b))
+                return false;
+        n = seqvar_size(a);
+        if (n != seqvar_size(b))
+                return false;
+        if (V2NA(a)->kind == NA_INT && V2NA(b)->kind == NA_INT) {
+                for (i = 0; i < n; i++) {
+                        if (na_int_at(a, i) != na_int_at(b, i))
+                                return false;
+                }
+        } else {
+                for (i = 0; i < n; i++) {
+                        if (na_real_at(a, i) != na_real_at(b, i))
+                                return false;
+                }
+        }
+        return true;
+}
+
+static bool
+numarray_cmpz(Object *a)
+{
+        return seqvar_size(a) == 0;
+}
+
+static Object *
+numarray_str(Object *a)
+{
+        struct string_writer_t wr;
+        size_t i, n = seqvar_size(a);
+
+        string_writer_init(&wr, 1);
+        string_writer_appends(&wr, "numarray([");
+        for (i = 0; i < n; i++) {
+                Object *v, *s;
+
+                if (i > 0)
+                        string_writer_appends(&wr, ", ");
+                v = seqvar_getitem(a, i);
+                s = var_str(v);
+                string_writer_append_strobj(&wr, s);
+                VAR_DECR_REF(s);
+                VAR_DECR_REF(v);
+        }
+        string_writer_appends(&wr, "], ");
+        string_writer_appends(&wr, V2NA(a)->kind == NA_INT
+                                   ? IntType.name : FloatType.name);
+        string_writer_append(&wr, ')');
+        return stringvar_from_writer(&wr);
+}
+
+static void
+numarray_reset(Object *a)
+{
+        struct numarrayvar_t *na = V2NA(a);
+        if (na->owner)
+                VAR_DECR_REF(na->owner);
+        else if (na->data)
+                efree(na->data);
+        na->owner = NULL;
+        na->data = NULL;
+}
+
+/* A numarray's length is fixed, so there's nothing to release */
+static enum result_t
+numarray_getbuffer(Object *a, struct buffer_export_t *exp)
+{
+        struct numarrayvar_t *na = V2NA(a);
+
+        exp->buf      = na->data;
+        exp->n        = seqvar_size(a);
+        exp->itemsize = na_elemsize(na->kind);
+        exp->stride   = na->stride * (ssize_t)exp->itemsize;
+        exp->kind     = na->kind == NA_INT ? EXPORT_INT : EXPORT_FLOAT;
+        exp->readonly = false;
+        return RES_OK;
+}
+
+/* **********************************************************************
+ *                      Sequence Callbacks
+ ***********************************************************************/
+
+static Object *
+numarray_getitem(Object *a, size_t i)
+{
+        bug_on(i >= seqvar_size(a));
+        if (V2NA(a)->kind == NA_INT)
+                return intvar_new(na_int_at(a, i));
+        return floatvar_new(na_float_at(a, i));
+}
+
+static enum result_t
+numarray_setitem(Object *a, size_t i, Object *v)
+{
+        struct numarrayvar_t *na = V2NA(a);
+        ssize_t at = (ssize_t)i * na->stride;
+
+        bug_on(i >= seqvar_size(a));
+        if (na->kind == NA_INT) {
+                if (!isvar_int(v))
+                        goto badtype;
+                ((long long *)na->data)[at] = intvar_toll(v);
+        } else {
+                if (!isvar_real(v))
+                        goto badtype;
+                ((double *)na->data)[at] = realvar_tod(v);
+        }
+        return RES_OK;
+
+badtype:
+        err_setstr(TypeError, "cannot store %s in %s numarray",
+                   typestr(v), na->kind == NA_INT ? "integer" : "float");
+        return RES_ERROR;
+}
+
+static bool
+numarray_hasitem(Object *a, Object *v)
+{
+        size_t i, n = seqvar_size(a);
+        double d;
+
+        if (!isvar_real(v))
+                return false;
+        if (V2NA(a)->kind == NA_INT && isvar_int(v)) {
+                long long ll = intvar_toll(v);
+                for (i = 0; i < n; i++) {
+                        if (na_int_at(a, i) == ll)
+                                return true;
+                }
+                return false;
+        }
+        d = realvar_tod(v);
+        for (i = 0; i < n; i++) {
+                if (na_real_at(a, i) == d)
+                        return true;
+        }
+        return false;
+}
+
+/* Slices are views into @a, see top of file */
+static Object *
+numarray_getslice(Object *a, ssize_t start, ssize_t stop, ssize_t step)
+{
+        struct numarrayvar_t *na = V2NA(a);
+        struct numarrayvar_t *view;
+        size_t n = var_slice_size(start, stop, step);
+        Object *ret = var_new(&NumArrayType);
+
+        view = V2NA(ret);
+        view->kind = na->kind;
+        view->stride = na->stride * step;
+        view->owner = VAR_NEW_REF(na->owner ? na->owner : a);
+        view->data = na->data;
+        if (n > 0) {
+                view->data = (char *)na->data
+                             + start * na->stride
+                               * (ssize_t)na_elemsize(na->kind);
+        }
+        seqvar_set_size(ret, n);
+        return ret;
+}
+
+/* **********************************************************************
+ *                      Built-in Methods
+ ***********************************************************************/
+
+static Object *
+do_numarray_sum(Frame *fr)
+{
+        Object *self;
+        void *p;
+        Object *ret;
+
+        if (vm_getargs(fr, "<*>[!]{!}:sum", &self) == RES_ERROR)
+                return ErrorVar;
+        bug_on(!isvar_numarray(self));
+        p = na_acquire(self, V2NA(self)->kind);
+        if (V2NA(self)->kind == NA_INT)
+                ret = intvar_new(int_sum(p, seqvar_size(self)));
+        else
+                ret = floatvar_new(float_sum(p, seqvar_size(self)));
+        na_release(self, p);
+        return ret;
+}
+
+static Object *
+do_numarray_mean(Frame *fr)
+{
+        Object *self;
+        size_t n;
+        void *p;
+        double sum;
+
+        if (vm_getargs(fr, "<*>[!]{!}:mean", &self) == RES_ERROR)
+                return ErrorVar;
+        bug_on(!isvar_numarray(self));
+        n = seqvar_size(self);
+        if (!n) {
+                err_setstr(ValueError, "mean of empty numarray");
+                return ErrorVar;
+        }
+        p = na_acquire(self, NA_FLOAT);
+        sum = float_sum(p, n);
+        na_release(self, p);
+        return floatvar_new(sum / (double)n);
+}
+
+static Object *
+na_minmax(Frame *fr, bool max, const char *fmt)
+{
+        Object *self;
+        size_t i, n;
+
+        if (vm_getargs(fr, fmt, &self) == RES_ERROR)
+                return ErrorVar;
+        bug_on(!isvar_numarray(self));
+        n = seqvar_size(self);
+        if (!n) {
+                err_setstr(ValueError, "%s of empty numarray",
+                           max ? "max" : "min");
+                return ErrorVar;
+        }
+
+        if (V2NA(self)->kind == NA_INT) {
+                long long best = na_int_at(self, 0);
+                for (i = 1; i < n; i++) {
+                        long long v = na_int_at(self, i);
+                        if (max ? v > best : v < best)
+                                best = v;
+                }
+                return intvar_new(best);
+        } else {
+                double best = na_float_at(self, 0);
+                for (i = 1; i < n; i++) {
+                        double v = na_float_at(self, i);
+                        if (max ? v > best : v < best)
+                                best = v;
+                }
+                return floatvar_new(best);
+        }
+}
+
+static Object *
+do_numarray_min(Frame *fr)
+{
+        return na_minmax(fr, false, "<*>[!]{!}:min");
+}
+
+static Object *
+do_numarray_max(Frame *fr)
+{
+        return na_minmax(fr, true, "<*>[!]{!}:max");
+}
+
+static Object *
+do_numarray_dot(Frame *fr)
+{
+        Object *self, *other, *ret;
+        struct na_operand_t x, y;
+        void *px, *py;
+        size_t n;
+        int kind;
+
+        if (vm_getargs(fr, "<*>[<*>!]{!}:dot", &self, &other) == RES_ERROR)
+                return ErrorVar;
+        bug_on(!isvar_numarray(self));
+        if (!isvar_numarray(other)) {
+                err_setstr(TypeError, "dot() expected numarray but got %s",
+                           typestr(other));
+                return ErrorVar;
+        }
+        if (na_operands(&x, &y, self, other, "dot()", &n, &kind)
+            == RES_ERROR) {
+                return ErrorVar;
+        }
+
+        px = na_acquire(self, kind);
+        py = na_acquire(other, kind);
+        if (kind == NA_INT)
+                ret = intvar_new(int_dot(px, py, n));
+        else
+                ret = floatvar_new(float_dot(px, py, n));
+        na_release(self, px);
+        na_release(other, py);
+        return ret;
+}
+
+static Object *
+na_compare(Frame *fr, int op, const char *fmt)
+{
+        Object *self, *other, *ret;
+        struct na_operand_t x, y;
+        void *px, *py;
+        size_t n;
+        int kind;
+
+        if (vm_getargs(fr, fmt, &self, &other) == RES_ERROR)
+                return ErrorVar;
+        bug_on(!isvar_numarray(self));
+        if (na_operands(&x, &y, self, other, "comparison", &n, &kind)
+            == RES_ERROR) {
+                return ErrorVar;
+        }
+
+        px = na_acquire(self, kind);
+        py = y.arr ? na_acquire(other, kind) : NULL;
+        ret = numarray_alloc(NA_INT, n);
+        if (kind == NA_INT)
+                int_compare(op, V2NA(ret)->data, px, py, x.i, y.i, n);
+        else
+                float_compare(op, V2NA(ret)->data, px, py, x.f, y.f, n);
+        na_release(self, px);
+        if (py)
+                na_release(other, py);
+        return ret;
+}
+
+static Object *
+do_numarray_eq(Frame *fr)
+{
+        return na_compare(fr, IARG_EQ, "<*>[<*>!]{!}:eq");
+}
+
+static Object *
+do_numarray_ne(Frame *fr)
+{
+        return na_compare(fr, IARG_NEQ, "<*>[<*>!]{!}:ne");
+}
+
+static Object *
+do_numarray_lt(Frame *fr)
+{
+        return na_compare(fr, IARG_LT, "<*>[<*>!]{!}:lt");
+}
+
+static Object *
+do_numarray_le(Frame *fr)
+{
+        return na_compare(fr, IARG_LEQ, "<*>[<*>!]{!}:le");
+}
+
+static Object *
+do_numarray_gt(Frame *fr)
+{
+        return na_compare(fr, IARG_GT, "<*>[<*>!]{!}:gt");
+}
+
+static Object *
+do_numarray_ge(Frame *fr)
+{
+        return na_compare(fr, IARG_GEQ, "<*>[<*>!]{!}:ge");
+}
+
+/* Contiguous copy of @a, also used to materialize views */
+static Object *
+numarray_copy(Object *a, int kind)
+{
+        size_t n = seqvar_size(a);
+        Object *ret = numarray_alloc(kind, n);
+        void *p = na_acquire(a, kind);
+
+        memcpy(V2NA(ret)->data, p, n * na_elemsize(kind));
+        na_release(a, p);
+        return ret;
+}
+
+static Object *
+do_numarray_copy(Frame *fr)
+{
+        Object *self;
+
+        if (vm_getargs(fr, "<*>[!]{!}:copy", &self) == RES_ERROR)
+                return ErrorVar;
+        bug_on(!isvar_numarray(self));
+        return numarray_copy(self, V2NA(self)->kind);
+}
+
+static Object *
+do_numarray_tolist(Frame *fr)
+{
+        Object *self, *ret;
+        size_t i, n;
+
+        if (vm_getargs(fr, "<*>[!]{!}:tolist", &self) == RES_ERROR)
+                return ErrorVar;
+        bug_on(!isvar_numarray(self));
+        n = seqvar_size(self);
+        ret = arrayvar_new(n);
+        for (i = 0; i < n; i++) {
+                Object *v = numarray_getitem(self, i);
+                array_setitem(ret, i, v);
+                VAR_DECR_REF(v);
+        }
+        return ret;
+}
+
+/*
+ * .tobytes()   Elements in the machine's own format, the inverse of
+ *              numarray(bytes, dtype)
+ */
+static Object *
+do_numarray_tobytes(Frame *fr)
+{
+        Object *self, *ret;
+        size_t n;
+        void *p;
+
+        if (vm_getargs(fr, "<*>[!]{!}:tobytes", &self) == RES_ERROR)
+                return ErrorVar;
+        bug_on(!isvar_numarray(self));
+        n = seqvar_size(self);
+        p = na_acquire(self, V2NA(self)->kind);
+        ret = bytesvar_new((unsigned char *)p,
+                           n * na_elemsize(V2NA(self)->kind));
+        na_release(self, p);
+        return ret;
+}
+
+static Object *
+numarray_getprop_length(Object *self)
+{
+        bug_on(!isvar_numarray(self));
+        return intvar_new(seqvar_size(self));
+}
+
+static Object *
+numarray_getprop_dtype(Object *self)
+{
+        bug_on(!isvar_numarray(self));
+        if (V2NA(self)->kind == NA_INT)
+                return VAR_NEW_REF((Object *)&IntType);
+        return VAR_NEW_REF((Object *)&FloatType);
+}
+
+/* **********************************************************************
+ *                      Creation
+ ***********************************************************************/
+
+static Object *
+numarray_from_bytes(Object *b, int kind)
+{
+        size_t size = seqvar_size(b);
+        size_t elsize = na_elemsize(kind);
+        Object *ret;
+
+        if (size % elsize != 0) {
+                err_setstr(ValueError,
+                           "bytes length %lld is not a multiple of %d",
+                           (long long)size, (int)elsize);
+                return ErrorVar;
+        }
+        ret = numarray_alloc(kind, size / elsize);
+        memcpy(V2NA(ret)->data, bytes_get_data(b), size);
+        return ret;
+}
+
+/* @kind < 0 means figure it out from the items */
+static Object *
+numarray_from_items(Object **items, size_t n, int kind)
+{
+        Object *ret;
+        size_t i;
+
+        for (i = 0; i < n; i++) {
+                if (isvar_float(items[i])) {
+                        if (kind == NA_INT)
+                                goto badtype;
+                } else if (!isvar_int(items[i])) {
+                        goto badtype;
+                }
+        }
+        if (kind < 0) {
+                kind = NA_INT;
+                for (i = 0; i < n; i++) {
+                        if (isvar_float(items[i])) {
+                                kind = NA_FLOAT;
+                                break;
+                        }
+                }
+        }
+
+        ret = numarray_alloc(kind, n);
+        if (kind == NA_INT) {
+                long long *p = V2NA(ret)->data;
+                for (i = 0; i < n; i++)
+                        p[i] = intvar_toll(items[i]);
+        } else {
+                double *p = V2NA(ret)->data;
+                for (i = 0; i < n; i++)
+                        p[i] = realvar_tod(items[i]);
+        }
+        return ret;
+
+badtype:
+        if (isvar_float(items[i])) {
+                err_setstr(TypeError,
+                           "numarray() cannot store float in integer numarray");
+        } else {
+                err_setstr(TypeError,
+                           "numarray() item %lld is %s, not a number",
+                           (long long)i, typestr(items[i]));
+        }
+        return ErrorVar;
+}
+
+/*
+ * numarray(init, dtype)
+ *
+ * @init is a number of zeros, a bytes object holding the elements in
+ * the machine's own format, or an iterable of numbers.  @dtype is
+ * either integer or float.  If it is missing, the numarray is float unless
+ * @init is a numarray of ints or an iterable of nothing but ints.
+ */
+static Object *
+numarray_create(Frame *fr)
+{
+        Object *init = NULL, *dtype = NULL;
+        int kind = -1;
+
+        if (vm_getargs(fr, "[<*>|<*>!]:numarray", &init, &dtype)
+            == RES_ERROR) {
+                return ErrorVar;
+        }
+
+        if (dtype) {
+                if (dtype == (Object *)&IntType) {
+                        kind = NA_INT;
+                } else if (dtype == (Object *)&FloatType) {
+                        kind = NA_FLOAT;
+                } else {
+                        err_setstr(TypeError,
+                                   "numarray() dtype must be integer or float");
+                        return ErrorVar;
+                }
+        }
+
+        if (isvar_int(init)) {
+                long long n = intvar_toll(init);
+                Object *ret;
+
+                if (n < 0) {
+                        err_setstr(ValueError,
+                                   "numarray() size may not be negative");
+                        return ErrorVar;
+                }
+                if (kind < 0)
+                        kind = NA_FLOAT;
+                ret = numarray_alloc(kind, n);
+                memset(V2NA(ret)->data, 0, n * na_elemsize(kind));
+                return ret;
+        } else if (isvar_bytes(init)) {
+                return numarray_from_bytes(init, kind < 0 ? NA_FLOAT : kind);
+        } else if (isvar_numarray(init)) {
+                if (kind < 0)
+                        kind = V2NA(init)->kind;
+                if (kind == NA_INT && V2NA(init)->kind == NA_FLOAT) {
+                        err_setstr(TypeError,
+                                   "numarray() cannot convert float numarray to integer");
+                        return ErrorVar;
+                }
+                return numarray_copy(init, kind);
+        } else if (isvar_array(init)) {
+                return numarray_from_items(array_get_data(init),
+                                           seqvar_size(init), kind);
+        } else if (isvar_tuple(init)) {
+                return numarray_from_items(tuple_get_data(init),
+                                           seqvar_size(init), kind);
+        } else {
+                Object *ret, *tmp = arrayvar_new(0);
+                if (array_extend(tmp, init) == RES_ERROR) {
+                        VAR_DECR_REF(tmp);
+                        return ErrorVar;
+                }
+                ret = numarray_from_items(array_get_data(tmp),
+                                          seqvar_size(tmp), kind);
+                VAR_DECR_REF(tmp);
+                return ret;
+        }
+}
+
+/* **********************************************************************
+ *                              Iterator
+ ***********************************************************************/
+
+struct numarray_iterator_t {
+        Object base;
+        Object *target;
+        size_t i;
+};
+
+#define O2NAIT(o)       ((struct numarray_iterator_t *)(o))
+
+static Object *
+numarray_iter_next(Object *it)
+{
+        struct numarray_iterator_t *nit = O2NAIT(it);
+        if (!nit->target) {
+                return NULL;
+        } else if (nit->i < seqvar_size(nit->target)) {
+                return numarray_getitem(nit->target, nit->i++);
+        } else {
+                VAR_DECR_REF(nit->target);
+                nit->target = NULL;
+                return NULL;
+        }
+}
+
+static void
+numarray_iter_reset(Object *it)
+{
+        struct numarray_iterator_t *nit = O2NAIT(it);
+        if (nit->target)
+                VAR_DECR_REF(nit->target);
+        nit->target = NULL;
+}
+
+struct type_t NumArrayIterType = {
+        .name   = "numarray_iterator",
+        .reset  = numarray_iter_reset,
+        .size   = sizeof(struct numarray_iterator_t),
+        .iter_next = numarray_iter_next,
+};
+
+static Object *
+numarray_get_iter(Object *a)
+{
+        Object *ret = var_new(&NumArrayIterType);
+        O2NAIT(ret)->target = VAR_NEW_REF(a);
+        O2NAIT(ret)->i = 0;
+        return ret;
+}
+
+/* **********************************************************************
+ *                              CAPI
+ ***********************************************************************/
+
+/**
+ * numarrayvar_from_doubles - Create a float numarray
+ * @data:       Elements to copy into it
+ * @n:          Number of elements in @data
+ */
+Object *
+numarrayvar_from_doubles(const double *data, size_t n)
+{
+        Object *ret = numarray_alloc(NA_FLOAT, n);
+        memcpy(V2NA(ret)->data, data, n * sizeof(double));
+        return ret;
+}
+
+/**
+ * numarrayvar_from_ints - Create an int numarray
+ * @data:       Elements to copy into it
+ * @n:          Number of elements in @data
+ */
+Object *
+numarrayvar_from_ints(const long long *data, size_t n)
+{
+        Object *ret = numarray_alloc(NA_INT, n);
+        memcpy(V2NA(ret)->data, data, n * sizeof(long long));
+        return ret;
+}
+
+static const struct type_method_t numarray_cb_methods[] = {
+        {"copy",    do_numarray_copy},
+        {"dot",     do_numarray_dot},
+        {"eq",      do_numarray_eq},
+        {"ge",      do_numarray_ge},
+        {"gt",      do_numarray_gt},
+        {"le",      do_numarray_le},
+        {"lt",      do_numarray_lt},
+        {"max",     do_numarray_max},
+        {"mean",    do_numarray_mean},
+        {"min",     do_numarray_min},
+        {"ne",      do_numarray_ne},
+        {"sum",     do_numarray_sum},
+        {"tobytes", do_numarray_tobytes},
+        {"tolist",  do_numarray_tolist},
+        {NULL, NULL},
+};
+
+static const struct type_prop_t numarray_prop_getsets[] = {
+        { .name = "dtype",  .getprop = numarray_getprop_dtype,  .setprop = NULL },
+        { .name = "length", .getprop = numarray_getprop_length, .setprop = NULL },
+        { .name = NULL },
+};
+
+static const struct operator_methods_t numarray_op_methods = {
+        .add            = numarray_add,
+        .sub            = numarray_sub,
+        .mul            = numarray_mul,
+        .div            = numarray_div,
+        .negate         = numarray_negate,
+        .abs            = numarray_abs,
+};
+
+static const struct seq_methods_t numarray_seq_methods = {
+        .getitem        = numarray_getitem,
+        .setitem        = numarray_setitem,
+        .hasitem        = numarray_hasitem,
+        .getslice       = numarray_getslice,
+        .cat            = NULL, /* '+' adds element-wise */
+        .sort           = NULL,
+};
+
+static const struct buffer_methods_t numarray_buffer_methods = {
+        .getbuffer      = numarray_getbuffer,
+        .releasebuffer  = NULL,
+};
+
+struct type_t NumArrayType = {
+        .flags  = OBF_BROADCAST,
+        .name   = "numarray",
+        .opm    = &numarray_op_methods,
+        .cbm    = numarray_cb_methods,
+        .mpm    = NULL,
+        .sqm    = &numarray_seq_methods,
+        .size   = sizeof(struct numarrayvar_t),
+        .str    = numarray_str,
+        .cmp    = NULL,
+        .cmpz   = numarray_cmpz,
+        .cmpeq  = numarray_cmpeq,
+        .reset  = numarray_reset,
+        .prop_getsets = numarray_prop_getsets,
+        .create = numarray_create,
+        .hash   = NULL,
+        .get_iter = numarray_get_iter,
+        .bfm    = &numarray_buffer_methods,
+};
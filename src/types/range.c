@@ -1,5 +1,11 @@
 /*
  * range.c - Iterable data type
+ *
+ * 'for i in range(...)' doesn't create a range at all if it can help
+ * it.  The VM's RANGE_SETUP instruction calls range_counter_new() to
+ * make only the iterator, and RANGE_ITER steps it with
+ * range_counter_next(), which returns a C integer instead of a new
+ * object.
  */
 #include <evilcandy/debug.h>
 #include <evilcandy/vm.h>
@@ -10,8 +16,10 @@
 #include <evilcandy/types/array.h>
 #include <evilcandy/types/string.h>
 #include <evilcandy/types/number_types.h>
+#include <evilcandy/types/range.h>
 #include <internal/errmsg.h>
 #include <internal/types/number_types.h>
+#include <internal/types/sequential_types.h>
 #include <lib/helpers.h>
 
 struct rangevar_t {
@@ -137,21 +145,23 @@ range_getprop_length(Object *self)
         return intvar_new(RANGE_LEN(self));
 }
 
-static Object *
-range_create(Frame *fr)
+/*
+ * Get start, stop, and step from the @argc arguments at @argv, the
+ * same way as range(...) would.
+ */
+static enum result_t
+range_parse_args(Object *const *argv, int argc, long long *pstart,
+                 long long *pstop, long long *pstep)
 {
-        Object *arg, *args;
-        int argc, start, stop, step;
+        Object *arg;
+        int start, stop, step;
 
-        if (vm_getargs(fr, "<[]>{!}:range", &args) == RES_ERROR)
-                return ErrorVar;
-        argc = seqvar_size(args);
         if (argc < 1 || argc > 3) {
                 if (argc < 1)
                         err_minargs(1, argc);
                 else
                         err_maxargs(3, argc);
-                return ErrorVar;
+                return RES_ERROR;
         }
         /* defaults */
         stop = -1LL;
@@ -159,25 +169,25 @@ range_create(Frame *fr)
         step  = 1LL;
         switch (argc) {
         case 1:
-                arg = array_borrowitem(args, 0);
+                arg = argv[0];
                 if (!isvar_int(arg))
                         goto needint;
                 stop  = intvar_toi(arg);
                 break;
         case 3:
         case 2:
-                arg = array_borrowitem(args, 0);
+                arg = argv[0];
                 if (!isvar_int(arg))
                         goto needint;
                 start = intvar_toi(arg);
-                arg = array_borrowitem(args, 1);
+                arg = argv[1];
                 if (!isvar_int(arg))
                         goto needint;
                 stop = intvar_toi(arg);
                 if (argc == 2)
                         break;
                 /* case 3, fall through */
-                arg = array_borrowitem(args, 2);
+                arg = argv[2];
                 if (!isvar_int(arg))
                         goto needint;
                 step = intvar_toi(arg);
@@ -186,19 +196,46 @@ range_create(Frame *fr)
                 err_clear();
                 err_setstr(ValueError,
                            "Range values currently must fit in type 'int'");
-                return ErrorVar;
+                return RES_ERROR;
         }
-        return rangevar_new(start, stop, step);
+        if (!step) {
+                err_setstr(ValueError, "range() step may not be zero");
+                return RES_ERROR;
+        }
+        *pstart = start;
+        *pstop  = stop;
+        *pstep  = step;
+        return RES_OK;
 
 needint:
         err_argtype("integer");
-        return ErrorVar;
+        return RES_ERROR;
+}
+
+static Object *
+range_create(Frame *fr)
+{
+        Object *args;
+        long long start, stop, step;
+
+        if (vm_getargs(fr, "<[]>{!}:range", &args) == RES_ERROR)
+                return ErrorVar;
+        if (range_parse_args(array_get_data(args), seqvar_size(args),
+                             &start, &stop, &step) == RES_ERROR) {
+                return ErrorVar;
+        }
+        return rangevar_new(start, stop, step);
 }
 
+/*
+ * A range can't change, so its iterator just copies what it needs
+ * instead of keeping a reference to it.
+ */
 struct rangeiter_t {
         Object base;
-        Object *target;
         long long i;
+        long long step;
+        size_t n;       /* number of values left */
 };
 
 #define O2RIT(o)        ((struct rangeiter_t *)(o))
@@ -206,54 +243,78 @@ struct rangeiter_t {
 static Object *
 rangeiter_next(Object *it)
 {
-        struct rangeiter_t *rit = O2RIT(it);
-        struct rangevar_t *r = (struct rangevar_t *)(rit->target);
-        Object *ret;
+        long long i;
 
-        if (!r)
+        if (!range_counter_next(it, &i))
                 return NULL;
-
-        if (seqvar_size(rit->target) == 0)
-                goto nomore;
-        if (r->step < 0 && rit->i <= r->stop)
-                goto nomore;
-        else if (r->step > 0 && rit->i >= r->stop)
-                goto nomore;
-
-        ret = intvar_new(rit->i);
-        rit->i += r->step;
-        return ret;
-
-nomore:
-        VAR_DECR_REF(rit->target);
-        rit->target = NULL;
-        return NULL;
-}
-
-static void
-rangeiter_reset(Object *it)
-{
-        if (O2RIT(it)->target)
-                VAR_DECR_REF(O2RIT(it)->target);
-        O2RIT(it)->target = NULL;
+        return intvar_new(i);
 }
 
 struct type_t RangeIterType = {
         .name           = "range_iterator",
-        .reset          = rangeiter_reset,
+        .reset          = NULL,
         .size           = sizeof(struct rangeiter_t),
         .iter_next      = rangeiter_next,
 };
 
 static Object *
-range_get_iter(Object *rng)
+rangeiter_new(long long start, long long stop, long long step)
 {
         Object *ret = var_new(&RangeIterType);
-        O2RIT(ret)->target = VAR_NEW_REF(rng);
-        O2RIT(ret)->i = ((struct rangevar_t *)rng)->start;
+        O2RIT(ret)->i = start;
+        O2RIT(ret)->step = step;
+        O2RIT(ret)->n = var_slice_size(start, stop, step);
         return ret;
 }
 
+static Object *
+range_get_iter(Object *rng)
+{
+        struct rangevar_t *r = V2R(rng);
+        return rangeiter_new(r->start, r->stop, r->step);
+}
+
+/**
+ * range_counter_new - Get the iterator for range(...) without making
+ *                     the range
+ * @argv:       Arguments to range()
+ * @argc:       Number of arguments
+ *
+ * Return: A range iterator, or ErrorVar if the arguments are bad
+ */
+Object *
+range_counter_new(Object *const *argv, int argc)
+{
+        long long start, stop, step;
+
+        if (range_parse_args(argv, argc, &start, &stop, &step)
+            == RES_ERROR) {
+                return ErrorVar;
+        }
+        return rangeiter_new(start, stop, step);
+}
+
+/**
+ * range_counter_next - Step a range iterator without allocating
+ * @it:         A range iterator
+ * @val:        Filled with the next value
+ *
+ * Return: false if there are no values left, true otherwise
+ */
+bool
+range_counter_next(Object *it, long long *val)
+{
+        struct rangeiter_t *rit = O2RIT(it);
+
+        bug_on(it->v_type != &RangeIterType);
+        if (!rit->n)
+                return false;
+        *val = rit->i;
+        rit->i += rit->step;
+        rit->n--;
+        return true;
+}
+
 static const struct type_prop_t range_prop_getsets[] = {
         {
                 .name = "length",
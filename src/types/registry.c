@@ -31,21 +31,29 @@ static struct type_t *const VAR_TYPES_TBL[] = {
         &DictType,
         &StringType,
         &BytesType,
+        &BytearrayType,
         &PropertyType,
         &RangeType,
         &SetType,
         &UuidptrType,
         &IdType,
         &CellType,
+        &NumArrayType,
+        &DequeType,
+        &MemoryviewType,
 
         /* the iterators */
         &ArrayIterType,
         &BytesIterType,
+        &BytearrayIterType,
         &DictIterType,
         &TupleIterType,
         &SetIterType,
         &RangeIterType,
         &StringIterType,
+        &NumArrayIterType,
+        &DequeIterType,
+        &MemoryviewIterType,
 
         /* special extra iters */
         &DictItemsType,
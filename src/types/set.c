@@ -5,232 +5,96 @@
 #include <evilcandy/global.h>
 #include <evilcandy/errmsg.h>
 #include <evilcandy/ewrappers.h>
+#include <evilcandy/hash.h>
 #include <evilcandy/types/set.h>
+#include <internal/types/hashtable.h>
 #include <internal/types/string.h>
 
 struct setvar_t {
         struct seqvar_t base;
-        size_t s_size;          /* size of entries, a power of two */
-        size_t s_used;          /* # of active entries */
-        size_t s_count;         /* # of active + # of removed entries */
-        size_t s_growsize;      /* next threshold for expanding */
-        size_t s_shrinksize;    /* next threshold for shrinking */
-        Object **s_keys;        /* Actual entries */
+        struct htable_t s_table; /* entries' .val are unused */
 };
 
-#define BUCKET_DEAD             ((void *)-1)
-#define SET_INITIAL_SIZE        16
-#define KEY_ALLOC_SIZE(n_)      ((n_) * sizeof(Object *))
+#define V2SET(v_)       ((struct setvar_t *)(v_))
 
 /* **********************************************************************
  *                      Local helpers
  ***********************************************************************/
 
-/*
- * FIXME: A lot of these are near DRY violations with dict.c.  Make an
- * in-directory private header to inline common functionality.
- */
-
-static void
-bucket_alloc(struct setvar_t *sv, size_t size)
-{
-        sv->s_size = size;
-        sv->s_keys = emalloc(KEY_ALLOC_SIZE(size));
-        memset(sv->s_keys, 0, KEY_ALLOC_SIZE(size));
-}
-
 static Object *
 setvar_instantiate(void)
 {
         Object *ret;
-        struct setvar_t *sv;
 
         ret = var_new(&SetType);
-        sv = (struct setvar_t *)ret;
-
-        sv->s_used = sv->s_count = 0;
-        bucket_alloc(sv, SET_INITIAL_SIZE);
+        htable_init(&V2SET(ret)->s_table);
         seqvar_set_size(ret, 0);
         return ret;
 }
 
-static int
-bucketi(struct setvar_t *sv, hash_t hash)
+/* Drop references to all entries, but don't free the table */
+static void
+set_release_entries(struct setvar_t *sv)
 {
-        return hash & (sv->s_size - 1);
-}
+        struct htentry_t *e;
+        size_t idx = 0;
 
-static bool
-key_match(Object *key1, Object *key2, hash_t key2_hash)
-{
-        /* XXX: DRY violation with 'key_match' in dict.c */
-        if (isvar_string(key1)) {
-                if (isvar_string(key2)) {
-                        if (var_hash(key1) != key2_hash)
-                                return false;
-                        return string_eq(key1, key2);
-                }
-                return false;
+        while ((e = htable_next(&sv->s_table, &idx)) != NULL) {
+                VAR_DECR_REF(e->key);
+                e->key = NULL;
         }
-        return var_matches(key1, key2);
-}
-
-static int
-seek_helper(struct setvar_t *sv, Object *key)
-{
-        Object *k;
-        hash_t hash;
-        unsigned long perturb;
-        int i;
-
-        /* XXX: why not store hash *with* key? */
-        hash = var_hash(key);
-        if (hash == RES_ERROR)
-                return -1;
-
-        perturb = hash;
-        i = bucketi(sv, hash);
-        while ((k = sv->s_keys[i]) != NULL) {
-                if (k != BUCKET_DEAD && key_match(k, key, hash))
-                        break;
-                /*
-                 * Collision or dead entry.  See dict.c for big long
-                 * explanation what I'm doing here.  It's the same thing.
-                 */
-                perturb >>= 5;
-                i = bucketi(sv, i * 5 + perturb + 1);
-        }
-        bug_on(i < 0 || i >= sv->s_size);
-        return i;
 }
 
+/* set_additem(), but @child's hash is already known */
 static void
-transfer_table(struct setvar_t *sv, size_t old_size)
+set_additem_hashed(Object *set, Object *child,
+                   hash_t hash, Object **unique)
 {
-        ssize_t i, j, n;
-        Object **old_keys = sv->s_keys;
-
-        bucket_alloc(sv, sv->s_size);
-
-        n = 0;
-        for (i = 0; i < old_size; i++) {
-                unsigned long perturb;
-                Object *k;
-                hash_t hash;
-
-                k = old_keys[i];
-                if (k == NULL || k == BUCKET_DEAD)
-                        continue;
-
-                hash = var_hash(k);
-                perturb = hash;
-                j = bucketi(sv, hash);
-                while (sv->s_keys[j] != NULL) {
-                        perturb >>= 5;
-                        j = bucketi(sv, j * 5 + perturb + 1);
+        struct setvar_t *sv = V2SET(set);
+        struct htentry_t *e;
+        bool found;
+
+        e = htable_insert(&sv->s_table, child, hash, &found);
+        if (found) {
+                if (unique) {
+                        VAR_DECR_REF(child);
+                        *unique = VAR_NEW_REF(e->key);
                 }
-                sv->s_keys[j] = k;
-                n++;
+        } else {
+                VAR_INCR_REF(child);
+                if (unique)
+                        *unique = child;
+                seqvar_set_size(set, sv->s_table.used);
         }
-        sv->s_count = sv->s_used = n;
-        seqvar_set_size((Object *)sv, n);
-
-        efree(old_keys);
-}
-
-static void
-refresh_grow_markers(struct setvar_t *sv)
-{
-        sv->s_growsize = (sv->s_size << 1) / 3;
-        sv->s_shrinksize = sv->s_used <= SET_INITIAL_SIZE
-                        ? 0 : sv->s_growsize / 3;
 }
 
-static void
-maybe_grow_table(struct setvar_t *sv)
+static bool
+set_hasitem_hashed(Object *set, Object *item, hash_t hash)
 {
-        size_t old_size = sv->s_size;
-        while (sv->s_count > sv->s_growsize) {
-                sv->s_size *= 2;
-                refresh_grow_markers(sv);
-        }
-        if (sv->s_size != old_size)
-                transfer_table(sv, old_size);
-        seqvar_set_size((Object *)sv, sv->s_used);
+        return htable_lookup(&V2SET(set)->s_table, item, hash) != NULL;
 }
 
+/* Add all of @from's items to @to */
 static void
-maybe_shrink_table(struct setvar_t *sv)
+set_update(Object *to, Object *from)
 {
-        size_t old_size = sv->s_size;
-        while (sv->s_used < sv->s_shrinksize) {
-                sv->s_size /= 2;
-                refresh_grow_markers(sv);
-        }
-        if (sv->s_size < SET_INITIAL_SIZE)
-                sv->s_size = SET_INITIAL_SIZE;
+        struct htable_t *ht = &V2SET(from)->s_table;
+        struct htentry_t *e;
+        size_t idx = 0;
 
-        if (sv->s_size != old_size)
-                transfer_table(sv, old_size);
-        seqvar_set_size((Object *)sv, sv->s_used);
-}
-
-static void
-set_clear_noresize(struct setvar_t *sv)
-{
-        size_t i;
-        for (i = 0; i < sv->s_size; i++) {
-                Object *k = sv->s_keys[i];
-                if (k == BUCKET_DEAD) {
-                        sv->s_keys[i] = NULL;
-                } else if (k != NULL) {
-                        VAR_DECR_REF(k);
-                        sv->s_keys[i] = NULL;
-                }
-        }
-        sv->s_count = sv->s_used = 0;
-        seqvar_set_size((Object *)sv, sv->s_used);
+        htable_reserve(&V2SET(to)->s_table, ht->used);
+        while ((e = htable_next(ht, &idx)) != NULL)
+                set_additem_hashed(to, e->key, e->hash, NULL);
 }
 
 static Object *
 set_shallowcopy(Object *set)
 {
-        struct setvar_t *sv = (struct setvar_t *)set;
-        size_t i, n = sv->s_size;
         Object *new = setvar_instantiate();
-        for (i = 0; i < n; i++) {
-                enum result_t res;
-                Object *k = sv->s_keys[i];
-                if (!k || k == BUCKET_DEAD)
-                        continue;
-                res = set_additem(new, k, NULL);
-                bug_on(res == RES_ERROR);
-                (void)res;
-        }
+        set_update(new, set);
         return new;
 }
 
-/* Discard @child from @set, no error if @child was not in @set */
-static void
-set_discard(Object *set, Object *child)
-{
-        struct setvar_t *sv = (struct setvar_t *)set;
-        int i;
-
-        i = seek_helper(sv, child);
-        /* XXX: Exception if child is not hashable? */
-        if (i < 0)
-                return;
-
-        if (sv->s_keys[i] == NULL)
-                return;
-
-        VAR_DECR_REF(sv->s_keys[i]);
-        sv->s_keys[i] = BUCKET_DEAD;
-        sv->s_used--;
-        maybe_shrink_table(sv);
-}
-
 /* **********************************************************************
  *                      Type callbacks
  ***********************************************************************/
@@ -244,16 +108,14 @@ do_set_hasitem(Object *set, Object *item)
 static Object *
 set_sub_op(Object *a, Object *b)
 {
-        struct setvar_t *sv = (struct setvar_t *)b;
-        size_t i, n = sv->s_size;
-        /* XXX: very non-optimal */
-        Object *new = set_shallowcopy(a);
+        struct htentry_t *e;
+        size_t idx = 0;
+        Object *new = setvar_instantiate();
 
-        for (i = 0; i < n; i++) {
-                Object *k = sv->s_keys[i];
-                if (!k || k == BUCKET_DEAD)
-                        continue;
-                set_discard(new, k);
+        htable_reserve(&V2SET(new)->s_table, seqvar_size(a));
+        while ((e = htable_next(&V2SET(a)->s_table, &idx)) != NULL) {
+                if (!set_hasitem_hashed(b, e->key, e->hash))
+                        set_additem_hashed(new, e->key, e->hash, NULL);
         }
         return new;
 }
@@ -261,20 +123,13 @@ set_sub_op(Object *a, Object *b)
 static Object *
 set_intersection_op(Object *a, Object *b)
 {
-        struct setvar_t *sv = (struct setvar_t *)a;
-        size_t i, n = sv->s_size;
+        struct htentry_t *e;
+        size_t idx = 0;
         Object *new = setvar_instantiate();
 
-        for (i = 0; i < n; i++) {
-                enum result_t res;
-                Object *k = sv->s_keys[i];
-                if (!k || k == BUCKET_DEAD)
-                        continue;
-                if (!set_hasitem(b, k))
-                        continue;
-                res = set_additem(new, k, NULL);
-                bug_on(res == RES_ERROR);
-                (void)res;
+        while ((e = htable_next(&V2SET(a)->s_table, &idx)) != NULL) {
+                if (set_hasitem_hashed(b, e->key, e->hash))
+                        set_additem_hashed(new, e->key, e->hash, NULL);
         }
         return new;
 }
@@ -282,25 +137,8 @@ set_intersection_op(Object *a, Object *b)
 static Object *
 set_union_op(Object *a, Object *b)
 {
-        struct setvar_t *sv[2];
-        Object *new;
-        size_t i, j;
-
-        new = setvar_instantiate();
-        sv[0] = (struct setvar_t *)a;
-        sv[1] = (struct setvar_t *)b;
-
-        for (i = 0; i < 2; i++) {
-                for (j = 0; j < sv[i]->s_size; j++) {
-                        enum result_t res;
-                        Object *k = sv[i]->s_keys[j];
-                        if (!k || k == BUCKET_DEAD)
-                                continue;
-                        res = set_additem(new, k, NULL);
-                        bug_on(res == RES_ERROR);
-                        (void)res;
-                }
-        }
+        Object *new = set_shallowcopy(a);
+        set_update(new, b);
         return new;
 }
 
@@ -308,18 +146,12 @@ set_union_op(Object *a, Object *b)
 static void
 set_exclusive_from_one(Object *output, Object *this_set, Object *other_set)
 {
-        struct setvar_t *sv = (struct setvar_t *)this_set;
-        size_t i;
-        for (i = 0; i < sv->s_size; i++) {
-                enum result_t res;
-                Object *k = sv->s_keys[i];
-                if (!k || k == BUCKET_DEAD)
-                        continue;
-                if (set_hasitem(other_set, k))
-                        continue;
-                res = set_additem(output, k, NULL);
-                bug_on(res == RES_ERROR);
-                (void)res;
+        struct htentry_t *e;
+        size_t idx = 0;
+
+        while ((e = htable_next(&V2SET(this_set)->s_table, &idx)) != NULL) {
+                if (!set_hasitem_hashed(other_set, e->key, e->hash))
+                        set_additem_hashed(output, e->key, e->hash, NULL);
         }
 }
 
@@ -335,23 +167,20 @@ set_exclusive_op(Object *a, Object *b)
 static Object *
 set_str(Object *set)
 {
-        struct setvar_t *sv = (struct setvar_t *)set;
         struct string_writer_t wr;
-        size_t i, count = 0, n = sv->s_size;
+        struct htentry_t *e;
+        size_t idx = 0, count = 0;
 
         if (seqvar_size(set) == 0)
                 return VAR_NEW_REF(STRCONST_ID(emptyset));
 
         string_writer_init(&wr, 1);
         string_writer_appends(&wr, "{");
-        for (i = 0; i < n; i++) {
+        while ((e = htable_next(&V2SET(set)->s_table, &idx)) != NULL) {
                 Object *repr;
-                Object *k = sv->s_keys[i];
-                if (!k || k == BUCKET_DEAD)
-                        continue;
                 if (count > 0)
                         string_writer_appends(&wr, ", ");
-                repr = var_str(k);
+                repr = var_str(e->key);
                 string_writer_append_strobj(&wr, repr);
                 VAR_DECR_REF(repr);
                 count++;
@@ -363,19 +192,15 @@ set_str(Object *set)
 static bool
 set_cmpeq(Object *a, Object *b)
 {
-        struct setvar_t *sv;
-        size_t i;
+        struct htentry_t *e;
+        size_t idx = 0;
 
         if (seqvar_size(a) != seqvar_size(b))
-                return (int)(seqvar_size(a) - seqvar_size(b));
+                return false;
 
         /* Sizes are equal, so if a is a subset of b then a == b */
-        sv = (struct setvar_t *)a;
-        for (i = 0; i < sv->s_size; i++) {
-                Object *k = sv->s_keys[i];
-                if (!k || k == BUCKET_DEAD)
-                        continue;
-                if (!set_hasitem(b, k))
+        while ((e = htable_next(&V2SET(a)->s_table, &idx)) != NULL) {
+                if (!set_hasitem_hashed(b, e->key, e->hash))
                         return false;
         }
         return true;
@@ -384,8 +209,8 @@ set_cmpeq(Object *a, Object *b)
 static void
 set_reset(Object *set)
 {
-        set_clear_noresize((struct setvar_t *)set);
-        efree(((struct setvar_t *)set)->s_keys);
+        set_release_entries(V2SET(set));
+        htable_free(&V2SET(set)->s_table);
 }
 
 static Object *
@@ -407,18 +232,15 @@ static Object *
 set_iter_next(Object *it)
 {
         struct setiter_t *sit = (struct setiter_t *)it;
-        struct setvar_t *sv = (struct setvar_t *)(sit->target);
-        size_t i = sit->i;
+        struct setvar_t *sv = V2SET(sit->target);
+        struct htentry_t *e;
+
         if (!sv)
                 return NULL;
 
-        for (; i < sv->s_size; i++) {
-                Object *k = sv->s_keys[i];
-                if (!k || k == BUCKET_DEAD)
-                        continue;
-                sit->i = i + 1;
-                return VAR_NEW_REF(k);
-        }
+        e = htable_next(&sv->s_table, &sit->i);
+        if (e)
+                return VAR_NEW_REF(e->key);
 
         VAR_DECR_REF(sit->target);
         sit->target = NULL;
@@ -519,29 +341,12 @@ struct type_t SetType = {
 enum result_t
 set_additem(Object *set, Object *child, Object **unique)
 {
-        struct setvar_t *sv = (struct setvar_t *)set;
-        int i;
-
-        i = seek_helper(sv, child);
-        if (i < 0) {
+        hash_t hash = var_hash(child);
+        if (hash == HASH_ERROR) {
                 err_hashable(child, NULL);
                 return RES_ERROR;
         }
-
-        if (sv->s_keys[i] != NULL) {
-                if (unique) {
-                        VAR_DECR_REF(child);
-                        *unique = VAR_NEW_REF(sv->s_keys[i]);
-                }
-        } else {
-                sv->s_keys[i] = VAR_NEW_REF(child);
-                if (unique)
-                        *unique = child;
-
-                sv->s_count++;
-                sv->s_used++;
-                maybe_grow_table(sv);
-        }
+        set_additem_hashed(set, child, hash, unique);
         return RES_OK;
 }
 
@@ -610,12 +415,14 @@ setvar_new(Object *seq)
 bool
 set_hasitem(Object *set, Object *item)
 {
-        int i;
+        hash_t hash;
         if (!item)
                 return 0;
         bug_on(!isvar_set(set));
-        i = seek_helper((struct setvar_t *)set, item);
-        return i >= 0 && ((struct setvar_t *)set)->s_keys[i] != NULL;
+        hash = var_hash(item);
+        if (hash == HASH_ERROR)
+                return 0;
+        return set_hasitem_hashed(set, item, hash);
 }
 
 
@@ -0,0 +1,185 @@
+/*
+ * shape.c - Shared key layouts for instance attributes
+ *
+ * Instances of a class nearly always get the same attributes in the
+ * same order, because their __init__ method sets them.  So instead of
+ * giving every instance its own dictionary, the attribute names live in
+ * a "shape" shared by all the instances which were given the same names
+ * in the same order, and each instance only has an array of values.
+ * (This is what V8 calls "hidden classes" and CPython calls "split-key
+ * dictionaries".)
+ *
+ * Each class has a tree of shapes.  Its root has no keys, and the
+ * children of a shape are the shapes reached by adding one more key to
+ * it.  An instance starts at the root and walks down the tree as it
+ * gets new attributes.
+ *
+ * Shapes never lose keys.  If an attribute is deleted, or if the tree
+ * grows past the limits below (which happens if a program uses
+ * instances as dictionaries with arbitrary keys), the instance gives
+ * up its shape and switches to a real dictionary.  See class.c
+ *
+ * A class with __slots__ has only one shape, a root which holds every
+ * slot from the start.  Its instances never leave it.
+ */
+#include <evilcandy/debug.h>
+#include <evilcandy/ewrappers.h>
+#include <evilcandy/var.h>
+#include <internal/type_registry.h>
+#include <internal/types/shape.h>
+#include <internal/types/string.h>
+
+enum {
+        /* Most keys in one shape */
+        SHAPE_MAX_KEYS          = 32,
+        /* Most transitions out of one shape */
+        SHAPE_MAX_CHILDREN      = 8,
+        /* Most shapes for one class */
+        SHAPE_MAX_SHAPES        = 256,
+};
+
+static struct shape_t *
+shape_alloc(struct shape_t *parent)
+{
+        struct shape_t *sh = emalloc(sizeof(*sh));
+
+        htable_init(&sh->keys);
+        sh->parent = parent;
+        sh->root = parent ? parent->root : sh;
+        sh->children = NULL;
+        sh->sibling = NULL;
+        sh->n_children = 0;
+        sh->n_shapes = 1;
+        sh->hint = 0;
+        return sh;
+}
+
+/* True if @sh was reached by adding @key to its parent */
+static bool
+shape_last_key_is(struct shape_t *sh, Object *key, hash_t hash)
+{
+        struct htentry_t *e = &sh->keys.entries[shape_size(sh) - 1];
+
+        if (e->hash != hash)
+                return false;
+        if (e->key == key)
+                return true;
+        if (isvar_string(e->key) && isvar_string(key))
+                return string_eq(e->key, key);
+        return var_matches(e->key, key);
+}
+
+/**
+ * shape_new_root - Get a new root shape, one with no keys
+ */
+struct shape_t *
+shape_new_root(void)
+{
+        return shape_alloc(NULL);
+}
+
+/**
+ * shape_free - Free a tree of shapes
+ * @root:       Root of the tree.
+ *
+ * Only call this when the class which owns the tree is being
+ * destroyed, since every instance of the class points into it.
+ */
+void
+shape_free(struct shape_t *root)
+{
+        struct shape_t *child, *next;
+        struct htentry_t *e;
+        size_t i = 0;
+
+        for (child = root->children; child != NULL; child = next) {
+                next = child->sibling;
+                shape_free(child);
+        }
+
+        while ((e = htable_next(&root->keys, &i)) != NULL) {
+                VAR_DECR_REF(e->key);
+                if (e->val)
+                        VAR_DECR_REF(e->val);
+        }
+        htable_free(&root->keys);
+        efree(root);
+}
+
+/**
+ * shape_add - Get the shape that results from adding a key to a shape
+ * @sh:         Current shape.  It must not already have @key.
+ * @key:        Name of the new attribute
+ * @hash:       Result of var_hash(@key)
+ *
+ * Return: The new shape, or NULL if it would grow @sh's tree past its
+ * limits.  In the latter case, the caller should switch to a
+ * dictionary.
+ */
+struct shape_t *
+shape_add(struct shape_t *sh, Object *key, hash_t hash)
+{
+        struct shape_t *child, *root;
+        struct htentry_t *e;
+        size_t i, n;
+        bool found;
+
+        for (child = sh->children; child != NULL; child = child->sibling) {
+                if (shape_last_key_is(child, key, hash))
+                        return child;
+        }
+
+        root = sh->root;
+        n = shape_size(sh);
+        if (n >= SHAPE_MAX_KEYS ||
+            sh->n_children >= SHAPE_MAX_CHILDREN ||
+            root->n_shapes >= SHAPE_MAX_SHAPES) {
+                return NULL;
+        }
+
+        child = shape_alloc(sh);
+        htable_reserve(&child->keys, n + 1);
+        for (i = 0; i < n; i++) {
+                struct htentry_t *old = &sh->keys.entries[i];
+                e = htable_insert(&child->keys, old->key, old->hash, &found);
+                bug_on(found);
+                e->key = VAR_NEW_REF(old->key);
+                bug_on(old->val != NULL);
+        }
+        e = htable_insert(&child->keys, key, hash, &found);
+        bug_on(found);
+        e->key = VAR_NEW_REF(key);
+
+        child->sibling = sh->children;
+        sh->children = child;
+        sh->n_children++;
+        root->n_shapes++;
+        if (root->hint < n + 1)
+                root->hint = n + 1;
+        return child;
+}
+
+/**
+ * shape_add_slot - Add a slot to the shape of a class with __slots__
+ * @root:       The class's root shape, which is its only shape.
+ * @key:        Name of the slot
+ * @hash:       Result of var_hash(@key)
+ * @init:       Value each new instance starts with in this slot
+ *
+ * Return: false if @root already has @key, true otherwise.
+ */
+bool
+shape_add_slot(struct shape_t *root, Object *key, hash_t hash, Object *init)
+{
+        struct htentry_t *e;
+        bool found;
+
+        bug_on(root->parent != NULL || root->children != NULL);
+        e = htable_insert(&root->keys, key, hash, &found);
+        if (found)
+                return false;
+        e->key = VAR_NEW_REF(key);
+        e->val = VAR_NEW_REF(init);
+        root->hint = shape_size(root);
+        return true;
+}
@@ -114,55 +114,76 @@ string_getidx(Object *str, size_t idx)
         return string_getidx_raw(string_width(str), string_data(str), idx);
 }
 
+/*
+ * Helpers to find_max_width.  OR-ing the points together tells us
+ * exactly whether any point crosses the 0xff or 0xffff boundaries, and
+ * unlike a running max, it is a reduction the compiler can vectorize.
+ * Go in blocks, so we can quit early if a string's widest character is
+ * near its start.
+ */
+enum { MAXWIDTH_BLOCK = 64 };
+
 static size_t
-maxchr_to_width(unsigned long maxchr)
+find_max_width_16(const uint16_t *u16, size_t len)
 {
-        if (maxchr > 0xffff)
-                return 4;
-        if (maxchr > 0xff)
-                return 2;
+        size_t i, j;
+        unsigned int acc = 0;
+
+        for (i = 0; i < len; i += MAXWIDTH_BLOCK) {
+                size_t stop = len - i < MAXWIDTH_BLOCK
+                              ? len : i + MAXWIDTH_BLOCK;
+                for (j = i; j < stop; j++)
+                        acc |= u16[j];
+                if ((acc & 0xff00u) != 0)
+                        return 2;
+        }
         return 1;
 }
 
-/* used to determine if a buffer needs to be down-sized */
 static size_t
-find_max_width(size_t width, const void *unicode,
-               size_t starti, size_t stopi)
+find_max_width_32(const uint32_t *u32, size_t len)
 {
-        size_t i;
-        long maxchr = 0;
-        long thresh;
+        size_t i, j;
+        unsigned long acc = 0;
+
+        for (i = 0; i < len; i += MAXWIDTH_BLOCK) {
+                size_t stop = len - i < MAXWIDTH_BLOCK
+                              ? len : i + MAXWIDTH_BLOCK;
+                for (j = i; j < stop; j++)
+                        acc |= u32[j];
+                if ((acc & 0xffff0000ul) != 0)
+                        return 4;
+        }
+        return (acc & 0xff00ul) != 0 ? 2 : 1;
+}
 
+/*
+ * used to determine if a buffer needs to be down-sized
+ * @unicode is the start of the sub-array, @len its length.
+ */
+static size_t
+find_max_width(size_t width, const void *unicode, size_t len)
+{
         switch (width) {
         case 1:
                 return 1; /* can't downsize */
         case 2:
-                thresh = 0xff;
-                break;
+                return find_max_width_16(unicode, len);
         case 4:
-                thresh = 0xffff;
-                break;
+                return find_max_width_32(unicode, len);
         default:
-                thresh = 0;
                 bug();
+                return width;
         }
-
-        if (width == 1)
-                return 1;
-
-        for (i = starti; i < stopi; i++) {
-                long v = string_getidx_raw(width, unicode, i);
-                if (v > thresh)
-                        return width;
-                if (v > maxchr)
-                        maxchr = v;
-        }
-        return maxchr_to_width(maxchr);
 }
 
-/* ONLY CALL THIS IF YOU ALREADY CONFIRMED THAT @p IS ALL ASCII */
+/*
+ * Make an ASCII string of length @len whose contents the caller will
+ * fill in, through V2STR(ret)->s, before anyone else can see it.
+ * The nulchar terminator is already set.
+ */
 static Object *
-stringvar_from_ascii_(void *p, size_t len)
+stringvar_ascii_alloc_(size_t len)
 {
         Object *ret = var_new(&StringType);
         struct stringvar_t *vs = V2STR(ret);
@@ -171,8 +192,6 @@ stringvar_from_ascii_(void *p, size_t len)
         vs->s_ascii_len = len;
 
         vs->s = emalloc(len + 1);
-        if (len)
-                memcpy(vs->s, p, len);
         vs->s[len] = '\0';
 
         vs->s_hash      = 0;
@@ -182,6 +201,16 @@ stringvar_from_ascii_(void *p, size_t len)
         return ret;
 }
 
+/* ONLY CALL THIS IF YOU ALREADY CONFIRMED THAT @p IS ALL ASCII */
+static Object *
+stringvar_from_ascii_(const void *p, size_t len)
+{
+        Object *ret = stringvar_ascii_alloc_(len);
+        if (len)
+                memcpy(V2STR(ret)->s, p, len);
+        return ret;
+}
+
 /*
  * @enclen and @ascii may be NULL if these results are not needed.
  *
@@ -190,42 +219,90 @@ stringvar_from_ascii_(void *p, size_t len)
  *              is because the result could store embedded nulchars.
  * @isascii:    Will store 'true' if @points are all ascii.
  */
+/*
+ * Size of @points once encoded, so the result can be allocated exactly
+ * once.  The loops have no branches, so the compiler can vectorize them.
+ */
+static size_t
+utf8_encoded_size(const void *points, size_t width, size_t len)
+{
+        size_t i, nbytes = len;
+
+        switch (width) {
+        case 1: {
+                const uint8_t *u8 = points;
+                for (i = 0; i < len; i++)
+                        nbytes += u8[i] > 0x7fu;
+                break;
+        }
+        case 2: {
+                const uint16_t *u16 = points;
+                for (i = 0; i < len; i++)
+                        nbytes += (u16[i] > 0x7fu) + (u16[i] > 0x7ffu);
+                break;
+        }
+        default: {
+                const uint32_t *u32 = points;
+                bug_on(width != 4);
+                for (i = 0; i < len; i++) {
+                        nbytes += (u32[i] > 0x7fu) + (u32[i] > 0x7ffu)
+                                  + (u32[i] > 0xfffful);
+                }
+                break;
+        }
+        }
+        return nbytes;
+}
+
 static char *
 string_encode_points_utf8(void *points, size_t width, size_t len,
                           size_t *enclen, int *isascii)
 {
-        size_t i;
-        struct buffer_t buf;
-        int ascii = 1;
+        size_t i, nbytes;
+        unsigned char *ret, *dst;
+
+        nbytes = utf8_encoded_size(points, width, len);
+
+        ret = emalloc(nbytes + 1);
+        ret[nbytes] = '\0';
+        if (enclen)
+                *enclen = nbytes;
+        if (isascii)
+                *isascii = nbytes == len;
+
+        if (nbytes == len) {
+                /* all ASCII */
+                if (width == 1) {
+                        if (len)
+                                memcpy(ret, points, len);
+                } else {
+                        for (i = 0; i < len; i++)
+                                ret[i] = string_getidx_raw(width, points, i);
+                }
+                return (char *)ret;
+        }
 
-        buffer_init(&buf);
+        dst = ret;
         for (i = 0; i < len; i++) {
                 long point = string_getidx_raw(width, points, i);
                 if (point < 128) {
-                        buffer_putc_strict(&buf, point);
-                        continue;
-                }
-                ascii = 0;
-                if (point < 0x7ff) {
-                        buffer_putc(&buf, 0xc0 | (point >> 6));
-                        buffer_putc(&buf, 0x80 | (point & 0x3f));
-                } else if (point < 0xffff) {
-                        buffer_putc(&buf, 0xe0 | (point >> 12));
-                        buffer_putc(&buf, 0x80 | ((point >> 6) & 0x3f));
-                        buffer_putc(&buf, 0x80 | (point & 0x3f));
+                        *dst++ = point;
+                } else if (point <= 0x7ff) {
+                        *dst++ = 0xc0 | (point >> 6);
+                        *dst++ = 0x80 | (point & 0x3f);
+                } else if (point <= 0xffff) {
+                        *dst++ = 0xe0 | (point >> 12);
+                        *dst++ = 0x80 | ((point >> 6) & 0x3f);
+                        *dst++ = 0x80 | (point & 0x3f);
                 } else {
-                        buffer_putc(&buf, 0xf0 | (point >> 18));
-                        buffer_putc(&buf, 0x80 | ((point >> 12) & 0x3f));
-                        buffer_putc(&buf, 0x80 | ((point >> 6) & 0x3f));
-                        buffer_putc(&buf, 0x80 | (point & 0x3f));
+                        *dst++ = 0xf0 | (point >> 18);
+                        *dst++ = 0x80 | ((point >> 12) & 0x3f);
+                        *dst++ = 0x80 | ((point >> 6) & 0x3f);
+                        *dst++ = 0x80 | (point & 0x3f);
                 }
         }
-
-        if (enclen)
-                *enclen = buffer_size(&buf);
-        if (isascii)
-                *isascii = ascii;
-        return buffer_trim(&buf);
+        bug_on(dst != ret + nbytes);
+        return (char *)ret;
 }
 
 static Object *
@@ -273,6 +350,43 @@ stringvar_from_points(void *points, size_t width,
         return ret;
 }
 
+/*
+ * Create a string from UTF-8 text that has already been through
+ * utf8_scan().  Since the encoding is known to be valid (and not
+ * overlong), @data itself can become the new string's C string, and
+ * the Unicode array can be sized and written in one pass.
+ */
+static Object *
+stringvar_from_valid_utf8(const void *data, size_t n,
+                          size_t npoints, unsigned long maxchr)
+{
+        struct string_writer_t wr;
+        struct stringvar_t *vs;
+        size_t width, len;
+        Object *ret;
+
+        if (!maxchr)
+                return stringvar_from_ascii_((void *)data, n);
+
+        string_writer_init(&wr, maxchr > 0xfffful ? 4
+                                : (maxchr > 0xfful ? 2 : 1));
+        string_writer_append_utf8(&wr, data, n, npoints, maxchr);
+
+        ret = var_new(&StringType);
+        vs = V2STR(ret);
+        vs->s_unicode   = string_writer_finish(&wr, &width, &len);
+        vs->s_width     = width;
+        vs->s_ascii_len = n;
+        vs->s           = emalloc(n + 1);
+        memcpy(vs->s, data, n);
+        vs->s[n]        = '\0';
+        vs->s_hash      = 0;
+        vs->s_ascii     = 0;
+        seqvar_set_size(ret, len);
+        bug_on(len != npoints);
+        return ret;
+}
+
 /* There used to be flags, hence the `f', but they went obsolete */
 static Object *
 stringvar_newf(char *cstr, size_t size)
@@ -533,7 +647,7 @@ match_here_anywidth(Object *haystack, Object *needle, size_t idx)
 #undef TYPE
 
 #define STRING_HELPER(name_) name_##_32
-#define TYPE uint16_t
+#define TYPE uint32_t
 #include "string_include.c.h"
 #undef STRING_HELPER
 #undef TYPE
@@ -1078,7 +1192,7 @@ parse_fmt_args(Object *fmt, struct fmt_args_t *args, size_t pos, int endchr)
         if (point < 128 && strchr("xXdufeEsgG", point)) {
                 args->conv = point;
                 if (endchr) {
-                        if (point == n)
+                        if (pos == n)
                                 return -1;
                         point = string_getidx(fmt, pos++);
                         if (point != endchr)
@@ -1154,89 +1268,413 @@ format2_output(struct string_writer_t *wr,
         }
 }
 
-static ssize_t
-format2_helper(Object *arg, struct string_writer_t *wr,
-               Object *self, size_t self_i)
-{
+/* **********************************************************************
+ *                      Compiled format strings
+ ***********************************************************************/
+
+/*
+ * Parsing a template costs about as much as formatting it, and the same
+ * few templates (f-strings especially) get formatted over and over.  So
+ * the first time a string is used as a template, it is compiled into an
+ * array of fmt_item_t's--literal runs and conversions--and that array
+ * is cached on the string itself.  Strings are immutable, so the cache
+ * never goes stale.
+ */
+enum fmt_style_t {
+        FMT_STYLE_BRACE = 1,    /* string_format(), f-strings */
+        FMT_STYLE_PERCENT,      /* string_printf(), str % x */
+        FMT_STYLE_VALUE,        /* string_format_value() */
+};
+
+enum fmt_item_kind_t {
+        FMTI_LITERAL,   /* copy template[.start : .start + .len] */
+        FMTI_ARG,       /* next positional arg, or arg number .argi */
+        FMTI_KEY,       /* '%(.key)' */
+};
+
+/*
+ * For FMTI_ARG and FMTI_KEY in '%'-style templates, .start and .len
+ * are the raw text after the '%' (for FMTI_KEY, after the "%("), which
+ * is written as-is if the wrong kind of argument was passed.
+ */
+struct fmt_item_t {
+        enum fmt_item_kind_t kind;
+        size_t start;
+        size_t len;
+        ssize_t argi;
+        Object *key;
+        bool bad;       /* '%' conversion which failed to parse */
         struct fmt_args_t fa;
-        ssize_t newpos = parse_fmt_args(self, &fa, self_i, '\0');
+};
 
-        /* incr by one on error, else caller will loop forever */
-        if (newpos < 0)
-                return self_i + 1;
+struct fmt_spec_t {
+        enum fmt_style_t style;
+        bool malformed;
+        size_t n_items;
+        size_t n_alloc;
+        struct fmt_item_t *items;
+};
 
-        format2_output(wr, arg, &fa);
-        return newpos;
+static void
+fmt_spec_free(struct fmt_spec_t *spec)
+{
+        size_t i;
+        for (i = 0; i < spec->n_items; i++) {
+                if (spec->items[i].key)
+                        VAR_DECR_REF(spec->items[i].key);
+        }
+        if (spec->items)
+                efree(spec->items);
+        efree(spec);
 }
 
-/* Common to string_format2 and string_modulo */
-static Object *
-string_printf(Object *self, Object *args, Object *kwargs)
+static struct fmt_item_t *
+fmt_spec_add(struct fmt_spec_t *spec, enum fmt_item_kind_t kind,
+             size_t start, size_t len)
 {
-        struct string_writer_t wr;
-        size_t i, n, argi;
+        struct fmt_item_t *item;
 
-        n = seqvar_size(self);
-        if (n == 0)
-                return VAR_NEW_REF(self);
+        if (spec->n_items == spec->n_alloc) {
+                spec->n_alloc = spec->n_alloc ? spec->n_alloc * 2 : 8;
+                spec->items = erealloc(spec->items,
+                                spec->n_alloc * sizeof(*spec->items));
+        }
+        item = &spec->items[spec->n_items++];
+        memset(item, 0, sizeof(*item));
+        item->kind = kind;
+        item->start = start;
+        item->len = len;
+        item->argi = -1;
+        default_fmt_args(&item->fa);
+        return item;
+}
 
-        argi = 0;
-        i = 0;
-        string_writer_init(&wr, string_width(self));
+/* add template[start:stop] as a literal run, if it isn't empty */
+static void
+fmt_spec_literal(struct fmt_spec_t *spec, size_t start, size_t stop)
+{
+        if (stop > start)
+                fmt_spec_add(spec, FMTI_LITERAL, start, stop - start);
+}
+
+/*
+ * parse_fmt_args() wrapper for compile time.  A number too big for
+ * str_finish_digit() is just a malformed template here; don't leave
+ * its exception lying around.
+ */
+static ssize_t
+fmt_parse_args(Object *str, struct fmt_args_t *fa, size_t pos, int endchr)
+{
+        ssize_t newpos = parse_fmt_args(str, fa, pos, endchr);
+        if (newpos < 0 && err_occurred())
+                err_clear();
+        return newpos;
+}
+
+/* Compile a template for string_format() */
+static void
+fmt_compile_brace(struct fmt_spec_t *spec, Object *str)
+{
+        size_t i, n, litstart;
+
+        n = seqvar_size(str);
+        i = litstart = 0;
         while (i < n) {
-                unsigned long point = string_getidx(self, i++);
-                if (point == '%') {
-                        Object *arg;
+                long point = string_getidx(str, i++);
+                if (point == '{' && i < n) {
+                        struct fmt_item_t *item;
 
-                        if (i >= n)
-                                break;
-                        point = string_getidx(self, i++);
-                        if (point == '%') {
-                                string_writer_append(&wr, '%');
+                        point = string_getidx(str, i++);
+                        if (point == '{') {
+                                /* keep the first brace, skip the second */
+                                fmt_spec_literal(spec, litstart, i - 1);
+                                litstart = i;
                                 continue;
                         }
 
-                        if (point == '(') {
-                                size_t start, stop;
-                                Object *key;
-
-                                if (!kwargs)
-                                        continue;
+                        fmt_spec_literal(spec, litstart, i - 2);
+                        item = fmt_spec_add(spec, FMTI_ARG, 0, 0);
+                        if (point == ':') {
+                                ssize_t newpos;
 
-                                start = i++;
-                                while (i < n) {
-                                        point = string_getidx(self, i++);
-                                        bug_on((long)point < 0);
-                                        if (point == ')')
-                                                break;
-                                }
-                                stop = i;
-                                key = stringvar_from_substr(self, start, stop);
-                                arg = dict_getitem(kwargs, key);
-                                VAR_DECR_REF(key);
-                                if (!arg)
-                                        continue;
+                                if (i == n)
+                                        goto malformed;
+                                newpos = fmt_parse_args(str, &item->fa,
+                                                        i, '}');
+                                if (newpos < 0)
+                                        goto malformed;
+                                i = newpos;
                         } else {
-                                --i;
+                                if (isdigit_ascii(point)) {
+                                        int argi;
+
+                                        argi = str_finish_digit(str, &i,
+                                                                point);
+                                        if (argi < 0) {
+                                                err_clear();
+                                                goto malformed;
+                                        }
+                                        if (i == n)
+                                                goto malformed;
+                                        item->argi = argi;
+                                        point = string_getidx(str, i++);
+                                }
+                                /*
+                                 * TODO: if point is ident, use
+                                 * dict key.
+                                 */
+                                if (point != '}')
+                                        goto malformed;
+                        }
+                        litstart = i;
+                } else if (point == '}') {
+                        if (i >= n)
+                                goto malformed;
+                        if (string_getidx(str, i++) != '}')
+                                goto malformed;
+                        fmt_spec_literal(spec, litstart, i - 1);
+                        litstart = i;
+                }
+        }
+        fmt_spec_literal(spec, litstart, n);
+        return;
+
+malformed:
+        spec->malformed = true;
+}
+
+/* Compile a template for string_printf() */
+static void
+fmt_compile_percent(struct fmt_spec_t *spec, Object *str)
+{
+        size_t i, n, litstart;
+
+        n = seqvar_size(str);
+        i = litstart = 0;
+        while (i < n) {
+                struct fmt_item_t *item;
+                size_t rawstart;
+                ssize_t newpos;
+                long point = string_getidx(str, i++);
+
+                if (point != '%')
+                        continue;
 
-                                /* Numbered arg */
-                                if (!args)
-                                        continue;
+                fmt_spec_literal(spec, litstart, i - 1);
+                if (i >= n) {
+                        /* trailing '%' is dropped */
+                        litstart = n;
+                        break;
+                }
+
+                point = string_getidx(str, i);
+                if (point == '%') {
+                        i++;
+                        fmt_spec_literal(spec, i - 1, i);
+                        litstart = i;
+                        continue;
+                }
 
-                                arg = seqvar_getitem(args, argi++);
-                                if (!arg)
-                                        continue;
+                rawstart = i;
+                if (point == '(') {
+                        size_t keystart = ++i;
+                        while (i < n && string_getidx(str, i) != ')')
+                                i++;
+                        if (i == n) {
+                                /* unterminated key, nothing to print */
+                                litstart = n;
+                                break;
                         }
+                        item = fmt_spec_add(spec, FMTI_KEY, keystart, 0);
+                        item->key = stringvar_from_substr(str, keystart, i);
+                        i++;
+                } else {
+                        item = fmt_spec_add(spec, FMTI_ARG, rawstart, 0);
+                }
 
-                        /* minus one because of 'for' iterator */
-                        i = format2_helper(arg, &wr, self, i);
-                        VAR_DECR_REF(arg);
+                if (i == n) {
+                        newpos = n;
                 } else {
-                        string_writer_append(&wr, point);
+                        newpos = fmt_parse_args(str, &item->fa, i, '\0');
+                        /* skip one character and the arg if malformed */
+                        if (newpos < 0) {
+                                item->bad = true;
+                                newpos = i + 1;
+                        }
                 }
+                item->len = newpos - item->start;
+                i = litstart = newpos;
+        }
+        fmt_spec_literal(spec, litstart, n);
+}
+
+/*
+ * Compile a single conversion spec for string_format_value(), the text
+ * between the ':' and '}' of an f-string's "{expr:spec}"
+ */
+static void
+fmt_compile_value(struct fmt_spec_t *spec, Object *str)
+{
+        struct fmt_item_t *item;
+        size_t n = seqvar_size(str);
+
+        item = fmt_spec_add(spec, FMTI_ARG, 0, n);
+        if (n && fmt_parse_args(str, &item->fa, 0, '\0') != n)
+                spec->malformed = true;
+}
+
+static struct fmt_spec_t *
+fmt_compile(Object *str, enum fmt_style_t style)
+{
+        struct fmt_spec_t *spec = ecalloc(sizeof(*spec));
+
+        spec->style = style;
+        switch (style) {
+        case FMT_STYLE_BRACE:
+                fmt_compile_brace(spec, str);
+                break;
+        case FMT_STYLE_PERCENT:
+                fmt_compile_percent(spec, str);
+                break;
+        case FMT_STYLE_VALUE:
+                fmt_compile_value(spec, str);
+                break;
+        default:
+                bug();
+        }
+        return spec;
+}
+
+/*
+ * Get @str's compiled template.  If it had already been compiled for
+ * the other style, which is rare and silly, return a throwaway spec;
+ * the caller knows to free it if it isn't V2STR(str)->s_fmt.
+ */
+static struct fmt_spec_t *
+fmt_get_spec(Object *str, enum fmt_style_t style)
+{
+        struct stringvar_t *vs = V2STR(str);
+
+        if (vs->s_fmt) {
+                if (vs->s_fmt->style == style)
+                        return vs->s_fmt;
+                return fmt_compile(str, style);
         }
+        vs->s_fmt = fmt_compile(str, style);
+        return vs->s_fmt;
+}
+
+static void
+fmt_write_raw(struct string_writer_t *wr, Object *str,
+              size_t start, size_t len)
+{
+        size_t width = string_width(str);
+        string_writer_appendb(wr, voidp_add(string_data(str), start * width),
+                              width, len);
+}
+
+/*
+ * Walk a compiled template.  @args is a tuple or list, and @kwargs is a
+ * dictionary.  Either may be NULL.
+ */
+static Object *
+fmt_spec_exec(Object *str, struct fmt_spec_t *spec,
+              Object *args, Object *kwargs)
+{
+        struct string_writer_t wr;
+        size_t i, argi, nargs;
+
+        if (spec->malformed)
+                goto malformed;
+
+        nargs = args ? seqvar_size(args) : 0;
+        argi = 0;
+        string_writer_init(&wr, string_width(str));
+        for (i = 0; i < spec->n_items; i++) {
+                struct fmt_item_t *item = &spec->items[i];
+                struct fmt_args_t fa;
+                Object *arg;
+
+                switch (item->kind) {
+                case FMTI_LITERAL:
+                        fmt_write_raw(&wr, str, item->start, item->len);
+                        continue;
+                case FMTI_ARG:
+                        if (!args) {
+                                fmt_write_raw(&wr, str, item->start,
+                                              item->len);
+                                continue;
+                        }
+                        if (item->argi >= 0)
+                                argi = item->argi;
+                        if (argi >= nargs)
+                                goto too_few;
+                        arg = seqvar_getitem(args, argi++);
+                        break;
+                case FMTI_KEY:
+                    {
+                        /* +1 for the ')' */
+                        size_t keylen = seqvar_size(item->key) + 1;
+
+                        if (!kwargs) {
+                                fmt_write_raw(&wr, str, item->start,
+                                              item->len);
+                                continue;
+                        }
+                        arg = dict_getitem(kwargs, item->key);
+                        if (!arg) {
+                                fmt_write_raw(&wr, str,
+                                              item->start + keylen,
+                                              item->len - keylen);
+                                continue;
+                        }
+                        break;
+                    }
+                default:
+                        bug();
+                        string_writer_destroy(&wr);
+                        return ErrorVar;
+                }
 
+                if (!item->bad) {
+                        /* format2_output() scribbles on this */
+                        fa = item->fa;
+                        format2_output(&wr, arg, &fa);
+                }
+                VAR_DECR_REF(arg);
+        }
         return stringvar_from_writer(&wr);
+
+too_few:
+        string_writer_destroy(&wr);
+        if (spec->style == FMT_STYLE_PERCENT) {
+                err_setstr(TypeError,
+                           "not enough arguments for format string");
+                return ErrorVar;
+        }
+malformed:
+        err_setstr(ValueError, "Malformed format string");
+        return ErrorVar;
+}
+
+static Object *
+fmt_format(Object *str, enum fmt_style_t style,
+           Object *args, Object *kwargs)
+{
+        struct fmt_spec_t *spec = fmt_get_spec(str, style);
+        Object *ret = fmt_spec_exec(str, spec, args, kwargs);
+        if (spec != V2STR(str)->s_fmt)
+                fmt_spec_free(spec);
+        return ret;
+}
+
+/* Common to string_format2 and string_modulo */
+static Object *
+string_printf(Object *self, Object *args, Object *kwargs)
+{
+        if (seqvar_size(self) == 0)
+                return VAR_NEW_REF(self);
+        return fmt_format(self, FMT_STYLE_PERCENT, args, kwargs);
 }
 
 /* **********************************************************************
@@ -1283,6 +1721,43 @@ string_format_mthd(Frame *fr)
         return string_format(self, list);
 }
 
+/*
+ * string_lrstrip_() for when @self and @skip are both ASCII: look up
+ * each end character in a table instead of searching @skip for it.
+ */
+static Object *
+strip_ascii(Object *self, Object *skip, unsigned int flags)
+{
+        bool skipset[128];
+        const unsigned char *src, *sk;
+        size_t i, n, start, end;
+
+        memset(skipset, 0, sizeof(skipset));
+        sk = (unsigned char *)string_cstring(skip);
+        n = seqvar_size(skip);
+        for (i = 0; i < n; i++)
+                skipset[sk[i]] = true;
+
+        src = (unsigned char *)string_cstring(self);
+        n = seqvar_size(self);
+        start = 0;
+        end = n;
+        if (!(flags & SF_RIGHT)) {
+                while (start < end && skipset[src[start]])
+                        start++;
+        }
+        if (!!(flags & (SF_CENTER|SF_RIGHT))) {
+                while (end > start && skipset[src[end - 1]])
+                        end--;
+        }
+
+        if (start == 0 && end == n)
+                return VAR_NEW_REF(self);
+        if (start == end)
+                return VAR_NEW_REF(STRCONST_ID(mpty));
+        return stringvar_from_ascii_(&src[start], end - start);
+}
+
 static Object *
 string_lrstrip_(Frame *fr, unsigned int flags, const char *fmt)
 {
@@ -1302,6 +1777,9 @@ string_lrstrip_(Frame *fr, unsigned int flags, const char *fmt)
         vsrc = V2STR(self);
         vskip = V2STR(arg);
 
+        if (vsrc->s_ascii && vskip->s_ascii)
+                return strip_ascii(self, arg, flags);
+
         if (vskip->s_width < vsrc->s_width) {
                 skip = widen_buffer(arg, vsrc->s_width);
                 src = vsrc->s_unicode;;
@@ -1505,6 +1983,121 @@ string_center(Frame *fr)
 
 #undef string_lrjust
 
+/* Copy @n points from @src to @dst, @dst being at least as wide */
+static void
+string_copy_points(void *dst, size_t dwidth,
+                   const void *src, size_t swidth, size_t n)
+{
+        size_t i;
+
+        if (dwidth == swidth) {
+                memcpy(dst, src, n * swidth);
+                return;
+        }
+
+        bug_on(dwidth < swidth);
+        if (dwidth == 2) {
+                uint16_t *d16 = dst;
+                const uint8_t *s8 = src;
+                for (i = 0; i < n; i++)
+                        d16[i] = s8[i];
+        } else if (swidth == 1) {
+                uint32_t *d32 = dst;
+                const uint8_t *s8 = src;
+                for (i = 0; i < n; i++)
+                        d32[i] = s8[i];
+        } else {
+                uint32_t *d32 = dst;
+                const uint16_t *s16 = src;
+                for (i = 0; i < n; i++)
+                        d32[i] = s16[i];
+        }
+}
+
+/*
+ * Concatenate @items, with @sep (if not NULL) between each of them.
+ * The result's length, width and encoded size are all found first, so
+ * it is written exactly once with no intermediate strings.  Caller must
+ * have type-checked @items.
+ */
+static Object *
+string_concat_(Object *sep, Object **items, size_t n_items)
+{
+        struct stringvar_t *vs;
+        Object *ret;
+        size_t i, len, nbytes, width, pos, seplen, sepbytes;
+        int ascii;
+        char *utf8;
+
+        len = nbytes = 0;
+        width = 1;
+        ascii = 1;
+        for (i = 0; i < n_items; i++) {
+                bug_on(!isvar_string(items[i]));
+                len += seqvar_size(items[i]);
+                nbytes += string_nbytes(items[i]);
+                if (string_width(items[i]) > width)
+                        width = string_width(items[i]);
+                ascii &= V2STR(items[i])->s_ascii;
+        }
+
+        seplen = sepbytes = 0;
+        if (sep && n_items > 1 && (seplen = seqvar_size(sep)) > 0) {
+                sepbytes = string_nbytes(sep);
+                len += seplen * (n_items - 1);
+                nbytes += sepbytes * (n_items - 1);
+                if (string_width(sep) > width)
+                        width = string_width(sep);
+                ascii &= V2STR(sep)->s_ascii;
+        }
+
+        if (!len)
+                return VAR_NEW_REF(STRCONST_ID(mpty));
+
+        ret = var_new(&StringType);
+        vs = V2STR(ret);
+
+        utf8 = emalloc(nbytes + 1);
+        for (i = 0, pos = 0; i < n_items; i++) {
+                size_t nb = string_nbytes(items[i]);
+                if (i > 0 && sepbytes) {
+                        memcpy(&utf8[pos], string_cstring(sep), sepbytes);
+                        pos += sepbytes;
+                }
+                memcpy(&utf8[pos], string_cstring(items[i]), nb);
+                pos += nb;
+        }
+        utf8[pos] = '\0';
+        vs->s = utf8;
+
+        if (ascii) {
+                vs->s_unicode = utf8;
+        } else {
+                void *points = emalloc(len * width);
+                for (i = 0, pos = 0; i < n_items; i++) {
+                        size_t n = seqvar_size(items[i]);
+                        if (i > 0 && seplen) {
+                                string_copy_points(
+                                        voidp_add(points, pos * width),
+                                        width, string_data(sep),
+                                        string_width(sep), seplen);
+                                pos += seplen;
+                        }
+                        string_copy_points(voidp_add(points, pos * width),
+                                           width, string_data(items[i]),
+                                           string_width(items[i]), n);
+                        pos += n;
+                }
+                vs->s_unicode = points;
+        }
+        vs->s_width     = width;
+        vs->s_ascii_len = nbytes;
+        vs->s_ascii     = ascii;
+        vs->s_hash      = 0;
+        seqvar_set_size(ret, len);
+        return ret;
+}
+
 /* data sent to string_join_one via var_traverse() */
 struct string_join_t {
         struct string_writer_t wr;
@@ -1535,12 +2128,42 @@ string_join_one(Object *item, void *data)
         return RES_OK;
 }
 
+/*
+ * 'string().join()' for a list or tuple.  The items are already in
+ * memory, so check them all first, then let string_concat_() write the
+ * result in one go.
+ */
+static Object *
+string_join_seq(Object *self, Object **items, size_t n)
+{
+        size_t i;
+
+        for (i = 0; i < n; i++) {
+                if (!isvar_string(items[i])) {
+                        err_setstr(TypeError,
+                                   "expected string in sequence but found %s",
+                                   typestr(items[i]));
+                        return ErrorVar;
+                }
+        }
+        if (n == 1)
+                return VAR_NEW_REF(items[0]);
+        return string_concat_(self, items, n);
+}
+
 /* default string().join() method, takes iterable object */
 static Object *
 string_join_iterable(Object *self, Object *other)
 {
         struct string_join_t data;
 
+        if (isvar_array(other))
+                return string_join_seq(self, array_get_data(other),
+                                       seqvar_size(other));
+        if (isvar_tuple(other))
+                return string_join_seq(self, tuple_get_data(other),
+                                       seqvar_size(other));
+
         string_writer_init(&data.wr, string_width(self));
         data.self = self;
         data.idx = 0;
@@ -1915,14 +2538,55 @@ string_removesuffix(Frame *fr)
 
 #undef string_removelr
 
+/*
+ * The split helpers below are each called twice, first with @items NULL
+ * just to count the fields, so the result array can be allocated once
+ * at its final size, then again to fill in @items.  @n is the number
+ * of fields stored so far.
+ */
+static void
+split_store(Object **items, size_t *n, Object *self,
+            size_t start, size_t stop)
+{
+        if (items) {
+                items[*n] = start == stop
+                          ? VAR_NEW_REF(STRCONST_ID(mpty))
+                          : stringvar_from_substr(self, start, stop);
+        }
+        (*n)++;
+}
+
+/* Make an array from @n new references in @items, and free @items */
+static Object *
+split_finish(Object **items, size_t n, bool reverse)
+{
+        Object *ret;
+
+        if (!n)
+                return arrayvar_new(0);
+
+        if (reverse) {
+                size_t i, j;
+                for (i = 0, j = n - 1; i < j; i++, j--) {
+                        Object *tmp = items[i];
+                        items[i] = items[j];
+                        items[j] = tmp;
+                }
+        }
+        ret = arrayvar_from_stack(items, n, true);
+        efree(items);
+        return ret;
+}
+
 static ssize_t
-split_combine_right(Object *self, Object *sep, Object *array, ssize_t idx)
+split_combine_right(Object *self, Object *sep, Object **items,
+                    size_t *n, ssize_t idx)
 {
         ssize_t seplen = seqvar_size(sep);
         while (idx - seplen >= 0) {
                 idx -= seplen;
                 if (match_here_anywidth(self, sep, idx)) {
-                        array_append(array, STRCONST_ID(mpty));
+                        split_store(items, n, self, 0, 0);
                 } else {
                         idx += seplen;
                         break;
@@ -1932,14 +2596,14 @@ split_combine_right(Object *self, Object *sep, Object *array, ssize_t idx)
 }
 
 static ssize_t
-split_combine_left(Object *self, Object *sep, Object *array,
-                   ssize_t idx, ssize_t endpos)
+split_combine_left(Object *self, Object *sep, Object **items,
+                   size_t *n, ssize_t idx, ssize_t endpos)
 {
         ssize_t seplen = seqvar_size(sep);
-        while (idx + seplen < endpos) {
+        while (idx + 2 * seplen <= endpos) {
                 idx += seplen;
                 if (match_here_anywidth(self, sep, idx)) {
-                        array_append(array, STRCONST_ID(mpty));
+                        split_store(items, n, self, 0, 0);
                 } else {
                         idx -= seplen;
                         break;
@@ -1948,46 +2612,76 @@ split_combine_left(Object *self, Object *sep, Object *array,
         return idx;
 }
 
-static Object *
-string_lrsplit(Frame *fr, unsigned int flags)
+/* Find @sep in [@s, @end), or return NULL */
+static const char *
+find_ascii(const char *s, const char *end, const char *sep, size_t seplen)
 {
-        enum { LRSPLIT_STACK_SIZE = 64, };
-        Object *self, *separg, *array;
-        const char *fmt;
-        int maxsplit;
-        bool combine;
-        size_t startpos, seplen, endpos;
-        bool right;
+        if (seplen == 1)
+                return memchr(s, sep[0], end - s);
+        return memmem(s, end - s, sep, seplen);
+}
 
-        separg = NULL;
-        maxsplit = -1;
-        combine = false;
-        fmt = !!(flags & SF_RIGHT)
-                ? "<s>[!]{|<s>i}:rsplit"
-                : "<s>[!]{|<s>i}:split";
-        if (vm_getargs(fr, fmt, &self, STRCONST_ID(sep), &separg,
-                       STRCONST_ID(maxsplit), &maxsplit) == RES_ERROR) {
-                return ErrorVar;
-        }
+/*
+ * split_fields() for a left split where @self and @sep are both ASCII.
+ * The rules are the same, but memchr() and memmem() do the searching.
+ */
+static size_t
+split_fields_ascii(Object **items, Object *self, Object *sep,
+                   int maxsplit, bool combine)
+{
+        const char *s, *start, *end, *sp;
+        size_t seplen, n = 0;
 
-        if (!separg) {
-                combine = true;
-                separg = STRCONST_ID(spc);
-        }
-        if (seqvar_size(separg) == 0) {
-                err_setstr(ValueError, "Separator may not be empty");
-                return ErrorVar;
+        start = s = string_cstring(self);
+        end = s + seqvar_size(self);
+        sp = string_cstring(sep);
+        seplen = seqvar_size(sep);
+
+        while (maxsplit-- != 0) {
+                const char *p = find_ascii(s, end, sp, seplen);
+                if (!p)
+                        break;
+
+                if (p != s)
+                        split_store(items, &n, self, s - start, p - start);
+
+                /* see split_combine_left() */
+                if (!combine) {
+                        while (p + 2 * seplen <= end
+                               && !memcmp(p + seplen, sp, seplen)) {
+                                split_store(items, &n, self, 0, 0);
+                                p += seplen;
+                        }
+                }
+                s = p + seplen;
         }
+        if (s != end)
+                split_store(items, &n, self, s - start, end - start);
+        return n;
+}
 
-        array = arrayvar_new(0);
+/*
+ * Helper to string_lrsplit().  For right splits, the fields are stored
+ * last one first.
+ */
+static size_t
+split_fields(Object **items, Object *self, Object *sep,
+             unsigned int flags, int maxsplit, bool combine)
+{
+        size_t startpos, seplen, endpos, n;
+        bool right = !!(flags & SF_RIGHT);
+
+        if (!right && V2STR(self)->s_ascii && V2STR(sep)->s_ascii)
+                return split_fields_ascii(items, self, sep, maxsplit, combine);
+
+        n = 0;
         startpos = 0;
-        seplen = seqvar_size(separg);
+        seplen = seqvar_size(sep);
         endpos = seqvar_size(self);
-        right = !!(flags & SF_RIGHT);
         while (maxsplit-- != 0) {
                 ssize_t substr_start, substr_end, idx;
 
-                idx = find_or_count_within(self, separg, flags,
+                idx = find_or_count_within(self, sep, flags,
                                            startpos, endpos);
                 if (idx < 0)
                         break;
@@ -2001,21 +2695,17 @@ string_lrsplit(Frame *fr, unsigned int flags)
                 }
 
                 if (substr_start != substr_end) {
-                        Object *substr = stringvar_from_substr(
-                                                        self,
-                                                        substr_start,
-                                                        substr_end);
-                        array_append(array, substr);
-                        VAR_DECR_REF(substr);
+                        split_store(items, &n, self,
+                                    substr_start, substr_end);
                 }
 
                 if (!combine) {
                         if (right) {
-                                idx = split_combine_right(self, separg,
-                                                          array, idx);
+                                idx = split_combine_right(self, sep,
+                                                          items, &n, idx);
                         } else {
-                                idx = split_combine_left(self, separg,
-                                                         array, idx,
+                                idx = split_combine_left(self, sep,
+                                                         items, &n, idx,
                                                          endpos);
                         }
                 }
@@ -2025,14 +2715,52 @@ string_lrsplit(Frame *fr, unsigned int flags)
                 else
                         startpos = idx + seplen;
         }
-        if (startpos != endpos) {
-                Object *substr = stringvar_from_substr(self, startpos, endpos);
-                array_append(array, substr);
-                VAR_DECR_REF(substr);
+        if (startpos != endpos)
+                split_store(items, &n, self, startpos, endpos);
+        return n;
+}
+
+static Object *
+string_lrsplit(Frame *fr, unsigned int flags)
+{
+        Object *self, *separg, **items;
+        const char *fmt;
+        int maxsplit;
+        bool combine;
+        size_t n;
+
+        separg = NULL;
+        maxsplit = -1;
+        combine = false;
+        fmt = !!(flags & SF_RIGHT)
+                ? "<s>[!]{|<s>i}:rsplit"
+                : "<s>[!]{|<s>i}:split";
+        if (vm_getargs(fr, fmt, &self, STRCONST_ID(sep), &separg,
+                       STRCONST_ID(maxsplit), &maxsplit) == RES_ERROR) {
+                return ErrorVar;
+        }
+
+        if (!separg) {
+                combine = true;
+                separg = STRCONST_ID(spc);
+        }
+        if (seqvar_size(separg) == 0) {
+                err_setstr(ValueError, "Separator may not be empty");
+                return ErrorVar;
+        }
+
+        items = NULL;
+        n = split_fields(NULL, self, separg, flags, maxsplit, combine);
+        if (n) {
+                size_t n2;
+
+                items = emalloc(n * sizeof(Object *));
+                n2 = split_fields(items, self, separg, flags,
+                                  maxsplit, combine);
+                bug_on(n2 != n);
+                (void)n2;
         }
-        if (!!(flags & SF_RIGHT))
-                array_reverse(array);
-        return array;
+        return split_finish(items, n, !!(flags & SF_RIGHT));
 }
 
 static Object *
@@ -2047,25 +2775,21 @@ string_split(Frame *fr)
         return string_lrsplit(fr, 0);
 }
 
-static Object *
-string_splitlines(Frame *fr)
+/* Helper to string_splitlines(), see split_store() */
+static size_t
+splitlines_fields(Object **items, Object *self, bool keepends)
 {
-        Object *self, *ret;
-        int keepends = 0;
-        size_t i, j, n;
-
-        if (vm_getargs(fr, "<s>[!]{|i}:splitlines", &self,
-                       STRCONST_ID(keepends), &keepends) == RES_ERROR) {
-                return ErrorVar;
-        }
-
-        ret = arrayvar_new(0);
+        size_t i, j, n, count;
+        const unsigned char *ascii;
 
+        ascii = V2STR(self)->s_ascii
+                ? (const unsigned char *)string_cstring(self) : NULL;
+        count = 0;
         n = seqvar_size(self);
         i = j = 0;
         while (i < n) {
                 size_t eol;
-                long pt = string_getidx(self, i);
+                long pt = ascii ? ascii[i] : string_getidx(self, i);
                 /* TODO: support non-ASCII line breaks */
                 if (!(pt == '\r' || pt == '\n')) {
                         i++;
@@ -2074,29 +2798,44 @@ string_splitlines(Frame *fr)
 
                 eol = i;
                 i++;
-                if (pt == '\r' && string_getidx(self, i) == '\n')
+                if (pt == '\r' && i < n
+                    && (ascii ? ascii[i] : string_getidx(self, i)) == '\n') {
                         i++;
+                }
                 if (keepends)
                         eol = i;
 
-                if (eol == j) {
-                        array_append(ret, STRCONST_ID(mpty));
-                } else {
-                        Object *substr;
+                split_store(items, &count, self, j, eol);
+                j = i;
+        }
+        if (i > j)
+                split_store(items, &count, self, j, i);
+        return count;
+}
 
-                        substr = stringvar_from_substr(self, j, eol);
-                        array_append(ret, substr);
-                        VAR_DECR_REF(substr);
-                }
+static Object *
+string_splitlines(Frame *fr)
+{
+        Object *self, **items;
+        int keepends = 0;
+        size_t n;
 
-                j = i;
+        if (vm_getargs(fr, "<s>[!]{|i}:splitlines", &self,
+                       STRCONST_ID(keepends), &keepends) == RES_ERROR) {
+                return ErrorVar;
         }
-        if (i > j) {
-                Object *substr = stringvar_from_substr(self, j, i);
-                array_append(ret, substr);
-                VAR_DECR_REF(substr);
+
+        items = NULL;
+        n = splitlines_fields(NULL, self, !!keepends);
+        if (n) {
+                size_t n2;
+
+                items = emalloc(n * sizeof(Object *));
+                n2 = splitlines_fields(items, self, !!keepends);
+                bug_on(n2 != n);
+                (void)n2;
         }
-        return ret;
+        return split_finish(items, n, false);
 }
 
 static Object *
@@ -2149,8 +2888,12 @@ string_is1(Frame *fr, bool (*cb)(Object *))
         return ret;
 }
 
+/*
+ * @ctmask is the EVC_CT_* equivalent of @tst, for checking ASCII
+ * strings a byte at a time.
+ */
 static Object *
-string_is2(Frame *fr, bool (*tst)(unsigned long c))
+string_is2(Frame *fr, bool (*tst)(unsigned long c), unsigned int ctmask)
 {
         bool bret;
         Object *self;
@@ -2162,6 +2905,17 @@ string_is2(Frame *fr, bool (*tst)(unsigned long c))
         bret = true;
         if (seqvar_size(self) == 0) {
                 bret = false;
+        } else if (V2STR(self)->s_ascii) {
+                const unsigned char *src;
+                size_t i, n = seqvar_size(self);
+
+                src = (unsigned char *)string_cstring(self);
+                for (i = 0; i < n; i++) {
+                        if (!(evc_ascii_ctype[src[i]] & ctmask)) {
+                                bret = false;
+                                break;
+                        }
+                }
         } else {
                 size_t i, n = seqvar_size(self);
                 for (i = 0; i < n; i++) {
@@ -2223,10 +2977,10 @@ static Object *string_istitle(Frame *fr)
         { return string_is1(fr, is_title); }
 
 static Object *string_isalnum(Frame *fr)
-        { return string_is2(fr, evc_isalnum); }
+        { return string_is2(fr, evc_isalnum, EVC_CT_ALNUM); }
 
 static Object *string_isalpha(Frame *fr)
-        { return string_is2(fr, evc_isalpha); }
+        { return string_is2(fr, evc_isalpha, EVC_CT_ALPHA); }
 
 /* FIXME: Skip the scan, just return V2STR(self)->s_ascii. */
 /* named funny, because string_isascii is an API func */
@@ -2244,16 +2998,16 @@ string_isascii_mthd(Frame *fr)
 }
 
 static Object *string_isdigit(Frame *fr)
-        { return string_is2(fr, evc_isdigit); }
+        { return string_is2(fr, evc_isdigit, EVC_CT_DIGIT); }
 
 static Object *string_isprintable(Frame *fr)
-        { return string_is2(fr, evc_isprint); }
+        { return string_is2(fr, evc_isprint, EVC_CT_PRINT); }
 
 static Object *string_isspace(Frame *fr)
-        { return string_is2(fr, evc_isspace); }
+        { return string_is2(fr, evc_isspace, EVC_CT_SPACE); }
 
 static Object *string_isupper(Frame *fr)
-        { return string_is2(fr, evc_isupper); }
+        { return string_is2(fr, evc_isupper, EVC_CT_UPPER); }
 
 /*
  * string case-swapping & helpers
@@ -2269,10 +3023,38 @@ string_title(Frame *fr)
         if (vm_getargs(fr, "<s>[!]{!}:title", &self) == RES_ERROR)
                 return ErrorVar;
 
-        /* XXX: Do I know that evc_toupper/lower do not change width? */
-        string_writer_init(&wr, string_width(self));
         n = seqvar_size(self);
         first = true;
+        if (V2STR(self)->s_ascii) {
+                const unsigned char *src;
+                Object *ret;
+                char *dst;
+
+                src = (unsigned char *)string_cstring(self);
+                ret = stringvar_ascii_alloc_(n);
+                dst = V2STR(ret)->s;
+                for (i = 0; i < n; i++) {
+                        unsigned int c = src[i];
+                        unsigned int ct = evc_ascii_ctype[c];
+                        if (!!(ct & EVC_CT_ALPHA)) {
+                                /* flip bit 5 to change case */
+                                if (first) {
+                                        if (!!(ct & EVC_CT_LOWER))
+                                                c ^= 0x20;
+                                        first = false;
+                                } else if (!!(ct & EVC_CT_UPPER)) {
+                                        c ^= 0x20;
+                                }
+                        } else {
+                                first = true;
+                        }
+                        dst[i] = c;
+                }
+                return ret;
+        }
+
+        /* XXX: Do I know that evc_toupper/lower do not change width? */
+        string_writer_init(&wr, string_width(self));
         for (i = 0; i < n; i++) {
                 long point = string_getidx(self, i);
                 bug_on(point < 0);
@@ -2291,8 +3073,13 @@ string_title(Frame *fr)
         return stringvar_from_writer(&wr);
 }
 
+/*
+ * @ascii_flags is the mem_ascii_case() equivalent of @cb, for ASCII
+ * strings, which can be converted in bulk.
+ */
 static Object *
-string_to(Frame *fr, unsigned long (*cb)(unsigned long))
+string_to(Frame *fr, unsigned long (*cb)(unsigned long),
+          unsigned int ascii_flags)
 {
         Object *self;
         size_t i, n;
@@ -2301,8 +3088,15 @@ string_to(Frame *fr, unsigned long (*cb)(unsigned long))
         if (vm_getargs(fr, "<s>[!]{!}:title", &self) == RES_ERROR)
                 return ErrorVar;
 
-        string_writer_init(&wr, string_width(self));
         n = seqvar_size(self);
+        if (V2STR(self)->s_ascii) {
+                Object *ret = stringvar_ascii_alloc_(n);
+                mem_ascii_case(V2STR(ret)->s, string_cstring(self),
+                               n, ascii_flags);
+                return ret;
+        }
+
+        string_writer_init(&wr, string_width(self));
         for (i = 0; i < n; i++) {
                 long point = string_getidx(self, i);
                 bug_on(point < 0);
@@ -2326,19 +3120,19 @@ to_swap(unsigned long c)
 static Object *
 string_lower(Frame *fr)
 {
-        return string_to(fr, evc_tolower);
+        return string_to(fr, evc_tolower, ASCII_TOLOWER);
 }
 
 static Object *
 string_swapcase(Frame *fr)
 {
-        return string_to(fr, to_swap);
+        return string_to(fr, to_swap, ASCII_TOLOWER | ASCII_TOUPPER);
 }
 
 static Object *
 string_upper(Frame *fr)
 {
-        return string_to(fr, evc_toupper);
+        return string_to(fr, evc_toupper, ASCII_TOUPPER);
 }
 
 static struct type_method_t string_methods[] = {
@@ -2476,6 +3270,8 @@ static void
 string_reset(Object *str)
 {
         struct stringvar_t *vs = V2STR(str);
+        if (vs->s_fmt)
+                fmt_spec_free(vs->s_fmt);
         if (vs->s_unicode != vs->s && vs->s_unicode != NULL)
                 efree(vs->s_unicode);
         if (vs->s)
@@ -2760,11 +3556,40 @@ err_decode(int codec, const char *why)
 /* ie ((c & 0xc0) == 0x80), but usu. one less instruction */
 static inline bool is_continuation(int c) { return c < 0xc0 && c >= 0x80; }
 
+/*
+ * Check @point, decoded from a sequence of @seqlen bytes, by the same
+ * rules as utf8_scan(): no overlong encodings, no surrogates, nothing
+ * past U+10FFFF.  Return 0 if it's valid, or set an error and return -1.
+ */
+static int
+utf8_check_point(unsigned long point, int seqlen)
+{
+        static const unsigned long UNICODE_MAXCHR = 0x10ffffu;
+        /* smallest point that needs @seqlen bytes */
+        static const unsigned long MINPOINT[] = {
+                0, 0, 0x80u, 0x800u, 0x10000u
+        };
+
+        bug_on(seqlen < 2 || seqlen > 4);
+        if (point > UNICODE_MAXCHR) {
+                err_ord(CODEC_UTF8, point);
+                return -1;
+        }
+        if (point < MINPOINT[seqlen]) {
+                err_decode(CODEC_UTF8, "overlong encoding");
+                return -1;
+        }
+        if (point >= 0xd800u && point <= 0xdfffu) {
+                err_decode(CODEC_UTF8, "invalid surrogate pair");
+                return -1;
+        }
+        return 0;
+}
+
 static ssize_t
 string_writer_decode_utf8(struct string_writer_t *wr, const void *data,
                           size_t n, size_t max, struct utf8_state_t *state)
 {
-        static const unsigned long UNICODE_MAXCHR = 0x10ffffu;
         const unsigned char *u8 = data;
         const unsigned char *end = u8 + n;
         unsigned long point = 0;
@@ -2777,7 +3602,7 @@ string_writer_decode_utf8(struct string_writer_t *wr, const void *data,
                         bug_on(state->state > UTF8_STATE_GET3);
                         if (!is_continuation(u8[0]))
                                 goto err_continuation_byte;
-                        point = (point << 6) & (u8[0] & 0x3fu);
+                        point = (point << 6) | (u8[0] & 0x3fu);
                         state->buf[state->state - 1] = u8[0];
                         state->state--;
                         u8++;
@@ -2789,13 +3614,33 @@ string_writer_decode_utf8(struct string_writer_t *wr, const void *data,
                         return (size_t)(u8 - (unsigned char *)data);
                 }
 
-                if (point > UNICODE_MAXCHR)
-                        goto err_ord;
+                if (utf8_check_point(point, state->seqlen) < 0)
+                        return -1;
                 string_writer_append(wr, point);
                 memset(state, 0, sizeof(*state));
                 max--;
         }
 
+        /*
+         * Fast path: validate, count, and find the width of as much as
+         * we can in one bulk pass, so the writer is resized at most
+         * once and pure ASCII is a memcpy.  The loop below only has to
+         * deal with whatever utf8_scan() refused, which is either an
+         * error or a sequence straddling the end of @data.
+         */
+        if (u8 < end && max != 0) {
+                size_t nvalid, npoints;
+                unsigned long maxchr;
+
+                nvalid = utf8_scan(u8, end - u8, &npoints, &maxchr);
+                if (nvalid > 0 && npoints <= max) {
+                        string_writer_append_utf8(wr, u8, nvalid,
+                                                  npoints, maxchr);
+                        u8 += nvalid;
+                        max -= npoints;
+                }
+        }
+
         while (u8 < end && max != 0) {
                 unsigned int c = *u8;
                 if (c < 128) {
@@ -2818,17 +3663,12 @@ string_writer_decode_utf8(struct string_writer_t *wr, const void *data,
                                 | ((u8[1] & 0x3fu) << 12)
                                 | ((u8[2] & 0x3fu) << 6)
                                 | (u8[3] & 0x3fu);
-                        if (point > UNICODE_MAXCHR)
-                                goto err_ord;
+                        if (utf8_check_point(point, 4) < 0)
+                                return -1;
                         u8 += 4;
                         max--;
                         string_writer_append(wr, point);
                 } else if (c >= 0xe0u && c < 0xf0u) {
-                        /*
-                         * Check for surrogate pairs.  This can't be done
-                         * after the decoding, because they won't decode
-                         * that way.
-                         */
                         if (end - u8 < 3)
                                 break;
                         if (!is_continuation(u8[1]) ||
@@ -2839,12 +3679,8 @@ string_writer_decode_utf8(struct string_writer_t *wr, const void *data,
                         point = ((c & 0x0fu) << 12)
                                 | ((u8[1] & 0x3fu) << 6)
                                 | (u8[2] & 0x3fu);
-                        if (point > UNICODE_MAXCHR)
-                                goto err_ord;
-                        if (point >= 0xd800u && point <= 0xdfffu) {
-                                /* invalid surrogate pair */
-                                goto err_surrogate;
-                        }
+                        if (utf8_check_point(point, 3) < 0)
+                                return -1;
                         u8 += 3;
                         max--;
                         string_writer_append(wr, point);
@@ -2854,8 +3690,8 @@ string_writer_decode_utf8(struct string_writer_t *wr, const void *data,
                         if (!is_continuation(u8[1]))
                                 goto err_continuation_byte;
                         point = ((c & 0x1fu) << 6) | (u8[1] & 0x3fu);
-                        if (point > UNICODE_MAXCHR)
-                                goto err_ord;
+                        if (utf8_check_point(point, 2) < 0)
+                                return -1;
                         u8 += 2;
                         max--;
                         string_writer_append(wr, point);
@@ -2871,12 +3707,15 @@ string_writer_decode_utf8(struct string_writer_t *wr, const void *data,
                 if (c >= 0xf0u && c < 0xf8u) {
                         state->point = c & 0x07u;
                         state->state = UTF8_STATE_GET3;
+                        state->seqlen = 4;
                 } else if (c >= 0xe0u && c < 0xf0u) {
                         state->point = c & 0x0fu;
                         state->state = UTF8_STATE_GET2;
+                        state->seqlen = 3;
                 } else if (c >= 0xc0u && c < 0xe0) {
                         state->point = c & 0x1fu;
                         state->state = UTF8_STATE_GET1;
+                        state->seqlen = 2;
                 } else {
                         bug();
                 }
@@ -2904,14 +3743,6 @@ err_start_byte:
 err_continuation_byte:
         err_decode(CODEC_UTF8, "bad continuation byte");
         return -1;
-
-err_ord:
-        err_ord(CODEC_UTF8, point);
-        return -1;
-
-err_surrogate:
-        err_decode(CODEC_UTF8, "invalid surrogate pair");
-        return -1;
 }
 
 /* **********************************************************************
@@ -3107,6 +3938,8 @@ stringvar_from_substr(Object *old, size_t start, size_t stop)
         width = string_width(old);
         len  = stop - start;
         buf = voidp_add(string_data(old), start * width);
+        if (V2STR(old)->s_ascii)
+                return stringvar_from_ascii_(buf, len);
         /*
          * Quickly scan unicode to determine if width of substring
          * does not need to shrink.  If not, we can call the quicker
@@ -3117,7 +3950,7 @@ stringvar_from_substr(Object *old, size_t start, size_t stop)
          * same array of Unicode points need to have matching widths,
          * or else a comparison could yield a false negative.
          */
-        maxwidth = find_max_width(width, buf, start, stop);
+        maxwidth = find_max_width(width, buf, len);
         if (maxwidth != width) {
                 /*
                  * Substring does not contain widest chars in @old.
@@ -3312,6 +4145,18 @@ stringvar_from_binary(const void *data, size_t n, int encoding)
         ssize_t res;
         struct utf8_state_t state;
 
+        if (encoding == CODEC_UTF8) {
+                size_t npoints;
+                unsigned long maxchr;
+                if (utf8_scan(data, n, &npoints, &maxchr) == n) {
+                        return stringvar_from_valid_utf8(data, n,
+                                                         npoints, maxchr);
+                }
+        } else if (mem_is_ascii(data, n)) {
+                /* ASCII is a subset of every codec we support */
+                return stringvar_from_ascii_((void *)data, n);
+        }
+
         memset(&state, 0, sizeof(state));
 
         string_writer_init(&wr, 1);
@@ -3328,6 +4173,28 @@ stringvar_from_binary(const void *data, size_t n, int encoding)
         return stringvar_from_writer(&wr);
 }
 
+/**
+ * stringvar_from_stack - Concatenate an array of strings
+ * @items:      Array of string objects
+ * @n_items:    Number of items in @items
+ * @consume:    True to consume the references of @items
+ *
+ * Unlike repeated string_cat() calls, the result is written exactly
+ * once, with no temporary strings.  This is for the BUILD_STRING
+ * instruction.
+ */
+Object *
+stringvar_from_stack(Object **items, int n_items, bool consume)
+{
+        Object *ret = string_concat_(NULL, items, n_items);
+        if (consume) {
+                int i;
+                for (i = 0; i < n_items; i++)
+                        VAR_DECR_REF(items[i]);
+        }
+        return ret;
+}
+
 /**
  * string_ord - Get the ordinal value of @str at index @idx
  */
@@ -3350,78 +4217,142 @@ string_ord(Object *str, size_t idx)
 Object *
 string_format(Object *str, Object *tup)
 {
-        struct string_writer_t wr;
-        size_t i, n, nt;
-        size_t argi;
-
         if (arg_type_check(str, &StringType) == RES_ERROR)
                 return ErrorVar;
         if (!isvar_tuple(tup) && !isvar_array(tup)) {
                 err_setstr(TypeError, "format expects tuple or list");
                 return ErrorVar;
         }
+        return fmt_format(str, FMT_STYLE_BRACE, tup, NULL);
+}
 
-        n = seqvar_size(str);
-        nt = seqvar_size(tup);
+/**
+ * string_format_value - Convert one f-string expression to a string
+ * @v:          Value of the expression
+ * @spec:       Its conversion spec, the text between ':' and '}', or
+ *              NULL if there was none.
+ *
+ * Return: the converted string, or ErrorVar if @spec is malformed.
+ */
+Object *
+string_format_value(Object *v, Object *spec)
+{
+        struct string_writer_t wr;
+        struct fmt_args_t fa;
+
+        if (!spec) {
+                if (isvar_string(v))
+                        return VAR_NEW_REF(v);
+                default_fmt_args(&fa);
+        } else {
+                struct fmt_spec_t *fs;
+                bool malformed;
+
+                bug_on(!isvar_string(spec));
+                fs = fmt_get_spec(spec, FMT_STYLE_VALUE);
+                malformed = fs->malformed;
+                if (!malformed)
+                        fa = fs->items[0].fa;
+                if (fs != V2STR(spec)->s_fmt)
+                        fmt_spec_free(fs);
+                if (malformed) {
+                        err_setstr(ValueError, "Malformed format string");
+                        return ErrorVar;
+                }
+        }
+
+        string_writer_init(&wr, isvar_string(v) ? string_width(v) : 1);
+        format2_output(&wr, v, &fa);
+        return stringvar_from_writer(&wr);
+}
+
+/**
+ * string_precompile_format - Compile @spec for string_format_value()
+ *                            ahead of time.
+ *
+ * The assembler calls this for f-string conversion specs, so not even
+ * the first FORMAT_VALUE instruction has to parse them.
+ */
+void
+string_precompile_format(Object *spec)
+{
+        bug_on(!isvar_string(spec));
+        (void)fmt_get_spec(spec, FMT_STYLE_VALUE);
+}
+
+/**
+ * string_fstring_parts - Split an f-string template for the assembler
+ * @tmpl: Template from the tokenizer, where each expression has been
+ *        replaced with "{}" or "{:spec}", and literal braces are still
+ *        doubled.
+ *
+ * Return: a list of [lit0, spec0, lit1, spec1, ... litN], where the
+ * lits are literal text (maybe empty) with braces un-doubled, and the
+ * specs are the text between ':' and '}', or NullVar if there was
+ * none.  ErrorVar is returned with a SyntaxError if @tmpl is malformed,
+ * which should only happen if the tokenizer has a bug.
+ */
+Object *
+string_fstring_parts(Object *tmpl)
+{
+        struct string_writer_t wr;
+        Object *parts, *item;
+        size_t i, n, width;
+
+        bug_on(!isvar_string(tmpl));
+
+        parts = arrayvar_new(0);
+        width = string_width(tmpl);
+        n = seqvar_size(tmpl);
         i = 0;
-        argi = 0;
-        string_writer_init(&wr, string_width(str));
+        string_writer_init(&wr, width);
         while (i < n) {
-                long point = string_getidx(str, i++);
-                if (point == '{' && i < n) {
-                        struct fmt_args_t fa;
-                        Object *arg;
-                        point = string_getidx(str, i++);
-                        if (point == '{') {
+                long point = string_getidx(tmpl, i++);
+                if (point == '{' || point == '}') {
+                        size_t start;
+
+                        if (i == n)
+                                goto malformed;
+                        if (string_getidx(tmpl, i) == point) {
                                 string_writer_append(&wr, point);
+                                i++;
                                 continue;
                         }
-                        if (point == ':') {
-                                size_t newpos;
-
-                                if (i == n)
-                                        goto bad_format;
-                                newpos = parse_fmt_args(str, &fa, i, '}');
-                                if ((ssize_t)newpos < 0)
-                                        goto bad_format;
-                                i = newpos;
-                        } else {
-                                if (isdigit_ascii(point)) {
-                                        argi = str_finish_digit(str, &i, point);
-                                        if ((int)argi < 0)
-                                                goto bad_format;
-                                }
-                                /*
-                                 * TODO: if point is ident, use
-                                 * dict key.
-                                 */
-                                if (point != '}')
-                                        goto bad_format;
-                                default_fmt_args(&fa);
-                        }
-
-                        if (argi >= nt)
-                                goto bad_format;
-
-                        arg = seqvar_getitem(tup, argi++);
-                        format2_output(&wr, arg, &fa);
-                        VAR_DECR_REF(arg);
+                        if (point == '}')
+                                goto malformed;
+
+                        item = stringvar_from_writer(&wr);
+                        array_append(parts, item);
+                        VAR_DECR_REF(item);
+                        string_writer_init(&wr, width);
+
+                        if (string_getidx(tmpl, i) == ':')
+                                i++;
+                        start = i;
+                        while (i < n && string_getidx(tmpl, i) != '}')
+                                i++;
+                        if (i == n)
+                                goto malformed;
+                        if (i == start)
+                                item = VAR_NEW_REF(NullVar);
+                        else
+                                item = stringvar_from_substr(tmpl, start, i);
+                        array_append(parts, item);
+                        VAR_DECR_REF(item);
+                        i++;
                 } else {
-                        if (point == '}') {
-                                if (i >= n)
-                                        goto bad_format;
-                                point = string_getidx(str, i++);
-                                if (point != '}')
-                                        goto bad_format;
-                        }
                         string_writer_append(&wr, point);
                 }
         }
-        return stringvar_from_writer(&wr);
+        item = stringvar_from_writer(&wr);
+        array_append(parts, item);
+        VAR_DECR_REF(item);
+        return parts;
 
-bad_format:
-        err_setstr(ValueError, "Malformed format string");
+malformed:
         string_writer_destroy(&wr);
+        VAR_DECR_REF(parts);
+        err_setstr(SyntaxError, "Malformed f-string");
         return ErrorVar;
 }
 
@@ -35,7 +35,7 @@ STRING_HELPER(lfind_idx)(const TYPE *hsrc, const TYPE *nsrc,
                 if (hsrc[i] == nsrc[0]) {
                         if (nlen == 1
                             || STRING_HELPER(match_here)(
-                                        &hsrc[i+1], &nsrc[1], nlen - 1)) {
+                                        &hsrc[i], nsrc, nlen)) {
                                 if (!counting)
                                         return i;
                                 i += nlen - 1;
@@ -57,7 +57,7 @@ STRING_HELPER(rfind_idx)(const TYPE *hsrc, const TYPE *nsrc,
                         if (nlen == 1)
                                 return i;
                         if (STRING_HELPER(match_here)(
-                                        &hsrc[i+1], &nsrc[1], nlen - 1))
+                                        &hsrc[i], nsrc, nlen))
                                 return i;
                 }
         }
@@ -18,6 +18,14 @@ xptr_reset(Object *v)
                 efree(ex->instr);
         if (ex->locations)
                 efree(ex->locations);
+        if (ex->inlined) {
+                int i;
+                for (i = 0; i < ex->n_inlined; i++) {
+                        if (ex->inlined[i].funcname)
+                                VAR_DECR_REF(ex->inlined[i].funcname);
+                }
+                efree(ex->inlined);
+        }
         if (ex->rodata)
                 VAR_DECR_REF(ex->rodata);
         if (ex->file_name)
@@ -26,6 +34,8 @@ xptr_reset(Object *v)
                 VAR_DECR_REF(ex->names);
         if (ex->funcname)
                 VAR_DECR_REF(ex->funcname);
+        if (ex->lazy)
+                assemble_lazy_free(ex->lazy);
 }
 
 static Object *
@@ -60,18 +70,14 @@ struct type_t XptrType = {
 };
 
 /**
- * xptrvar_new - Get a new XptrType var
- * @file_name: Name of source file that defines this code
- * @file_line: Starting line in file of this code block if it's a
- *             function definition, or 1 if it's the start of a
- *             script.
+ * xptr_set_code - Fill in the code of an XptrType var
+ * @x:   XptrType var created lazily by xptrvar_new()
+ * @cfg: The finished code.  Its name and location are ignored, since
+ *       @x already has them.
  */
-Object *
-xptrvar_new(const struct xptr_cfg_t *cfg)
+void
+xptr_set_code(struct xptrvar_t *x, const struct xptr_cfg_t *cfg)
 {
-        Object *v = var_new(&XptrType);
-        struct xptrvar_t *x = V2XP(v);
-
         if (cfg->rodata && seqvar_size(cfg->rodata) > 0) {
                 x->rodata = tuplevar_from_stack(array_get_data(cfg->rodata),
                                                 seqvar_size(cfg->rodata),
@@ -90,15 +96,40 @@ xptrvar_new(const struct xptr_cfg_t *cfg)
         bug_on(!cfg->n_instr);
         x->instr        = cfg->instr;
         x->n_instr      = cfg->n_instr;
-        x->file_name    = estrdup(cfg->file_name);
-        x->file_line    = cfg->file_line;
         x->n_locals     = cfg->n_locals;
-        x->funcname     = cfg->funcname;
+        x->max_stack    = cfg->max_stack;
         x->locations    = cfg->locations;
         x->locations_size = cfg->locations_size;
+        x->inlined      = cfg->inlined;
+        x->n_inlined    = cfg->n_inlined;
+        x->lazy         = NULL;
+}
+
+/**
+ * xptrvar_new - Get a new XptrType var
+ * @file_name: Name of source file that defines this code
+ * @file_line: Starting line in file of this code block if it's a
+ *             function definition, or 1 if it's the start of a
+ *             script.
+ *
+ * If @cfg->lazy is set, everything else but the name and location is
+ * ignored, and the code will be filled in by xptr_set_code() when it's
+ * first needed.
+ */
+Object *
+xptrvar_new(const struct xptr_cfg_t *cfg)
+{
+        Object *v = var_new(&XptrType);
+        struct xptrvar_t *x = V2XP(v);
+
+        x->file_name    = estrdup(cfg->file_name);
+        x->file_line    = cfg->file_line;
+        x->funcname     = cfg->funcname;
         if (x->funcname)
                 VAR_INCR_REF(x->funcname);
+        if (cfg->lazy)
+                x->lazy = cfg->lazy;
+        else
+                xptr_set_code(x, cfg);
         return v;
 }
-
-
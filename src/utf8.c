@@ -1,5 +1,6 @@
 /* utf8.c - Helpers for UTF-8 C-string encoding/decoding */
 #include <lib/utf8.h>
+#include <lib/helpers.h>
 
 static long
 decode_one_point(const unsigned char *s, unsigned char **endptr,
@@ -53,3 +54,91 @@ utf8_decode_one(const unsigned char *src, unsigned char **endptr)
         return point;
 }
 
+
+/**
+ * utf8_scan - Validate UTF-8 and measure what it decodes to
+ * @src:        Buffer of UTF-8-encoded text
+ * @n:          Size of @src in bytes
+ * @npoints:    (output) Number of Unicode points in the valid part of
+ *              @src
+ * @maxchr:     (output) Largest non-ASCII point in the valid part of
+ *              @src, or zero if it is pure ASCII.  This lets the caller
+ *              pick a width of 1, 2, or 4 up front.
+ *
+ * This is strict: overlong encodings, surrogates, and points past
+ * U+10FFFF are all treated as invalid.  ASCII runs are skipped in bulk
+ * with mem_find_nonascii(), so mostly-ASCII text costs about as much as
+ * a memchr().
+ *
+ * Return: Number of bytes from the start of @src which make up complete,
+ *         valid UTF-8 sequences.  If this is less than @n, then @src at
+ *         the return value is the start of a sequence which is either
+ *         invalid or truncated by the end of the buffer.
+ */
+size_t
+utf8_scan(const void *src, size_t n, size_t *npoints, unsigned long *maxchr)
+{
+        const unsigned char *s = src;
+        const unsigned char *end = s + n;
+        size_t count = 0;
+        unsigned long max = 0;
+
+        while (s < end) {
+                unsigned int c, c1;
+                unsigned long point;
+                size_t nascii;
+
+                nascii = mem_find_nonascii(s, end - s);
+                if (nascii) {
+                        count += nascii;
+                        s += nascii;
+                        if (s == end)
+                                break;
+                }
+
+                c = s[0];
+                if (c < 0xc2u || c > 0xf4u)
+                        break;
+
+                if (c < 0xe0u) {
+                        if (end - s < 2 || (s[1] & 0xc0u) != 0x80u)
+                                break;
+                        point = ((c & 0x1fu) << 6) | (s[1] & 0x3fu);
+                        s += 2;
+                } else if (c < 0xf0u) {
+                        if (end - s < 3)
+                                break;
+                        c1 = s[1];
+                        if ((c1 & 0xc0u) != 0x80u
+                            || (s[2] & 0xc0u) != 0x80u
+                            || (c == 0xe0u && c1 < 0xa0u)
+                            || (c == 0xedu && c1 > 0x9fu)) {
+                                break;
+                        }
+                        point = ((c & 0x0fu) << 12) | ((c1 & 0x3fu) << 6)
+                                | (s[2] & 0x3fu);
+                        s += 3;
+                } else {
+                        if (end - s < 4)
+                                break;
+                        c1 = s[1];
+                        if ((c1 & 0xc0u) != 0x80u
+                            || (s[2] & 0xc0u) != 0x80u
+                            || (s[3] & 0xc0u) != 0x80u
+                            || (c == 0xf0u && c1 < 0x90u)
+                            || (c == 0xf4u && c1 > 0x8fu)) {
+                                break;
+                        }
+                        point = ((c & 0x07u) << 18) | ((c1 & 0x3fu) << 12)
+                                | ((s[2] & 0x3fu) << 6) | (s[3] & 0x3fu);
+                        s += 4;
+                }
+                if (point > max)
+                        max = point;
+                count++;
+        }
+
+        *npoints = count;
+        *maxchr = max;
+        return (size_t)(s - (const unsigned char *)src);
+}
@@ -544,6 +544,25 @@ var_getattr_or_null(Frame *frame, Object *obj, Object *key)
         return type_get_builtin_attr(obj->v_type, obj, key);
 }
 
+/**
+ * var_getmethod - like var_getattr_or_null, but for an attribute that
+ *                 is about to be called
+ * @self: Set to @obj if the return value is a function that
+ *        var_getattr_or_null() would have bound to @obj, or to NULL
+ *        otherwise.  No reference is produced for it.
+ *
+ * This saves creating a method object just to take it apart again.
+ * The caller should pass @self to the function as its owner.
+ */
+Object *
+var_getmethod(Frame *frame, Object *obj, Object *key, Object **self)
+{
+        *self = NULL;
+        if (isvar_instance(obj))
+                return instance_getmethod(frame, obj, key, self);
+        return type_get_builtin_method(obj->v_type, obj, key, self);
+}
+
 bool
 var_hasattr(Frame *frame, Object *obj, Object *key)
 {
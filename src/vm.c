@@ -25,20 +25,27 @@
 #include <evilcandy/types/generator.h>
 #include <evilcandy/types/string.h>
 #include <evilcandy/types/method.h>
+#include <evilcandy/types/number_types.h>
+#include <evilcandy/types/range.h>
 #include <evilcandy/types/set.h>
 #include <evilcandy/types/tuple.h>
 #include <internal/import.h>
 #include <internal/type_registry.h>
 #include <internal/op.h>
+#include <internal/types/number_types.h>
 #include <internal/types/string.h>
 #include <internal/types/xptr.h>
 #include <internal/types/sequential_types.h>
 #include <internal/types/internal_types.h>
 #include <internal/errmsg.h>
 #include <internal/init.h>
+#include <internal/instruction_name.h>
 #include <internal/vm.h>
+#include <lib/buffer.h>
 #include <lib/helpers.h>
 
+#include <stdlib.h>
+
 /* XXX: Need to be made per-thread */
 static struct vm_t {
         Object *globals;
@@ -185,8 +192,6 @@ vmframe_free__(Frame *fr)
 static Frame *
 vmframe_new_generator_frame(Frame *fr)
 {
-        /* FIXME: This should be calculated dynamically in assembler.c */
-        enum { GENERATOR_STACK_SIZE = 100 };
         size_t i, stack_pos, stack_size;
         Frame *ret;
 
@@ -203,8 +208,14 @@ vmframe_new_generator_frame(Frame *fr)
         ret->ppii = fr->ppii;
         ret->clo = fr->clo;
 
+        /*
+         * The generator's stack never gets deeper than the depth
+         * assemble_post.c worked out for this function, so we can
+         * size it exactly.
+         */
         stack_pos = (size_t)(fr->stackptr - fr->stack);
-        stack_size = ret->ap + ret->n_locals + GENERATOR_STACK_SIZE;
+        stack_size = ret->n_locals + ret->ex->max_stack;
+        bug_on(stack_pos > stack_size);
         ret->stack = emalloc(sizeof(Object *) * stack_size);
         ret->stackptr = ret->stack + stack_pos;
         ret->stack_end = ret->stack + stack_size;
@@ -378,20 +389,31 @@ assign_complete(Frame *fr, instruction_t ii, Object *from)
 }
 
 static int
-do_format(Frame *fr, instruction_t ii)
+do_format_value(Frame *fr, instruction_t ii)
 {
-        Object *str, *tup, *res;
-        str = pop(fr);
-        tup = pop(fr);
-        res = string_format(str, tup);
-        VAR_DECR_REF(str);
-        VAR_DECR_REF(tup);
+        Object *spec, *v, *res;
+        spec = ii.arg1 ? pop(fr) : NULL;
+        v = pop(fr);
+        res = string_format_value(v, spec);
+        VAR_DECR_REF(v);
+        if (spec)
+                VAR_DECR_REF(spec);
         if (res == ErrorVar)
                 return RES_ERROR;
         push(fr, res);
         return RES_OK;
 }
 
+static int
+do_build_string(Frame *fr, instruction_t ii)
+{
+        int n = ii.arg2;
+        Object *str = stringvar_from_stack(fr->stackptr - n, n, true);
+        fr->stackptr -= n;
+        push(fr, str);
+        return RES_OK;
+}
+
 static int
 do_nop(Frame *fr, instruction_t ii)
 {
@@ -450,6 +472,55 @@ do_load_local(Frame *fr, instruction_t ii)
         return RES_OK;
 }
 
+/*
+ * The _fast and _cell variants are for when the assembler knows
+ * whether the variable is in a cell or not.  See tools/instructions.
+ */
+static int
+do_load_fast(Frame *fr, instruction_t ii)
+{
+        Object *p;
+
+        bug_on((unsigned)ii.arg2 >= fr->n_locals);
+        p = fr->stack[ii.arg2];
+        bug_on(isvar_cell(p));
+        VAR_INCR_REF(p);
+        push(fr, p);
+        return RES_OK;
+}
+
+static int
+do_store_fast(Frame *fr, instruction_t ii)
+{
+        Object **ppto;
+
+        bug_on((unsigned)ii.arg2 >= fr->n_locals);
+        ppto = fr->stack + ii.arg2;
+        bug_on(isvar_cell(*ppto));
+        VAR_DECR_REF(*ppto);
+        *ppto = pop(fr);
+        return RES_OK;
+}
+
+static int
+do_load_cell(Frame *fr, instruction_t ii)
+{
+        bug_on(!fr->clo);
+        push(fr, cell_get_value(fr->clo[ii.arg2]));
+        return RES_OK;
+}
+
+static int
+do_store_cell(Frame *fr, instruction_t ii)
+{
+        Object *from = pop(fr);
+
+        bug_on(!fr->clo);
+        cell_replace_value(fr->clo[ii.arg2], from);
+        VAR_DECR_REF(from);
+        return RES_OK;
+}
+
 static int
 do_load_arg(Frame *fr, instruction_t ii)
 {
@@ -705,6 +776,35 @@ do_return_generator(Frame *fr, instruction_t ii)
         return RES_RETURN;
 }
 
+/*
+ * Call @func with @owner as its "this".  If @bound, @owner is also its
+ * first argument.  This borrows @func and @owner; the caller must keep
+ * them alive until it returns.  Arguments and return value are the
+ * same as vm_exec_func().
+ */
+static Object *
+vm_exec_bound(Frame *fr_old, Object *func, Object *owner,
+              Object *args, Object *kwargs, bool bound)
+{
+        Frame *fr, *tfr;
+        Object *res;
+
+        tfr = fr_old ? fr_old : vm_current_frame();
+        if (tfr && tfr->ex)
+                debug_push_location(tfr, tfr->ppii - 1 - tfr->ex->instr);
+
+        fr = vmframe_alloc(func, owner, fr_old);
+        res = function_call(fr, fr->func, args, kwargs, bound);
+        vmframe_free(fr);
+
+        if (tfr && tfr->ex)
+                debug_pop_location();
+
+        if (!res)
+                res = VAR_NEW_REF(NullVar);
+        return res;
+}
+
 static int
 do_call_func(Frame *fr, instruction_t ii)
 {
@@ -732,6 +832,40 @@ do_call_func(Frame *fr, instruction_t ii)
         return RES_OK;
 }
 
+static int
+do_call_method(Frame *fr, instruction_t ii)
+{
+        Object *kwargs, *args, *self, *func, *retval;
+
+        kwargs = pop(fr);
+        args = pop(fr);
+        self = pop(fr);
+        func = pop(fr);
+
+        if (kwargs == NullVar) {
+                VAR_DECR_REF(kwargs);
+                kwargs = NULL;
+        }
+
+        bug_on(!isvar_array(args));
+        if (self == NullVar) {
+                retval = vm_exec_func(fr, func, args, kwargs);
+        } else {
+                bug_on(!isvar_function(func));
+                retval = vm_exec_bound(fr, func, self, args, kwargs, true);
+        }
+        VAR_DECR_REF(args);
+        VAR_DECR_REF(self);
+        VAR_DECR_REF(func);
+        if (kwargs)
+                VAR_DECR_REF(kwargs);
+
+        if (retval == ErrorVar)
+                return RES_ERROR;
+        push(fr, retval);
+        return RES_OK;
+}
+
 static int
 do_deffunc(Frame *fr, instruction_t ii)
 {
@@ -829,6 +963,15 @@ do_add_closure(Frame *fr, instruction_t ii)
                 bug_on(!fr->clo);
                 ppto = fr->clo + ii.arg2;
                 break;
+        case IARG_PTR_COPY:
+                /* nothing writes the local again, so copy it */
+                bug_on((unsigned)ii.arg2 >= fr->n_locals);
+                bug_on(isvar_cell(fr->stack[ii.arg2]));
+                cell = cellvar_new(fr->stack[ii.arg2]);
+                function_add_closure(func, cell);
+                VAR_DECR_REF(cell);
+                push(fr, func);
+                return RES_OK;
         default:
                 bug();
                 return RES_ERROR;
@@ -1088,7 +1231,11 @@ do_setattr(Frame *fr, instruction_t ii)
                 val = tfunc;
         }
 
-        if ((ret = var_setattr(fr, obj, key, val)) != 0) {
+        /* arg2 is a hint, same as with do_getattr() */
+        if (ii.arg2 > 0 && isvar_instance(obj) &&
+            instance_setslot(fr, obj, ii.arg2 - 1, key, val) == RES_OK) {
+                ret = RES_OK;
+        } else if ((ret = var_setattr(fr, obj, key, val)) != 0) {
                 if (!err_occurred())
                         err_attribute("set", key, obj);
         }
@@ -1128,7 +1275,15 @@ do_getattr(Frame *fr, instruction_t ii)
         key = pop(fr);
         obj = pop(fr);
 
-        attr = var_getattr(fr, obj, key);
+        /*
+         * arg2, if nonzero, is the assembler's guess at where @key is
+         * stored in @obj, plus one.  instance_getslot() checks it.
+         */
+        attr = NULL;
+        if (ii.arg2 > 0 && isvar_instance(obj))
+                attr = instance_getslot(fr, obj, ii.arg2 - 1, key);
+        if (!attr)
+                attr = var_getattr(fr, obj, key);
         if (attr == ErrorVar) {
                 if (!err_occurred())
                         err_attribute("get", key, obj);
@@ -1143,6 +1298,54 @@ do_getattr(Frame *fr, instruction_t ii)
         return ret;
 }
 
+static int
+do_load_method(Frame *fr, instruction_t ii)
+{
+        Object *attr, *key, *obj, *self;
+
+        key = pop(fr);
+        obj = pop(fr);
+
+        /* arg2 is a hint, same as with do_getattr() */
+        attr = NULL;
+        self = NULL;
+        if (ii.arg2 > 0 && isvar_instance(obj)) {
+                attr = instance_getslot_method(fr, obj, ii.arg2 - 1,
+                                               key, &self);
+        }
+        if (!attr)
+                attr = var_getmethod(fr, obj, key, &self);
+        if (!attr || attr == ErrorVar) {
+                if (!err_occurred())
+                        err_attribute("get", key, obj);
+                VAR_DECR_REF(key);
+                VAR_DECR_REF(obj);
+                return RES_ERROR;
+        }
+        VAR_DECR_REF(key);
+
+        /*
+         * CALL_METHOD takes null to mean "not bound", so if the owner
+         * really is null, bind it the slow way.
+         */
+        if (self && obj == NullVar) {
+                Object *tmp = attr;
+                attr = methodvar_new(tmp, obj);
+                VAR_DECR_REF(tmp);
+                self = NULL;
+        }
+
+        push(fr, attr);
+        if (self) {
+                /* hand our reference to @obj over to the stack */
+                push(fr, obj);
+        } else {
+                VAR_DECR_REF(obj);
+                push(fr, VAR_NEW_REF(NullVar));
+        }
+        return RES_OK;
+}
+
 static int
 do_getattr_super(Frame *fr, instruction_t ii)
 {
@@ -1288,6 +1491,87 @@ do_foreach_iter(Frame *fr, instruction_t ii)
         return RES_OK;
 }
 
+/*
+ * 'for i in range(...)'.  Stack is args to range, and under those,
+ * whatever 'range' is.
+ */
+static int
+do_range_setup(Frame *fr, instruction_t ii)
+{
+        int i, argc = ii.arg2;
+        Object **argv = fr->stackptr - argc;
+        Object *func = argv[-1];
+        Object *it;
+
+        if (func == (Object *)&RangeType) {
+                it = range_counter_new(argv, argc);
+        } else {
+                /* 'range' was rebound, do it the long way */
+                Object *args, *res;
+
+                args = arrayvar_from_stack(argv, argc, false);
+                res = vm_exec_func(fr, func, args, NULL);
+                VAR_DECR_REF(args);
+                if (res == ErrorVar) {
+                        it = ErrorVar;
+                } else {
+                        it = iterator_get(res);
+                        if (!it) {
+                                err_iterable(res, NULL);
+                                it = ErrorVar;
+                        }
+                        VAR_DECR_REF(res);
+                }
+        }
+
+        for (i = 0; i < argc + 1; i++)
+                VAR_DECR_REF(pop(fr));
+        if (it == ErrorVar)
+                return RES_ERROR;
+        push(fr, it);
+        return RES_OK;
+}
+
+static int
+do_range_iter(Frame *fr, instruction_t ii)
+{
+        Object *it, *needle, **ppto;
+        long long i;
+
+        it = fr->stackptr[-1];
+        bug_on((unsigned)ii.arg1 >= fr->n_locals);
+        ppto = fr->stack + ii.arg1;
+
+        if (it->v_type == &RangeIterType) {
+                if (!range_counter_next(it, &i)) {
+                        fr->ppii += ii.arg2;
+                        return RES_OK;
+                }
+                if (isvar_int(*ppto) && VAR_IS_UNIQUE(*ppto)) {
+                        intvar_reuse(*ppto, i);
+                        return RES_OK;
+                }
+                needle = intvar_new(i);
+        } else {
+                needle = iterator_next(it);
+                if (needle == ErrorVar)
+                        return RES_ERROR;
+                if (!needle) {
+                        fr->ppii += ii.arg2;
+                        return RES_OK;
+                }
+        }
+
+        if (isvar_cell(*ppto)) {
+                cell_replace_value(*ppto, needle);
+                VAR_DECR_REF(needle);
+        } else {
+                VAR_DECR_REF(*ppto);
+                *ppto = needle;
+        }
+        return RES_OK;
+}
+
 static int
 do_b_if(Frame *fr, instruction_t ii)
 {
@@ -1536,6 +1820,39 @@ do_end(Frame *fr, instruction_t ii)
         return 0;
 }
 
+/*
+ * Superinstructions.  See tools/superinstructions.
+ *
+ * CMP followed by B_IF.  The B_IF is still right after us in the
+ * array, so take its arguments from there, and test the comparison
+ * directly instead of pushing a boolean just to pop it off again.
+ */
+static int
+do_cmp_branch(Frame *fr, instruction_t ii)
+{
+        Object *rval, *lval;
+        enum result_t retval;
+        bool cmp;
+
+        rval = pop(fr);
+        lval = pop(fr);
+        retval = var_compare_iarg(lval, rval, ii.arg1, &cmp);
+        VAR_DECR_REF(rval);
+        VAR_DECR_REF(lval);
+        if (retval != RES_OK)
+                return retval;
+
+        ii = *(fr->ppii)++;
+        if (!!(ii.arg1 & IARG_COND_COND) == cmp) {
+                fr->ppii += ii.arg2;
+                if (!!(ii.arg1 & IARG_COND_SAVEF))
+                        push(fr, gbl_new_bool(cmp));
+        }
+        return RES_OK;
+}
+
+#include "vm_super_gen.c.h"
+
 /* return value is 0 or OPRES_* enum */
 typedef int (*callfunc_t)(Frame *fr, instruction_t ii);
 
@@ -1554,6 +1871,105 @@ check_ghost_errors(int res)
                 DBUG1("Error return but none reported");
 }
 
+#if DBUG_PROFILE_OPCODES
+/*
+ * Counts of instruction pairs and triples, indexed by their codes.
+ * A sequence is only counted if its instructions are in a row in the
+ * same array, since those are the only ones that can be fused.
+ */
+static unsigned long opcode_pairs[N_INSTR][N_INSTR];
+static unsigned long opcode_triples[N_INSTR][N_INSTR][N_INSTR];
+static const instruction_t *opcode_last_pc;
+static int opcode_last[2] = { -1, -1 };
+
+struct opcode_count_t {
+        unsigned long count;
+        int code[3];
+        int n;
+};
+
+static void
+profile_opcode(const instruction_t *pc)
+{
+        int code = pc->code;
+
+        if (pc != opcode_last_pc + 1) {
+                opcode_last[0] = opcode_last[1] = -1;
+        } else {
+                if (opcode_last[1] >= 0)
+                        opcode_pairs[opcode_last[1]][code]++;
+                if (opcode_last[0] >= 0) {
+                        opcode_triples[opcode_last[0]]
+                                      [opcode_last[1]][code]++;
+                }
+        }
+        opcode_last[0] = opcode_last[1];
+        opcode_last[1] = code;
+        opcode_last_pc = pc;
+}
+
+static int
+opcode_count_cmp(const void *a, const void *b)
+{
+        const struct opcode_count_t *ca = a, *cb = b;
+        if (ca->count != cb->count)
+                return ca->count < cb->count ? 1 : -1;
+        return ca->n - cb->n;
+}
+
+static void
+report_opcode_profile(void)
+{
+        struct buffer_t b;
+        struct opcode_count_t *counts;
+        size_t i, n;
+        int x, y, z;
+
+        buffer_init(&b);
+        for (x = 0; x < N_INSTR; x++) {
+                for (y = 0; y < N_INSTR; y++) {
+                        struct opcode_count_t c;
+                        if (opcode_pairs[x][y]) {
+                                c.count = opcode_pairs[x][y];
+                                c.code[0] = x;
+                                c.code[1] = y;
+                                c.n = 2;
+                                buffer_putd(&b, &c, sizeof(c));
+                        }
+                        for (z = 0; z < N_INSTR; z++) {
+                                if (!opcode_triples[x][y][z])
+                                        continue;
+                                c.count = opcode_triples[x][y][z];
+                                c.code[0] = x;
+                                c.code[1] = y;
+                                c.code[2] = z;
+                                c.n = 3;
+                                buffer_putd(&b, &c, sizeof(c));
+                        }
+                }
+        }
+
+        counts = (struct opcode_count_t *)b.s;
+        n = buffer_size(&b) / sizeof(*counts);
+        if (n)
+                qsort(counts, n, sizeof(*counts), opcode_count_cmp);
+        for (i = 0; i < n; i++) {
+                fprintf(stderr, "%lu %s %s", counts[i].count,
+                        instruction_name(counts[i].code[0]),
+                        instruction_name(counts[i].code[1]));
+                if (counts[i].n == 3) {
+                        fprintf(stderr, " %s",
+                                instruction_name(counts[i].code[2]));
+                }
+                fputc('\n', stderr);
+        }
+        buffer_free(&b);
+}
+#else
+# define profile_opcode(...)            do { (void)0; } while (0)
+# define report_opcode_profile()        do { (void)0; } while (0)
+#endif /* DBUG_PROFILE_OPCODES */
+
 static inline bool
 vm_pointers_in_stack(Object **start, Object **end)
 {
@@ -1573,15 +1989,23 @@ vmframe_finish_stack_setup(Frame *fr, struct xptrvar_t *xptr,
         size_t i;
 
         bug_on(!xptr);
+        xptr_ready(xptr);
         fr->clo = closures;
         fr->n_locals = xptr->n_locals;
         fr->ex = xptr;
-        if (!vm_pointers_in_stack(fr->stack, fr->stack + fr->n_locals)) {
+        /*
+         * This is the only overflow check the frame gets.  xptr knows
+         * how deep its stack will go, so if it fits now, push() does
+         * not have to check again.
+         */
+        if (!vm_pointers_in_stack(fr->stack, fr->stack + fr->n_locals
+                                             + xptr->max_stack)) {
                 /* XXX: Correct exception to raise? */
                 err_setstr(ArgumentError,
                            "Cannot execute: stack overflow would occur");
                 return RES_ERROR;
         }
+        fr->stack_end = fr->stack + fr->n_locals + xptr->max_stack;
         for (i = fr->ap; i < fr->n_locals; i++)
                 fr->stack[i] = VAR_NEW_REF(NullVar);
         fr->stackptr = fr->stack + fr->ex->n_locals;
@@ -1719,6 +2143,8 @@ execute_loop(Frame *fr)
         while ((ii = *(fr->ppii)++).code != INSTR_END) {
                 enum result_t res;
                 bug_on((unsigned int)ii.code >= N_INSTR);
+                if (DBUG_PROFILE_OPCODES)
+                        profile_opcode(fr->ppii - 1);
                 res = JUMP_TABLE[ii.code](fr, ii);
 
                 if (DBUG_CHECK_GHOST_ERRORS)
@@ -1852,7 +2278,6 @@ vm_exec_script(Object *top_level, Frame *fr_old)
 Object *
 vm_exec_func(Frame *fr_old, Object *func, Object *args, Object *kwargs)
 {
-        Frame *fr;
         Object *res, *owner;
         bool bound;
 
@@ -1875,19 +2300,7 @@ vm_exec_func(Frame *fr_old, Object *func, Object *args, Object *kwargs)
                 VAR_INCR_REF(func);
         }
 
-        Frame *tfr = fr_old ? fr_old : vm_current_frame();
-        if (tfr && tfr->ex)
-                debug_push_location(tfr, tfr->ppii - 1 - tfr->ex->instr);
-
-        fr = vmframe_alloc(func, owner, fr_old);
-        res = function_call(fr, fr->func, args, kwargs, bound);
-        vmframe_free(fr);
-
-        if (tfr && tfr->ex)
-                debug_pop_location();
-
-        if (!res)
-                res = VAR_NEW_REF(NullVar);
+        res = vm_exec_bound(fr_old, func, owner, args, kwargs, bound);
 
         VAR_DECR_REF(func);
         VAR_DECR_REF(owner);
@@ -2086,6 +2499,9 @@ cfile_deinit_vm(void)
 {
         struct list_t *li, *tmp;
 
+        if (DBUG_PROFILE_OPCODES)
+                report_opcode_profile();
+
         if (vm.globals)
                 VAR_DECR_REF(vm.globals);
         if (vm.locals)
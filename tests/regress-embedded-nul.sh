@@ -0,0 +1,66 @@
+#!/bin/sh
+
+# Regression test for a nulchar in the middle of a script.
+#
+# A nulchar ends the line it is on, and tokenizing carries on with the
+# next line.  A regular file, which the tokenizer maps into memory,
+# must behave the same as the same file piped in a line at a time.
+
+set -u
+
+evilcandy=${EVILCANDY:-./evilcandy}
+
+case $evilcandy in
+    /*) ;;
+    *) evilcandy=$(pwd)/$evilcandy ;;
+esac
+
+if [ ! -x "$evilcandy" ]; then
+    echo "$0: cannot execute $evilcandy" >&2
+    exit 1
+fi
+
+tmpbase=${TMPDIR:-/tmp}
+tmpdir=$tmpbase/evilcandy-nul-$$
+
+if ! (umask 077 && mkdir "$tmpdir"); then
+    echo "$0: cannot create temporary directory $tmpdir" >&2
+    exit 1
+fi
+
+cleanup() {
+    rm -f "$tmpdir/test.evc" "$tmpdir/file.txt" \
+          "$tmpdir/pipe.txt" "$tmpdir/expected.txt"
+    rmdir "$tmpdir" 2>/dev/null || true
+}
+trap cleanup EXIT HUP INT TERM
+
+script=$tmpdir/test.evc
+expected=$tmpdir/expected.txt
+
+printf 'print(1);\n\000print(3);\nprint(2); // x\000y\nprint(4);\n' \
+        > "$script" || exit 1
+
+cat > "$expected" <<'EOF'
+1
+2
+4
+EOF
+
+status=0
+"$evilcandy" "$script" > "$tmpdir/file.txt" 2>&1 || status=$?
+"$evilcandy" < "$script" > "$tmpdir/pipe.txt" 2>&1 || status=$?
+if [ "$status" -ne 0 ]; then
+    echo "$0: EvilCandy test script failed with status $status" >&2
+    cat "$tmpdir/file.txt" "$tmpdir/pipe.txt" >&2
+    exit "$status"
+fi
+
+for mode in file pipe; do
+    if ! cmp -s "$expected" "$tmpdir/$mode.txt"; then
+        echo "$0: unexpected output reading from $mode" >&2
+        diff -u "$expected" "$tmpdir/$mode.txt" >&2
+        exit 1
+    fi
+done
+echo "embedded nulchar regression: success"
@@ -0,0 +1,101 @@
+#!/bin/sh
+
+# Regression test for decoding invalid UTF-8 in a text file.
+#
+# Overlong encodings, surrogates, and points past U+10FFFF must be
+# rejected, whether the bad sequence is decoded in one piece or split
+# across reads.  An overlong "\300\257" used to be read as '/'.
+
+set -u
+
+evilcandy=${EVILCANDY:-./evilcandy}
+
+case $evilcandy in
+    /*) ;;
+    *) evilcandy=$(pwd)/$evilcandy ;;
+esac
+
+if [ ! -x "$evilcandy" ]; then
+    echo "$0: cannot execute $evilcandy" >&2
+    exit 1
+fi
+
+tmpbase=${TMPDIR:-/tmp}
+tmpdir=$tmpbase/evilcandy-utf8-$$
+
+if ! (umask 077 && mkdir "$tmpdir"); then
+    echo "$0: cannot create temporary directory $tmpdir" >&2
+    exit 1
+fi
+
+names="overlong2 overlong3 overlong4 surrogate toobig valid"
+
+cleanup() {
+    for name in $names; do
+        rm -f "$tmpdir/$name.txt"
+    done
+    rm -f "$tmpdir/test.evc" "$tmpdir/actual.txt" "$tmpdir/expected.txt"
+    rmdir "$tmpdir" 2>/dev/null || true
+}
+trap cleanup EXIT HUP INT TERM
+
+script=$tmpdir/test.evc
+actual=$tmpdir/actual.txt
+expected=$tmpdir/expected.txt
+
+printf 'a\300\257b' > "$tmpdir/overlong2.txt" || exit 1
+printf 'a\340\200\257b' > "$tmpdir/overlong3.txt" || exit 1
+printf 'a\360\200\200\257b' > "$tmpdir/overlong4.txt" || exit 1
+printf 'a\355\240\200b' > "$tmpdir/surrogate.txt" || exit 1
+printf 'a\364\220\200\200b' > "$tmpdir/toobig.txt" || exit 1
+printf 'a\303\251\355\237\277\364\217\277\277b' > "$tmpdir/valid.txt" || exit 1
+
+cat > "$script" <<EOF
+for name in '$names'.split() {
+    let path = '$tmpdir/' + name + '.txt';
+    for buffering in [-1, 1] {
+        let result;
+        try {
+            let s;
+            if (buffering < 0)
+                s = open(path, 'r').read();
+            else
+                s = open(path, 'r', buffering=buffering).read();
+            result = length(s);
+        } catch (e) {
+            result = typeof(e);
+        }
+        print(f'{name}=<{result}>');
+    }
+}
+EOF
+
+cat > "$expected" <<'EOF'
+overlong2=<ValueError>
+overlong2=<ValueError>
+overlong3=<ValueError>
+overlong3=<ValueError>
+overlong4=<ValueError>
+overlong4=<ValueError>
+surrogate=<ValueError>
+surrogate=<ValueError>
+toobig=<ValueError>
+toobig=<ValueError>
+valid=<5>
+valid=<5>
+EOF
+
+if ! "$evilcandy" "$script" > "$actual" 2>&1; then
+    result=$?
+    echo "$0: EvilCandy test script failed with status $result" >&2
+    cat "$actual" >&2
+    exit "$result"
+fi
+
+if cmp -s "$expected" "$actual"; then
+    echo "text file UTF-8 regression: success"
+else
+    echo "$0: unexpected output" >&2
+    diff -u "$expected" "$actual" >&2
+    exit 1
+fi
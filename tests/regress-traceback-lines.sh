@@ -0,0 +1,129 @@
+#!/bin/sh
+
+# Regression test for the line numbers in tracebacks.
+#
+# The assembler's optimizations remove and rearrange instructions, but
+# an error must still be reported at the line that caused it, in the
+# function that caused it.
+
+set -u
+
+evilcandy=${EVILCANDY:-./evilcandy}
+
+case $evilcandy in
+    /*) ;;
+    *) evilcandy=$(pwd)/$evilcandy ;;
+esac
+
+if [ ! -x "$evilcandy" ]; then
+    echo "$0: cannot execute $evilcandy" >&2
+    exit 1
+fi
+
+tmpbase=${TMPDIR:-/tmp}
+tmpdir=$tmpbase/evilcandy-traceback-$$
+
+if ! (umask 077 && mkdir "$tmpdir"); then
+    echo "$0: cannot create temporary directory $tmpdir" >&2
+    exit 1
+fi
+
+cleanup() {
+    rm -f "$tmpdir/test.evc" "$tmpdir/actual.txt" "$tmpdir/expected.txt"
+    rmdir "$tmpdir" 2>/dev/null || true
+}
+trap cleanup EXIT HUP INT TERM
+
+script=$tmpdir/test.evc
+actual=$tmpdir/actual.txt
+expected=$tmpdir/expected.txt
+
+fail=0
+
+# check NAME EXPECTED: run $script and compare the traceback's
+# "... line N" lines with EXPECTED
+check() {
+    "$evilcandy" "$script" 2>&1 |
+            grep -o '[a-z]* from [^ ]*\|in function [^ ]*\|line [0-9]*$' \
+            > "$actual"
+    printf '%s\n' "$2" > "$expected"
+    if ! cmp -s "$expected" "$actual"; then
+        echo "$0: $1: unexpected traceback" >&2
+        diff -u "$expected" "$actual" >&2
+        fail=1
+    fi
+}
+
+# A dead store at the top of a function is removed, which must not
+# take the next statement's line with it.
+cat > "$script" <<'EOF'
+let acc = [];
+
+
+function g(p) {
+    let v = -3;
+    acc.append(p * 'x' * []);
+}
+g(2);
+EOF
+check "dead store" "called from g
+line 6
+in function <anonymous>
+line 8"
+
+cat > "$script" <<'EOF'
+let acc = [];
+function g(p) {
+    acc.append(1);
+    let v = -3;
+    acc.append(p * 'x' * []);
+}
+g(2);
+EOF
+check "dead store between statements" "called from g
+line 5
+in function <anonymous>
+line 7"
+
+# A function pasted into its caller still gets a line of its own in
+# the traceback, naming its own line.
+cat > "$script" <<'EOF'
+let acc = [];
+
+function g(p) {
+    let f = (x) => x * [];
+    return f(p);
+}
+g('a');
+EOF
+check "inlined lambda" "called from <anonymous>
+line 4
+called from g
+line 5
+in function <anonymous>
+line 7"
+
+cat > "$script" <<'EOF'
+function g(p) {
+    let f = function(x) {
+        let y = x + 1;
+        return y * [];
+    };
+    let k = () => 1 + f(p);
+    return k();
+}
+g('a');
+EOF
+check "inlined into inlined" "called from <anonymous>
+line 3
+called from <anonymous>
+line 6
+called from g
+line 7
+in function <anonymous>
+line 9"
+
+if [ "$fail" -eq 0 ]; then
+    echo "traceback lines regression: success"
+fi
+exit "$fail"
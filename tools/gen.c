@@ -8,6 +8,47 @@
 
 static char buf[1024];
 
+/*
+ * Superinstructions, read from tools/superinstructions.  Each one is
+ * a name, then the SUPER_MIN to SUPER_MAX instructions it does the
+ * work of, and optionally the word "custom" if vm.c has a hand-written
+ * callback for it.  For the rest, we write one that calls the
+ * instructions' own callbacks in turn.
+ */
+enum { SUPER_MIN = 2, SUPER_MAX = 3 };
+
+struct super_t {
+        char *name;
+        char *seq[SUPER_MAX];
+        int n;
+        bool custom;
+};
+
+static struct super_t *supers = NULL;
+static int nsupers = 0;
+
+/*
+ * These move the program counter or leave the frame, so only the last
+ * instruction of a superinstruction may be one of them; otherwise the
+ * rest of it would not be what runs next.  INSTR_END is never called
+ * at all, the VM checks for it before calling anything.
+ */
+static const char *NOT_FIRST[] = {
+        "B", "B_IF", "BREAK", "CONTINUE", "FOREACH_ITER", "RANGE_ITER",
+        "RETURN_VALUE", "RETURN_GENERATOR", "YIELD_VALUE", "THROW",
+        NULL,
+};
+
+static bool
+in_list(const char **list, const char *name)
+{
+        while (*list) {
+                if (!strcmp(*list++, name))
+                        return true;
+        }
+        return false;
+}
+
 static inline int
 istokchar(int c)
 {
@@ -77,27 +118,119 @@ next_instruction(void)
 }
 
 static void
-prlower(void)
+prlower_s(const char *s)
 {
         int c;
-        char *s = buf;
         while ((c = *s++) != '\0')
                 putchar(tolower(c));
 }
 
 static void
-prupper(void)
+prupper_s(const char *s)
 {
         int c;
-        char *s = buf;
         while ((c = *s++) != '\0')
                 putchar(toupper(c));
 }
 
+static void
+prlower(void)
+{
+        prlower_s(buf);
+}
+
+static void
+prupper(void)
+{
+        prupper_s(buf);
+}
+
+static bool
+isname(const char *s)
+{
+        if (!isupper((int)*s))
+                return false;
+        while (*s != '\0') {
+                if (!istokchar(*s))
+                        return false;
+                s++;
+        }
+        return true;
+}
+
+static void
+super_error(const char *path, const char *name, const char *msg)
+{
+        fprintf(stderr, "%s: %s: %s\n", path, name, msg);
+        exit(1);
+}
+
+static void
+load_supers(const char *path)
+{
+        FILE *fp;
+        char **toks;
+        int ntok;
+
+        fp = fopen(path, "r");
+        if (!fp) {
+                perror(path);
+                exit(1);
+        }
+
+        while ((toks = tokenize_next_line(fp, &ntok)) != NULL) {
+                struct super_t *sup;
+                int i;
+
+                supers = realloc(supers, (nsupers + 1) * sizeof(*supers));
+                if (!supers)
+                        oom();
+                sup = &supers[nsupers++];
+                memset(sup, 0, sizeof(*sup));
+
+                if (ntok > 1 && !strcmp(toks[ntok - 1], "custom")) {
+                        sup->custom = true;
+                        free(toks[--ntok]);
+                }
+                if (ntok < SUPER_MIN + 1 || ntok > SUPER_MAX + 1) {
+                        super_error(path, toks[0],
+                                    "Expected: NAME INSTR INSTR [INSTR] [custom]");
+                }
+
+                for (i = 0; i < ntok; i++) {
+                        if (!isname(toks[i]))
+                                super_error(path, toks[0], "Bad name");
+                }
+                sup->name = toks[0];
+                sup->n = ntok - 1;
+                for (i = 0; i < sup->n; i++) {
+                        int j;
+                        sup->seq[i] = toks[i + 1];
+                        if (!strcmp(sup->seq[i], "END")) {
+                                super_error(path, toks[0],
+                                            "END may not be fused");
+                        }
+                        if (i < sup->n - 1 &&
+                            in_list(NOT_FIRST, sup->seq[i])) {
+                                super_error(path, toks[0],
+                                            "Only the last instruction may branch or return");
+                        }
+                        for (j = 0; j < nsupers - 1; j++) {
+                                if (!strcmp(sup->seq[i], supers[j].name)) {
+                                        super_error(path, toks[0],
+                                                "Superinstructions may not be fused");
+                                }
+                        }
+                }
+                free(toks);
+        }
+        fclose(fp);
+}
+
 static int
 dis(void)
 {
-        int res;
+        int res, i;
         printf("/*\n"
                " * Auto-generated code, do not edit\n"
                " * used by disassemble.c\n"
@@ -112,13 +245,18 @@ dis(void)
                 perror("Input error");
                 return 1;
         }
+        for (i = 0; i < nsupers; i++) {
+                printf("        \"");
+                prupper_s(supers[i].name);
+                printf("\",\n");
+        }
         return 0;
 }
 
 static int
 def(void)
 {
-        int res;
+        int res, i;
         static const char *excl = "EGQ_INSTRUCTION_DEFS_H";
         bool first = true;
         printf("/* Auto-generated code, do not edit */\n");
@@ -140,6 +278,11 @@ def(void)
                 perror("Input error");
                 return 1;
         }
+        for (i = 0; i < nsupers; i++) {
+                printf("        INSTR_");
+                prupper_s(supers[i].name);
+                printf(",\n");
+        }
         printf("        N_INSTR,\n");
         printf("};\n");
         printf("#endif /* %s */\n", excl);
@@ -149,7 +292,7 @@ def(void)
 static int
 jump(void)
 {
-        int res;
+        int res, i;
         printf("/*\n"
                " * Auto-generated code, do not edit\n"
                " * used by vm.c\n"
@@ -165,14 +308,188 @@ jump(void)
                 perror("Input error");
                 return 1;
         }
+        for (i = 0; i < nsupers; i++) {
+                printf("        do_");
+                prlower_s(supers[i].name);
+                putchar(',');
+                putchar('\n');
+        }
+        return 0;
+}
+
+/* Table of superinstructions for superinstr.c */
+static int
+supertab(void)
+{
+        int i, j;
+        printf("/*\n"
+               " * Auto-generated code, do not edit\n"
+               " * used by superinstr.c\n"
+               " * (see tools/gen.c, tools/superinstructions)\n"
+               " */\n");
+        for (i = 0; i < nsupers; i++) {
+                printf("        { INSTR_");
+                prupper_s(supers[i].name);
+                printf(", %d, {", supers[i].n);
+                for (j = 0; j < supers[i].n; j++) {
+                        printf(" INSTR_");
+                        prupper_s(supers[i].seq[j]);
+                        putchar(j == supers[i].n - 1 ? ' ' : ',');
+                }
+                printf("} },\n");
+        }
+        return 0;
+}
+
+/*
+ * Callbacks for superinstructions that aren't "custom".  The VM already
+ * moved the program counter past the first instruction, and the rest
+ * are still in the array right after it, so each one's turn comes with
+ * the program counter right where it would be if it ran on its own.
+ * That keeps error locations and branch offsets the same.
+ */
+static int
+superdo(void)
+{
+        int i, j;
+        printf("/*\n"
+               " * Auto-generated code, do not edit\n"
+               " * used by vm.c\n"
+               " * (see tools/gen.c, tools/superinstructions)\n"
+               " */\n");
+        for (i = 0; i < nsupers; i++) {
+                struct super_t *sup = &supers[i];
+                if (sup->custom)
+                        continue;
+                printf("\nstatic int\ndo_");
+                prlower_s(sup->name);
+                printf("(Frame *fr, instruction_t ii)\n{\n");
+                printf("        int res = do_");
+                prlower_s(sup->seq[0]);
+                printf("(fr, ii);\n");
+                for (j = 1; j < sup->n; j++) {
+                        printf("        if (res == RES_OK)\n");
+                        printf("                res = do_");
+                        prlower_s(sup->seq[j]);
+                        printf("(fr, *fr->ppii++);\n");
+                }
+                printf("        return res;\n}\n");
+        }
+        return 0;
+}
+
+/*
+ * A sequence of instructions from an opcode profile, see
+ * DBUG_PROFILE_OPCODES in debug.h
+ */
+struct seq_t {
+        unsigned long long count;
+        char *seq[SUPER_MAX];
+        int n;
+};
+
+static int
+seq_compar(const void *a, const void *b)
+{
+        const struct seq_t *sa = a, *sb = b;
+        if (sa->count != sb->count)
+                return sa->count < sb->count ? 1 : -1;
+        return sa->n - sb->n;
+}
+
+static bool
+seq_match(const struct seq_t *sq, char **toks, int n)
+{
+        int i;
+        if (sq->n != n)
+                return false;
+        for (i = 0; i < n; i++) {
+                if (strcmp(sq->seq[i], toks[i]))
+                        return false;
+        }
+        return true;
+}
+
+/*
+ * Read opcode profiles from stdin, and print the @npick most common
+ * sequences that can be fused, in the format of tools/superinstructions.
+ * Any lines that don't start with a count are skipped, so a whole
+ * stderr can be fed in, or several of them.  Counts of the same
+ * sequence are added together.
+ */
+static int
+pick(int npick)
+{
+        struct seq_t *seqs = NULL;
+        int nseqs = 0, npicked = 0;
+        char **toks;
+        int ntok, i, j;
+
+        while ((toks = tokenize_next_line(stdin, &ntok)) != NULL) {
+                unsigned long long count;
+                char *endptr;
+                bool ok;
+
+                count = strtoull(toks[0], &endptr, 10);
+                ok = endptr != toks[0] && *endptr == '\0' &&
+                     ntok >= SUPER_MIN + 1 && ntok <= SUPER_MAX + 1;
+                for (i = 1; ok && i < ntok; i++) {
+                        if (!isname(toks[i]) || !strcmp(toks[i], "END"))
+                                ok = false;
+                        else if (i < ntok - 1 &&
+                                 in_list(NOT_FIRST, toks[i]))
+                                ok = false;
+                }
+                if (ok) {
+                        for (i = 0; i < nseqs; i++) {
+                                if (seq_match(&seqs[i], &toks[1], ntok - 1))
+                                        break;
+                        }
+                        if (i == nseqs) {
+                                seqs = realloc(seqs,
+                                               (nseqs + 1) * sizeof(*seqs));
+                                if (!seqs)
+                                        oom();
+                                seqs[i].count = 0;
+                                seqs[i].n = ntok - 1;
+                                for (j = 0; j < ntok - 1; j++)
+                                        seqs[i].seq[j] = toks[j + 1];
+                                nseqs++;
+                                /* seqs[i] keeps the names */
+                                ntok = 1;
+                        }
+                        seqs[i].count += count;
+                }
+                for (i = 0; i < ntok; i++)
+                        free(toks[i]);
+                free(toks);
+        }
+
+        qsort(seqs, nseqs, sizeof(*seqs), seq_compar);
+        printf("# Generated by 'tools/gen pick %d'\n", npick);
+        for (i = 0; i < nseqs && npicked < npick; i++) {
+                struct seq_t *sq = &seqs[i];
+                printf("# %llu\n", sq->count);
+                for (j = 0; j < sq->n; j++)
+                        printf("%s%s", j ? "_" : "", sq->seq[j]);
+                for (j = 0; j < sq->n; j++)
+                        printf(" %s", sq->seq[j]);
+                putchar('\n');
+                npicked++;
+        }
         return 0;
 }
 
 int
 main(int argc, char **argv)
 {
-        if (argc != 2)
+        if (argc == 3 && !strcmp(argv[1], "pick"))
+                return pick(atoi(argv[2]));
+
+        if (argc != 2 && argc != 3)
                 goto er;
+        if (argc == 3)
+                load_supers(argv[2]);
 
         if (!strcmp(argv[1], "jump"))
                 return jump();
@@ -180,8 +497,16 @@ main(int argc, char **argv)
                 return def();
         else if (!strcmp(argv[1], "dis"))
                 return dis();
+        else if (!strcmp(argv[1], "supertab") && argc == 3)
+                return supertab();
+        else if (!strcmp(argv[1], "superdo") && argc == 3)
+                return superdo();
 
 er:
-        fprintf(stderr, "Expected: %s jump|def|dis\n", argv[0]);
+        fprintf(stderr,
+                "Expected: %s jump|def|dis [SUPERINSTRUCTIONS]\n"
+                "          %s supertab|superdo SUPERINSTRUCTIONS\n"
+                "          %s pick N < PROFILE\n",
+                argv[0], argv[0], argv[0]);
         return 1;
 }
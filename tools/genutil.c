@@ -32,6 +32,7 @@ tokenize_next_line(FILE *fp, int *ntok)
                                 abort();
                         }
                         /* else, normal EOF */
+                        free(line);
                         return NULL;
                 }
 